@@ -0,0 +1,146 @@
+/******************************************************************************
+ *
+ *  Copyright 2019 NXP
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+#ifndef ESE_SIM_H_
+#define ESE_SIM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "IChannel.h"
+
+/*
+ * Simulated eSE for host builds.
+ * Implements IChannel_t on top of a small model of the card:
+ *  - logical channels (MANAGE CHANNEL open/close, channel from CLA), their
+ *    number advertised in the card capabilities (GET DATA 0047)
+ *  - SELECT of the Loader Service / SEMS applets with a valid FCI
+ *  - STORE DATA and Loader Service commands answered with 9000
+ *  - JCOP update: trigger APDUs, UAI GetInfo, updater OS switching its
+ *    OSID at each JCOP download reset after an image was received
+ * Rules loaded from a file take precedence over the model, which allows
+ * scripting 6310 (forward to eSE) and 6320 (self update) flows and errors.
+ *
+ * Rule file, one rule per line, '#' starts a comment:
+ *   <command> <response> [delay=<us>] [once]
+ * <command> is a hex prefix of the C-APDU where XX matches any byte,
+ * <response> is the complete R-APDU in hex including the status word.
+ * Rules are tried in file order, a rule marked once is dropped after use.
+ *
+ * Each transceive takes apduLatencyUs plus the transfer time of command and
+ * response at bytesPerSec, spent in usleep so that wall clock measurements
+ * of the clients are meaningful.
+ */
+
+typedef struct EseSimConfig {
+  uint32_t apduLatencyUs;  /* Processing time of every APDU */
+  uint32_t bytesPerSec;    /* Link throughput, 0 for unlimited */
+  uint32_t resetLatencyUs; /* Time of a reset */
+  uint8_t intf;            /* Returned by getInterfaceInfo, IntfInfo */
+  uint8_t channels;        /* Logical channels with the basic one, 0 for 20 */
+} EseSimConfig_t;
+
+typedef struct EseSimStats {
+  uint32_t apduCount;
+  uint32_t resetCount;
+  uint64_t bytesIn;  /* C-APDU bytes */
+  uint64_t bytesOut; /* R-APDU bytes */
+  uint64_t busyUs;   /* Simulated latency spent */
+} EseSimStats_t;
+
+/*******************************************************************************
+**
+** Function:        EseSim_Init
+**
+** Description:     Resets the simulated card to JCOP OS with no channel
+**                  open and applies pConfig, NULL for no latency.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+bool EseSim_Init(const EseSimConfig_t* pConfig);
+
+/*******************************************************************************
+**
+** Function:        EseSim_LoadRules
+**
+** Description:     Replaces the rules with the ones read from path.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+bool EseSim_LoadRules(const char* path);
+
+/*******************************************************************************
+**
+** Function:        EseSim_GetChannel
+**
+** Description:     Fills pChannel with the entry points of the simulator.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void EseSim_GetChannel(IChannel_t* pChannel);
+
+/*******************************************************************************
+**
+** Function:        EseSim_GetStats
+**
+** Description:     Counters since EseSim_Init.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void EseSim_GetStats(EseSimStats_t* pStats);
+
+/*******************************************************************************
+**
+** Function:        EseSim_GetOsId
+**
+** Description:     OSID currently reported in the UAI query info.
+**
+** Returns:         OSID
+**
+*******************************************************************************/
+uint16_t EseSim_GetOsId();
+
+/*******************************************************************************
+**
+** Function:        EseSim_MakeRoot
+**
+** Description:     Creates a scratch tree with the vendor and data
+**                  directories used by the clients and makes it the working
+**                  directory. Host builds of the clients set ESE_FS_ROOT to
+**                  "." and so only touch this tree. pPath receives its path.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+bool EseSim_MakeRoot(char* pPath, size_t len);
+
+/*******************************************************************************
+**
+** Function:        EseSim_RemoveRoot
+**
+** Description:     Deletes a tree created by EseSim_MakeRoot.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void EseSim_RemoveRoot(const char* pPath);
+
+#endif /* ESE_SIM_H_ */
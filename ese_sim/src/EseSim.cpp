@@ -0,0 +1,743 @@
+/******************************************************************************
+ *
+ *  Copyright 2019 NXP
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+#include <ctype.h>
+#include <ftw.h>
+#include <log/log.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include <EseSim.h>
+
+#define ESE_SIM_MAX_CHANNELS 20
+#define ESE_SIM_MAX_LINE 1024
+#define ESE_SIM_ROOT_TEMPLATE "/tmp/ese_sim_XXXXXX"
+
+/* OSID reported in the UAI query info, see JcopOs_OSID_state */
+#define ESE_SIM_OSID_1 0x01
+#define ESE_SIM_OSID_2 0x02
+#define ESE_SIM_OSID_SU1 0x11
+#define ESE_SIM_OSID_JCOP 0x5A
+
+/* Position of the UAI query info in the GetInfo response, must match
+ * JCOP_UAI_INFO_INDEX and the JCOP_UAI_*_OFFSET of the JCOP client */
+#define ESE_SIM_UAI_INFO_INDEX 7
+#define ESE_SIM_UAI_CSN_INDEX (ESE_SIM_UAI_INFO_INDEX + 5)
+#define ESE_SIM_UAI_RSN_INDEX (ESE_SIM_UAI_INFO_INDEX + 9)
+#define ESE_SIM_UAI_FSN_INDEX (ESE_SIM_UAI_INFO_INDEX + 13)
+#define ESE_SIM_UAI_OSID_INDEX (ESE_SIM_UAI_INFO_INDEX + 21)
+#define ESE_SIM_UAI_INFO_LEN (ESE_SIM_UAI_OSID_INDEX + 2)
+
+typedef enum {
+  ESE_SIM_APP_NONE = 0,
+  ESE_SIM_APP_LS, /* Loader Service or SEMS */
+  ESE_SIM_APP_OTHER
+} EseSimApp_t;
+
+typedef struct EseSimRule {
+  std::vector<uint8_t> cmd;
+  std::vector<uint8_t> mask; /* 0x00 for XX */
+  std::vector<uint8_t> rsp;
+  uint32_t delayUs;
+  bool once;
+} EseSimRule_t;
+
+typedef struct EseSimCtx {
+  EseSimConfig_t config;
+  EseSimStats_t stats;
+  std::vector<EseSimRule_t> rules;
+  EseSimApp_t app[ESE_SIM_MAX_CHANNELS]; /* Selected applet per channel */
+  bool isOpen[ESE_SIM_MAX_CHANNELS];
+  uint16_t osId;
+  uint16_t sn;            /* CSN and RSN */
+  bool isTriggered;       /* Updater OS entered at next JCOP reset */
+  uint32_t imageApduCnt;  /* APDUs received by the updater OS */
+} EseSimCtx_t;
+
+static EseSimCtx_t sSim;
+static pthread_mutex_t sSimLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Registered Identifier of the applets answered with a Loader Service FCI:
+ * NXP (Loader Service) and SEMS */
+static const uint8_t sLsRid[] = {0xA0, 0x00, 0x00, 0x03, 0x96};
+static const uint8_t sSemsRid[] = {0xA0, 0x00, 0x00, 0x01, 0x51};
+/* Last bytes of the SEMS updater AID, not present until installed */
+static const uint8_t sSemsUpdaterSfx[] = {0xFF, 0xFF, 0xFF, 0x01};
+/* JCOP updater GetInfo applet */
+static const uint8_t sGetInfoAid[] = {0xD2, 0x76, 0x00, 0x00, 0x85, 0x41,
+                                      0x00, 0x00, 0x00, 0x00, 0x20, 0x00};
+static const uint8_t sTriggerHdr[] = {0x4F, 0x70, 0x80, 0x13, 0x04};
+static const uint8_t sJcopTrigger[] = {0xDE, 0xAD, 0xBE, 0xEF};
+static const uint8_t sUaiGetInfo[] = {0x80, 0xCA, 0x00, 0xFE,
+                                      0x02, 0xDF, 0x43};
+
+/*******************************************************************************
+**
+** Function:        EseSim_ParseHex
+**
+** Description:     Parses a hex string, XX (any case) is stored with a zero
+**                  mask when pMask is given.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+static bool EseSim_ParseHex(const char* pStr, std::vector<uint8_t>& data,
+                            std::vector<uint8_t>* pMask) {
+  size_t len = strlen(pStr);
+
+  if (len == 0 || (len % 2) != 0) return false;
+  for (size_t i = 0; i < len; i += 2) {
+    if (pMask != NULL && toupper(pStr[i]) == 'X' &&
+        toupper(pStr[i + 1]) == 'X') {
+      data.push_back(0x00);
+      pMask->push_back(0x00);
+      continue;
+    }
+    if (!isxdigit(pStr[i]) || !isxdigit(pStr[i + 1])) return false;
+    char byte[3] = {pStr[i], pStr[i + 1], 0};
+    data.push_back((uint8_t)strtoul(byte, NULL, 16));
+    if (pMask != NULL) pMask->push_back(0xFF);
+  }
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        EseSim_MatchRule
+**
+** Description:     Looks for the first rule matching the command, a rule
+**                  marked once is removed. Called with sSimLock held.
+**
+** Returns:         True if a rule matched, pRule receives a copy of it.
+**
+*******************************************************************************/
+static bool EseSim_MatchRule(const uint8_t* pCmd, int32_t len,
+                             EseSimRule_t* pRule) {
+  for (auto it = sSim.rules.begin(); it != sSim.rules.end(); ++it) {
+    if ((int32_t)it->cmd.size() > len) continue;
+    size_t i = 0;
+    while (i < it->cmd.size() && (pCmd[i] & it->mask[i]) == it->cmd[i]) i++;
+    if (i != it->cmd.size()) continue;
+    *pRule = *it;
+    if (it->once) sSim.rules.erase(it);
+    return true;
+  }
+  return false;
+}
+
+/*******************************************************************************
+**
+** Function:        EseSim_ChannelOf
+**
+** Description:     Logical channel coded in the class byte.
+**
+** Returns:         Channel number
+**
+*******************************************************************************/
+static uint8_t EseSim_ChannelOf(uint8_t cla) {
+  /*Further interindustry class bytes code channels 4 to 19*/
+  if (cla & 0x40) return 4 + (cla & 0x0F);
+  return cla & 0x03;
+}
+
+/*******************************************************************************
+**
+** Function:        EseSim_SetSw
+**
+** Description:     Appends the status word to the response.
+**
+** Returns:         Response length
+**
+*******************************************************************************/
+static int32_t EseSim_SetSw(uint8_t* pRsp, int32_t len, uint16_t sw) {
+  pRsp[len++] = (uint8_t)(sw >> 8);
+  pRsp[len++] = (uint8_t)sw;
+  return len;
+}
+
+/*******************************************************************************
+**
+** Function:        EseSim_LsFci
+**
+** Description:     FCI returned on selection of the Loader Service, in the
+**                  layout expected by Process_SelectRsp.
+**
+** Returns:         Response length
+**
+*******************************************************************************/
+static int32_t EseSim_LsFci(const uint8_t* pAid, uint8_t aidLen,
+                            uint8_t* pRsp) {
+  int32_t i = 0;
+  uint8_t lenIdx;
+
+  pRsp[i++] = 0x6F; /* FCI */
+  lenIdx = (uint8_t)i++;
+  pRsp[i++] = 0x84; /* AID */
+  pRsp[i++] = aidLen;
+  memcpy(&pRsp[i], pAid, aidLen);
+  i += aidLen;
+  pRsp[i++] = 0x9F; /* LS application version */
+  pRsp[i++] = 0x08;
+  pRsp[i++] = 0x02;
+  pRsp[i++] = 0x02;
+  pRsp[i++] = 0x00;
+  pRsp[i++] = 0x65; /* Root entity key set */
+  pRsp[i++] = 2 + 16 + 2 + 8;
+  pRsp[i++] = 0x42; /* Root entity identifier */
+  pRsp[i++] = 16;
+  for (uint8_t j = 0; j < 16; j++) pRsp[i++] = 0x10 + j;
+  pRsp[i++] = 0x45; /* Signature key identifier */
+  pRsp[i++] = 8;
+  for (uint8_t j = 0; j < 8; j++) pRsp[i++] = 0x40 + j;
+  pRsp[lenIdx] = (uint8_t)(i - 2);
+  return EseSim_SetSw(pRsp, i, 0x9000);
+}
+
+/*******************************************************************************
+**
+** Function:        EseSim_UaiInfo
+**
+** Description:     GetInfo response carrying the UAI query info of the
+**                  current OS.
+**
+** Returns:         Response length
+**
+*******************************************************************************/
+static int32_t EseSim_UaiInfo(uint8_t* pRsp) {
+  memset(pRsp, 0x00, ESE_SIM_UAI_INFO_LEN);
+  pRsp[0] = 0xDF;
+  pRsp[1] = 0x43;
+  pRsp[2] = ESE_SIM_UAI_INFO_LEN - 3;
+  pRsp[ESE_SIM_UAI_CSN_INDEX] = (uint8_t)(sSim.sn >> 8);
+  pRsp[ESE_SIM_UAI_CSN_INDEX + 1] = (uint8_t)sSim.sn;
+  pRsp[ESE_SIM_UAI_RSN_INDEX] = (uint8_t)(sSim.sn >> 8);
+  pRsp[ESE_SIM_UAI_RSN_INDEX + 1] = (uint8_t)sSim.sn;
+  pRsp[ESE_SIM_UAI_FSN_INDEX] = (uint8_t)(sSim.sn >> 8);
+  pRsp[ESE_SIM_UAI_FSN_INDEX + 1] = (uint8_t)sSim.sn;
+  pRsp[ESE_SIM_UAI_OSID_INDEX] = (uint8_t)(sSim.osId >> 8);
+  pRsp[ESE_SIM_UAI_OSID_INDEX + 1] = (uint8_t)sSim.osId;
+  return EseSim_SetSw(pRsp, ESE_SIM_UAI_INFO_LEN, 0x9000);
+}
+
+/*******************************************************************************
+**
+** Function:        EseSim_Select
+**
+** Description:     SELECT by AID on channel.
+**
+** Returns:         Response length
+**
+*******************************************************************************/
+static int32_t EseSim_Select(uint8_t channel, const uint8_t* pAid,
+                             uint8_t aidLen, uint8_t* pRsp) {
+  if (aidLen == 0) {
+    /*Default applet*/
+    sSim.app[channel] = ESE_SIM_APP_OTHER;
+    return EseSim_SetSw(pRsp, 0, 0x9000);
+  }
+  if (aidLen == sizeof(sGetInfoAid) &&
+      !memcmp(pAid, sGetInfoAid, sizeof(sGetInfoAid))) {
+    if (sSim.osId == ESE_SIM_OSID_JCOP) return EseSim_SetSw(pRsp, 0, 0x6A82);
+    sSim.app[channel] = ESE_SIM_APP_OTHER;
+    return EseSim_UaiInfo(pRsp);
+  }
+  if (aidLen >= sizeof(sLsRid) + sizeof(sSemsUpdaterSfx) &&
+      (!memcmp(pAid, sLsRid, sizeof(sLsRid)) ||
+       !memcmp(pAid, sSemsRid, sizeof(sSemsRid))) &&
+      memcmp(&pAid[aidLen - sizeof(sSemsUpdaterSfx)], sSemsUpdaterSfx,
+             sizeof(sSemsUpdaterSfx))) {
+    sSim.app[channel] = ESE_SIM_APP_LS;
+    return EseSim_LsFci(pAid, aidLen, pRsp);
+  }
+  sSim.app[channel] = ESE_SIM_APP_NONE;
+  return EseSim_SetSw(pRsp, 0, 0x6A82);
+}
+
+/*******************************************************************************
+**
+** Function:        EseSim_Process
+**
+** Description:     Builds the response of the card model to the command.
+**                  Called with sSimLock held, pRsp holds at least 512 bytes.
+**
+** Returns:         Response length
+**
+*******************************************************************************/
+static int32_t EseSim_Process(const uint8_t* pCmd, int32_t len,
+                              uint8_t* pRsp) {
+  static const char fn[] = "EseSim_Process";
+  uint8_t channel, ins;
+  uint8_t channels = (sSim.config.channels == 0 ||
+                      sSim.config.channels > ESE_SIM_MAX_CHANNELS)
+                         ? ESE_SIM_MAX_CHANNELS
+                         : sSim.config.channels;
+
+  if (len < 4) return EseSim_SetSw(pRsp, 0, 0x6700);
+  if (len >= (int32_t)(sizeof(sTriggerHdr) + sizeof(sJcopTrigger)) &&
+      !memcmp(pCmd, sTriggerHdr, sizeof(sTriggerHdr))) {
+    /*JCOP and UAI trigger APDUs*/
+    if (!memcmp(&pCmd[sizeof(sTriggerHdr)], sJcopTrigger,
+                sizeof(sJcopTrigger))) {
+      sSim.isTriggered = true;
+      ALOGD("%s: JCOP update triggered", fn);
+    }
+    return EseSim_SetSw(pRsp, 0, 0x9000);
+  }
+  if (len >= (int32_t)sizeof(sUaiGetInfo) &&
+      !memcmp(pCmd, sUaiGetInfo, sizeof(sUaiGetInfo))) {
+    return EseSim_UaiInfo(pRsp);
+  }
+  if (sSim.osId != ESE_SIM_OSID_JCOP) {
+    /*The updater OS accepts every image APDU*/
+    sSim.imageApduCnt++;
+    return EseSim_SetSw(pRsp, 0, 0x9000);
+  }
+
+  channel = EseSim_ChannelOf(pCmd[0]);
+  ins = pCmd[1];
+  if (channel >= channels || !sSim.isOpen[channel]) {
+    return EseSim_SetSw(pRsp, 0, 0x6881);
+  }
+  switch (ins) {
+    case 0x70: /* MANAGE CHANNEL */
+      if (pCmd[2] == 0x00) {
+        for (uint8_t i = 1; i < channels; i++) {
+          if (!sSim.isOpen[i]) {
+            sSim.isOpen[i] = true;
+            sSim.app[i] = ESE_SIM_APP_NONE;
+            pRsp[0] = i;
+            return EseSim_SetSw(pRsp, 1, 0x9000);
+          }
+        }
+        return EseSim_SetSw(pRsp, 0, 0x6A81);
+      }
+      if (pCmd[2] == 0x80 && pCmd[3] != 0 &&
+          pCmd[3] < ESE_SIM_MAX_CHANNELS && sSim.isOpen[pCmd[3]]) {
+        sSim.isOpen[pCmd[3]] = false;
+        sSim.app[pCmd[3]] = ESE_SIM_APP_NONE;
+        return EseSim_SetSw(pRsp, 0, 0x9000);
+      }
+      return EseSim_SetSw(pRsp, 0, 0x6A86);
+    case 0xA4: /* SELECT */
+      if (pCmd[2] != 0x04) return EseSim_SetSw(pRsp, 0, 0x6A86);
+      if (len < 5 || len < 5 + pCmd[4]) {
+        return EseSim_Select(channel, NULL, 0, pRsp);
+      }
+      return EseSim_Select(channel, &pCmd[5], pCmd[4], pRsp);
+    case 0xE2: /* STORE DATA */
+      return EseSim_SetSw(pRsp, 0, 0x9000);
+    case 0xCA: /* GET DATA */
+      if (pCmd[2] == 0x00 && pCmd[3] == 0x47 &&
+          sSim.app[channel] != ESE_SIM_APP_LS) {
+        /*Card capabilities, 8 or more channels coded as 7*/
+        pRsp[0] = 0x47;
+        pRsp[1] = 0x03;
+        pRsp[2] = 0x00;
+        pRsp[3] = 0x00;
+        pRsp[4] = (channels > 8) ? 0x07 : (uint8_t)(channels - 1);
+        return EseSim_SetSw(pRsp, 5, 0x9000);
+      }
+      if (sSim.app[channel] == ESE_SIM_APP_LS) {
+        return EseSim_SetSw(pRsp, 0, 0x9000);
+      }
+      return EseSim_SetSw(pRsp, 0, 0x6A88);
+    default:
+      /*Loader Service commands, the embedded script commands are not
+        interpreted, use rules for the 6310/6320 flows*/
+      if (sSim.app[channel] == ESE_SIM_APP_LS) {
+        return EseSim_SetSw(pRsp, 0, 0x9000);
+      }
+      return EseSim_SetSw(pRsp, 0, 0x6D00);
+  }
+}
+
+/*******************************************************************************
+**
+** Function:        EseSim_Delay
+**
+** Description:     Spends the processing and transfer time of an APDU.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void EseSim_Delay(const EseSimConfig_t* pConfig, int32_t bytes,
+                         uint32_t extraUs) {
+  uint64_t us = (uint64_t)pConfig->apduLatencyUs + extraUs;
+
+  if (pConfig->bytesPerSec != 0) {
+    us += ((uint64_t)bytes * 1000000) / pConfig->bytesPerSec;
+  }
+  pthread_mutex_lock(&sSimLock);
+  sSim.stats.busyUs += us;
+  pthread_mutex_unlock(&sSimLock);
+  if (us != 0) usleep((useconds_t)us);
+}
+
+/*******************************************************************************
+**
+** Function:        EseSim_Transceive
+**
+** Description:     Transceive entry point, raw and normal APDUs are handled
+**                  alike.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+static bool EseSim_Transceive(uint8_t* xmitBuffer, int32_t xmitBufferSize,
+                              uint8_t* recvBuffer, int32_t recvBufferMaxSize,
+                              int32_t& recvBufferActualSize,
+                              int32_t timeoutMillisec) {
+  static const char fn[] = "EseSim_Transceive";
+  uint8_t rsp[512];
+  int32_t rspLen;
+  uint32_t delayUs = 0;
+  EseSimRule_t rule;
+  EseSimConfig_t config;
+  (void)timeoutMillisec;
+
+  recvBufferActualSize = 0;
+  if (xmitBuffer == NULL || xmitBufferSize <= 0 || recvBuffer == NULL) {
+    ALOGE("%s: Invalid parameter", fn);
+    return false;
+  }
+  pthread_mutex_lock(&sSimLock);
+  if (EseSim_MatchRule(xmitBuffer, xmitBufferSize, &rule)) {
+    rspLen = (int32_t)rule.rsp.size();
+    if (rspLen > (int32_t)sizeof(rsp)) rspLen = (int32_t)sizeof(rsp);
+    memcpy(rsp, rule.rsp.data(), rspLen);
+    delayUs = rule.delayUs;
+  } else {
+    rspLen = EseSim_Process(xmitBuffer, xmitBufferSize, rsp);
+  }
+  sSim.stats.apduCount++;
+  sSim.stats.bytesIn += xmitBufferSize;
+  sSim.stats.bytesOut += rspLen;
+  config = sSim.config;
+  pthread_mutex_unlock(&sSimLock);
+
+  EseSim_Delay(&config, xmitBufferSize + rspLen, delayUs);
+  if (rspLen > recvBufferMaxSize) {
+    ALOGE("%s: Response of %d bytes exceeds buffer", fn, rspLen);
+    return false;
+  }
+  memcpy(recvBuffer, rsp, rspLen);
+  recvBufferActualSize = rspLen;
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        EseSim_CloseChannels
+**
+** Description:     Closes all logical channels but the basic one.
+**                  Called with sSimLock held.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void EseSim_CloseChannels() {
+  memset(sSim.isOpen, 0, sizeof(sSim.isOpen));
+  memset(sSim.app, 0, sizeof(sSim.app));
+  sSim.isOpen[0] = true;
+}
+
+/*******************************************************************************
+**
+** Function:        EseSim_Reset
+**
+** Description:     Cold reset of the card.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void EseSim_Reset() {
+  uint32_t resetUs;
+
+  pthread_mutex_lock(&sSimLock);
+  EseSim_CloseChannels();
+  sSim.stats.resetCount++;
+  sSim.stats.busyUs += sSim.config.resetLatencyUs;
+  resetUs = sSim.config.resetLatencyUs;
+  pthread_mutex_unlock(&sSimLock);
+  if (resetUs != 0) usleep(resetUs);
+}
+
+/*******************************************************************************
+**
+** Function:        EseSim_JcopDownLoadReset
+**
+** Description:     Reset issued by the JCOP client, enters the updater OS
+**                  after a trigger and moves to the next OS once an image
+**                  was received: OSID_1, OSID_2, OSID_SU1, then JCOP.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void EseSim_JcopDownLoadReset() {
+  static const char fn[] = "EseSim_JcopDownLoadReset";
+  uint16_t osId;
+
+  pthread_mutex_lock(&sSimLock);
+  if (sSim.isTriggered) {
+    sSim.isTriggered = false;
+    sSim.osId = ESE_SIM_OSID_1;
+  } else if (sSim.imageApduCnt != 0) {
+    switch (sSim.osId) {
+      case ESE_SIM_OSID_1:
+        sSim.osId = ESE_SIM_OSID_2;
+        break;
+      case ESE_SIM_OSID_2:
+        sSim.osId = ESE_SIM_OSID_SU1;
+        break;
+      case ESE_SIM_OSID_SU1:
+        sSim.osId = ESE_SIM_OSID_JCOP;
+        sSim.sn++;
+        break;
+      default:
+        break;
+    }
+  }
+  sSim.imageApduCnt = 0;
+  osId = sSim.osId;
+  pthread_mutex_unlock(&sSimLock);
+  ALOGD("%s: OSID 0x%02X", fn, osId);
+  EseSim_Reset();
+}
+
+static int16_t EseSim_Open() { return 1; }
+
+static bool EseSim_Close(int16_t mHandle) {
+  (void)mHandle;
+  return true;
+}
+
+static uint8_t EseSim_GetInterfaceInfo() { return sSim.config.intf; }
+
+/*******************************************************************************
+**
+** Function:        EseSim_Init
+**
+** Description:     Resets the simulated card to JCOP OS with no channel
+**                  open and applies pConfig, NULL for no latency.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+bool EseSim_Init(const EseSimConfig_t* pConfig) {
+  pthread_mutex_lock(&sSimLock);
+  memset(&sSim.config, 0, sizeof(EseSimConfig_t));
+  if (pConfig != NULL) memcpy(&sSim.config, pConfig, sizeof(EseSimConfig_t));
+  memset(&sSim.stats, 0, sizeof(EseSimStats_t));
+  sSim.rules.clear();
+  EseSim_CloseChannels();
+  sSim.osId = ESE_SIM_OSID_JCOP;
+  sSim.sn = 1;
+  sSim.isTriggered = false;
+  sSim.imageApduCnt = 0;
+  pthread_mutex_unlock(&sSimLock);
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        EseSim_LoadRules
+**
+** Description:     Replaces the rules with the ones read from path.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+bool EseSim_LoadRules(const char* path) {
+  static const char fn[] = "EseSim_LoadRules";
+  std::vector<EseSimRule_t> rules;
+  char line[ESE_SIM_MAX_LINE];
+  uint32_t lineNo = 0;
+  FILE* fp;
+
+  if (path == NULL || (fp = fopen(path, "r")) == NULL) {
+    ALOGE("%s: Unable to open rules <%s>", fn, path != NULL ? path : "");
+    return false;
+  }
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    char *pSave = NULL, *pTok;
+    EseSimRule_t rule;
+    bool isValid;
+
+    lineNo++;
+    if ((pTok = strchr(line, '#')) != NULL) *pTok = '\0';
+    if ((pTok = strtok_r(line, " \t\r\n", &pSave)) == NULL) continue;
+    rule.delayUs = 0;
+    rule.once = false;
+    isValid = EseSim_ParseHex(pTok, rule.cmd, &rule.mask);
+    if (isValid) {
+      pTok = strtok_r(NULL, " \t\r\n", &pSave);
+      isValid = (pTok != NULL) && EseSim_ParseHex(pTok, rule.rsp, NULL) &&
+                rule.rsp.size() >= 2;
+    }
+    while (isValid && (pTok = strtok_r(NULL, " \t\r\n", &pSave)) != NULL) {
+      if (!strncmp(pTok, "delay=", 6)) {
+        rule.delayUs = (uint32_t)strtoul(&pTok[6], NULL, 10);
+      } else if (!strcmp(pTok, "once")) {
+        rule.once = true;
+      } else {
+        isValid = false;
+      }
+    }
+    if (!isValid) {
+      ALOGE("%s: Invalid rule at line %u", fn, lineNo);
+      fclose(fp);
+      return false;
+    }
+    rules.push_back(rule);
+  }
+  fclose(fp);
+
+  pthread_mutex_lock(&sSimLock);
+  sSim.rules.swap(rules);
+  pthread_mutex_unlock(&sSimLock);
+  ALOGD("%s: %zu rules loaded", fn, sSim.rules.size());
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        EseSim_GetChannel
+**
+** Description:     Fills pChannel with the entry points of the simulator.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void EseSim_GetChannel(IChannel_t* pChannel) {
+  if (pChannel == NULL) return;
+  memset(pChannel, 0, sizeof(IChannel_t));
+  pChannel->open = EseSim_Open;
+  pChannel->close = EseSim_Close;
+  pChannel->transceive = EseSim_Transceive;
+  pChannel->transceiveRaw = EseSim_Transceive;
+  pChannel->doeSE_Reset = EseSim_Reset;
+  pChannel->doeSE_JcopDownLoadReset = EseSim_JcopDownLoadReset;
+  pChannel->getInterfaceInfo = EseSim_GetInterfaceInfo;
+}
+
+/*******************************************************************************
+**
+** Function:        EseSim_GetStats
+**
+** Description:     Counters since EseSim_Init.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void EseSim_GetStats(EseSimStats_t* pStats) {
+  if (pStats == NULL) return;
+  pthread_mutex_lock(&sSimLock);
+  memcpy(pStats, &sSim.stats, sizeof(EseSimStats_t));
+  pthread_mutex_unlock(&sSimLock);
+}
+
+/*******************************************************************************
+**
+** Function:        EseSim_GetOsId
+**
+** Description:     OSID currently reported in the UAI query info.
+**
+** Returns:         OSID
+**
+*******************************************************************************/
+uint16_t EseSim_GetOsId() {
+  uint16_t osId;
+
+  pthread_mutex_lock(&sSimLock);
+  osId = sSim.osId;
+  pthread_mutex_unlock(&sSimLock);
+  return osId;
+}
+
+/* Directories of the device the clients write to or read from */
+static const char* const sRootDirs[] = {"odm",
+                                        "odm/etc",
+                                        "vendor",
+                                        "vendor/etc",
+                                        "etc",
+                                        "data",
+                                        "data/vendor",
+                                        "data/vendor/nfc",
+                                        "data/vendor/secure_element"};
+
+/*******************************************************************************
+**
+** Function:        EseSim_MakeRoot
+**
+** Description:     Creates a scratch tree with the vendor and data
+**                  directories used by the clients and makes it the working
+**                  directory. Host builds of the clients set ESE_FS_ROOT to
+**                  "." and so only touch this tree. pPath receives its path.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+bool EseSim_MakeRoot(char* pPath, size_t len) {
+  static const char fn[] = "EseSim_MakeRoot";
+
+  if (pPath == NULL || len < sizeof(ESE_SIM_ROOT_TEMPLATE)) return false;
+  memcpy(pPath, ESE_SIM_ROOT_TEMPLATE, sizeof(ESE_SIM_ROOT_TEMPLATE));
+  if (mkdtemp(pPath) == NULL || chdir(pPath) != 0) {
+    ALOGE("%s: Unable to create <%s>", fn, pPath);
+    return false;
+  }
+  for (size_t i = 0; i < sizeof(sRootDirs) / sizeof(sRootDirs[0]); i++) {
+    if (mkdir(sRootDirs[i], 0700) != 0) {
+      ALOGE("%s: Unable to create <%s/%s>", fn, pPath, sRootDirs[i]);
+      EseSim_RemoveRoot(pPath);
+      return false;
+    }
+  }
+  return true;
+}
+
+static int EseSim_RemoveEntry(const char* path, const struct stat* pStat,
+                              int type, struct FTW* pFtw) {
+  (void)pStat;
+  (void)type;
+  (void)pFtw;
+  remove(path);
+  return 0;
+}
+
+/*******************************************************************************
+**
+** Function:        EseSim_RemoveRoot
+**
+** Description:     Deletes a tree created by EseSim_MakeRoot.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void EseSim_RemoveRoot(const char* pPath) {
+  if (pPath == NULL ||
+      strncmp(pPath, ESE_SIM_ROOT_TEMPLATE, sizeof(ESE_SIM_ROOT_TEMPLATE) - 7)) {
+    return;
+  }
+  nftw(pPath, EseSim_RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
@@ -0,0 +1,185 @@
+/******************************************************************************
+ *
+ *  Copyright 2019 NXP
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/*
+ * Measures the eSE client part of the HAL start, checkeSEClientRequired,
+ * from settings not loaded yet as after a reboot.
+ *
+ *   ese_boot_bench [-n iterations] [-p settings]
+ *   -n <n>   runs of each case (200)
+ *   -p <n>   settings of libnfc-nxp.conf besides the ones of the clients,
+ *            for a config of realistic size (300)
+ *
+ * Cases:
+ *   parse    no boot decision cached, no config cache: the config files
+ *            are parsed and the decision is made again
+ *   config   no boot decision cached, the settings come from the config
+ *            cache
+ *   cached   the boot decision of the previous start is reused, the
+ *            config files are only stat()ed
+ * The vendor files are generated in an EseSim_MakeRoot tree, the update
+ * itself is not run.
+ */
+
+#include <algorithm>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include <EseSim.h>
+#include <eSEClientIntf.h>
+#include <phNxpConfig.h>
+
+#define BENCH_PATH_LEN 64
+
+typedef enum { CASE_PARSE = 0, CASE_CONFIG, CASE_CACHED, CASE_CNT } BenchCase_t;
+
+static const char* const sCaseName[CASE_CNT] = {"parse", "config", "cached"};
+static const char sConfigPath[] = "vendor/etc/libnfc-nxp.conf";
+static const char sConfigCachePath[] =
+    "data/vendor/nfc/libnfc-nxpConfigCache.bin";
+/* Touched to invalidate the cached decision, as an OTA would */
+static const char sVendorFile[] = "vendor/etc/jci.apdu";
+
+/*******************************************************************************
+**
+** Function:        Bench_WriteFiles
+**
+** Description:     Generates the config and the vendor files the decision
+**                  depends on.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+static bool Bench_WriteFiles(uint32_t padCnt) {
+  static const char* const vendorFiles[] = {
+      "vendor/etc/cci.apdu", "vendor/etc/jci.apdu",
+      "vendor/etc/JcopOs_Update1.apdu",
+      "vendor/etc/loaderservice_updater.txt"};
+  FILE* fp = fopen(sConfigPath, "w");
+
+  if (fp == NULL) return false;
+  fprintf(fp, "###############################################\n"
+              "# eSE clients\n"
+              "NXP_P61_JCOP_DEFAULT_INTERFACE=0x01\n"
+              "NXP_P61_LS_DEFAULT_INTERFACE=0x01\n"
+              "NXP_LS_MAX_CHANNELS=0x04\n");
+  for (uint32_t i = 0; i < padCnt; i++) {
+    if (i % 3 == 0) {
+      fprintf(fp, "# Setting %u\nNXP_BENCH_SETTING_%u={", i, i);
+      for (uint32_t j = 0; j < 16; j++) {
+        fprintf(fp, "%s%02X", j ? ", " : "", (i + j) & 0xFF);
+      }
+      fprintf(fp, "}\n");
+    } else if (i % 3 == 1) {
+      fprintf(fp, "NXP_BENCH_SETTING_%u=0x%02X\n", i, i & 0xFF);
+    } else {
+      fprintf(fp, "NXP_BENCH_SETTING_%u=\"setting_%u\"\n", i, i);
+    }
+  }
+  if (fclose(fp) != 0) return false;
+  for (size_t i = 0; i < sizeof(vendorFiles) / sizeof(vendorFiles[0]); i++) {
+    if ((fp = fopen(vendorFiles[i], "w")) == NULL) return false;
+    fprintf(fp, "80E2900004DEADBEEF\n");
+    if (fclose(fp) != 0) return false;
+  }
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        Bench_Prepare
+**
+** Description:     Puts the files in the state of the case.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void Bench_Prepare(BenchCase_t benchCase, uint32_t iter) {
+  if (benchCase != CASE_CACHED) {
+    struct timespec times[2];
+    /*A new modification time, whatever the timestamp resolution*/
+    times[0].tv_sec = times[1].tv_sec = 1000000 + iter * CASE_CNT + benchCase;
+    times[0].tv_nsec = times[1].tv_nsec = 0;
+    utimensat(AT_FDCWD, sVendorFile, times, 0);
+  }
+  if (benchCase == CASE_PARSE) unlink(sConfigCachePath);
+  /*Settings not loaded, as at the start of the HAL*/
+  resetNxpConfig();
+}
+
+int main(int argc, char** argv) {
+  std::vector<long> samples[CASE_CNT];
+  char root[BENCH_PATH_LEN];
+  uint32_t iterCnt = 200, padCnt = 300;
+  struct timespec start, end;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:p:")) != -1) {
+    switch (opt) {
+      case 'n':
+        iterCnt = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'p':
+        padCnt = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-n iterations] [-p settings]\n", argv[0]);
+        return 2;
+    }
+  }
+  if (iterCnt == 0) {
+    fprintf(stderr, "%s: invalid arguments\n", argv[0]);
+    return 2;
+  }
+  if (!EseSim_MakeRoot(root, sizeof(root)) || !Bench_WriteFiles(padCnt)) {
+    fprintf(stderr, "%s: unable to create the scratch tree\n", argv[0]);
+    return 1;
+  }
+  /*First start, records the decision*/
+  checkeSEClientRequired(ESE_INTF_NFC);
+  for (uint32_t i = 0; i < iterCnt; i++) {
+    for (int c = 0; c < CASE_CNT; c++) {
+      Bench_Prepare((BenchCase_t)c, i);
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      checkeSEClientRequired(ESE_INTF_NFC);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      samples[c].push_back((end.tv_sec - start.tv_sec) * 1000000 +
+                           (end.tv_nsec - start.tv_nsec) / 1000);
+    }
+  }
+  printf("HAL start, %u runs, %u settings, Jcop %d LS %d\n", iterCnt,
+         padCnt + 3, getJcopUpdateRequired(), getLsUpdateRequired());
+  for (int c = 0; c < CASE_CNT; c++) {
+    std::vector<long>& s = samples[c];
+    long sum = 0;
+    std::sort(s.begin(), s.end());
+    for (size_t i = 0; i < s.size(); i++) sum += s[i];
+    printf("  %-7s avg %6ld us  p50 %6ld us  p90 %6ld us  max %6ld us\n",
+           sCaseName[c], sum / (long)s.size(), s[s.size() / 2],
+           s[(s.size() * 9) / 10], s.back());
+  }
+  EseSim_RemoveRoot(root);
+  return 0;
+}
@@ -0,0 +1,380 @@
+/******************************************************************************
+ *
+ *  Copyright 2019 NXP
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/*
+ * Runs the LS and JCOP clients against the simulated eSE.
+ *
+ *   ese_sim_driver [options] ls|multi|batch|jcop
+ *     ls     performLSDownload of loaderservice_updater.txt
+ *     multi  LSC_StartMulti of -s scripts
+ *     batch  LSC_StartBatch of -s scripts
+ *     jcop   JCOP update of the three images through the UAI flow
+ *   -s <n>   scripts of multi and batch (4)
+ *   -a <n>   commands per script, APDUs per JCOP image (64)
+ *   -l <us>  processing time of an APDU (2000)
+ *   -b <n>   link throughput in bytes per second, 0 for unlimited (0)
+ *   -c <n>   logical channels of the card with the basic one (20)
+ *   -r <f>   rules file, see EseSim.h
+ *   -k       keep the scratch tree
+ *
+ * The scripts and images are generated in a scratch tree the host build of
+ * the clients uses as their root (ESE_FS_ROOT), with a valid certificate
+ * and signature for the Loader Service FCI of the simulator.
+ * The exit status is 0 if the download succeeded.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <EseSim.h>
+#include <EseStateJournal.h>
+#include <JcDnld.h>
+#include <LsClient.h>
+
+#define DRIVER_MAX_SCRIPTS 16
+#define DRIVER_PATH_LEN 64
+#define DRIVER_CMD_DATA_LEN 48 /* Above the 32 bytes required for tag 40 */
+
+typedef enum { MODE_LS = 0, MODE_MULTI, MODE_BATCH, MODE_JCOP } DriverMode_t;
+
+/* Settings the download paths depend on */
+static const char sConfig[] =
+    "NXP_LS_MAX_CHANNELS=0x04\n"
+    "NXP_JCOP_CHECKPOINT_INTERVAL=0x10\n"
+    "NXP_APDU_STATS=0x01\n";
+
+/*******************************************************************************
+**
+** Function:        Driver_PutHex
+**
+** Description:     Writes data as hex.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void Driver_PutHex(FILE* fp, const uint8_t* pData, size_t len) {
+  for (size_t i = 0; i < len; i++) fprintf(fp, "%02X", pData[i]);
+}
+
+/*******************************************************************************
+**
+** Function:        Driver_WriteFile
+**
+** Description:     Creates path with the text pData.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+static bool Driver_WriteFile(const char* path, const char* pData) {
+  FILE* fp = fopen(path, "w");
+
+  if (fp == NULL) return false;
+  fputs(pData, fp);
+  return (fclose(fp) == 0);
+}
+
+/*******************************************************************************
+**
+** Function:        Driver_WriteLsScript
+**
+** Description:     Generates a script of cmdCnt Loader Service commands,
+**                  certified for the root entity and signature key of the
+**                  simulator.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+static bool Driver_WriteLsScript(const char* path, uint32_t cmdCnt,
+                                 uint8_t serial) {
+  uint8_t cert[192];
+  uint8_t cmd[5 + DRIVER_CMD_DATA_LEN];
+  size_t i = 0;
+  FILE* fp = fopen(path, "w");
+
+  if (fp == NULL) return false;
+  cert[i++] = 0x93; /* Serial number */
+  cert[i++] = 0x01;
+  cert[i++] = serial;
+  cert[i++] = 0x42; /* Root entity identifier, see EseSim_LsFci */
+  cert[i++] = 16;
+  for (uint8_t j = 0; j < 16; j++) cert[i++] = 0x10 + j;
+  cert[i++] = 0x5F; /* Certificate holder */
+  cert[i++] = 0x20;
+  cert[i++] = 0x01;
+  cert[i++] = 0x00;
+  cert[i++] = 0x95; /* Key usage */
+  cert[i++] = 0x01;
+  cert[i++] = 0x00;
+  cert[i++] = 0x5F; /* Effective date */
+  cert[i++] = 0x25;
+  cert[i++] = 0x01;
+  cert[i++] = 0x00;
+  cert[i++] = 0x5F; /* Expiry date */
+  cert[i++] = 0x24;
+  cert[i++] = 0x01;
+  cert[i++] = 0x00;
+  cert[i++] = 0x45; /* Signature key identifier */
+  cert[i++] = 8;
+  for (uint8_t j = 0; j < 8; j++) cert[i++] = 0x40 + j;
+  cert[i++] = 0x53; /* CCM permissions */
+  cert[i++] = 0x01;
+  cert[i++] = 0x00;
+  cert[i++] = 0x5F; /* Signature */
+  cert[i++] = 0x37;
+  cert[i++] = 64;
+  memset(&cert[i], 0xA5, 64);
+  i += 64;
+  cert[i++] = 0x7F; /* Public key */
+  cert[i++] = 0x49;
+  cert[i++] = 2 + 65;
+  cert[i++] = 0x86;
+  cert[i++] = 65;
+  memset(&cert[i], 0x04, 65);
+  i += 65;
+
+  fprintf(fp, "7F2181%02zX", i);
+  Driver_PutHex(fp, cert, i);
+  fprintf(fp, "\n600A4108");
+  for (uint8_t j = 0; j < 8; j++) fprintf(fp, "%02X", serial ^ j);
+  fprintf(fp, "\n");
+  for (uint32_t n = 0; n < cmdCnt; n++) {
+    cmd[0] = 0x80;
+    cmd[1] = 0xE8;
+    cmd[2] = (n + 1 == cmdCnt) ? 0x80 : 0x00;
+    cmd[3] = (uint8_t)n;
+    cmd[4] = DRIVER_CMD_DATA_LEN;
+    for (uint8_t j = 0; j < DRIVER_CMD_DATA_LEN; j++) {
+      cmd[5 + j] = (uint8_t)(serial + n + j);
+    }
+    fprintf(fp, "40%02X", (unsigned)sizeof(cmd));
+    Driver_PutHex(fp, cmd, sizeof(cmd));
+    fprintf(fp, "\n");
+  }
+  return (fclose(fp) == 0);
+}
+
+/*******************************************************************************
+**
+** Function:        Driver_WriteImage
+**
+** Description:     Generates a JCOP image or UAI file of apduCnt APDUs.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+static bool Driver_WriteImage(const char* path, uint32_t apduCnt, uint8_t ins) {
+  uint8_t apdu[5 + 0xF0];
+  FILE* fp = fopen(path, "w");
+
+  if (fp == NULL) return false;
+  for (uint32_t n = 0; n < apduCnt; n++) {
+    apdu[0] = 0x80;
+    apdu[1] = ins;
+    apdu[2] = (uint8_t)(n >> 8);
+    apdu[3] = (uint8_t)n;
+    apdu[4] = sizeof(apdu) - 5;
+    memset(&apdu[5], (uint8_t)n, sizeof(apdu) - 5);
+    Driver_PutHex(fp, apdu, sizeof(apdu));
+    fprintf(fp, "\n");
+  }
+  return (fclose(fp) == 0);
+}
+
+/*******************************************************************************
+**
+** Function:        Driver_RunLs
+**
+** Description:     Runs the LS download of the selected mode.
+**
+** Returns:         True if every script succeeded.
+**
+*******************************************************************************/
+static bool Driver_RunLs(DriverMode_t mode, IChannel_t* pChannel,
+                         uint32_t scriptCnt, uint32_t cmdCnt) {
+  static const uint8_t hash[20] = {0x6d, 0x58, 0x3e, 0x84, 0xf2, 0x71, 0x0e,
+                                   0x6b, 0x0f, 0x06, 0xbe, 0xeb, 0xc1, 0xa1,
+                                   0x2a, 0x10, 0x83, 0x59, 0x13, 0x73};
+  static char name[DRIVER_MAX_SCRIPTS][DRIVER_PATH_LEN];
+  static char dest[DRIVER_MAX_SCRIPTS][DRIVER_PATH_LEN];
+  LsScript_t scripts[DRIVER_MAX_SCRIPTS];
+  tLSC_STATUS status;
+
+  if (mode == MODE_LS) {
+    if (!Driver_WriteLsScript("vendor/etc/loaderservice_updater.txt", cmdCnt,
+                              0x01)) {
+      return false;
+    }
+    return (performLSDownload(pChannel) == STATUS_SUCCESS);
+  }
+  memset(scripts, 0, sizeof(scripts));
+  for (uint32_t i = 0; i < scriptCnt; i++) {
+    snprintf(name[i], DRIVER_PATH_LEN, "data/ls_script_%u.txt", i);
+    snprintf(dest[i], DRIVER_PATH_LEN, "data/ls_script_%u_out.txt", i);
+    if (!Driver_WriteLsScript(name[i], cmdCnt, (uint8_t)(i + 1))) return false;
+    scripts[i].name = name[i];
+    scripts[i].dest = dest[i];
+    scripts[i].pHash = hash;
+    scripts[i].hashLen = sizeof(hash);
+  }
+  if (mode == MODE_MULTI) {
+    status = LSC_StartMulti(pChannel, scripts, (uint8_t)scriptCnt);
+  } else {
+    status = LSC_StartBatch(pChannel, scripts, (uint8_t)scriptCnt);
+  }
+  for (uint32_t i = 0; i < scriptCnt; i++) {
+    printf("  script %u: status 0x%X SW %02X%02X\n", i, scripts[i].status,
+           scripts[i].respSW[2], scripts[i].respSW[3]);
+  }
+  return (status == STATUS_SUCCESS);
+}
+
+/*******************************************************************************
+**
+** Function:        Driver_RunJcop
+**
+** Description:     Runs the JCOP update, the simulator switches its OSID as
+**                  each image is received.
+**
+** Returns:         True if the update succeeded.
+**
+*******************************************************************************/
+static bool Driver_RunJcop(IChannel_t* pChannel, uint32_t apduCnt) {
+  static const char* const images[] = {"vendor/etc/JcopOs_Update1.apdu",
+                                       "vendor/etc/JcopOs_Update2.apdu",
+                                       "vendor/etc/JcopOs_Update3.apdu"};
+  tJBL_STATUS status;
+
+  if (!Driver_WriteImage("vendor/etc/cci.apdu", 1, 0xE2) ||
+      !Driver_WriteImage("vendor/etc/jci.apdu", 1, 0xE2)) {
+    return false;
+  }
+  for (size_t i = 0; i < sizeof(images) / sizeof(images[0]); i++) {
+    if (!Driver_WriteImage(images[i], apduCnt, 0xE8)) return false;
+  }
+  if (JCDNLD_Init(pChannel) != STATUS_OK) {
+    JCDNLD_DeInit();
+    return false;
+  }
+  status = JCDNLD_StartDownload();
+  JCDNLD_DeInit();
+  printf("  OSID 0x%02X\n", EseSim_GetOsId());
+  return (status == STATUS_OK);
+}
+
+int main(int argc, char** argv) {
+  static const char* const modes[] = {"ls", "multi", "batch", "jcop"};
+  EseSimConfig_t config;
+  EseSimStats_t stats;
+  EseState_t state;
+  IChannel_t channel;
+  DriverMode_t mode = MODE_LS;
+  char root[DRIVER_PATH_LEN];
+  const char* pRules = NULL;
+  uint32_t scriptCnt = 4, cmdCnt = 64;
+  bool isKept = false, isOk = false;
+  struct timespec start, end;
+  int opt;
+
+  memset(&config, 0, sizeof(config));
+  config.apduLatencyUs = 2000;
+  while ((opt = getopt(argc, argv, "s:a:l:b:c:r:k")) != -1) {
+    switch (opt) {
+      case 's':
+        scriptCnt = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'a':
+        cmdCnt = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'l':
+        config.apduLatencyUs = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'b':
+        config.bytesPerSec = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'c':
+        config.channels = (uint8_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'r':
+        pRules = optarg;
+        break;
+      case 'k':
+        isKept = true;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-s n] [-a n] [-l us] [-b n] [-c n] "
+                        "[-r rules] [-k] ls|multi|batch|jcop\n", argv[0]);
+        return 2;
+    }
+  }
+  if (optind + 1 != argc) {
+    fprintf(stderr, "%s: one mode expected\n", argv[0]);
+    return 2;
+  }
+  while (mode <= MODE_JCOP && strcmp(argv[optind], modes[mode])) {
+    mode = (DriverMode_t)(mode + 1);
+  }
+  if (mode > MODE_JCOP || scriptCnt == 0 ||
+      scriptCnt > DRIVER_MAX_SCRIPTS || cmdCnt == 0) {
+    fprintf(stderr, "%s: invalid arguments\n", argv[0]);
+    return 2;
+  }
+
+  if (!EseSim_MakeRoot(root, sizeof(root)) ||
+      !Driver_WriteFile("vendor/etc/libnfc-nxp.conf", sConfig)) {
+    fprintf(stderr, "%s: unable to create the scratch tree\n", argv[0]);
+    return 1;
+  }
+  EseSim_Init(&config);
+  if (pRules != NULL && !EseSim_LoadRules(pRules)) {
+    fprintf(stderr, "%s: invalid rules %s\n", argv[0], pRules);
+  } else {
+    EseSim_GetChannel(&channel);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    isOk = (mode == MODE_JCOP)
+               ? Driver_RunJcop(&channel, cmdCnt)
+               : Driver_RunLs(mode, &channel, scriptCnt, cmdCnt);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    EseSim_GetStats(&stats);
+    printf("%s: %s in %ld ms, %u APDUs, %llu bytes in, %llu bytes out, "
+           "%llu ms in the eSE\n",
+           modes[mode], isOk ? "SUCCESS" : "FAILED",
+           (long)((end.tv_sec - start.tv_sec) * 1000 +
+                  (end.tv_nsec - start.tv_nsec) / 1000000),
+           stats.apduCount, (unsigned long long)stats.bytesIn,
+           (unsigned long long)stats.bytesOut,
+           (unsigned long long)(stats.busyUs / 1000));
+    if (EseState_Read(config.intf, &state)) {
+      if (state.valid & ESE_STATE_LS_STATUS) {
+        printf("  LS status %04X\n", state.lsStatus);
+      }
+      if (state.valid & ESE_STATE_JCOP) {
+        printf("  JCOP state %u\n", state.jcopState);
+      }
+    }
+  }
+  if (isKept) {
+    printf("  tree kept in %s\n", root);
+  } else {
+    EseSim_RemoveRoot(root);
+  }
+  return isOk ? 0 : 1;
+}
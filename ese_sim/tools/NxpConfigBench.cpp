@@ -0,0 +1,299 @@
+/******************************************************************************
+ *
+ *  Copyright 2019 NXP
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/*
+ * Measures the settings of phNxpConfig on a generated config.
+ *
+ *   nxp_config_bench [-n iterations] [-p settings] [-k keys]
+ *                    [-d duplicates] [-o overrides] lookup|load
+ *     lookup  every setting with a typed accessor plus -p others, each
+ *             looked up -n times by name (GetNxpNumValue) and by key
+ *             (GetNxpNum)
+ *     load    -k settings, the first -d of them set again at the end of
+ *             libnfc-nxp.conf and the next -o set again by
+ *             libnfc-brcm.conf, loaded -n times with and without the
+ *             config cache
+ *   -n <n>    iterations (lookup 1000, load 100)
+ *   -p <n>    settings besides the typed ones (150)
+ *   -k <n>    settings of the load (5000)
+ *   -d <n>    settings set twice in libnfc-nxp.conf (500)
+ *   -o <n>    settings of libnfc-nxp.conf set again by libnfc-brcm.conf (300)
+ *
+ * The config is generated in an EseSim_MakeRoot tree. Every value read
+ * back is checked, the exit status is 0 if all were as written.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <EseSim.h>
+#include <phNxpConfig.h>
+
+#define BENCH_PATH_LEN 64
+#define BENCH_NAME_LEN 32
+
+static const char sConfigCachePath[] =
+    "data/vendor/nfc/libnfc-nxpConfigCache.bin";
+
+/* Settings with a typed accessor, as listed in phNxpConfig.h */
+static const char* const sKeyNames[CFG_KEY_COUNT] = {
+#define BENCH_KEY_NAME(x) NAME_##x,
+    NXP_CONFIG_KEYS(BENCH_KEY_NAME)
+#undef BENCH_KEY_NAME
+};
+
+/*******************************************************************************
+**
+** Function:        Bench_Now
+**
+** Description:     Monotonic time.
+**
+** Returns:         Nanoseconds
+**
+*******************************************************************************/
+static uint64_t Bench_Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*******************************************************************************
+**
+** Function:        Bench_Lookup
+**
+** Description:     Writes a config holding every typed setting and padCnt
+**                  others, then looks each of them up iterCnt times.
+**
+** Returns:         True if every value read back is the one written.
+**
+*******************************************************************************/
+static bool Bench_Lookup(uint32_t iterCnt, uint32_t padCnt) {
+  std::vector<std::string> names;
+  uint32_t errCnt = 0, lookupCnt = 0;
+  unsigned long value;
+  uint64_t start, nameNs, keyNs;
+  FILE* fp = fopen("vendor/etc/libnfc-nxp.conf", "w");
+
+  if (fp == NULL) return false;
+  for (int key = 0; key < CFG_KEY_COUNT; key++) {
+    names.push_back(sKeyNames[key]);
+  }
+  for (uint32_t i = 0; i < padCnt; i++) {
+    names.push_back("NXP_BENCH_SETTING_" + std::to_string(i));
+  }
+  for (size_t i = 0; i < names.size(); i++) {
+    fprintf(fp, "# Setting %zu\n%s=0x%zX\n", i, names[i].c_str(), i + 1);
+  }
+  if (fclose(fp) != 0) return false;
+
+  resetNxpConfig();
+  start = Bench_Now();
+  for (uint32_t n = 0; n < iterCnt; n++) {
+    for (size_t i = 0; i < names.size(); i++) {
+      value = 0;
+      if (!GetNxpNumValue(names[i].c_str(), &value, sizeof(value)) ||
+          value != i + 1) {
+        errCnt++;
+      }
+      lookupCnt++;
+    }
+  }
+  nameNs = Bench_Now() - start;
+  start = Bench_Now();
+  for (uint32_t n = 0; n < iterCnt; n++) {
+    for (int key = 0; key < CFG_KEY_COUNT; key++) {
+      value = 0;
+      if (!GetNxpNum((ConfigKey)key, &value, sizeof(value)) ||
+          value != (unsigned long)key + 1) {
+        errCnt++;
+      }
+    }
+  }
+  keyNs = Bench_Now() - start;
+  printf("lookup: %zu settings, %u errors\n", names.size(), errCnt);
+  printf("  by name %8.1f ns  (%u lookups)\n", (double)nameNs / lookupCnt,
+         lookupCnt);
+  printf("  by key  %8.1f ns  (%u lookups)\n",
+         (double)keyNs / ((uint64_t)iterCnt * CFG_KEY_COUNT),
+         iterCnt * CFG_KEY_COUNT);
+  return (errCnt == 0);
+}
+
+/*******************************************************************************
+**
+** Function:        Bench_LoadValue
+**
+** Description:     Value the load case expects for a setting, the one of
+**                  its last definition.
+**
+** Returns:         Value
+**
+*******************************************************************************/
+static unsigned long Bench_LoadValue(uint32_t i, uint32_t dupCnt,
+                                     uint32_t overCnt) {
+  if (i < dupCnt) return i + 0x100000;
+  if (i < dupCnt + overCnt) return i + 0x200000;
+  return i;
+}
+
+/*******************************************************************************
+**
+** Function:        Bench_Report
+**
+** Description:     Prints the statistics of the samples.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void Bench_Report(const char* name, std::vector<uint64_t>& s) {
+  uint64_t sum = 0;
+  std::sort(s.begin(), s.end());
+  for (size_t i = 0; i < s.size(); i++) sum += s[i];
+  printf("  %-7s avg %8.1f us  p50 %8.1f us  p90 %8.1f us  max %8.1f us\n",
+         name, sum / 1000.0 / s.size(), s[s.size() / 2] / 1000.0,
+         s[(s.size() * 9) / 10] / 1000.0, s.back() / 1000.0);
+}
+
+/*******************************************************************************
+**
+** Function:        Bench_Load
+**
+** Description:     Writes keyCnt settings with dupCnt in-file duplicates and
+**                  overCnt overridden by libnfc-brcm.conf, then loads them
+**                  iterCnt times parsing the files and iterCnt times from
+**                  the config cache.
+**
+** Returns:         True if every value read back is the one of the last
+**                  definition of the setting.
+**
+*******************************************************************************/
+static bool Bench_Load(uint32_t iterCnt, uint32_t keyCnt, uint32_t dupCnt,
+                       uint32_t overCnt) {
+  std::vector<uint64_t> parseNs, cacheNs;
+  uint32_t errCnt = 0;
+  unsigned long value;
+  uint64_t start;
+  FILE* fp;
+
+  if ((uint64_t)dupCnt + overCnt > keyCnt) return false;
+  if ((fp = fopen("vendor/etc/libnfc-nxp.conf", "w")) == NULL) return false;
+  for (uint32_t i = 0; i < keyCnt; i++) {
+    fprintf(fp, "# Setting %u\nNXP_BENCH_SETTING_%u=0x%X\n", i, i, i);
+  }
+  for (uint32_t i = 0; i < dupCnt; i++) {
+    fprintf(fp, "NXP_BENCH_SETTING_%u=0x%X\n", i, i + 0x100000);
+  }
+  if (fclose(fp) != 0) return false;
+  if ((fp = fopen("vendor/etc/libnfc-brcm.conf", "w")) == NULL) return false;
+  for (uint32_t i = dupCnt; i < dupCnt + overCnt; i++) {
+    fprintf(fp, "NXP_BENCH_SETTING_%u=0x%X\n", i, i + 0x200000);
+  }
+  if (fclose(fp) != 0) return false;
+
+  for (uint32_t n = 0; n < iterCnt; n++) {
+    /*Settings not loaded, as at the start of the HAL*/
+    unlink(sConfigCachePath);
+    resetNxpConfig();
+    start = Bench_Now();
+    GetNxpNumValue("NXP_BENCH_SETTING_0", &value, sizeof(value));
+    parseNs.push_back(Bench_Now() - start);
+    resetNxpConfig();
+    start = Bench_Now();
+    GetNxpNumValue("NXP_BENCH_SETTING_0", &value, sizeof(value));
+    cacheNs.push_back(Bench_Now() - start);
+  }
+  /*Loaded from the cache last, check both ways*/
+  for (int pass = 0; pass < 2; pass++) {
+    if (pass == 1) {
+      unlink(sConfigCachePath);
+      resetNxpConfig();
+    }
+    for (uint32_t i = 0; i < keyCnt; i++) {
+      char name[BENCH_NAME_LEN];
+      snprintf(name, sizeof(name), "NXP_BENCH_SETTING_%u", i);
+      value = 0;
+      if (!GetNxpNumValue(name, &value, sizeof(value)) ||
+          value != Bench_LoadValue(i, dupCnt, overCnt)) {
+        errCnt++;
+      }
+    }
+  }
+  printf("load: %u settings, %u duplicates, %u overrides, %u runs, "
+         "%u errors\n",
+         keyCnt, dupCnt, overCnt, iterCnt, errCnt);
+  Bench_Report("parse", parseNs);
+  Bench_Report("cache", cacheNs);
+  return (errCnt == 0);
+}
+
+int main(int argc, char** argv) {
+  char root[BENCH_PATH_LEN];
+  uint32_t iterCnt = 0, padCnt = 150;
+  uint32_t keyCnt = 5000, dupCnt = 500, overCnt = 300;
+  bool isLookup, isOk = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:p:k:d:o:")) != -1) {
+    switch (opt) {
+      case 'n':
+        iterCnt = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'p':
+        padCnt = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'k':
+        keyCnt = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'd':
+        dupCnt = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'o':
+        overCnt = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      default:
+        fprintf(stderr,
+                "usage: %s [-n iterations] [-p settings] [-k keys] "
+                "[-d duplicates] [-o overrides] lookup|load\n",
+                argv[0]);
+        return 2;
+    }
+  }
+  if (optind + 1 != argc ||
+      (strcmp(argv[optind], "lookup") && strcmp(argv[optind], "load")) ||
+      (uint64_t)dupCnt + overCnt > keyCnt) {
+    fprintf(stderr, "%s: invalid arguments\n", argv[0]);
+    return 2;
+  }
+  isLookup = (strcmp(argv[optind], "lookup") == 0);
+  if (iterCnt == 0) iterCnt = isLookup ? 1000 : 100;
+  if (!EseSim_MakeRoot(root, sizeof(root))) {
+    fprintf(stderr, "%s: unable to create the scratch tree\n", argv[0]);
+    return 1;
+  }
+  isOk = isLookup ? Bench_Lookup(iterCnt, padCnt)
+                  : Bench_Load(iterCnt, keyCnt, dupCnt, overCnt);
+  EseSim_RemoveRoot(root);
+  return isOk ? 0 : 1;
+}
@@ -0,0 +1,155 @@
+ /*
+  * Copyright (C) 2019 NXP Semiconductors
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *      http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+
+#ifndef ICHANNEL_ASYNC_H_
+#define ICHANNEL_ASYNC_H_
+
+#include "IChannel.h"
+
+/*
+ * Asynchronous transceive on top of IChannel_t.
+ * IChannel_t itself is left untouched since the clients copy the caller's
+ * structure by size. A HAL with a native asynchronous transport registers
+ * an IChannelAsync_t next to its IChannel_t, any other HAL is served by a
+ * worker thread issuing the blocking transceive calls in submit order.
+ * Each channel gets its own adapter, so that the eSE and the eUICC can be
+ * used at the same time.
+ */
+
+typedef enum {
+  ICHANNEL_REQ_IDLE = 0,
+  ICHANNEL_REQ_PENDING,
+  ICHANNEL_REQ_DONE
+} IChannelReqState_t;
+
+struct IChannelRequest;
+typedef void (*IChannelCallback_t)(struct IChannelRequest* pReq);
+/* Adapter of one channel, see IChannelAsync_Init */
+typedef struct IChannelAsyncCtx* IChannelAsyncHandle_t;
+
+/* Zero initialize before the first submit, a request can be submitted again
+ * once completed */
+typedef struct IChannelRequest {
+  /* Filled by the caller, buffers must stay valid until completion */
+  uint8_t* xmitBuffer;
+  int32_t xmitBufferSize;
+  uint8_t* recvBuffer;
+  int32_t recvBufferMaxSize;
+  int32_t timeoutMillisec;
+  bool isRaw;                  /* Use transceiveRaw */
+  IChannelCallback_t callback; /* Optional, called on completion */
+  void* pCtx;                  /* Caller context for the callback */
+
+  /* Filled on completion */
+  bool status;
+  int32_t recvBufferActualSize;
+
+  /* Owned by the adapter */
+  IChannelReqState_t state;
+  IChannelAsyncHandle_t hAsync; /* Adapter the request was submitted to */
+  struct IChannelRequest* pNext;
+} IChannelRequest_t;
+
+typedef struct IChannelAsync {
+/*******************************************************************************
+**
+** Function:        submit
+**
+** Description:     Starts the transfer described by pReq and returns without
+**                  waiting for the response. The implementation reports the
+**                  result through IChannelAsync_Complete(), from any thread.
+**
+** Returns:         True if the request was accepted.
+**
+*******************************************************************************/
+bool (*submit)(IChannelRequest_t* pReq);
+} IChannelAsync_t;
+
+/*******************************************************************************
+**
+** Function:        IChannelAsync_Init
+**
+** Description:     Creates an adapter for channel. pNative is optional,
+**                  without it requests are run on a worker thread using the
+**                  blocking entry points of channel.
+**
+** Returns:         Handle of the adapter, NULL on failure.
+**
+*******************************************************************************/
+IChannelAsyncHandle_t IChannelAsync_Init(IChannel_t* channel,
+                                         IChannelAsync_t* pNative);
+
+/*******************************************************************************
+**
+** Function:        IChannelAsync_DeInit
+**
+** Description:     Completes all pending requests of hAsync, stops its worker
+**                  and releases it.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void IChannelAsync_DeInit(IChannelAsyncHandle_t hAsync);
+
+/*******************************************************************************
+**
+** Function:        IChannelAsync_Submit
+**
+** Description:     Queues pReq for transmission on the channel of hAsync.
+**                  Requests are sent in submit order.
+**
+** Returns:         True if the request was queued.
+**
+*******************************************************************************/
+bool IChannelAsync_Submit(IChannelAsyncHandle_t hAsync,
+                          IChannelRequest_t* pReq);
+
+/*******************************************************************************
+**
+** Function:        IChannelAsync_Poll
+**
+** Description:     Checks for completion of pReq without blocking.
+**
+** Returns:         True if pReq is completed.
+**
+*******************************************************************************/
+bool IChannelAsync_Poll(IChannelRequest_t* pReq);
+
+/*******************************************************************************
+**
+** Function:        IChannelAsync_Wait
+**
+** Description:     Blocks until pReq is completed.
+**
+** Returns:         Transceive status of pReq.
+**
+*******************************************************************************/
+bool IChannelAsync_Wait(IChannelRequest_t* pReq);
+
+/*******************************************************************************
+**
+** Function:        IChannelAsync_Complete
+**
+** Description:     Reports the result of a request, used by native
+**                  implementations of IChannelAsync_t::submit.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void IChannelAsync_Complete(IChannelRequest_t* pReq, bool status,
+                            int32_t recvBufferActualSize);
+
+#endif /* ICHANNEL_ASYNC_H_ */
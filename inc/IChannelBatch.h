@@ -0,0 +1,100 @@
+ /*
+  * Copyright (C) 2019 NXP Semiconductors
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *      http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+
+#ifndef ICHANNEL_BATCH_H_
+#define ICHANNEL_BATCH_H_
+
+#include "IChannel.h"
+
+/*
+ * Transceive of a sequence of C-APDUs in one call.
+ * Like IChannelAsync_t this is an optional extension registered next to
+ * IChannel_t, transports able to pipeline frames implement it natively,
+ * for all others the commands are sent one by one with transceive.
+ * A native batch serves only the channel it was registered for, told by
+ * its transceive entry point: channels wrapping it (statistics, trace,
+ * multi session) send one by one through the wrapper.
+ */
+
+#define ICHANNEL_BATCH_MAX_REG 4 /* Channels with a native batch */
+
+typedef enum {
+  ICHANNEL_BATCH_ABORT_NEVER = 0, /* Send all commands */
+  ICHANNEL_BATCH_ABORT_ON_ERROR,  /* Stop after a failed transceive */
+  ICHANNEL_BATCH_ABORT_ON_SW      /* Also stop after a status word other
+                                     than 9000 */
+} IChannelBatchPolicy_t;
+
+typedef struct IChannelCmd {
+  /* Filled by the caller */
+  uint8_t* p_data;
+  int32_t len;
+
+  /* Filled by the batch */
+  bool status;    /* Transceive status */
+  uint16_t sw;    /* SW1 SW2, 0 if the response has none */
+} IChannelCmd_t;
+
+typedef struct IChannelBatch {
+/*******************************************************************************
+**
+** Function:        transceiveBatch
+**
+** Description:     Sends pCmds[0..count-1] in order and fills in the result
+**                  of each command sent, honouring the abort policy.
+**                  recvBuffer receives the complete response of the last
+**                  command sent.
+**
+** Returns:         Number of commands sent.
+**
+*******************************************************************************/
+int32_t (*transceiveBatch)(IChannelCmd_t* pCmds, int32_t count,
+                           IChannelBatchPolicy_t policy, uint8_t* recvBuffer,
+                           int32_t recvBufferMaxSize,
+                           int32_t& recvBufferActualSize,
+                           int32_t timeoutMillisec);
+} IChannelBatch_t;
+
+/*******************************************************************************
+**
+** Function:        IChannelBatch_Register
+**
+** Description:     Registers the native batch implementation of channel,
+**                  NULL restores the one by one fallback for it.
+**
+** Returns:         True if ok, false if all registrations are in use.
+**
+*******************************************************************************/
+bool IChannelBatch_Register(IChannel_t* channel, IChannelBatch_t* pBatch);
+
+/*******************************************************************************
+**
+** Function:        IChannelBatch_Transceive
+**
+** Description:     Sends pCmds[0..count-1] using the batch implementation
+**                  registered for channel or one transceive per command.
+**                  See IChannelBatch_t::transceiveBatch.
+**
+** Returns:         Number of commands sent.
+**
+*******************************************************************************/
+int32_t IChannelBatch_Transceive(IChannel_t* channel, IChannelCmd_t* pCmds,
+                                 int32_t count, IChannelBatchPolicy_t policy,
+                                 uint8_t* recvBuffer, int32_t recvBufferMaxSize,
+                                 int32_t& recvBufferActualSize,
+                                 int32_t timeoutMillisec);
+
+#endif /* ICHANNEL_BATCH_H_ */
@@ -0,0 +1,112 @@
+ /*
+  * Copyright (C) 2019 NXP Semiconductors
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *      http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+
+#ifndef ICHANNEL_STATS_H_
+#define ICHANNEL_STATS_H_
+
+#include "IChannel.h"
+
+/*
+ * APDU latency and throughput instrumentation.
+ * A wrapped IChannel_t times every transceive and accounts it in log-linear
+ * latency histograms, one per INS byte and one per client phase, together
+ * with the bytes exchanged and the status words other than 9000.
+ * Counters are updated without locks and can be dumped at any time.
+ *
+ * The phase is set per thread by the clients, so that LS and JCOP update
+ * running on separate threads are accounted separately.
+ * Comparing the time spent in the channel with the wall time of a phase
+ * tells whether it is bound by the eSE and link or by the host.
+ */
+
+/* Enabled by NXP_APDU_STATS=1. The LS and JCOP clients wrap the channel of
+ * each operation once, whatever the number of sessions, and dump when it
+ * ends. */
+#define ICHANNEL_STATS_MAX_WRAP 2 /* Channels wrapped at the same time */
+
+typedef enum {
+  ICHANNEL_PHASE_OTHER = 0,
+  ICHANNEL_PHASE_LS_CERT,    /* Certificate and signature to the LSC */
+  ICHANNEL_PHASE_LS_CMD,     /* Script commands to the LSC and the eSE */
+  ICHANNEL_PHASE_JCOP_STEP1, /* Image load, JCOP_UPDATE_STATE0 */
+  ICHANNEL_PHASE_JCOP_STEP2, /* Image load, JCOP_UPDATE_STATE1 */
+  ICHANNEL_PHASE_JCOP_STEP3, /* Image load, JCOP_UPDATE_STATE2 */
+  ICHANNEL_PHASE_UAI,        /* UAI trigger and authentication */
+  ICHANNEL_PHASE_MAX
+} IChannelPhase_t;
+
+/*******************************************************************************
+**
+** Function:        IChannelStats_Wrap
+**
+** Description:     Fills pWrapped with a channel forwarding to channel and
+**                  accounting each transceive. channel is copied, pWrapped
+**                  may point to it.
+**
+** Returns:         True if ok, false if all wrapper slots are in use.
+**
+*******************************************************************************/
+bool IChannelStats_Wrap(IChannel_t* channel, IChannel_t* pWrapped);
+
+/*******************************************************************************
+**
+** Function:        IChannelStats_Unwrap
+**
+** Description:     Releases the slot of a channel filled by
+**                  IChannelStats_Wrap. No call may be made through it
+**                  afterwards.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void IChannelStats_Unwrap(IChannel_t* pWrapped);
+
+/*******************************************************************************
+**
+** Function:        IChannelStats_SetPhase
+**
+** Description:     Sets the phase the transceive calls of the calling thread
+**                  are accounted to.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void IChannelStats_SetPhase(IChannelPhase_t phase);
+
+/*******************************************************************************
+**
+** Function:        IChannelStats_Dump
+**
+** Description:     Writes percentiles, throughput and status word counts to
+**                  fd, or to the log if fd is negative.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void IChannelStats_Dump(int fd);
+
+/*******************************************************************************
+**
+** Function:        IChannelStats_Reset
+**
+** Description:     Clears all counters.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void IChannelStats_Reset();
+
+#endif /* ICHANNEL_STATS_H_ */
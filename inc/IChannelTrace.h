@@ -0,0 +1,118 @@
+ /*
+  * Copyright (C) 2019 NXP Semiconductors
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *      http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+
+#ifndef ICHANNEL_TRACE_H_
+#define ICHANNEL_TRACE_H_
+
+#include "IChannel.h"
+
+/*
+ * APDU trace recording and replay.
+ * The recorder is an IChannel_t forwarding to the caller's channel and
+ * appending every exchange to a trace file. The replay channel serves the
+ * responses of a trace in order, with the recorded latency scaled, so the
+ * clients can be profiled offline on traces captured in the field.
+ *
+ * Trace file, host byte order:
+ *   IChannelTraceHdr_t
+ *   { IChannelTraceRec_t, cmdLen bytes of command, rspLen bytes of response }
+ */
+
+#define ICHANNEL_TRACE_MAGIC 0x52544341 /* "ACTR" */
+#define ICHANNEL_TRACE_VERSION 1
+
+typedef enum {
+  ICHANNEL_TRACE_TRANSCEIVE = 0,
+  ICHANNEL_TRACE_TRANSCEIVE_RAW,
+  ICHANNEL_TRACE_RESET,
+  ICHANNEL_TRACE_JCOP_DL_RESET
+} IChannelTraceType_t;
+
+typedef struct IChannelTraceHdr {
+  uint32_t magic;
+  uint16_t version;
+  uint8_t intf; /* getInterfaceInfo of the recorded channel */
+  uint8_t rfu;
+} IChannelTraceHdr_t;
+
+typedef struct IChannelTraceRec {
+  uint8_t type;   /* IChannelTraceType_t */
+  uint8_t status; /* Transceive status */
+  uint16_t rfu;
+  uint32_t cmdLen;
+  uint32_t rspLen;
+  uint32_t durationUs; /* Time spent in the channel */
+  uint64_t startUs;    /* Monotonic time since the start of the trace */
+} IChannelTraceRec_t;
+
+typedef struct IChannelTraceStats {
+  uint32_t records;    /* Exchanges recorded or replayed */
+  uint32_t mismatches; /* Replay only, requests differing from the trace */
+  uint64_t bytes;      /* Command and response bytes */
+  uint64_t channelUs;  /* Recorded time spent in the channel */
+} IChannelTraceStats_t;
+
+/*******************************************************************************
+**
+** Function:        IChannelTrace_StartRecord
+**
+** Description:     Creates the trace file path and fills pTraced with a
+**                  channel recording each call before forwarding it to
+**                  channel.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+bool IChannelTrace_StartRecord(IChannel_t* channel, const char* path,
+                               IChannel_t* pTraced);
+
+/*******************************************************************************
+**
+** Function:        IChannelTrace_StopRecord
+**
+** Description:     Flushes and closes the trace file.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void IChannelTrace_StopRecord(IChannelTraceStats_t* pStats);
+
+/*******************************************************************************
+**
+** Function:        IChannelTrace_StartReplay
+**
+** Description:     Loads the trace file path and fills pReplay with a channel
+**                  answering from it. latencyPct scales the recorded
+**                  latency, 100 for the original timing, 0 for none.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+bool IChannelTrace_StartReplay(const char* path, uint32_t latencyPct,
+                               IChannel_t* pReplay);
+
+/*******************************************************************************
+**
+** Function:        IChannelTrace_StopReplay
+**
+** Description:     Releases the trace.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void IChannelTrace_StopReplay(IChannelTraceStats_t* pStats);
+
+#endif /* ICHANNEL_TRACE_H_ */
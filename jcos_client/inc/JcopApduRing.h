@@ -0,0 +1,155 @@
+ /*
+  * Copyright (C) 2019 NXP Semiconductors
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *      http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#ifndef JCOP_APDU_RING_H_
+#define JCOP_APDU_RING_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
+#include "ScriptSource.h"
+
+/* Number of decoded APDUs kept ahead of the transceive, overridden by
+ * NXP_JCOP_APDU_RING_DEPTH */
+#define JCOP_APDU_RING_DEF_DEPTH 4
+#define JCOP_APDU_RING_MIN_DEPTH 2
+#define JCOP_APDU_RING_MAX_DEPTH 32
+
+typedef enum
+{
+    RING_SLOT_APDU = 0, /* Slot holds a decoded C-APDU */
+    RING_SLOT_END,      /* Image fully read */
+    RING_SLOT_ERROR     /* Image could not be decoded */
+} JcopOs_RingSlotType_t;
+
+typedef struct JcopOs_RingStats
+{
+    uint32_t apduCount;      /* APDUs handed to the consumer */
+    uint32_t producerStalls; /* Reader waited for a free slot */
+    uint32_t consumerStalls; /* Transceive waited for a decoded APDU */
+} JcopOs_RingStats_t;
+
+/*
+ * Single producer single consumer ring of decoded C-APDUs.
+ * A reader thread decodes the image ahead into the ring while the
+ * download thread transceives the APDU at the tail, so that parsing the
+ * image is overlapped with the eSE processing time.
+ */
+class JcopApduRing
+{
+public:
+    JcopApduRing();
+    ~JcopApduRing();
+
+/*******************************************************************************
+**
+** Function:        allocate
+**
+** Description:     Allocates depth slots of slotSize bytes each.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+bool allocate(uint32_t depth, int32_t slotSize);
+
+/*******************************************************************************
+**
+** Function:        start
+**
+** Description:     Starts the reader thread decoding APDUs from pImage,
+**                  which must be open and is not touched by the caller
+**                  until stop().
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+bool start(ScriptSource *pImage);
+
+/*******************************************************************************
+**
+** Function:        stop
+**
+** Description:     Stops the reader thread and waits for it to exit,
+**                  safe to call when not started.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void stop();
+
+/*******************************************************************************
+**
+** Function:        front
+**
+** Description:     Waits for the next slot decoded by the reader thread.
+**                  For RING_SLOT_APDU *ppApdu and *pLen describe the
+**                  C-APDU which stays valid until pop(), *pNextOffset is
+**                  the image offset following it.
+**
+** Returns:         Type of the slot.
+**
+*******************************************************************************/
+JcopOs_RingSlotType_t front(uint8_t **ppApdu, int32_t *pLen, int32_t *pNextOffset);
+
+/*******************************************************************************
+**
+** Function:        pop
+**
+** Description:     Returns the slot at the front to the reader thread.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void pop();
+
+void getStats(JcopOs_RingStats_t *pStats) const;
+uint32_t depth() const { return mDepth; }
+
+private:
+    typedef struct RingSlot
+    {
+        uint8_t *pData;
+        int32_t len;
+        int32_t nextOffset;
+        JcopOs_RingSlotType_t type;
+    } RingSlot_t;
+
+    JcopApduRing(const JcopApduRing&);
+    JcopApduRing& operator=(const JcopApduRing&);
+
+    static void *readerThread(void *arg);
+    void produce();
+    void release();
+
+    RingSlot_t *mSlots;
+    uint8_t *mBuffer;
+    uint32_t mDepth;
+    int32_t mSlotSize;
+    ScriptSource *mImage;
+    pthread_t mThread;
+    bool mRunning;
+
+    /* Free running indices, head written by the reader only and tail by
+     * the consumer only */
+    std::atomic<uint32_t> mHead;
+    std::atomic<uint32_t> mTail;
+    std::atomic<bool> mStop;
+
+    std::atomic<uint32_t> mApduCount;
+    std::atomic<uint32_t> mProducerStalls;
+    std::atomic<uint32_t> mConsumerStalls;
+};
+
+#endif /* JCOP_APDU_RING_H_ */
@@ -16,6 +16,9 @@
 
 #include "data_types.h"
 #include "IChannel.h"
+#include "IChannelAsync.h"
+#include "ScriptSource.h"
+#include "JcopApduRing.h"
 #include <stdio.h>
 
 typedef struct JcopOs_TranscieveInfo
@@ -43,9 +46,23 @@ typedef struct JcopOs_Uai_QueryInfo {
   uint16_t OSIDData;
 } JcopOs_Uai_QueryInfo;
 
+/* Last APDU of an image acknowledged by the updater OS, persisted after the
+ * state in jcop_info.txt so that an interrupted image load can be resumed */
+typedef struct JcopOs_Checkpoint
+{
+    uint32_t step;      /* cur_state of the image load */
+    uint32_t apduIndex; /* Number of APDUs acknowledged, 0 if none */
+    uint32_t offset;    /* Image offset following the last acknowledged APDU */
+    uint32_t imgSize;   /* Size of the image the offset belongs to */
+}JcopOs_Checkpoint_t;
+
 typedef struct JcopOs_ImageInfo
 {
-    FILE *fp;
+    ScriptSource *pImage;
+    JcopApduRing *pApduRing;
+    JcopOs_Checkpoint_t ckpt;
+    uint8_t info_state;    /* State last read from or written to jcop_info.txt */
+    uint8_t uai_osu_state; /* State derived from UAI query info */
     int   fls_size;
     char  fls_path[256];
     int   index;
@@ -59,6 +76,7 @@ typedef struct JcopOs_Dwnld_Context
     JcopOs_ImageInfo_t       Image_info;
     JcopOs_TranscieveInfo_t  pJcopOs_TransInfo;
     IChannel_t               *channel;
+    IChannelAsyncHandle_t    hAsync; /* NULL for blocking transceive */
 }JcopOs_Dwnld_Context_t,*pJcopOs_Dwnld_Context_t;
 
 typedef enum {
@@ -112,6 +130,9 @@ static uint8_t Uai_GetInfo_APDU[] = {0x80,0xCA,0x00,0xFE,0x02,0xDF,0x43,0x00};
 #define JCOP_UPDATE_STATE_TRIGGER_APDU 4
 
 #define JCOP_MAX_RETRY_CNT 3
+/* Acknowledged APDUs between two checkpoints, overridden by
+ * NXP_JCOP_CHECKPOINT_INTERVAL, 0 disables resuming an image load */
+#define JCOP_CKPT_DEF_INTERVAL 16
 //#define JCOP_INFO_PATH     "/data/vendor/nfc/jcop_info.txt"
 
 #define JCOP_MAX_BUF_SIZE 10240
@@ -198,6 +219,17 @@ tJBL_STATUS SendUAICmds(JcopOs_ImageInfo_t *Os_info, tJBL_STATUS status, JcopOs_
 tJBL_STATUS DeriveJcopOsu_State(JcopOs_ImageInfo_t *Os_info,
                                 uint8_t *dh_osu_state);
 
+/*******************************************************************************
+**
+** Function:        getApduRingStats
+**
+** Description:     Reader/transceive stall counters of the last image load
+**
+** Returns:         None
+**
+*******************************************************************************/
+void getApduRingStats(JcopOs_RingStats_t *pStats);
+
 IChannel_t *mchannel;
 
 private:
@@ -206,6 +238,7 @@ bool mIsInit;
 tJBL_STATUS GetJcopOsState(JcopOs_ImageInfo_t *Os_info, uint8_t *counter,
                            JcopOs_TranscieveInfo_t *pTranscv_Info);
 tJBL_STATUS SetJcopOsState(JcopOs_ImageInfo_t *Os_info, uint8_t state);
+tJBL_STATUS WriteJcopOsInfo(JcopOs_ImageInfo_t *Os_info);
 tJBL_STATUS Get_UAI_JcopOsState(JcopOs_ImageInfo_t *pVersionInfo,
                                 uint8_t *dh_osu_state,
                                 JcopOs_TranscieveInfo_t *pTranscv_Info);
@@ -0,0 +1,274 @@
+ /*
+  * Copyright (C) 2019 NXP Semiconductors
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *      http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include <android-base/stringprintf.h>
+#include <base/logging.h>
+#include <JcopApduRing.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+using android::base::StringPrintf;
+
+/* Busy waits before a waiting side starts sleeping */
+#define RING_SPIN_YIELDS 16
+/* The reader waits on eSE processing time, the consumer only on decoding */
+#define RING_PRODUCER_SLEEP_US 200
+#define RING_CONSUMER_SLEEP_US 20
+
+static inline void ringBackoff(uint32_t spins, useconds_t sleepUs)
+{
+    if(spins < RING_SPIN_YIELDS)
+        sched_yield();
+    else
+        usleep(sleepUs);
+}
+
+JcopApduRing::JcopApduRing()
+    : mSlots(NULL),
+      mBuffer(NULL),
+      mDepth(0),
+      mSlotSize(0),
+      mImage(NULL),
+      mRunning(false),
+      mHead(0),
+      mTail(0),
+      mStop(false),
+      mApduCount(0),
+      mProducerStalls(0),
+      mConsumerStalls(0)
+{
+}
+
+JcopApduRing::~JcopApduRing()
+{
+    stop();
+    release();
+}
+
+/*******************************************************************************
+**
+** Function:        allocate
+**
+** Description:     Allocates depth slots of slotSize bytes each.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+bool JcopApduRing::allocate(uint32_t depth, int32_t slotSize)
+{
+    static const char fn [] = "JcopApduRing::allocate";
+
+    if(mRunning || slotSize <= 0)
+        return false;
+    if(depth < JCOP_APDU_RING_MIN_DEPTH)
+        depth = JCOP_APDU_RING_MIN_DEPTH;
+    else if(depth > JCOP_APDU_RING_MAX_DEPTH)
+        depth = JCOP_APDU_RING_MAX_DEPTH;
+
+    release();
+    mSlots = (RingSlot_t*)calloc(depth, sizeof(RingSlot_t));
+    mBuffer = (uint8_t*)malloc((size_t)depth * slotSize);
+    if(mSlots == NULL || mBuffer == NULL)
+    {
+        LOG(ERROR) << StringPrintf("%s: Memory allocation for %u slots failed", fn, depth);
+        release();
+        return false;
+    }
+    for(uint32_t i = 0; i < depth; i++)
+    {
+        mSlots[i].pData = &mBuffer[(size_t)i * slotSize];
+    }
+    mDepth = depth;
+    mSlotSize = slotSize;
+    DLOG_IF(INFO, nfc_debug_enabled)
+      << StringPrintf("%s: depth %u", fn, mDepth);
+    return true;
+}
+
+void JcopApduRing::release()
+{
+    if(mSlots != NULL)
+    {
+        free(mSlots);
+        mSlots = NULL;
+    }
+    if(mBuffer != NULL)
+    {
+        free(mBuffer);
+        mBuffer = NULL;
+    }
+    mDepth = 0;
+    mSlotSize = 0;
+}
+
+/*******************************************************************************
+**
+** Function:        start
+**
+** Description:     Starts the reader thread decoding APDUs from pImage,
+**                  which must be open and is not touched by the caller
+**                  until stop().
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+bool JcopApduRing::start(ScriptSource *pImage)
+{
+    static const char fn [] = "JcopApduRing::start";
+
+    if(mRunning || mDepth == 0 || pImage == NULL)
+        return false;
+    mImage = pImage;
+    mHead.store(0, std::memory_order_relaxed);
+    mTail.store(0, std::memory_order_relaxed);
+    mStop.store(false, std::memory_order_relaxed);
+    mApduCount.store(0, std::memory_order_relaxed);
+    mProducerStalls.store(0, std::memory_order_relaxed);
+    mConsumerStalls.store(0, std::memory_order_relaxed);
+    if(pthread_create(&mThread, NULL, readerThread, this) != 0)
+    {
+        LOG(ERROR) << StringPrintf("%s: Unable to create reader thread", fn);
+        mImage = NULL;
+        return false;
+    }
+    mRunning = true;
+    return true;
+}
+
+/*******************************************************************************
+**
+** Function:        stop
+**
+** Description:     Stops the reader thread and waits for it to exit,
+**                  safe to call when not started.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void JcopApduRing::stop()
+{
+    if(!mRunning)
+        return;
+    mStop.store(true, std::memory_order_release);
+    pthread_join(mThread, NULL);
+    mRunning = false;
+    mImage = NULL;
+}
+
+void *JcopApduRing::readerThread(void *arg)
+{
+    ((JcopApduRing*)arg)->produce();
+    return NULL;
+}
+
+void JcopApduRing::produce()
+{
+    static const char fn [] = "JcopApduRing::produce";
+    uint32_t head = mHead.load(std::memory_order_relaxed);
+    bool done = false;
+
+    while(!done)
+    {
+        uint32_t spins = 0;
+        while((head - mTail.load(std::memory_order_acquire)) == mDepth)
+        {
+            if(mStop.load(std::memory_order_acquire))
+                return;
+            if(spins == 0)
+                mProducerStalls.fetch_add(1, std::memory_order_relaxed);
+            ringBackoff(spins++, RING_PRODUCER_SLEEP_US);
+        }
+        if(mStop.load(std::memory_order_acquire))
+            return;
+
+        RingSlot_t *pSlot = &mSlots[head % mDepth];
+        if(mImage->atEnd())
+        {
+            pSlot->len = 0;
+            pSlot->type = RING_SLOT_END;
+            done = true;
+        }
+        else if(mImage->nextApdu(pSlot->pData, mSlotSize, &pSlot->len))
+        {
+            pSlot->type = RING_SLOT_APDU;
+        }
+        else
+        {
+            LOG(ERROR) << StringPrintf("%s: JcopOs image Read failed", fn);
+            pSlot->type = RING_SLOT_ERROR;
+            done = true;
+        }
+        pSlot->nextOffset = mImage->offset();
+        mHead.store(++head, std::memory_order_release);
+    }
+}
+
+/*******************************************************************************
+**
+** Function:        front
+**
+** Description:     Waits for the next slot decoded by the reader thread.
+**                  For RING_SLOT_APDU *ppApdu and *pLen describe the
+**                  C-APDU which stays valid until pop(), *pNextOffset is
+**                  the image offset following it.
+**
+** Returns:         Type of the slot.
+**
+*******************************************************************************/
+JcopOs_RingSlotType_t JcopApduRing::front(uint8_t **ppApdu, int32_t *pLen, int32_t *pNextOffset)
+{
+    uint32_t tail = mTail.load(std::memory_order_relaxed);
+    uint32_t spins = 0;
+
+    if(!mRunning)
+        return RING_SLOT_ERROR;
+    while(mHead.load(std::memory_order_acquire) == tail)
+    {
+        if(spins == 0)
+            mConsumerStalls.fetch_add(1, std::memory_order_relaxed);
+        ringBackoff(spins++, RING_CONSUMER_SLEEP_US);
+    }
+    RingSlot_t *pSlot = &mSlots[tail % mDepth];
+    *ppApdu = pSlot->pData;
+    *pLen = pSlot->len;
+    *pNextOffset = pSlot->nextOffset;
+    return pSlot->type;
+}
+
+/*******************************************************************************
+**
+** Function:        pop
+**
+** Description:     Returns the slot at the front to the reader thread.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void JcopApduRing::pop()
+{
+    uint32_t tail = mTail.load(std::memory_order_relaxed);
+    if(mSlots[tail % mDepth].type == RING_SLOT_APDU)
+        mApduCount.fetch_add(1, std::memory_order_relaxed);
+    mTail.store(tail + 1, std::memory_order_release);
+}
+
+void JcopApduRing::getStats(JcopOs_RingStats_t *pStats) const
+{
+    pStats->apduCount = mApduCount.load(std::memory_order_relaxed);
+    pStats->producerStalls = mProducerStalls.load(std::memory_order_relaxed);
+    pStats->consumerStalls = mConsumerStalls.load(std::memory_order_relaxed);
+}
@@ -18,16 +18,22 @@
 #include <semaphore.h>
 #include <JcopOsDownload.h>
 #include <IChannel.h>
+#include <IChannelStats.h>
+#include <phNxpConfig.h>
+#include <EseStateJournal.h>
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 
 using android::base::StringPrintf;
 
 JcopOsDwnld JcopOsDwnld::sJcopDwnld;
 static int32_t gTransceiveTimeout = 120000;
+static uint32_t gCheckpointInterval = JCOP_CKPT_DEF_INTERVAL;
+static bool gIsApduStats = false;
 uint8_t isUaiEnabled = false;
 uint8_t isPatchUpdate = false;
 
@@ -46,28 +52,54 @@ tJBL_STATUS (JcopOsDwnld::*JcopOs_dwnld_seqhandler[])(
    };
 
 pJcopOs_Dwnld_Context_t gpJcopOs_Dwnld_Context = NULL;
-static const char *path[3] = {"/vendor/etc/JcopOs_Update1.apdu",
-                             "/vendor/etc/JcopOs_Update2.apdu",
-                             "/vendor/etc/JcopOs_Update3.apdu"};
-static const char *JCOP_INFO_PATH[2] = {"/data/vendor/nfc/jcop_info.txt",
-                            "/data/vendor/secure_element/jcop_info.txt"};
+static const char *path[3] = {ESE_FS_ROOT "/vendor/etc/JcopOs_Update1.apdu",
+                             ESE_FS_ROOT "/vendor/etc/JcopOs_Update2.apdu",
+                             ESE_FS_ROOT "/vendor/etc/JcopOs_Update3.apdu"};
+static const char *JCOP_INFO_PATH[2] = {
+                            ESE_FS_ROOT "/data/vendor/nfc/jcop_info.txt",
+                            ESE_FS_ROOT "/data/vendor/secure_element/jcop_info.txt"};
 
-static const char *uai_path[2] = {"/vendor/etc/cci.apdu",
-                                  "/vendor/etc/jci.apdu"};
+static const char *uai_path[2] = {ESE_FS_ROOT "/vendor/etc/cci.apdu",
+                                  ESE_FS_ROOT "/vendor/etc/jci.apdu"};
 
-inline int FSCANF_BYTE(FILE *stream, const char *format, void* pVal)
+/*******************************************************************************
+**
+** Function:        JcopOsResumeAllowed
+**
+** Description:     Checks whether the checkpoint read from jcop_info.txt
+**                  belongs to the image about to be loaded and the UAI
+**                  query info shows the updater OS still in that step
+**
+** Returns:         True if the load can continue from the checkpoint.
+**
+*******************************************************************************/
+static bool JcopOsResumeAllowed(JcopOs_ImageInfo_t *Os_info)
 {
-    int Result = 0;
+    uint8_t expected_state;
 
-    if((NULL != stream) && (NULL != format) && (NULL != pVal))
+    if(!isUaiEnabled || gCheckpointInterval == 0 ||
+       Os_info->ckpt.apduIndex == 0 ||
+       Os_info->ckpt.step != Os_info->cur_state ||
+       Os_info->ckpt.imgSize != (uint32_t)Os_info->fls_size ||
+       Os_info->ckpt.offset >= Os_info->ckpt.imgSize)
     {
-        unsigned int dwVal;
-        unsigned char* pTmp = (unsigned char*)pVal;
-        Result = fscanf(stream, format, &dwVal);
-
-        (*pTmp) = (unsigned char)(dwVal & 0x000000FF);
+        return false;
+    }
+    switch(Os_info->cur_state)
+    {
+    case JCOP_UPDATE_STATE0:
+        expected_state = JCOP_UPDATE_STATE_TRIGGER_APDU;
+        break;
+    case JCOP_UPDATE_STATE1:
+        expected_state = JCOP_UPDATE_STATE1;
+        break;
+    case JCOP_UPDATE_STATE2:
+        expected_state = JCOP_UPDATE_STATE2;
+        break;
+    default:
+        return false;
     }
-    return Result;
+    return (Os_info->uai_osu_state == expected_state);
 }
 
 /*******************************************************************************
@@ -185,6 +217,24 @@ bool JcopOsDwnld::initialize (IChannel_t *channel)
                 << StringPrintf("%s: Memory allocation for SendBuf is failed", fn);
             return (false);
         }
+        gpJcopOs_Dwnld_Context->Image_info.pImage = new ScriptSource();
+        unsigned long num = JCOP_APDU_RING_DEF_DEPTH;
+        if(!GetNxpNum(CFG_NXP_JCOP_APDU_RING_DEPTH, &num, sizeof(num)))
+        {
+            num = JCOP_APDU_RING_DEF_DEPTH;
+        }
+        gpJcopOs_Dwnld_Context->Image_info.pApduRing = new JcopApduRing();
+        if(!gpJcopOs_Dwnld_Context->Image_info.pApduRing->allocate(num, JCOP_MAX_BUF_SIZE))
+        {
+            LOG(ERROR) << StringPrintf("%s: Memory allocation for APDU ring is failed", fn);
+            /*The caller does not finalize a failed initialize*/
+            finalize();
+            return (false);
+        }
+        if(GetNxpNum(CFG_NXP_JCOP_CHECKPOINT_INTERVAL, &num, sizeof(num)))
+        {
+            gCheckpointInterval = (uint32_t)num;
+        }
     }
     else
     {
@@ -194,6 +244,14 @@ bool JcopOsDwnld::initialize (IChannel_t *channel)
     }
     mIsInit = true;
     memcpy(gpJcopOs_Dwnld_Context->channel, channel, sizeof(IChannel_t));
+    unsigned long stats = 0;
+    if(GetNxpNum(CFG_NXP_APDU_STATS, &stats, sizeof(stats)) && stats == 1)
+    {
+        gIsApduStats = IChannelStats_Wrap(gpJcopOs_Dwnld_Context->channel,
+                                          gpJcopOs_Dwnld_Context->channel);
+    }
+    /*Image APDUs are sent through it, falls back to blocking transceive*/
+    gpJcopOs_Dwnld_Context->hAsync = IChannelAsync_Init(gpJcopOs_Dwnld_Context->channel, NULL);
     DLOG_IF(INFO, nfc_debug_enabled)
       << StringPrintf ("%s: exit", fn);
     return (true);
@@ -215,8 +273,19 @@ void JcopOsDwnld::finalize ()
     mIsInit       = false;
     if(gpJcopOs_Dwnld_Context != NULL)
     {
+        if(gpJcopOs_Dwnld_Context->hAsync != NULL)
+        {
+            IChannelAsync_DeInit(gpJcopOs_Dwnld_Context->hAsync);
+            gpJcopOs_Dwnld_Context->hAsync = NULL;
+        }
         if(gpJcopOs_Dwnld_Context->channel != NULL)
         {
+            if(gIsApduStats)
+            {
+                IChannelStats_Dump(-1);
+                IChannelStats_Unwrap(gpJcopOs_Dwnld_Context->channel);
+                gIsApduStats = false;
+            }
             free(gpJcopOs_Dwnld_Context->channel);
             gpJcopOs_Dwnld_Context->channel = NULL;
         }
@@ -225,6 +294,16 @@ void JcopOsDwnld::finalize ()
             free(gpJcopOs_Dwnld_Context->pJcopOs_TransInfo.sSendData);
             gpJcopOs_Dwnld_Context->pJcopOs_TransInfo.sSendData = NULL;
         }
+        if(gpJcopOs_Dwnld_Context->Image_info.pImage != NULL)
+        {
+            delete gpJcopOs_Dwnld_Context->Image_info.pImage;
+            gpJcopOs_Dwnld_Context->Image_info.pImage = NULL;
+        }
+        if(gpJcopOs_Dwnld_Context->Image_info.pApduRing != NULL)
+        {
+            delete gpJcopOs_Dwnld_Context->Image_info.pApduRing;
+            gpJcopOs_Dwnld_Context->Image_info.pApduRing = NULL;
+        }
         free(gpJcopOs_Dwnld_Context);
         gpJcopOs_Dwnld_Context = NULL;
     }
@@ -302,6 +381,7 @@ tJBL_STATUS JcopOsDwnld::JcopOs_update_seq_handler()
         status = STATUS_FAILED;
         status = (*this.*(JcopOs_dwnld_seqhandler[seq_counter]))(
             &update_info, status, &trans_info);
+        IChannelStats_SetPhase(ICHANNEL_PHASE_OTHER);
         if (STATUS_SUCCESS != status) {
           LOG(ERROR) << StringPrintf("%s: exiting; status=0x0%X", fn, status);
           break;
@@ -405,15 +485,13 @@ tJBL_STATUS JcopOsDwnld::SendUAICmds(JcopOs_ImageInfo_t* Os_info, tJBL_STATUS st
 {
     static const char fn [] = "JcopOsDwnld::SendUAICmds";
     bool stat = false;
-    int wResult;
-    int32_t wIndex,wCount=0;
-    int32_t wLen;
     IChannel_t *mchannel = gpJcopOs_Dwnld_Context->channel;
     int32_t recvBufferActualSize = 0;
     int i = 0;
 
     DLOG_IF(INFO, nfc_debug_enabled)
       << StringPrintf("%s: enter;", fn);
+    IChannelStats_SetPhase(ICHANNEL_PHASE_UAI);
 
     if(!pTranscv_Info || !Os_info) {
         DLOG_IF(INFO, nfc_debug_enabled)
@@ -425,74 +503,24 @@ tJBL_STATUS JcopOsDwnld::SendUAICmds(JcopOs_ImageInfo_t* Os_info, tJBL_STATUS st
     }
     for(i = 0; i < 2; i++)
     {
-        Os_info->fp = fopen(uai_path[i], "r");
-        if (Os_info->fp == NULL) {
-            LOG(ERROR) << StringPrintf("Error opening CCI file <%s> for reading: %s",
-                        Os_info->fls_path, strerror(errno));
+        if (!Os_info->pImage->open(uai_path[i])) {
+            LOG(ERROR) << StringPrintf("Error opening CCI file <%s> for reading",
+                        uai_path[i]);
             return STATUS_FILE_NOT_FOUND;
         }
-        wResult = fseek(Os_info->fp, 0L, SEEK_END);
-        if (wResult) {
-            LOG(ERROR) << StringPrintf("Error seeking end CCI file %s", strerror(errno));
-            goto exit;
-        }
-        Os_info->fls_size = ftell(Os_info->fp);
-        if (Os_info->fls_size < 0) {
-            LOG(ERROR) << StringPrintf("Error ftelling file %s", strerror(errno));
-            goto exit;
-        }
-        wResult = fseek(Os_info->fp, 0L, SEEK_SET);
-        if (wResult) {
-            LOG(ERROR) << StringPrintf("Error seeking start image file %s", strerror(errno));
-            goto exit;
-        }
-        while(!feof(Os_info->fp))
+        Os_info->fls_size = Os_info->pImage->size();
+        while(!Os_info->pImage->atEnd())
         {
-            wIndex=0;
-            wLen=0;
-            wCount=0;
-            memset(pTranscv_Info->sSendData,0x00,JCOP_MAX_BUF_SIZE);
             pTranscv_Info->sSendlength=0;
 
-            LOG(ERROR) << StringPrintf("%s; wIndex = 0", fn);
-            for(wCount =0; (wCount < 5 && !feof(Os_info->fp)); wCount++, wIndex++)
-            {
-                wResult = FSCANF_BYTE(Os_info->fp,"%2X",&pTranscv_Info->sSendData[wIndex]);
-                if(wResult == 0) {
-                    LOG(ERROR) << StringPrintf("%s: Failed in fscanf", fn);
-                }
-            }
-            if(wResult != 0)
-            {
-                wLen = pTranscv_Info->sSendData[4];
-                LOG(ERROR) << StringPrintf("%s; Read 5byes success & len=%d", fn,wLen);
-                if(wLen == 0x00)
-                {
-                    LOG(ERROR) << StringPrintf("%s: Extended APDU", fn);
-                    wResult = FSCANF_BYTE(Os_info->fp,"%2X",&pTranscv_Info->sSendData[wIndex++]);
-                    if(wResult == 0) {
-                        LOG(ERROR) << StringPrintf("%s: Failed in fscanf", fn);
-                    }
-                    wResult = FSCANF_BYTE(Os_info->fp,"%2X",&pTranscv_Info->sSendData[wIndex++]);
-                    if(wResult == 0) {
-                        LOG(ERROR) << StringPrintf("%s: Failed in fscanf", fn);
-                    }
-                    wLen = ((pTranscv_Info->sSendData[5] << 8) | (pTranscv_Info->sSendData[6]));
-                }
-                for(wCount =0; (wCount < wLen && !feof(Os_info->fp)); wCount++, wIndex++)
-                {
-                    wResult = FSCANF_BYTE(Os_info->fp,"%2X",&pTranscv_Info->sSendData[wIndex]);
-                    if(wResult == 0) {
-                        LOG(ERROR) << StringPrintf("%s: Failed in fscanf", fn);
-                    }
-                }
-            }
-            else
+            if(!Os_info->pImage->nextApdu(pTranscv_Info->sSendData,
+                                          JCOP_MAX_BUF_SIZE,
+                                          &pTranscv_Info->sSendlength))
             {
                 LOG(ERROR) << StringPrintf("%s: JcopOs image Read failed", fn);
+                status = STATUS_FAILED;
                 goto exit;
             }
-            pTranscv_Info->sSendlength = wIndex;
             LOG(ERROR) << StringPrintf("%s: start transceive for length %d", fn, pTranscv_Info->sSendlength);
             if((pTranscv_Info->sSendlength != 0x03) &&
                (pTranscv_Info->sSendData[0] != 0x00) &&
@@ -540,11 +568,10 @@ tJBL_STATUS JcopOsDwnld::SendUAICmds(JcopOs_ImageInfo_t* Os_info, tJBL_STATUS st
                 goto exit;
             }
         }
-        fclose(Os_info->fp);
-        Os_info->fp = NULL;
+        Os_info->pImage->close();
     }
 exit:
-    LOG(ERROR) << StringPrintf("%s close fp and exit; status= 0x%X", fn,status);
+    LOG(ERROR) << StringPrintf("%s close image and exit; status= 0x%X", fn,status);
 
     if(status == STATUS_SUCCESS) {
         SetJcopOsState(Os_info, JCOP_UPDATE_STATE_TRIGGER_APDU);
@@ -559,10 +586,7 @@ exit:
      * and MW context reset(SPI) & power recycle
      * in SMB*/
     mchannel->doeSE_JcopDownLoadReset();
-    if(Os_info->fp) {
-        fclose(Os_info->fp);
-        Os_info->fp = NULL;
-    }
+    Os_info->pImage->close();
 
     return status;
 }
@@ -584,6 +608,7 @@ tJBL_STATUS JcopOsDwnld::UaiTriggerApdu(JcopOs_ImageInfo_t* pVersionInfo, tJBL_S
 
     DLOG_IF(INFO, nfc_debug_enabled)
       << StringPrintf("%s: enter;", fn);
+    IChannelStats_SetPhase(ICHANNEL_PHASE_UAI);
 
     if(!isUaiEnabled)
     {
@@ -754,9 +779,15 @@ tJBL_STATUS JcopOsDwnld::load_JcopOS_image(JcopOs_ImageInfo_t *Os_info, tJBL_STA
 {
     static const char fn [] = "JcopOsDwnld::load_JcopOS_image";
     bool stat = false;
-    int wResult;
-    int32_t wIndex,wCount=0;
-    int32_t wLen;
+    uint8_t *pApdu = NULL;
+    int32_t apduLen = 0;
+    int32_t nextOffset = 0;
+    JcopOs_RingSlotType_t slotType;
+    JcopOs_RingStats_t ringStats;
+    bool isResumed = false;
+    bool isRejected = false;
+    bool isCkptDue = false;
+    IChannelRequest_t req;
 
     IChannel_t *mchannel = gpJcopOs_Dwnld_Context->channel;
     int32_t recvBufferActualSize = 0;
@@ -768,84 +799,115 @@ tJBL_STATUS JcopOsDwnld::load_JcopOS_image(JcopOs_ImageInfo_t *Os_info, tJBL_STA
         LOG(ERROR) << StringPrintf("%s: invalid parameter", fn);
         return status;
     }
-    Os_info->fp = fopen(Os_info->fls_path, "r");
-
-    if (Os_info->fp == NULL) {
-        LOG(ERROR) << StringPrintf("Error opening OS image file <%s> for reading: %s",
-                    Os_info->fls_path, strerror(errno));
+    if(Os_info->cur_state <= JCOP_UPDATE_STATE2)
+    {
+        IChannelStats_SetPhase((IChannelPhase_t)(ICHANNEL_PHASE_JCOP_STEP1 + Os_info->cur_state));
+    }
+    if (!Os_info->pImage->open(Os_info->fls_path)) {
+        LOG(ERROR) << StringPrintf("Error opening OS image file <%s> for reading",
+                    Os_info->fls_path);
         return STATUS_FILE_NOT_FOUND;
     }
-    wResult = fseek(Os_info->fp, 0L, SEEK_END);
-    if (wResult) {
-        LOG(ERROR) << StringPrintf("Error seeking end OS image file %s", strerror(errno));
-        goto exit;
+    Os_info->fls_size = Os_info->pImage->size();
+    /*An image load interrupted earlier is continued after the last
+      acknowledged APDU if the updater OS is still in the same step*/
+    if(JcopOsResumeAllowed(Os_info) &&
+       Os_info->pImage->seek(Os_info->ckpt.offset))
+    {
+        LOG(ERROR) << StringPrintf("%s: resuming step %u after APDU %u at offset %u", fn,
+                    Os_info->cur_state, Os_info->ckpt.apduIndex, Os_info->ckpt.offset);
+        isResumed = true;
     }
-    Os_info->fls_size = ftell(Os_info->fp);
-    if (Os_info->fls_size < 0) {
-        LOG(ERROR) << StringPrintf("Error ftelling file %s", strerror(errno));
-        goto exit;
+    else
+    {
+        memset(&Os_info->ckpt, 0, sizeof(JcopOs_Checkpoint_t));
     }
-    wResult = fseek(Os_info->fp, 0L, SEEK_SET);
-    if (wResult) {
-        LOG(ERROR) << StringPrintf("Error seeking start image file %s", strerror(errno));
+    Os_info->ckpt.step = Os_info->cur_state;
+    Os_info->ckpt.imgSize = (uint32_t)Os_info->fls_size;
+    memset(&req, 0, sizeof(req));
+    /*APDUs are decoded ahead by the ring reader while the previous one is
+      being processed by the eSE*/
+    if(!Os_info->pApduRing->start(Os_info->pImage))
+    {
+        status = STATUS_FAILED;
         goto exit;
     }
-    while(!feof(Os_info->fp))
+    while(true)
     {
         LOG(ERROR) << StringPrintf("%s; Start of line processing", fn);
 
-        wIndex=0;
-        wLen=0;
-        wCount=0;
-        memset(pTranscv_Info->sSendData,0x00,JCOP_MAX_BUF_SIZE);
-        pTranscv_Info->sSendlength=0;
-
-        LOG(ERROR) << StringPrintf("%s; wIndex = 0", fn);
-        for(wCount =0; (wCount < 5 && !feof(Os_info->fp)); wCount++, wIndex++)
-        {
-            wResult = FSCANF_BYTE(Os_info->fp,"%2X",&pTranscv_Info->sSendData[wIndex]);
-        }
-        if(wResult != 0)
+        slotType = Os_info->pApduRing->front(&pApdu, &apduLen, &nextOffset);
+        if(slotType == RING_SLOT_END)
         {
-            wLen = pTranscv_Info->sSendData[4];
-            LOG(ERROR) << StringPrintf("%s; Read 5byes success & len=%d", fn,wLen);
-            if(wLen == 0x00)
-            {
-                LOG(ERROR) << StringPrintf("%s: Extended APDU", fn);
-                wResult = FSCANF_BYTE(Os_info->fp,"%2X",&pTranscv_Info->sSendData[wIndex++]);
-                wResult = FSCANF_BYTE(Os_info->fp,"%2X",&pTranscv_Info->sSendData[wIndex++]);
-                wLen = ((pTranscv_Info->sSendData[5] << 8) | (pTranscv_Info->sSendData[6]));
-            }
-            for(wCount =0; (wCount < wLen && !feof(Os_info->fp)); wCount++, wIndex++)
-            {
-                wResult = FSCANF_BYTE(Os_info->fp,"%2X",&pTranscv_Info->sSendData[wIndex]);
-            }
+            break;
         }
-        else
+        else if(slotType != RING_SLOT_APDU)
         {
             LOG(ERROR) << StringPrintf("%s: JcopOs image Read failed", fn);
+            status = STATUS_FAILED;
             goto exit;
         }
 
-        pTranscv_Info->sSendlength = wIndex;
-        LOG(ERROR) << StringPrintf("%s: start transceive for length %d", fn, pTranscv_Info->sSendlength);
-        if((pTranscv_Info->sSendlength != 0x03) &&
-           (pTranscv_Info->sSendData[0] != 0x00) &&
-           (pTranscv_Info->sSendData[1] != 0x00))
+        LOG(ERROR) << StringPrintf("%s: start transceive for length %d", fn, apduLen);
+        if((apduLen != 0x03) &&
+           (pApdu[0] != 0x00) &&
+           (pApdu[1] != 0x00))
         {
-
-            stat = mchannel->transceive(pTranscv_Info->sSendData,
-                                    pTranscv_Info->sSendlength,
-                                    pTranscv_Info->sRecvData,
-                                    pTranscv_Info->sRecvlength,
-                                    recvBufferActualSize,
-                                    pTranscv_Info->timeout);
+            req.xmitBuffer = pApdu;
+            req.xmitBufferSize = apduLen;
+            req.recvBuffer = pTranscv_Info->sRecvData;
+            req.recvBufferMaxSize = pTranscv_Info->sRecvlength;
+            req.timeoutMillisec = pTranscv_Info->timeout;
+            if(gpJcopOs_Dwnld_Context->hAsync != NULL &&
+               IChannelAsync_Submit(gpJcopOs_Dwnld_Context->hAsync, &req))
+            {
+                /*The checkpoint of the previous APDU is synced to storage
+                  while the eSE processes this one*/
+                if(isCkptDue)
+                {
+                    WriteJcopOsInfo(Os_info);
+                }
+                stat = IChannelAsync_Wait(&req);
+                recvBufferActualSize = req.recvBufferActualSize;
+            }
+            else
+            {
+                if(isCkptDue)
+                {
+                    WriteJcopOsInfo(Os_info);
+                }
+                stat = mchannel->transceive(pApdu,
+                                        apduLen,
+                                        pTranscv_Info->sRecvData,
+                                        pTranscv_Info->sRecvlength,
+                                        recvBufferActualSize,
+                                        pTranscv_Info->timeout);
+            }
+            isCkptDue = false;
+            Os_info->pApduRing->pop();
         }
         else
         {
             LOG(ERROR) << StringPrintf("%s: Invalid packet", fn);
+            Os_info->pApduRing->pop();
             continue;
         }
+        if(isResumed && stat == true &&
+           (recvBufferActualSize < 2 ||
+            pTranscv_Info->sRecvData[recvBufferActualSize-2] != 0x90 ||
+            pTranscv_Info->sRecvData[recvBufferActualSize-1] != 0x00))
+        {
+            /*Updater OS does not accept the image from this point,
+              the retry has to restart the step from the first APDU.
+              A transport failure keeps the checkpoint, see exit*/
+            LOG(ERROR) << StringPrintf("%s: APDU %u rejected on resume, restarting step", fn,
+                        Os_info->ckpt.apduIndex);
+            memset(&Os_info->ckpt, 0, sizeof(JcopOs_Checkpoint_t));
+            WriteJcopOsInfo(Os_info);
+            status = STATUS_FAILED;
+            goto exit;
+        }
+        isResumed = false;
         if(stat != true)
         {
             LOG(ERROR) << StringPrintf("%s: Transceive failed; status=0x%X", fn, stat);
@@ -858,6 +920,15 @@ tJBL_STATUS JcopOsDwnld::load_JcopOS_image(JcopOs_ImageInfo_t *Os_info, tJBL_STA
         {
             //LOG(ERROR) << StringPrintf("%s: END transceive for length %d", fn, pTranscv_Info->sSendlength);
             status = STATUS_SUCCESS;
+            /*Once an APDU is rejected no later position can be resumed*/
+            if(!isRejected)
+            {
+                Os_info->ckpt.apduIndex++;
+                Os_info->ckpt.offset = (uint32_t)nextOffset;
+                /*Written with the next APDU, see above*/
+                isCkptDue = (gCheckpointInterval != 0 &&
+                             (Os_info->ckpt.apduIndex % gCheckpointInterval) == 0);
+            }
         }
         else if(pTranscv_Info->sRecvData[recvBufferActualSize-2] == 0x6F &&
                 pTranscv_Info->sRecvData[recvBufferActualSize-1] == 0x00)
@@ -879,6 +950,16 @@ tJBL_STATUS JcopOsDwnld::load_JcopOS_image(JcopOs_ImageInfo_t *Os_info, tJBL_STA
         {
             status = STATUS_FAILED;
             LOG(ERROR) << StringPrintf("%s: Invalid response", fn);
+            /*The retry has to send this APDU again, restart the step*/
+            if(!isRejected && Os_info->ckpt.apduIndex != 0)
+            {
+                memset(&Os_info->ckpt, 0, sizeof(JcopOs_Checkpoint_t));
+                if(gCheckpointInterval != 0)
+                {
+                    WriteJcopOsInfo(Os_info);
+                }
+            }
+            isRejected = true;
         }
         LOG(ERROR) << StringPrintf("%s: Going for next line", fn);
     }
@@ -893,13 +974,27 @@ tJBL_STATUS JcopOsDwnld::load_JcopOS_image(JcopOs_ImageInfo_t *Os_info, tJBL_STA
           JCOP Patch update*/
           Os_info->cur_state = 3;
         }
+        memset(&Os_info->ckpt, 0, sizeof(JcopOs_Checkpoint_t));
         SetJcopOsState(Os_info, Os_info->cur_state);
     }
 
 exit:
+    Os_info->pApduRing->stop();
+    if(status == STATUS_FAILED && gCheckpointInterval != 0 &&
+       Os_info->ckpt.apduIndex != 0 &&
+       Os_info->version_info.ver_status != STATUS_UPTO_DATE)
+    {
+        /*Keep the exact position for the retry*/
+        WriteJcopOsInfo(Os_info);
+    }
+    Os_info->pApduRing->getStats(&ringStats);
+    DLOG_IF(INFO, nfc_debug_enabled)
+      << StringPrintf("%s: %u APDUs, reader stalls %u, transceive stalls %u", fn,
+                      ringStats.apduCount, ringStats.producerStalls,
+                      ringStats.consumerStalls);
     mchannel->doeSE_JcopDownLoadReset();
-    LOG(ERROR) << StringPrintf("%s close fp and exit; status= 0x%X", fn,status);
-    wResult = fclose(Os_info->fp);
+    LOG(ERROR) << StringPrintf("%s close image and exit; status= 0x%X", fn,status);
+    Os_info->pImage->close();
     return status;
 }
 
@@ -917,7 +1012,7 @@ JcopOsDwnld::GetJcopOsState(JcopOs_ImageInfo_t *Os_info, uint8_t *counter,
                             JcopOs_TranscieveInfo_t *pTranscv_Info) {
   static const char fn[] = "JcopOsDwnld::GetJcopOsState";
   tJBL_STATUS status = STATUS_SUCCESS;
-  FILE *fp;
+  EseState_t state;
   uint8_t xx = 0;
   DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf("%s: enter", fn);
   IChannel_t *mchannel = gpJcopOs_Dwnld_Context->channel;
@@ -925,30 +1020,27 @@ JcopOsDwnld::GetJcopOsState(JcopOs_ImageInfo_t *Os_info, uint8_t *counter,
     LOG(ERROR) << StringPrintf("%s: invalid parameter", fn);
     return STATUS_FAILED;
   }
-  fp = fopen(JCOP_INFO_PATH[mchannel->getInterfaceInfo()], "r");
-
-  if (fp == NULL) {
-    LOG(ERROR) << StringPrintf(
-        "file <%s> not exits for reading- creating new file: %s",
-        JCOP_INFO_PATH[mchannel->getInterfaceInfo()], strerror(errno));
-    fp = fopen(JCOP_INFO_PATH[mchannel->getInterfaceInfo()], "w+");
-    if (fp == NULL) {
-      LOG(ERROR) << StringPrintf(
-          "Error opening OS image file <%s> for reading: %s",
-          JCOP_INFO_PATH[mchannel->getInterfaceInfo()], strerror(errno));
+  EseState_Read(mchannel->getInterfaceInfo(), &state);
+  if (!(state.valid & ESE_STATE_JCOP)) {
+    LOG(ERROR) << StringPrintf("%s: no JCOP state recorded - creating it", fn);
+    memset(&Os_info->ckpt, 0, sizeof(JcopOs_Checkpoint_t));
+    Os_info->info_state = xx;
+    if (WriteJcopOsInfo(Os_info) != STATUS_SUCCESS) {
       return STATUS_FAILED;
     }
-    fprintf(fp, "%u", xx);
-    fclose(fp);
   } else {
-    if (FSCANF_BYTE(fp, "%u", &xx) == 0) {
-      LOG(ERROR) << StringPrintf("Failed in fscanf function");
-    }
+    xx = state.jcopState;
     LOG(ERROR) << StringPrintf("JcopOsState %d", xx);
-    fclose(fp);
+    /*Checkpoint of an interrupted image load*/
+    Os_info->ckpt.step = state.ckptStep;
+    Os_info->ckpt.apduIndex = state.ckptApduIndex;
+    Os_info->ckpt.offset = state.ckptOffset;
+    Os_info->ckpt.imgSize = state.ckptImgSize;
   }
+  Os_info->info_state = xx;
 
   status = Get_UAI_JcopOsState(Os_info, &xx, pTranscv_Info);
+  Os_info->uai_osu_state = xx;
   if (status != STATUS_SUCCESS) {
     if (status == STATUS_UPTO_DATE) {
       DLOG_IF(INFO, nfc_debug_enabled)
@@ -1008,34 +1100,99 @@ tJBL_STATUS JcopOsDwnld::SetJcopOsState(JcopOs_ImageInfo_t *Os_info, uint8_t sta
 {
     static const char fn [] = "JcopOsDwnld::SetJcopOsState";
     tJBL_STATUS status = STATUS_FAILED;
-    FILE *fp;
     DLOG_IF(INFO, nfc_debug_enabled)
       << StringPrintf("%s: enter", fn);
-    IChannel_t *mchannel = gpJcopOs_Dwnld_Context->channel;
     if(Os_info == NULL)
     {
         LOG(ERROR) << StringPrintf("%s: invalid parameter", fn);
         return status;
     }
-    fp = fopen(JCOP_INFO_PATH[mchannel->getInterfaceInfo()], "w");
+    Os_info->info_state = state;
+    status = WriteJcopOsInfo(Os_info);
+    if(status == STATUS_SUCCESS)
+    {
+      DLOG_IF(INFO, nfc_debug_enabled)
+          << StringPrintf("Current JcopOsState: %d", state);
+    }
+    return status;
+}
 
+/*******************************************************************************
+**
+** Function:        WriteJcopOsInfo
+**
+** Description:     Stores the JCOP OS state and the checkpoint of the image
+**                  load, if any, in the state journal. Without a journal
+**                  the file is replaced by rename so that a crash leaves
+**                  either the old or the new content.
+**
+** Returns:         Success if ok.
+**
+*******************************************************************************/
+tJBL_STATUS JcopOsDwnld::WriteJcopOsInfo(JcopOs_ImageInfo_t *Os_info)
+{
+    static const char fn [] = "JcopOsDwnld::WriteJcopOsInfo";
+    IChannel_t *mchannel = gpJcopOs_Dwnld_Context->channel;
+    const char *pPath = JCOP_INFO_PATH[mchannel->getInterfaceInfo()];
+    char tmpPath[256];
+    EseState_t state;
+    FILE *fp;
+    int ret;
+
+    memset(&state, 0, sizeof(state));
+    state.jcopState = Os_info->info_state;
+    if(Os_info->ckpt.apduIndex != 0)
+    {
+      state.ckptStep = Os_info->ckpt.step;
+      state.ckptApduIndex = Os_info->ckpt.apduIndex;
+      state.ckptOffset = Os_info->ckpt.offset;
+      state.ckptImgSize = Os_info->ckpt.imgSize;
+    }
+    if(EseState_Write(mchannel->getInterfaceInfo(), ESE_STATE_JCOP, &state))
+    {
+      DLOG_IF(INFO, nfc_debug_enabled)
+          << StringPrintf("%s: state %u, checkpoint APDU %u", fn,
+                          Os_info->info_state, Os_info->ckpt.apduIndex);
+      return STATUS_SUCCESS;
+    }
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", pPath);
+    fp = fopen(tmpPath, "w");
     if (fp == NULL) {
       LOG(ERROR) << StringPrintf("Error opening OS image file <%s> for reading: %s",
-        JCOP_INFO_PATH[mchannel->getInterfaceInfo()], strerror(errno));
+        tmpPath, strerror(errno));
+      return STATUS_FAILED;
     }
-    else
+    fprintf(fp, "%u", Os_info->info_state);
+    if(Os_info->ckpt.apduIndex != 0)
     {
-      fprintf(fp, "%u", state);
-      fflush(fp);
-      DLOG_IF(INFO, nfc_debug_enabled)
-          << StringPrintf("Current JcopOsState: %d", state);
-      status = STATUS_SUCCESS;
-      int fd = fileno(fp);
-      int ret = fdatasync(fd);
-      DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf("ret value: %d", ret);
-      fclose(fp);
+      fprintf(fp, " %u %u %u %u", Os_info->ckpt.step, Os_info->ckpt.apduIndex,
+              Os_info->ckpt.offset, Os_info->ckpt.imgSize);
     }
-    return status;
+    fflush(fp);
+    ret = fdatasync(fileno(fp));
+    if(fclose(fp) != 0 || ret != 0 || rename(tmpPath, pPath) != 0)
+    {
+      LOG(ERROR) << StringPrintf("%s: Error writing <%s>: %s", fn, pPath, strerror(errno));
+      unlink(tmpPath);
+      return STATUS_FAILED;
+    }
+    /*Make the rename itself durable*/
+    const char *pSep = strrchr(pPath, '/');
+    if(pSep != NULL && (size_t)(pSep - pPath) < sizeof(tmpPath))
+    {
+      memcpy(tmpPath, pPath, pSep - pPath);
+      tmpPath[pSep - pPath] = '\0';
+      int dirFd = open(tmpPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if(dirFd >= 0)
+      {
+        fsync(dirFd);
+        close(dirFd);
+      }
+    }
+    DLOG_IF(INFO, nfc_debug_enabled)
+        << StringPrintf("%s: state %u, checkpoint APDU %u", fn,
+                        Os_info->info_state, Os_info->ckpt.apduIndex);
+    return STATUS_SUCCESS;
 }
 
 /*******************************************************************************
@@ -1155,3 +1312,24 @@ tJBL_STATUS JcopOsDwnld::DeriveJcopOsu_State(JcopOs_ImageInfo_t *Os_info,
   }
   return status;
 }
+
+/*******************************************************************************
+**
+** Function:        getApduRingStats
+**
+** Description:     Reader/transceive stall counters of the last image load
+**
+** Returns:         None
+**
+*******************************************************************************/
+void JcopOsDwnld::getApduRingStats(JcopOs_RingStats_t *pStats)
+{
+    if(pStats == NULL)
+        return;
+    memset(pStats, 0, sizeof(JcopOs_RingStats_t));
+    if(gpJcopOs_Dwnld_Context != NULL &&
+       gpJcopOs_Dwnld_Context->Image_info.pApduRing != NULL)
+    {
+        gpJcopOs_Dwnld_Context->Image_info.pApduRing->getStats(pStats);
+    }
+}
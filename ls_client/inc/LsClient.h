@@ -56,11 +56,58 @@ unsigned char LSC_Start(const char* name, const char* dest, uint8_t* pdata,
 *******************************************************************************/
 tLSC_STATUS performLSDownload(IChannel_t* data);
 
+/* One script of a multi channel run, see LSC_StartMulti */
+typedef struct LsScript {
+  const char* name;     /* Script path */
+  const char* dest;     /* Response out file path, NULL if none */
+  const uint8_t* pHash; /* SHA-1 of the application triggering the script */
+  uint16_t hashLen;
+  uint8_t respSW[4];    /* Execute response and status word, output */
+  tLSC_STATUS status;   /* Output */
+} LsScript_t;
+
+/*******************************************************************************
+**
+** Function:        LSC_StartMulti
+**
+** Description:     Runs independent LS scripts at the same time, each in its
+**                  own session on its own logical channel. channel carries
+**                  one APDU at a time, the sessions only overlap their host
+**                  work (script parsing, response files) with the APDUs of
+**                  the others. At most NXP_LS_MAX_CHANNELS scripts run at a
+**                  time, fewer if the card capabilities of the eSE advertise
+**                  fewer logical channels or it runs out of them. The LS
+**                  status is written once for the run, a script asking for
+**                  LS self update (6320) fails and is left to
+**                  performLSDownload.
+**
+** Returns:         SUCCESS if all scripts succeeded.
+**
+*******************************************************************************/
+tLSC_STATUS LSC_StartMulti(IChannel_t* channel, LsScript_t* pScripts,
+                           uint8_t count);
+
+/*******************************************************************************
+**
+** Function:        LSC_StartBatch
+**
+** Description:     Runs the scripts one after the other in one session on
+**                  one logical channel, each with its own StoreData identity.
+**                  The Lsc is selected again only when its AID changes.
+**                  The LS status is left to 6340 if a script failed.
+**
+** Returns:         SUCCESS if all scripts succeeded.
+**
+*******************************************************************************/
+tLSC_STATUS LSC_StartBatch(IChannel_t* channel, LsScript_t* pScripts,
+                           uint8_t count);
+
 void* phLS_memset(void* buff, int val, size_t len);
 void* phLS_memcpy(void* dest, const void* src, size_t len);
 void* phLS_memalloc(uint32_t size);
 void  phLS_free(void* ptr);
 void* phLS_calloc(size_t datatype, size_t size);
+uint32_t phLS_getAllocCount();
 
 #endif /* LSCLIENT_H_ */
 
@@ -24,33 +24,47 @@
 #include <stdio.h>
 #include "../../inc/IChannel.h"
 #include "phNxpConfig.h"
+#include "ScriptSource.h"
+#include "LsOutWriter.h"
+#include "EseStateJournal.h"
+#include "IChannelBatch.h"
 
 typedef struct Lsc_ChannelInfo {
   uint8_t channel_id;
   bool isOpend;
 } Lsc_ChannelInfo_t;
 
+/* Largest eSE response forwarded to the Lsc in one extended length command,
+ * the encoding allows up to 0xFFFF */
+#define LS_MAX_EXT_DATA 0x1000
+#define LS_EXT_HDR_LEN 0x07 /* CLA INS P1 P2 00 Lc1 Lc2 */
+#define LS_APDU_BUF_SIZE (LS_EXT_HDR_LEN + LS_MAX_EXT_DATA)
+
 typedef struct Lsc_TranscieveInfo {
   int32_t timeout;
-  uint8_t sRecvData[1024];
-  uint8_t sSendData[1024];
+  uint8_t sRecvData[LS_APDU_BUF_SIZE];
+  uint8_t sSendData[LS_APDU_BUF_SIZE];
   int32_t sSendlength;
   int sRecvlength;
   uint8_t sTemp_recvbuf[1024];
 } Lsc_TranscieveInfo_t;
 
 typedef struct Lsc_ImageInfo {
-  FILE* fp;
+  ScriptSource* pScript;
   int fls_size;
   char fls_path[384];
   int bytes_read;
-  FILE* fResp;
+  LsOutWriter* pOut;
   int fls_RespSize;
   char fls_RespPath[384];
   int bytes_wrote;
   Lsc_ChannelInfo_t Channel_Info[10];
   uint8_t channel_cnt;
   bool isUpdaterMode;
+  bool isBinScript;
+  const uint8_t* pBinScript;
+  uint32_t bin_rec_cnt;
+  uint32_t bin_rec_idx;
 } Lsc_ImageInfo_t;
 typedef enum {
   LS_Default = 0x00,
@@ -59,10 +73,29 @@ typedef enum {
   LS_Comm = 0x40
 } Ls_TagType;
 
+/* Extended length support of the Lsc, probed with the first eSE response
+ * larger than MAX_SIZE */
+typedef enum {
+  LS_EXT_LEN_UNKNOWN = 0,
+  LS_EXT_LEN_SUPPORTED,
+  LS_EXT_LEN_REJECTED
+} Ls_ExtLenState;
+
+/* Session scratch memory for the command and response buffers of the
+ * exchanges, allocated and released last in first out, see LSC_ArenaAlloc */
+#define LS_ARENA_SIZE (2 * LS_APDU_BUF_SIZE)
+
+typedef struct Lsc_Arena {
+  uint8_t buf[LS_ARENA_SIZE];
+  uint32_t used;
+  uint32_t peak;
+} Lsc_Arena_t;
+
 typedef struct Lsc_lib_Context {
   IChannel_t            *mchannel;
   Lsc_ImageInfo_t Image_info;
   Lsc_TranscieveInfo_t Transcv_Info;
+  Lsc_Arena_t arena;
 } Lsc_Dwnld_Context_t, *pLsc_Dwnld_Context_t;
 
 typedef struct phNxpLs_data {
@@ -138,13 +171,17 @@ static uint8_t ArrayOfAIDs[NOOFAIDS][LENOFAIDS] = {
 #define LS_ABORT_SW2 0x87
 //#define AID_MEM_PATH "/data/vendor/secure_element/AID_MEM.txt"
 //#define LS_STATUS_PATH "/data/vendor/secure_element/LS_Status.txt"
-#define LS_SRC_BACKUP "/data/vendor/secure_element/LS_Src_Backup.txt"
-#define LS_DST_BACKUP "/data/vendor/secure_element/LS_Dst_Backup.txt"
+#define LS_SRC_BACKUP \
+  ESE_FS_ROOT "/data/vendor/secure_element/LS_Src_Backup.txt"
+#define LS_DST_BACKUP \
+  ESE_FS_ROOT "/data/vendor/secure_element/LS_Dst_Backup.txt"
 #define MAX_CERT_LEN (255 + 137)
 
 /*LSC2*/
 
 #define JCOP3_WR
+/* INSTALL for load, up to 256 LOAD blocks and the command following them */
+#define LS_MAX_BUFFERED_CMDS (1 + 256 + 1)
 #define MAX_SIZE 0xFF
 #define PARAM_P1_OFFSET 0x02
 #define FIRST_BLOCK 0x05
@@ -174,22 +211,47 @@ static uint8_t ArrayOfAIDs[NOOFAIDS][LENOFAIDS] = {
 #define STORE_DATA_INS 0xE2
 #define STORE_DATA_LEN 32
 #define STORE_DATA_TAG 0x4F
-static const char *AID_MEM_PATH[2] = {"/data/vendor/nfc/AID_MEM.txt",
-                                  "/data/vendor/secure_element/AID_MEM.txt"};
-static const char *LS_STATUS_PATH[2] = {"/data/vendor/nfc/LS_Status.txt",
-                                  "/data/vendor/secure_element/LS_Status.txt"};
-
+/* Binary pre-compiled LS script layout, multi byte fields are little endian
+ *   0x00 : magic "LSB1"
+ *   0x04 : format version (2 bytes)
+ *   0x06 : reserved (2 bytes)
+ *   0x08 : number of records N (4 bytes)
+ *   0x0C : record offset table, N x 4 bytes, offsets from start of file
+ * followed by the records. Each record is one TLV of the hex text script
+ * (tag 7F21, 60 or 40 with its length and value) stored as raw bytes and
+ * ends where the next record starts (last record ends at end of file).*/
+#define LS_BIN_SCRIPT_MAGIC "LSB1"
+#define LS_BIN_SCRIPT_MAGIC_LEN 0x04
+#define LS_BIN_SCRIPT_VERSION 0x0001
+#define LS_BIN_SCRIPT_HDR_LEN 0x0C
+#define LS_SCRIPT_MAX_REC_LEN 1024
+
+static const char *AID_MEM_PATH[2] = {
+                          ESE_FS_ROOT "/data/vendor/nfc/AID_MEM.txt",
+                          ESE_FS_ROOT "/data/vendor/secure_element/AID_MEM.txt"};
+static const char *LS_STATUS_PATH[2] = {
+                          ESE_FS_ROOT "/data/vendor/nfc/LS_Status.txt",
+                          ESE_FS_ROOT "/data/vendor/secure_element/LS_Status.txt"};
+
+/* One Loader Service session. All state of a script execution is held by
+ * the object, sessions over different interfaces (see AID_MEM_PATH) can run
+ * on separate threads at the same time. */
+class LsSession {
+public:
 /*******************************************************************************
 **
 ** Function:        initialize
 **
 ** Description:     Initialize all member variables.
 **                  native: Native data.
+**                  isShared: the session runs next to others on channel,
+**                  the caller then keeps the LS status and LS self update
+**                  is refused.
 **
 ** Returns:         True if ok.
 **
 *******************************************************************************/
-bool    initialize (IChannel_t *channel);
+bool    initialize (IChannel_t *channel, bool isShared = false);
 
 /*******************************************************************************
 **
@@ -214,6 +276,53 @@ void finalize();
 tLSC_STATUS Perform_LSC(const char* path, const char* dest,
                         const uint8_t* pdata, uint16_t len, uint8_t* respSW);
 
+/*******************************************************************************
+**
+** Function:        Perform_LSC_Batch
+**
+** Description:     Executes the scripts in order in this session, opening
+**                  and closing the logical channel once.
+**
+** Returns:         Success if all scripts succeeded.
+**
+*******************************************************************************/
+tLSC_STATUS Perform_LSC_Batch(LsScript_t* pScripts, uint8_t count);
+
+/*******************************************************************************
+**
+** Function:        LSC_UpdateExeStatus
+**
+** Description:     Updates LSC status to a file
+**
+** Returns:         true if success else false
+**
+*******************************************************************************/
+bool LSC_UpdateExeStatus(uint16_t status);
+
+/*******************************************************************************
+**
+** Function:        LSC_WriteExeStatus
+**
+** Description:     Writes the LSC status of the interface intfInfo.
+**
+** Returns:         true if success else false
+**
+*******************************************************************************/
+static bool LSC_WriteExeStatus(uint8_t intfInfo, uint16_t status);
+
+/*******************************************************************************
+**
+** Function:        Get_LsStatus
+**
+** Description:     Interface to fetch Loader service client status to JNI,
+*Services
+**
+** Returns:         SUCCESS/FAILURE
+**
+*******************************************************************************/
+tLSC_STATUS Get_LsStatus(uint8_t* pVersion);
+
+private:
 /*******************************************************************************
 **
 ** Function:        LSC_OpenChannel
@@ -223,10 +332,9 @@ tLSC_STATUS Perform_LSC(const char* path, const char* dest,
 ** Returns:         Success if ok.
 **
 *******************************************************************************/
-static tLSC_STATUS LSC_OpenChannel(Lsc_ImageInfo_t* pContext,
-                                   tLSC_STATUS status,
-                                   Lsc_TranscieveInfo_t* pInfo)
-    __attribute__((unused));
+tLSC_STATUS LSC_OpenChannel(Lsc_ImageInfo_t* pContext,
+                            tLSC_STATUS status,
+                            Lsc_TranscieveInfo_t* pInfo);
 
 /*******************************************************************************
 **
@@ -238,9 +346,8 @@ static tLSC_STATUS LSC_OpenChannel(Lsc_ImageInfo_t* pContext,
 ** Returns:         Success if ok.
 **
 *******************************************************************************/
-static tLSC_STATUS LSC_SelectLsc(Lsc_ImageInfo_t* pContext, tLSC_STATUS status,
-                                 Lsc_TranscieveInfo_t* pInfo)
-    __attribute__((unused));
+tLSC_STATUS LSC_SelectLsc(Lsc_ImageInfo_t* pContext, tLSC_STATUS status,
+                          Lsc_TranscieveInfo_t* pInfo);
 
 /*******************************************************************************
 **
@@ -253,9 +360,8 @@ static tLSC_STATUS LSC_SelectLsc(Lsc_ImageInfo_t* pContext, tLSC_STATUS status,
 ** Returns:         Success if ok.
 **
 *******************************************************************************/
-static tLSC_STATUS LSC_StoreData(Lsc_ImageInfo_t* pContext, tLSC_STATUS status,
-                                 Lsc_TranscieveInfo_t* pInfo)
-    __attribute__((unused));
+tLSC_STATUS LSC_StoreData(Lsc_ImageInfo_t* pContext, tLSC_STATUS status,
+                          Lsc_TranscieveInfo_t* pInfo);
 
 /*******************************************************************************
 **
@@ -266,9 +372,8 @@ static tLSC_STATUS LSC_StoreData(Lsc_ImageInfo_t* pContext, tLSC_STATUS status,
 ** Returns:         Success if ok.
 **
 *******************************************************************************/
-static tLSC_STATUS LSC_loadapplet(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
-                                  Lsc_TranscieveInfo_t* pTranscv_Info)
-    __attribute__((unused));
+tLSC_STATUS LSC_loadapplet(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
+                           Lsc_TranscieveInfo_t* pTranscv_Info);
 
 /*******************************************************************************
 **
@@ -279,10 +384,11 @@ static tLSC_STATUS LSC_loadapplet(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
 ** Returns:         Success if ok.
 **
 *******************************************************************************/
-static tLSC_STATUS LSC_update_seq_handler(
-    tLSC_STATUS (*seq_handler[])(Lsc_ImageInfo_t* pContext, tLSC_STATUS status,
-                                 Lsc_TranscieveInfo_t* pInfo),
-    const char* name, const char* dest) __attribute__((unused));
+tLSC_STATUS LSC_update_seq_handler(
+    tLSC_STATUS (LsSession::*seq_handler[])(Lsc_ImageInfo_t* pContext,
+                                            tLSC_STATUS status,
+                                            Lsc_TranscieveInfo_t* pInfo),
+    const char* name, const char* dest);
 
 /*******************************************************************************
 **
@@ -398,29 +504,6 @@ tLSC_STATUS Check_Complete_7F21_Tag(Lsc_ImageInfo_t* Os_info,
                                     Lsc_TranscieveInfo_t* pTranscv_Info,
                                     uint8_t* read_buf, uint16_t* offset);
 
-/*******************************************************************************
-**
-** Function:        LSC_UpdateExeStatus
-**
-** Description:     Updates LSC status to a file
-**
-** Returns:         true if success else false
-**
-*******************************************************************************/
-bool LSC_UpdateExeStatus(uint16_t status);
-
-/*******************************************************************************
-**
-** Function:        Get_LsStatus
-**
-** Description:     Interface to fetch Loader service client status to JNI,
-*Services
-**
-** Returns:         SUCCESS/FAILURE
-**
-*******************************************************************************/
-tLSC_STATUS Get_LsStatus(uint8_t* pVersion);
-
 /*******************************************************************************
 **
 ** Function:        LSC_SendtoEse
@@ -490,11 +573,38 @@ tLSC_STATUS LSC_Check_KeyIdentifier(Lsc_ImageInfo_t* Os_info,
 ** Function:        LSC_ReadScript
 **
 ** Description:     Reads the current line if the script
+**                  ppRecord: set to the record read, which is read_buf for
+**                  a hex text script or the record within a binary script.
 **
 ** Returns:         Success if ok.
 **
 *******************************************************************************/
-tLSC_STATUS LSC_ReadScript(Lsc_ImageInfo_t* Os_info, uint8_t* read_buf);
+tLSC_STATUS LSC_ReadScript(Lsc_ImageInfo_t* Os_info, uint8_t* read_buf,
+                           uint8_t** ppRecord);
+
+/*******************************************************************************
+**
+** Function:        LSC_LoadBinScript
+**
+** Description:     Checks if the opened script is a binary pre-compiled
+**                  script. If so its record offset table is validated.
+**
+** Returns:         Success if ok or script is in hex text format.
+**
+*******************************************************************************/
+tLSC_STATUS LSC_LoadBinScript(Lsc_ImageInfo_t* Os_info);
+
+/*******************************************************************************
+**
+** Function:        LSC_ReadBinScript
+**
+** Description:     Returns the next record of a binary pre-compiled script
+**                  without copying it.
+**
+** Returns:         Success if ok.
+**
+*******************************************************************************/
+tLSC_STATUS LSC_ReadBinScript(Lsc_ImageInfo_t* Os_info, uint8_t** ppRecord);
 
 /*******************************************************************************
 **
@@ -538,7 +648,88 @@ tLSC_STATUS Send_Backall_Loadcmds(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
 
 tLSC_STATUS Bufferize_load_cmds(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
                                 Lsc_TranscieveInfo_t* pTranscv_Info);
+
+bool LSC_BufferCmd(Lsc_TranscieveInfo_t* pTranscv_Info);
+void LSC_ResetCmdBuffer();
+#endif
+
+/*******************************************************************************
+**
+** Function:        LSC_Transceive
+**
+** Description:     Sends pCmd to the eSE, pRsp points to the response
+**                  in the session buffer.
+**
+** Returns:         Success if ok.
+**
+*******************************************************************************/
+tLSC_STATUS LSC_Transceive(phNxpLs_data* pCmd, phNxpLs_data* pRsp);
+
+/*******************************************************************************
+**
+** Function:        LSC_IsScriptPending
+**
+** Description:     Checks whether records are left in the script.
+**
+** Returns:         True if a record is left.
+**
+*******************************************************************************/
+bool LSC_IsScriptPending(Lsc_ImageInfo_t* Os_info);
+
+/*******************************************************************************
+**
+** Function:        LSC_ArenaAlloc
+**
+** Description:     Allocates size bytes from the session arena.
+**
+** Returns:         Pointer to the memory, NULL if the arena is exhausted.
+**
+*******************************************************************************/
+uint8_t* LSC_ArenaAlloc(uint32_t size);
+
+/*******************************************************************************
+**
+** Function:        LSC_ArenaRelease
+**
+** Description:     Releases all arena memory allocated after mark was read
+**                  from arena.used.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void LSC_ArenaRelease(uint32_t mark);
+
+static tLSC_STATUS (LsSession::*Applet_load_seqhandler[])(
+    Lsc_ImageInfo_t* pContext, tLSC_STATUS status,
+    Lsc_TranscieveInfo_t* pInfo);
+
+pLsc_Dwnld_Context_t mpLsc_Dwnld_Context = NULL;
+bool mIsInit = false;
+bool mIsShared = false;
+Ls_ExtLenState mExtLenState = LS_EXT_LEN_UNKNOWN;
+#ifdef JCOP3_WR
+uint8_t Cmd_Buffer[64 * 1024];
+/*Buffered commands, pointing into Cmd_Buffer*/
+IChannelCmd_t Cmd_List[LS_MAX_BUFFERED_CMDS];
+int32_t cmd_count = 0;
+uint32_t cmd_buf_len = 0;
+bool islastcmdLoad = false;
+bool SendBack_cmds = false;
 #endif
+uint8_t Select_Rsp[1024];
+uint8_t Jsbl_RefKey[256];
+uint8_t Jsbl_keylen = 0;
+uint8_t StoreData[22];
+int Select_Rsp_Len = 0;
+uint8_t lsVersionArr[2];
+uint8_t tag42Arr[17];
+uint8_t tag45Arr[9];
+uint8_t lsExecuteResp[4] = {0};
+uint8_t AID_ARRAY[22];
+int32_t resp_len = 0;
+int32_t temp_len = 0; /* Pending certificate bytes, see LSC_ProcessResp */
+uint8_t lsGetStatusArr[2];
+};
 
 inline int FSCANF_BYTE(FILE* stream, const char* format, void* pVal) {
   int Result = 0;
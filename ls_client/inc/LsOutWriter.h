@@ -0,0 +1,125 @@
+/*******************************************************************************
+ *
+ *  Copyright 2019 NXP
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+#ifndef LS_OUT_WRITER_H_
+#define LS_OUT_WRITER_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+/* Text queued ahead of the writer thread */
+#define LS_OUT_RING_SIZE (32 * 1024)
+
+/*
+ * Response out file of an LS script.
+ * Records are hex encoded into a ring by the script thread and appended to
+ * the file by a writer thread, so the APDU exchanges never wait on the
+ * file system. The file is synced on request at phase boundaries and when
+ * closed.
+ */
+class LsOutWriter {
+ public:
+  LsOutWriter();
+  ~LsOutWriter();
+
+/*******************************************************************************
+**
+** Function:        open
+**
+** Description:     Opens path for appending and starts the writer thread.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+bool open(const char* path);
+
+/*******************************************************************************
+**
+** Function:        writeHex
+**
+** Description:     Queues len bytes of pData as upper case hex text, waits
+**                  only while the ring is full.
+**
+** Returns:         False if the file could not be written.
+**
+*******************************************************************************/
+bool writeHex(const uint8_t* pData, uint32_t len);
+
+/*******************************************************************************
+**
+** Function:        writeEol
+**
+** Description:     Queues the end of a record.
+**
+** Returns:         False if the file could not be written.
+**
+*******************************************************************************/
+bool writeEol();
+
+/*******************************************************************************
+**
+** Function:        sync
+**
+** Description:     Requests the writer thread to sync the file once all
+**                  text queued so far is written. Does not wait.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void sync();
+
+/*******************************************************************************
+**
+** Function:        close
+**
+** Description:     Writes the queued text, syncs and closes the file and
+**                  stops the writer thread. Safe to call when not open.
+**
+** Returns:         False if the file could not be written.
+**
+*******************************************************************************/
+bool close();
+
+  bool isOpen() const { return mRunning; }
+  uint32_t stalls() const { return mStalls; }
+
+ private:
+  LsOutWriter(const LsOutWriter&);
+  LsOutWriter& operator=(const LsOutWriter&);
+
+  static void* writerThread(void* arg);
+  void drain();
+  bool put(const char* pText, uint32_t len);
+
+  char mRing[LS_OUT_RING_SIZE];
+  uint64_t mHead;     /* Bytes queued, free running */
+  uint64_t mTail;     /* Bytes written to the file */
+  uint64_t mSyncPos;  /* Sync requested once mTail reaches it */
+  uint64_t mSyncedPos;
+  int mFd;
+  bool mRunning;
+  bool mStop;
+  bool mError;
+  uint32_t mStalls;   /* Producer waited for room in the ring */
+  pthread_t mThread;
+  pthread_mutex_t mLock;
+  pthread_cond_t mDataCond;  /* Text queued, sync or stop requested */
+  pthread_cond_t mRoomCond;  /* Text written */
+};
+
+#endif /* LS_OUT_WRITER_H_ */
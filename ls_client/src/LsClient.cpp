@@ -18,17 +18,78 @@
 
 #include "LsLib.h"
 #include "LsClient.h"
+#include <IChannelStats.h>
 #include <cutils/log.h>
 #include <dirent.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <string.h>
 #include <errno.h>
+#include <atomic>
 
 /*static char gethex(const char *s, char **endptr);
 char *convert(const char *s, int *length);*/
 uint8_t datahex(char c);
 void updateLsAid(uint8_t intfInfo);
+static std::atomic<uint32_t> gLsAllocCount(0);
+/*Session of the calling thread, set by performLSDownload*/
+static thread_local LsSession* tLsSession = NULL;
+
+#define LS_MULTI_DEF_CHANNELS 3  /* Supplementary channels of any ISO card */
+#define LS_MULTI_MAX_CHANNELS 19 /* Extended logical channels */
+#define LS_MULTI_TIMEOUT 2000     /* Card capabilities query, in ms */
+
+/* Scheduler of one LSC_StartMulti call */
+typedef struct LsMultiCtx {
+  IChannel_t* pChannel; /* Channel shared by the sessions */
+  LsScript_t* pScripts;
+  uint8_t pending[UINT8_MAX]; /* Scripts to start, the next one on top */
+  uint16_t pendingCnt;
+  uint8_t running;
+  uint8_t limit; /* Sessions allowed to run at the same time */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;         /* Session ended or scripts to start */
+  pthread_mutex_t channelLock; /* One APDU at a time on pChannel */
+} LsMultiCtx_t;
+
+/*Scheduler the calling thread works for, set by LSC_MultiWorker. The
+  sessions call the shared channel only from their worker thread.*/
+static thread_local LsMultiCtx_t* tMultiCtx = NULL;
+/*******************************************************************************
+**
+** Function:        LSC_StatsBegin
+**
+** Description:     Wraps channel for the APDU statistics of a whole LS
+**                  operation when NXP_APDU_STATS is enabled.
+**
+** Returns:         pStats if wrapped, else channel.
+**
+*******************************************************************************/
+static IChannel_t* LSC_StatsBegin(IChannel_t* channel, IChannel_t* pStats) {
+  unsigned long stats = 0;
+  if (GetNxpNum(CFG_NXP_APDU_STATS, &stats, sizeof(stats)) && (stats == 1) &&
+      IChannelStats_Wrap(channel, pStats)) {
+    return pStats;
+  }
+  return channel;
+}
+
+/*******************************************************************************
+**
+** Function:        LSC_StatsEnd
+**
+** Description:     Dumps the statistics of the operation and releases the
+**                  wrapper, if LSC_StatsBegin returned pStats.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void LSC_StatsEnd(IChannel_t* channel, IChannel_t* pStats) {
+  if (channel != pStats) return;
+  IChannelStats_Dump(-1);
+  IChannelStats_Unwrap(pStats);
+}
+
 //extern pLsc_Dwnld_Context_t gpLsc_Dwnld_Context;
 //static android::sp<ISecureElementHalCallback> cCallback;
 /*******************************************************************************
@@ -44,10 +105,12 @@ tLSC_STATUS LSC_Start(const char* name, const char* dest, uint8_t* pdata,
                       uint16_t len, uint8_t* respSW) {
   static const char fn[] = "LSC_Start";
   tLSC_STATUS status = STATUS_FAILED;
-  if (name != NULL) {
+  if (tLsSession == NULL) {
+    ALOGE("%s: No LS session", fn);
+  } else if (name != NULL) {
     ALOGE("%s: name is %s", fn, name);
     ALOGE("%s: Dest is %s", fn, dest);
-    status = Perform_LSC(name, dest, pdata, len, respSW);
+    status = tLsSession->Perform_LSC(name, dest, pdata, len, respSW);
   } else {
     ALOGE("Invalid parameter");
   }
@@ -68,10 +131,10 @@ tLSC_STATUS performLSDownload(IChannel_t* data) {
   tLSC_STATUS status = STATUS_FAILED;
 
   const char* lsUpdateBackupPath =
-      "/vendor/etc/loaderservice_updater.txt";
+      ESE_FS_ROOT "/vendor/etc/loaderservice_updater.txt";
   const char* lsUpdateBackupOutPath[2] =
-  {"/data/vendor/nfc/loaderservice_updater_out.txt",
-   "/data/vendor/secure_element/loaderservice_updater_out.txt",};
+  {ESE_FS_ROOT "/data/vendor/nfc/loaderservice_updater_out.txt",
+   ESE_FS_ROOT "/data/vendor/secure_element/loaderservice_updater_out.txt",};
   IChannel_t* mchannel = (IChannel_t*)data;
 
   /*generated SHA-1 string for secureElementLS
@@ -86,47 +149,374 @@ tLSC_STATUS performLSDownload(IChannel_t* data) {
   /*Check and update if any new LS AID is available*/
   updateLsAid(mchannel->getInterfaceInfo());
 
-  if(!initialize ((IChannel_t*) data))
+  IChannel_t statsChannel;
+  IChannel_t* pChannel = LSC_StatsBegin(mchannel, &statsChannel);
+  LsSession* pSession = new LsSession();
+  if (!pSession->initialize(pChannel)) {
+    pSession->finalize();
+    delete pSession;
+    LSC_StatsEnd(pChannel, &statsChannel);
     return status;
-
+  }
+  tLsSession = pSession;
 
   uint8_t resSW[4] = {0x4e, 0x02, 0x69, 0x87};
   FILE* fIn, *fOut;
   if ((fIn = fopen(lsUpdateBackupPath, "rb")) == NULL) {
     ALOGE("%s Cannot open file %s\n", __func__, lsUpdateBackupPath);
     ALOGE("%s Error : %s", __func__, strerror(errno));
-    return status;
   } else {
     ALOGD("%s File opened %s\n", __func__, lsUpdateBackupPath);
     if ((fOut = fopen(lsUpdateBackupOutPath[mchannel->getInterfaceInfo()], "wb")) == NULL) {
       ALOGE("%s Failed to open file %s\n", __func__,
         lsUpdateBackupOutPath[mchannel->getInterfaceInfo()]);
       fclose(fIn);
-      return status;
     } else {
       ALOGD("%s File opened %s\n", __func__,
         lsUpdateBackupOutPath[mchannel->getInterfaceInfo()]);
       fclose(fIn);
       fclose(fOut);
-    }
-    status = LSC_Start(lsUpdateBackupPath, lsUpdateBackupOutPath[mchannel->getInterfaceInfo()],
-                       (uint8_t*)hash, (uint16_t)sizeof(hash), resSW);
-    resSW[0]=0x4e;
-    ALOGD("%s LSC_Start completed\n", __func__);
-    if (status == STATUS_SUCCESS) {
-      if (remove(lsUpdateBackupPath) == 0) {
-        ALOGD("%s  : %s file deleted successfully\n", __func__,
-              lsUpdateBackupPath);
-      } else {
-        ALOGD("%s  : %s file deletion failed!!!\n", __func__,
-              lsUpdateBackupPath);
+      status = LSC_Start(lsUpdateBackupPath, lsUpdateBackupOutPath[mchannel->getInterfaceInfo()],
+                         (uint8_t*)hash, (uint16_t)sizeof(hash), resSW);
+      resSW[0]=0x4e;
+      ALOGD("%s LSC_Start completed\n", __func__);
+      if (status == STATUS_SUCCESS) {
+        if (remove(lsUpdateBackupPath) == 0) {
+          ALOGD("%s  : %s file deleted successfully\n", __func__,
+                lsUpdateBackupPath);
+        } else {
+          ALOGD("%s  : %s file deletion failed!!!\n", __func__,
+                lsUpdateBackupPath);
+        }
       }
     }
   }
+  tLsSession = NULL;
+  pSession->finalize();
+  delete pSession;
+  LSC_StatsEnd(pChannel, &statsChannel);
   ALOGD("%s pthread_exit\n", __func__);
   return status;
 }
 
+/*******************************************************************************
+**
+** Function:        LSC_MultiOpen
+**
+** Description:     The shared channel is opened once by LSC_StartMulti, the
+**                  sessions only get the result.
+**
+** Returns:         STATUS_SUCCESS
+**
+*******************************************************************************/
+static int16_t LSC_MultiOpen() { return STATUS_SUCCESS; }
+
+/*******************************************************************************
+**
+** Function:        LSC_MultiTransceive
+**
+** Description:     Entry points of the shared channel, forwarding to the
+**                  caller's channel of the worker's scheduler one call at a
+**                  time.
+**
+** Returns:         As the caller's channel.
+**
+*******************************************************************************/
+static bool LSC_MultiClose(int16_t handle) {
+  (void)handle;
+  return true;
+}
+
+static bool LSC_MultiTransceive(uint8_t* xmitBuffer, int32_t xmitBufferSize,
+                                uint8_t* recvBuffer, int32_t recvBufferMaxSize,
+                                int32_t& recvBufferActualSize,
+                                int32_t timeOut) {
+  LsMultiCtx_t* pCtx = tMultiCtx;
+  pthread_mutex_lock(&pCtx->channelLock);
+  bool stat = pCtx->pChannel->transceive(xmitBuffer, xmitBufferSize,
+                                         recvBuffer, recvBufferMaxSize,
+                                         recvBufferActualSize, timeOut);
+  pthread_mutex_unlock(&pCtx->channelLock);
+  return stat;
+}
+
+static bool LSC_MultiTransceiveRaw(uint8_t* xmitBuffer, int32_t xmitBufferSize,
+                                   uint8_t* recvBuffer,
+                                   int32_t recvBufferMaxSize,
+                                   int32_t& recvBufferActualSize,
+                                   int32_t timeOut) {
+  LsMultiCtx_t* pCtx = tMultiCtx;
+  pthread_mutex_lock(&pCtx->channelLock);
+  bool stat = pCtx->pChannel->transceiveRaw(xmitBuffer, xmitBufferSize,
+                                            recvBuffer, recvBufferMaxSize,
+                                            recvBufferActualSize, timeOut);
+  pthread_mutex_unlock(&pCtx->channelLock);
+  return stat;
+}
+
+static void LSC_MultiReset() {
+  LsMultiCtx_t* pCtx = tMultiCtx;
+  pthread_mutex_lock(&pCtx->channelLock);
+  pCtx->pChannel->doeSE_Reset();
+  pthread_mutex_unlock(&pCtx->channelLock);
+}
+
+static void LSC_MultiJcopDownLoadReset() {
+  LsMultiCtx_t* pCtx = tMultiCtx;
+  pthread_mutex_lock(&pCtx->channelLock);
+  pCtx->pChannel->doeSE_JcopDownLoadReset();
+  pthread_mutex_unlock(&pCtx->channelLock);
+}
+
+static uint8_t LSC_MultiGetInterfaceInfo() {
+  return tMultiCtx->pChannel->getInterfaceInfo();
+}
+
+/*******************************************************************************
+**
+** Function:        LSC_IsChannelUnavailable
+**
+** Description:     Checks whether a script failed because the eSE refused to
+**                  open one more logical channel.
+**
+** Returns:         True if so.
+**
+*******************************************************************************/
+static bool LSC_IsChannelUnavailable(const LsScript_t* pScript) {
+  const uint8_t* sw = &pScript->respSW[2];
+  return (pScript->status != STATUS_SUCCESS) &&
+         (((sw[0] == 0x68) && (sw[1] == 0x81)) ||
+          ((sw[0] == 0x6A) && (sw[1] == 0x81)));
+}
+
+/*******************************************************************************
+**
+** Function:        LSC_MultiWorker
+**
+** Description:     Starts pending scripts while fewer than limit sessions
+**                  run. A script refused a logical channel while other
+**                  sessions hold one is queued again, and the limit lowered
+**                  to the sessions still running.
+**
+** Returns:         NULL
+**
+*******************************************************************************/
+static void* LSC_MultiWorker(void* arg) {
+  static const char fn[] = "LSC_MultiWorker";
+  LsMultiCtx_t* pCtx = (LsMultiCtx_t*)arg;
+  IChannel_t shared = {LSC_MultiOpen,          LSC_MultiClose,
+                       LSC_MultiTransceive,    LSC_MultiTransceiveRaw,
+                       LSC_MultiReset,         LSC_MultiJcopDownLoadReset,
+                       LSC_MultiGetInterfaceInfo};
+
+  tMultiCtx = pCtx;
+  pthread_mutex_lock(&pCtx->lock);
+  for (;;) {
+    /*A running session may still hand its script back*/
+    while (((pCtx->pendingCnt > 0) && (pCtx->running >= pCtx->limit)) ||
+           ((pCtx->pendingCnt == 0) && (pCtx->running > 0))) {
+      pthread_cond_wait(&pCtx->cond, &pCtx->lock);
+    }
+    if (pCtx->pendingCnt == 0) break;
+    uint8_t idx = pCtx->pending[--pCtx->pendingCnt];
+    pCtx->running++;
+    pthread_mutex_unlock(&pCtx->lock);
+
+    LsScript_t* pScript = &pCtx->pScripts[idx];
+    LsSession* pSession = new LsSession();
+    pScript->status = STATUS_FAILED;
+    if (pSession->initialize(&shared, true)) {
+      pScript->status =
+          pSession->Perform_LSC(pScript->name, pScript->dest, pScript->pHash,
+                                pScript->hashLen, pScript->respSW);
+    }
+    pSession->finalize();
+    delete pSession;
+
+    pthread_mutex_lock(&pCtx->lock);
+    pCtx->running--;
+    if (LSC_IsChannelUnavailable(pScript) && (pCtx->running > 0)) {
+      pCtx->limit = pCtx->running;
+      pCtx->pending[pCtx->pendingCnt++] = idx;
+      ALOGD("%s: no logical channel for %s, limit=%d", fn, pScript->name,
+            pCtx->limit);
+    } else {
+      ALOGD("%s: %s done; status=0x%x", fn, pScript->name, pScript->status);
+    }
+    pthread_cond_broadcast(&pCtx->cond);
+  }
+  pthread_mutex_unlock(&pCtx->lock);
+  tMultiCtx = NULL;
+  return NULL;
+}
+
+/*******************************************************************************
+**
+** Function:        LSC_GetCardChannels
+**
+** Description:     Reads the maximum number of logical channels from the
+**                  card capabilities of the eSE (ISO/IEC 7816-4 data object
+**                  47, third software function table).
+**
+** Returns:         Supplementary channels advertised, LS_MULTI_MAX_CHANNELS
+**                  for eight or more, -1 if the eSE does not tell.
+**
+*******************************************************************************/
+static int LSC_GetCardChannels(IChannel_t* channel) {
+  static const char fn[] = "LSC_GetCardChannels";
+  uint8_t getData[] = {0x00, 0xCA, 0x00, 0x47, 0x00};
+  uint8_t rsp[32];
+  int32_t rspLen = 0;
+  const uint8_t* pCaps = rsp;
+  int32_t capsLen;
+
+  if (!channel->transceive(getData, sizeof(getData), rsp, sizeof(rsp), rspLen,
+                           LS_MULTI_TIMEOUT) ||
+      (rspLen < 2) || (rsp[rspLen - 2] != 0x90) || (rsp[rspLen - 1] != 0x00)) {
+    ALOGD("%s: card capabilities not available", fn);
+    return -1;
+  }
+  capsLen = rspLen - 2;
+  if ((capsLen >= 2) && (rsp[0] == 0x47) && (rsp[1] <= capsLen - 2)) {
+    pCaps = &rsp[2];
+    capsLen = rsp[1];
+  }
+  if (capsLen < 3) return -1;
+  /*'111' for eight or more, else the count less one, basic channel included*/
+  if ((pCaps[2] & 0x07) == 0x07) return LS_MULTI_MAX_CHANNELS;
+  return pCaps[2] & 0x07;
+}
+
+/*******************************************************************************
+**
+** Function:        LSC_StartMulti
+**
+** Description:     Runs independent LS scripts at the same time, each in its
+**                  own session on its own logical channel. The LS status is
+**                  written here once for all sessions, so that a failed
+**                  script is still pending at next boot.
+**
+** Returns:         SUCCESS if all scripts succeeded.
+**
+*******************************************************************************/
+tLSC_STATUS LSC_StartMulti(IChannel_t* channel, LsScript_t* pScripts,
+                           uint8_t count) {
+  static const char fn[] = "LSC_StartMulti";
+  tLSC_STATUS status = STATUS_FAILED;
+  unsigned long maxChannels = LS_MULTI_DEF_CHANNELS;
+  pthread_t workers[LS_MULTI_MAX_CHANNELS];
+  uint8_t workerCnt = 0;
+  LsMultiCtx_t ctx;
+  IChannel_t statsChannel;
+  int16_t handle;
+  int cardChannels;
+  uint8_t intf;
+
+  if ((channel == NULL) || (pScripts == NULL) || (count == 0)) {
+    ALOGE("%s: Invalid parameter", fn);
+    return status;
+  }
+  handle = channel->open();
+  if (handle == STATUS_FAILED) {
+    ALOGE("%s: channel open failed", fn);
+    return status;
+  }
+  GetNxpNum(CFG_NXP_LS_MAX_CHANNELS, &maxChannels, sizeof(maxChannels));
+  cardChannels = LSC_GetCardChannels(channel);
+  if ((cardChannels >= 0) && (maxChannels > (unsigned long)cardChannels)) {
+    maxChannels = cardChannels;
+  }
+  if (maxChannels == 0) maxChannels = 1;
+  if (maxChannels > LS_MULTI_MAX_CHANNELS) maxChannels = LS_MULTI_MAX_CHANNELS;
+  if (maxChannels > count) maxChannels = count;
+
+  intf = channel->getInterfaceInfo();
+  updateLsAid(intf);
+  if (!LsSession::LSC_WriteExeStatus(intf, LS_DEFAULT_STATUS)) {
+    ALOGE("%s: LS status update failed", fn);
+    channel->close(handle);
+    return status;
+  }
+  ctx.pChannel = LSC_StatsBegin(channel, &statsChannel);
+  ctx.pScripts = pScripts;
+  ctx.pendingCnt = 0;
+  for (int i = count - 1; i >= 0; i--) {
+    pScripts[i].status = STATUS_FAILED;
+    memset(pScripts[i].respSW, 0, sizeof(pScripts[i].respSW));
+    ctx.pending[ctx.pendingCnt++] = (uint8_t)i;
+  }
+  ctx.running = 0;
+  ctx.limit = (uint8_t)maxChannels;
+  pthread_mutex_init(&ctx.lock, NULL);
+  pthread_cond_init(&ctx.cond, NULL);
+  pthread_mutex_init(&ctx.channelLock, NULL);
+  ALOGD("%s: %d scripts on up to %lu channels, card advertises %d", fn, count,
+        maxChannels, cardChannels);
+
+  /*The calling thread is one of the workers*/
+  for (uint8_t i = 1; i < maxChannels; i++) {
+    if (pthread_create(&workers[workerCnt], NULL, LSC_MultiWorker, &ctx) !=
+        0) {
+      ALOGE("%s: worker creation failed", fn);
+      break;
+    }
+    workerCnt++;
+  }
+  LSC_MultiWorker(&ctx);
+  for (uint8_t i = 0; i < workerCnt; i++) {
+    pthread_join(workers[i], NULL);
+  }
+  pthread_mutex_destroy(&ctx.channelLock);
+  pthread_cond_destroy(&ctx.cond);
+  pthread_mutex_destroy(&ctx.lock);
+  LSC_StatsEnd(ctx.pChannel, &statsChannel);
+
+  status = STATUS_SUCCESS;
+  for (uint8_t i = 0; i < count; i++) {
+    if (pScripts[i].status != STATUS_SUCCESS) status = pScripts[i].status;
+  }
+  if (status == STATUS_SUCCESS) {
+    LsSession::LSC_WriteExeStatus(intf, LS_SUCCESS_STATUS);
+  }
+  channel->close(handle);
+  ALOGD("%s: exit; status=0x%x", fn, status);
+  return status;
+}
+
+/*******************************************************************************
+**
+** Function:        LSC_StartBatch
+**
+** Description:     Runs the scripts one after the other in one session.
+**
+** Returns:         SUCCESS if all scripts succeeded.
+**
+*******************************************************************************/
+tLSC_STATUS LSC_StartBatch(IChannel_t* channel, LsScript_t* pScripts,
+                           uint8_t count) {
+  static const char fn[] = "LSC_StartBatch";
+  tLSC_STATUS status = STATUS_FAILED;
+
+  if ((channel == NULL) || (pScripts == NULL) || (count == 0)) {
+    ALOGE("%s: Invalid parameter", fn);
+    return status;
+  }
+  /*Check and update if any new LS AID is available*/
+  updateLsAid(channel->getInterfaceInfo());
+
+  IChannel_t statsChannel;
+  IChannel_t* pChannel = LSC_StatsBegin(channel, &statsChannel);
+  LsSession* pSession = new LsSession();
+  if (pSession->initialize(pChannel)) {
+    status = pSession->Perform_LSC_Batch(pScripts, count);
+  }
+  pSession->finalize();
+  delete pSession;
+  LSC_StatsEnd(pChannel, &statsChannel);
+  ALOGD("%s: exit; status=0x%x", fn, status);
+  return status;
+}
+
 /*******************************************************************************
 **
 ** Function:        datahex
@@ -160,30 +550,14 @@ uint8_t datahex(char c) {
 void updateLsAid(uint8_t intfInfo) {
   ALOGD_IF( "%s Enter\n", __func__);
 
-  FILE* fAID_MEM = NULL;
-  fAID_MEM = fopen(AID_MEM_PATH[intfInfo], "r");
-
-  if (fAID_MEM == NULL) {
-    ALOGE("%s: AID data file does not exists", __func__);
+  EseState_t state;
+  EseState_Read(intfInfo, &state);
+  if (!(state.valid & ESE_STATE_LS_AID)) {
+    ALOGE("%s: AID data does not exists", __func__);
     return;
   }
-
-  uint8_t aidLen = 0x00;
-  int32_t wStatus = 0;
-
-  while (!(feof(fAID_MEM))) {
-    wStatus = FSCANF_BYTE(fAID_MEM, "%2x",
-                          &ArrayOfAIDs[LS_SELF_UPDATE_AID_IDX][aidLen++]);
-    if (wStatus == 0) {
-      ALOGE("%s: exit: Error during read AID data", __func__);
-      ArrayOfAIDs[LS_SELF_UPDATE_AID_IDX][0] = 0x00;
-      break;
-    }
-  }
-  if ((wStatus > 0x00) && (aidLen > 0x00)) {
-    ArrayOfAIDs[LS_SELF_UPDATE_AID_IDX][0] = aidLen - 1;
-  }
-  fclose(fAID_MEM);
+  uint8_t aidLen = (state.lsAidLen > LEN_LS_AID) ? LEN_LS_AID : state.lsAidLen;
+  memcpy(&ArrayOfAIDs[LS_SELF_UPDATE_AID_IDX][0], state.lsAid, aidLen);
 }
 
 void* phLS_memset(void* buff, int val, size_t len) {
@@ -194,10 +568,17 @@ void* phLS_memcpy(void* dest, const void* src, size_t len) {
   return memcpy(dest, src, len);
 }
 
-void* phLS_memalloc(uint32_t size) { return malloc(size); }
+void* phLS_memalloc(uint32_t size) {
+  gLsAllocCount++;
+  return malloc(size);
+}
 
 void phLS_free(void* ptr) { return free(ptr); }
 
 void* phLS_calloc(size_t datatype, size_t size) {
+  gLsAllocCount++;
   return calloc(datatype, size);
 }
+
+/* Heap allocations made through phLS_memalloc and phLS_calloc */
+uint32_t phLS_getAllocCount() { return gLsAllocCount; }
@@ -19,42 +19,19 @@
 #include <cutils/log.h>
 #include <LsLib.h>
 #include <LsClient.h>
+#include <IChannelStats.h>
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 
-pLsc_Dwnld_Context_t gpLsc_Dwnld_Context = NULL;
 static int32_t gTransceiveTimeout = 120000;
-#ifdef JCOP3_WR
-uint8_t Cmd_Buffer[64 * 1024];
-static int32_t cmd_count = 0;
-bool islastcmdLoad;
-bool SendBack_cmds = false;
-uint8_t* pBuffer;
-#endif
-bool mIsInit;
-uint8_t Select_Rsp[1024];
-uint8_t Jsbl_RefKey[256];
-uint8_t Jsbl_keylen;
-uint8_t StoreData[22];
-int Select_Rsp_Len;
-uint8_t lsVersionArr[2];
-uint8_t tag42Arr[17];
-uint8_t tag45Arr[9];
-uint8_t lsExecuteResp[4];
-uint8_t AID_ARRAY[22];
-int32_t resp_len = 0;
-FILE* fAID_MEM = NULL;
-FILE* fLS_STATUS = NULL;
-uint8_t lsGetStatusArr[2];
-phNxpLs_data cmdApdu;
-phNxpLs_data rspApdu;
-static tLSC_STATUS LSC_Transceive(phNxpLs_data* pCmd, phNxpLs_data* pRsp);
-tLSC_STATUS (*Applet_load_seqhandler[])(Lsc_ImageInfo_t* pContext,
-                                        tLSC_STATUS status,
-                                        Lsc_TranscieveInfo_t* pInfo) = {
-    LSC_OpenChannel, LSC_SelectLsc, LSC_StoreData, LSC_loadapplet, NULL};
+static bool LSC_IsExtLenRejected(const uint8_t* pRsp, int32_t len);
+tLSC_STATUS (LsSession::*LsSession::Applet_load_seqhandler[])(
+    Lsc_ImageInfo_t* pContext, tLSC_STATUS status,
+    Lsc_TranscieveInfo_t* pInfo) = {
+    &LsSession::LSC_OpenChannel, &LsSession::LSC_SelectLsc,
+    &LsSession::LSC_StoreData, &LsSession::LSC_loadapplet, NULL};
 
 /*******************************************************************************
 **
@@ -66,23 +43,27 @@ tLSC_STATUS (*Applet_load_seqhandler[])(Lsc_ImageInfo_t* pContext,
 ** Returns:         True if ok.
 **
 *******************************************************************************/
-bool initialize (IChannel_t* channel)
+bool LsSession::initialize(IChannel_t* channel, bool isShared)
 {
     static const char fn [] = "Ala_initialize";
 
     ALOGD ("%s: enter", fn);
 
-    gpLsc_Dwnld_Context = (pLsc_Dwnld_Context_t)malloc(sizeof(Lsc_Dwnld_Context_t));
-    if(gpLsc_Dwnld_Context != NULL)
+    mpLsc_Dwnld_Context = (pLsc_Dwnld_Context_t)malloc(sizeof(Lsc_Dwnld_Context_t));
+    if(mpLsc_Dwnld_Context != NULL)
     {
-        memset((void *)gpLsc_Dwnld_Context, 0, (uint32_t)sizeof(Lsc_Dwnld_Context_t));
+        memset((void *)mpLsc_Dwnld_Context, 0, (uint32_t)sizeof(Lsc_Dwnld_Context_t));
+        mpLsc_Dwnld_Context->Image_info.pScript = new ScriptSource();
+        mpLsc_Dwnld_Context->Image_info.pOut = new LsOutWriter();
     }
     else
     {
         ALOGD("%s: Memory allocation failed", fn);
         return (false);
     }
-    gpLsc_Dwnld_Context->mchannel = channel;
+    mpLsc_Dwnld_Context->mchannel = channel;
+    mIsShared = isShared;
+    mExtLenState = LS_EXT_LEN_UNKNOWN;
     if((channel != NULL) &&
        (channel->open) != NULL)
     {
@@ -111,13 +92,15 @@ bool initialize (IChannel_t* channel)
 ** Returns:         None
 **
 *******************************************************************************/
-void finalize() {
+void LsSession::finalize() {
   static const char fn[] = "Lsc_finalize";
   ALOGD("%s: enter", fn);
   mIsInit = false;
-  if (gpLsc_Dwnld_Context != NULL) {
-    free(gpLsc_Dwnld_Context);
-    gpLsc_Dwnld_Context = NULL;
+  if (mpLsc_Dwnld_Context != NULL) {
+    delete mpLsc_Dwnld_Context->Image_info.pScript;
+    delete mpLsc_Dwnld_Context->Image_info.pOut;
+    free(mpLsc_Dwnld_Context);
+    mpLsc_Dwnld_Context = NULL;
   }
   ALOGD("%s: exit", fn);
 }
@@ -131,8 +114,9 @@ void finalize() {
 ** Returns:         Success if ok.
 **
 *******************************************************************************/
-tLSC_STATUS Perform_LSC(const char* name, const char* dest,
-                        const uint8_t* pdata, uint16_t len, uint8_t* respSW) {
+tLSC_STATUS LsSession::Perform_LSC(const char* name, const char* dest,
+                                   const uint8_t* pdata, uint16_t len,
+                                   uint8_t* respSW) {
   static const char fn[] = "Perform_LSC";
   tLSC_STATUS status = STATUS_FAILED;
   ALOGD("%s: enter; sha-len=%d", fn, len);
@@ -162,6 +146,123 @@ tLSC_STATUS Perform_LSC(const char* name, const char* dest,
 }
 /*******************************************************************************
 **
+** Function:        Perform_LSC_Batch
+**
+** Description:     Executes the scripts in order on one logical channel.
+**                  The Lsc is selected again only when its AID changed or
+**                  the previous script failed, the channel is closed once
+**                  at the end. The LS status is left to 6340 if a script
+**                  failed.
+**
+** Returns:         Success if all scripts succeeded.
+**
+*******************************************************************************/
+tLSC_STATUS LsSession::Perform_LSC_Batch(LsScript_t* pScripts, uint8_t count) {
+  static const char fn[] = "Perform_LSC_Batch";
+  tLSC_STATUS status = STATUS_FAILED;
+  tLSC_STATUS batchStatus = STATUS_SUCCESS;
+  bool isSelected = false;
+  uint32_t allocCount = phLS_getAllocCount();
+  ALOGD("%s: enter; count=%d", fn, count);
+
+  if (mIsInit == false) {
+    ALOGD("%s: LSC lib is not initialized", fn);
+    return STATUS_FAILED;
+  } else if ((pScripts == NULL) || (count == 0)) {
+    ALOGD("%s: Invalid parameter", fn);
+    return STATUS_FAILED;
+  }
+  Lsc_ImageInfo_t update_info =
+      (Lsc_ImageInfo_t)mpLsc_Dwnld_Context->Image_info;
+  Lsc_TranscieveInfo_t trans_info =
+      (Lsc_TranscieveInfo_t)mpLsc_Dwnld_Context->Transcv_Info;
+
+  for (uint8_t i = 0; i < count; i++) {
+    pScripts[i].status = STATUS_FAILED;
+    memset(pScripts[i].respSW, 0, sizeof(pScripts[i].respSW));
+  }
+  status = LSC_OpenChannel(&update_info, STATUS_FAILED, &trans_info);
+  if (status != STATUS_OK) {
+    for (uint8_t i = 0; i < count; i++) {
+      memcpy(pScripts[i].respSW, lsExecuteResp, sizeof(lsExecuteResp));
+    }
+    ALOGE("%s: exit; open channel failed", fn);
+    return status;
+  }
+
+  for (uint8_t i = 0; i < count; i++) {
+    LsScript_t* pScript = &pScripts[i];
+    ALOGD("%s: script %d: %s", fn, i, pScript->name);
+    if ((pScript->name == NULL) || (pScript->pHash == NULL) ||
+        (pScript->hashLen == 0) ||
+        (pScript->hashLen > (sizeof(StoreData) - 2))) {
+      ALOGE("%s: Invalid script %d", fn, i);
+      batchStatus = STATUS_FAILED;
+      continue;
+    }
+    update_info.fls_path[0] = '\0';
+    strlcat(update_info.fls_path, pScript->name, sizeof(update_info.fls_path));
+    update_info.fls_RespPath[0] = '\0';
+    if (pScript->dest != NULL) {
+      strlcat(update_info.fls_RespPath, pScript->dest,
+              sizeof(update_info.fls_RespPath));
+      update_info.bytes_wrote = 0xAA;
+    } else {
+      update_info.bytes_wrote = 0x55;
+    }
+    lsExecuteResp[2] = 0x00;
+    lsExecuteResp[3] = 0x00;
+    StoreData[0] = STORE_DATA_TAG;
+    StoreData[1] = pScript->hashLen;
+    memcpy(&StoreData[2], pScript->pHash, pScript->hashLen);
+
+    status = STATUS_FAILED;
+    if (LSC_UpdateExeStatus(LS_DEFAULT_STATUS) != true) {
+      ALOGE("%s: LS status update failed", fn);
+    } else {
+      /*A new LS AID is pending when the previous script updated the LS*/
+      if (!isSelected || update_info.isUpdaterMode) {
+        status = LSC_SelectLsc(&update_info, STATUS_FAILED, &trans_info);
+        isSelected = (status == STATUS_OK);
+      } else {
+        status = STATUS_OK;
+      }
+      if (status == STATUS_OK) {
+        status = LSC_StoreData(&update_info, STATUS_FAILED, &trans_info);
+      }
+      if (status == STATUS_OK) {
+        status = LSC_loadapplet(&update_info, STATUS_FAILED, &trans_info);
+      }
+      IChannelStats_SetPhase(ICHANNEL_PHASE_OTHER);
+    }
+    if (status != STATUS_OK) {
+      /*State of the Lsc unknown*/
+      isSelected = false;
+      batchStatus = status;
+      if ((lsExecuteResp[2] == 0x90) && (lsExecuteResp[3] == 0x00)) {
+        lsExecuteResp[2] = LS_ABORT_SW1;
+        lsExecuteResp[3] = LS_ABORT_SW2;
+      }
+    }
+    memcpy(pScript->respSW, lsExecuteResp, sizeof(lsExecuteResp));
+    pScript->status = status;
+    ALOGD("%s: script %d status=0x%x SW=%2x%2x", fn, i, status,
+          lsExecuteResp[2], lsExecuteResp[3]);
+  }
+
+  LSC_CloseChannel(&update_info, STATUS_FAILED, &trans_info);
+  /*A later script succeeding must not hide the failed one at next boot*/
+  if ((batchStatus != STATUS_SUCCESS) &&
+      (LSC_UpdateExeStatus(LS_DEFAULT_STATUS) != true)) {
+    ALOGE("%s: LS status update failed", fn);
+  }
+  ALOGD("%s: heap allocations=%u arena peak=%u", fn,
+        phLS_getAllocCount() - allocCount, mpLsc_Dwnld_Context->arena.peak);
+  ALOGD("%s: exit; status=0x%x", fn, batchStatus);
+  return batchStatus;
+}
+/*******************************************************************************
+**
 ** Function:        LSC_update_seq_handler
 **
 ** Description:     Performs the LSC update sequence handler sequence
@@ -169,17 +270,19 @@ tLSC_STATUS Perform_LSC(const char* name, const char* dest,
 ** Returns:         Success if ok.
 **
 *******************************************************************************/
-tLSC_STATUS LSC_update_seq_handler(
-    tLSC_STATUS (*seq_handler[])(Lsc_ImageInfo_t* pContext, tLSC_STATUS status,
-                                 Lsc_TranscieveInfo_t* pInfo),
+tLSC_STATUS LsSession::LSC_update_seq_handler(
+    tLSC_STATUS (LsSession::*seq_handler[])(Lsc_ImageInfo_t* pContext,
+                                            tLSC_STATUS status,
+                                            Lsc_TranscieveInfo_t* pInfo),
     const char* name, const char* dest) {
   static const char fn[] = "LSC_update_seq_handler";
   uint16_t seq_counter = 0;
   Lsc_ImageInfo_t update_info =
-      (Lsc_ImageInfo_t)gpLsc_Dwnld_Context->Image_info;
+      (Lsc_ImageInfo_t)mpLsc_Dwnld_Context->Image_info;
   Lsc_TranscieveInfo_t trans_info =
-      (Lsc_TranscieveInfo_t)gpLsc_Dwnld_Context->Transcv_Info;
+      (Lsc_TranscieveInfo_t)mpLsc_Dwnld_Context->Transcv_Info;
   tLSC_STATUS status = STATUS_FAILED;
+  uint32_t allocCount = phLS_getAllocCount();
   ALOGD("%s: enter", fn);
 
   if (dest != NULL) {
@@ -198,7 +301,9 @@ tLSC_STATUS LSC_update_seq_handler(
 
   while ((seq_handler[seq_counter]) != NULL) {
     status = STATUS_FAILED;
-    status = (*(seq_handler[seq_counter]))(&update_info, status, &trans_info);
+    status = (this->*(seq_handler[seq_counter]))(&update_info, status,
+                                                  &trans_info);
+    IChannelStats_SetPhase(ICHANNEL_PHASE_OTHER);
     if (STATUS_SUCCESS != status) {
       ALOGE("%s: exiting; status=0x0%X", fn, status);
       break;
@@ -207,6 +312,8 @@ tLSC_STATUS LSC_update_seq_handler(
   }
 
   LSC_CloseChannel(&update_info, STATUS_FAILED, &trans_info);
+  ALOGD("%s: heap allocations=%u arena peak=%u", fn,
+        phLS_getAllocCount() - allocCount, mpLsc_Dwnld_Context->arena.peak);
   ALOGE("%s: exit; status=0x%x", fn, status);
   return status;
 }
@@ -219,8 +326,9 @@ tLSC_STATUS LSC_update_seq_handler(
 ** Returns:         Success if ok.
 **
 *******************************************************************************/
-tLSC_STATUS LSC_OpenChannel(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
-                            Lsc_TranscieveInfo_t* pTranscv_Info) {
+tLSC_STATUS LsSession::LSC_OpenChannel(Lsc_ImageInfo_t* Os_info,
+                                       tLSC_STATUS status,
+                                       Lsc_TranscieveInfo_t* pTranscv_Info) {
   static const char fn[] = "LSC_OpenChannel";
   tLSC_STATUS transStat = STATUS_FAILED;
   phNxpLs_data cmdApdu;
@@ -235,8 +343,7 @@ tLSC_STATUS LSC_OpenChannel(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
     phLS_memset(&rspApdu, 0x00, sizeof(phNxpLs_data));
 
     cmdApdu.len = (int32_t)sizeof(OpenChannel);
-    cmdApdu.p_data = (uint8_t*)phLS_memalloc(cmdApdu.len * sizeof(uint8_t));
-    memcpy(cmdApdu.p_data, OpenChannel, cmdApdu.len);
+    cmdApdu.p_data = OpenChannel;
 
     ALOGD("%s: Calling Secure Element Transceive", fn);
     transStat = LSC_Transceive(&cmdApdu, &rspApdu);
@@ -259,7 +366,6 @@ tLSC_STATUS LSC_OpenChannel(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
       status = STATUS_FAILED;
       ALOGE("%s: invalid response = 0x%X", fn, status);
     }
-    phLS_free(cmdApdu.p_data);
   }
 
   ALOGE("%s: exit; status=0x%x", fn, status);
@@ -275,13 +381,15 @@ tLSC_STATUS LSC_OpenChannel(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
 ** Returns:         Success if ok.
 **
 *******************************************************************************/
-tLSC_STATUS LSC_SelectLsc(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
-                          Lsc_TranscieveInfo_t* pTranscv_Info) {
+tLSC_STATUS LsSession::LSC_SelectLsc(Lsc_ImageInfo_t* Os_info,
+                                     tLSC_STATUS status,
+                                     Lsc_TranscieveInfo_t* pTranscv_Info) {
   static const char fn[] = "LSC_SelectLsc";
   tLSC_STATUS transStat = STATUS_FAILED;
   phNxpLs_data cmdApdu;
   phNxpLs_data rspApdu;
   unsigned long semsPresent = 1;
+  uint32_t mark = mpLsc_Dwnld_Context->arena.used;
 
   if (Os_info == NULL || pTranscv_Info == NULL) {
     ALOGD("%s: Invalid parameter", fn);
@@ -289,7 +397,7 @@ tLSC_STATUS LSC_SelectLsc(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
     phLS_memset(&cmdApdu, 0x00, sizeof(phNxpLs_data));
     phLS_memset(&rspApdu, 0x00, sizeof(phNxpLs_data));
 
-  if(!GetNxpNumValue(NAME_NXP_SEMS_SUPPORTED, &semsPresent, sizeof(semsPresent))) {
+  if(!GetNxpNum(CFG_NXP_SEMS_SUPPORTED, &semsPresent, sizeof(semsPresent))) {
     ALOGE("%s: Failed to retrieve value NAME_NXP_SEMS_SUPPORTED ", __func__);
   }
 
@@ -297,13 +405,21 @@ tLSC_STATUS LSC_SelectLsc(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
   {
     if (Os_info->isUpdaterMode) {
       cmdApdu.len = (int32_t)(AID_ARRAY[0]);
-      cmdApdu.p_data = (uint8_t *)phLS_memalloc(cmdApdu.len * sizeof(uint8_t));
+      cmdApdu.p_data = LSC_ArenaAlloc(cmdApdu.len);
+      if (cmdApdu.p_data == NULL) {
+        ALOGE("%s: Memory allocation failed", fn);
+        return STATUS_FAILED;
+      }
       cmdApdu.p_data[0] = Os_info->Channel_Info[0].channel_id;
       memcpy(&(cmdApdu.p_data[1]), &AID_ARRAY[2], cmdApdu.len - 1);
       Os_info->isUpdaterMode = false;
     } else {
       cmdApdu.len = (int32_t)(sizeof(SelectSEMS) + 1);
-      cmdApdu.p_data = (uint8_t *)phLS_memalloc(cmdApdu.len * sizeof(uint8_t));
+      cmdApdu.p_data = LSC_ArenaAlloc(cmdApdu.len);
+      if (cmdApdu.p_data == NULL) {
+        ALOGE("%s: Memory allocation failed", fn);
+        return STATUS_FAILED;
+      }
       cmdApdu.p_data[0] = Os_info->Channel_Info[0].channel_id;
       memcpy(&(cmdApdu.p_data[1]), SelectSEMS, sizeof(SelectSEMS));
     }
@@ -312,7 +428,11 @@ tLSC_STATUS LSC_SelectLsc(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
   {
     /*p_data will have channel_id (1 byte) + SelectLsc APDU*/
     cmdApdu.len = (int32_t)(sizeof(SelectLsc) + 1);
-    cmdApdu.p_data = (uint8_t*)phLS_memalloc(cmdApdu.len * sizeof(uint8_t));
+    cmdApdu.p_data = LSC_ArenaAlloc(cmdApdu.len);
+    if (cmdApdu.p_data == NULL) {
+      ALOGE("%s: Memory allocation failed", fn);
+      return STATUS_FAILED;
+    }
     cmdApdu.p_data[0] = Os_info->Channel_Info[0].channel_id;
     memcpy(&(cmdApdu.p_data[1]), SelectLsc, sizeof(SelectLsc));
   }
@@ -339,9 +459,13 @@ tLSC_STATUS LSC_SelectLsc(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
     }
     if(status == STATUS_FAILED && semsPresent)
     {
-      phLS_free(cmdApdu.p_data);
+      LSC_ArenaRelease(mark);
       cmdApdu.len = (int32_t)(sizeof(SelectSEMSUpdater) + 1);
-      cmdApdu.p_data = (uint8_t*)phLS_memalloc(cmdApdu.len * sizeof(uint8_t));
+      cmdApdu.p_data = LSC_ArenaAlloc(cmdApdu.len);
+      if (cmdApdu.p_data == NULL) {
+        ALOGE("%s: Memory allocation failed", fn);
+        return STATUS_FAILED;
+      }
       cmdApdu.p_data[0] = Os_info->Channel_Info[0].channel_id;
       memcpy(&(cmdApdu.p_data[1]), SelectSEMSUpdater, sizeof(SelectSEMSUpdater));
       transStat = LSC_Transceive(&cmdApdu, &rspApdu);
@@ -364,7 +488,7 @@ tLSC_STATUS LSC_SelectLsc(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
         status = STATUS_FAILED;
       }
     }
-    phLS_free(cmdApdu.p_data);
+    LSC_ArenaRelease(mark);
   }
   ALOGE("%s: exit; status=0x%x", fn, status);
   return status;
@@ -381,8 +505,9 @@ tLSC_STATUS LSC_SelectLsc(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
 ** Returns:         Success if ok.
 **
 *******************************************************************************/
-tLSC_STATUS LSC_StoreData(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
-                          Lsc_TranscieveInfo_t* pTranscv_Info) {
+tLSC_STATUS LsSession::LSC_StoreData(Lsc_ImageInfo_t* Os_info,
+                                     tLSC_STATUS status,
+                                     Lsc_TranscieveInfo_t* pTranscv_Info) {
   static const char fn[] = "LSC_StoreData";
   tLSC_STATUS transStat = STATUS_FAILED;
   phNxpLs_data cmdApdu;
@@ -394,8 +519,13 @@ tLSC_STATUS LSC_StoreData(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
   } else {
     phLS_memset(&cmdApdu, 0x00, sizeof(phNxpLs_data));
     phLS_memset(&rspApdu, 0x00, sizeof(phNxpLs_data));
+    uint32_t mark = mpLsc_Dwnld_Context->arena.used;
     cmdApdu.len = (int32_t)(5 + sizeof(StoreData));
-    cmdApdu.p_data = (uint8_t*)phLS_memalloc(cmdApdu.len * sizeof(uint8_t));
+    cmdApdu.p_data = LSC_ArenaAlloc(cmdApdu.len);
+    if (cmdApdu.p_data == NULL) {
+      ALOGE("%s: Memory allocation failed", fn);
+      return STATUS_FAILED;
+    }
 
     len = StoreData[1] + 2;  //+2 offset is for tag value and length byte
     cmdApdu.p_data[xx++] =
@@ -408,7 +538,7 @@ tLSC_STATUS LSC_StoreData(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
 
     ALOGD("%s: Calling Secure Element Transceive", fn);
     transStat = LSC_Transceive(&cmdApdu, &rspApdu);
-    phLS_free(cmdApdu.p_data);
+    LSC_ArenaRelease(mark);
     if ((transStat != STATUS_SUCCESS) && (rspApdu.len == 0x00)) {
       status = STATUS_FAILED;
       ALOGE("%s: SE transceive failed status = 0x%X", fn, status);
@@ -435,12 +565,13 @@ tLSC_STATUS LSC_StoreData(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
 ** Returns:         Success if ok.
 **
 *******************************************************************************/
-tLSC_STATUS LSC_loadapplet(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
-                           Lsc_TranscieveInfo_t* pTranscv_Info) {
+tLSC_STATUS LsSession::LSC_loadapplet(Lsc_ImageInfo_t* Os_info,
+                                      tLSC_STATUS status,
+                                      Lsc_TranscieveInfo_t* pTranscv_Info) {
   static const char fn[] = "LSC_loadapplet";
-  int wResult;
   int32_t wLen = 0;
   uint8_t temp_buf[1024];
+  uint8_t* pRec = temp_buf;
   uint8_t len_byte = 0, offset = 0;
   bool reachEOFCheck = false;
   tLSC_STATUS tag40_found = STATUS_FAILED;
@@ -451,10 +582,9 @@ tLSC_STATUS LSC_loadapplet(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
   }
   Os_info->bytes_read = 0;
   if (Os_info->bytes_wrote == 0xAA) {
-    Os_info->fResp = fopen(Os_info->fls_RespPath, "a+");
-    if (Os_info->fResp == NULL) {
-      ALOGE("Error opening response recording file <%s> for reading: %s",
-            Os_info->fls_RespPath, strerror(errno));
+    if (!Os_info->pOut->open(Os_info->fls_RespPath)) {
+      ALOGE("Error opening response recording file <%s>",
+            Os_info->fls_RespPath);
       return status;
     }
     ALOGD("%s: Response OUT FILE path is successfully created", fn);
@@ -462,27 +592,15 @@ tLSC_STATUS LSC_loadapplet(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
     ALOGD("%s: Response Out file is optional as per input", fn);
   }
   ALOGD("%s: enter", fn);
-  Os_info->fp = fopen(Os_info->fls_path, "r");
-
-  if (Os_info->fp == NULL) {
-    ALOGE("Error opening OS image file <%s> for reading: %s", Os_info->fls_path,
-          strerror(errno));
+  if (!Os_info->pScript->open(Os_info->fls_path)) {
+    ALOGE("Error opening OS image file <%s> for reading", Os_info->fls_path);
+    Os_info->pOut->close();
     return status;
   }
-  wResult = fseek(Os_info->fp, 0L, SEEK_END);
-  if (wResult) {
-    ALOGE("Error seeking end OS image file %s", strerror(errno));
-    goto exit;
-  }
-  Os_info->fls_size = ftell(Os_info->fp);
+  Os_info->fls_size = Os_info->pScript->size();
   ALOGE("fls_size=%d", Os_info->fls_size);
-  if (Os_info->fls_size < 0) {
-    ALOGE("Error ftelling file %s", strerror(errno));
-    goto exit;
-  }
-  wResult = fseek(Os_info->fp, 0L, SEEK_SET);
-  if (wResult) {
-    ALOGE("Error seeking start image file %s", strerror(errno));
+  status = LSC_LoadBinScript(Os_info);
+  if (status != STATUS_OK) {
     goto exit;
   }
   status = LSC_Check_KeyIdentifier(Os_info, status, pTranscv_Info, NULL,
@@ -490,25 +608,27 @@ tLSC_STATUS LSC_loadapplet(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
   if (status != STATUS_OK) {
     goto exit;
   }
-  while (!feof(Os_info->fp) && (Os_info->bytes_read < Os_info->fls_size)) {
+  /*Certificate and signature responses are recorded*/
+  Os_info->pOut->sync();
+  while (LSC_IsScriptPending(Os_info)) {
     len_byte = 0x00;
     offset = 0;
     /*Check if the certificate/ is verified or not*/
     memset(temp_buf, 0, sizeof(temp_buf));
     ALOGE("%s; Start of line processing", fn);
-    status = LSC_ReadScript(Os_info, temp_buf);
+    status = LSC_ReadScript(Os_info, temp_buf, &pRec);
     if (status != STATUS_OK) {
       goto exit;
     } else if (status == STATUS_OK) {
       /*Reset the flag in case further commands exists*/
       reachEOFCheck = false;
     }
-    if (temp_buf[offset] == TAG_LSC_CMD_ID) {
+    if (pRec[offset] == TAG_LSC_CMD_ID) {
       /*
        * start sending the packet to Lsc
        * */
       offset = offset + 1;
-      len_byte = Numof_lengthbytes(&temp_buf[offset], &wLen);
+      len_byte = Numof_lengthbytes(&pRec[offset], &wLen);
       /*If the len data not present or
        * len is less than or equal to 32*/
       if ((len_byte == 0) || (wLen <= 32))
@@ -520,7 +640,7 @@ tLSC_STATUS LSC_loadapplet(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
         tag40_found = STATUS_OK;
         offset = offset + len_byte;
         pTranscv_Info->sSendlength = wLen;
-        memcpy(pTranscv_Info->sSendData, &temp_buf[offset], wLen);
+        memcpy(pTranscv_Info->sSendData, &pRec[offset], wLen);
       }
       status = LSC_SendtoLsc(Os_info, status, pTranscv_Info, LS_Comm);
       if (status != STATUS_OK) {
@@ -556,8 +676,8 @@ tLSC_STATUS LSC_loadapplet(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
         ALOGE("Sending packet to lsc failed");
         goto exit;
       }
-    } else if ((temp_buf[offset] == (0x7F)) &&
-               (temp_buf[offset + 1] == (0x21))) {
+    } else if ((pRec[offset] == (0x7F)) &&
+               (pRec[offset + 1] == (0x21))) {
       ALOGD("TAGID: Encountered again certificate tag 7F21");
       if (tag40_found == STATUS_OK) {
         ALOGD("2nd Script processing starts with reselect");
@@ -571,9 +691,9 @@ tLSC_STATUS LSC_loadapplet(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
             ALOGD(
                 "2nd Script store data success next certificate verification");
             offset = offset + 2;
-            len_byte = Numof_lengthbytes(&temp_buf[offset], &wLen);
+            len_byte = Numof_lengthbytes(&pRec[offset], &wLen);
             status = LSC_Check_KeyIdentifier(Os_info, status, pTranscv_Info,
-                                             temp_buf, STATUS_OK,
+                                             pRec, STATUS_OK,
                                              wLen + len_byte + 2);
           }
         }
@@ -582,6 +702,7 @@ tLSC_STATUS LSC_loadapplet(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
           /*If the certificate is verified for 6320 then new
            * script starts*/
           tag40_found = STATUS_FAILED;
+          Os_info->pOut->sync();
         }
         /*If the certificate or signature verification failed*/
         else {
@@ -591,12 +712,12 @@ tLSC_STATUS LSC_loadapplet(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
       /*Already certificate&Sginature verified previously skip 7f21& tag 60*/
       else {
         memset(temp_buf, 0, sizeof(temp_buf));
-        status = LSC_ReadScript(Os_info, temp_buf);
+        status = LSC_ReadScript(Os_info, temp_buf, &pRec);
         if (status != STATUS_OK) {
           ALOGE("%s; Next Tag has to TAG 60 not found", fn);
           goto exit;
         }
-        if (temp_buf[offset] == TAG_JSBL_HDR_ID)
+        if (pRec[offset] == TAG_JSBL_HDR_ID)
           continue;
         else
           goto exit;
@@ -610,24 +731,24 @@ tLSC_STATUS LSC_loadapplet(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
       break;
     }
   }
-  if (Os_info->bytes_wrote == 0xAA) {
-    fclose(Os_info->fResp);
+  if (!Os_info->pOut->close()) {
+    ALOGE("%s: Response out file is incomplete", fn);
   }
   LSC_UpdateExeStatus(LS_SUCCESS_STATUS);
-  wResult = fclose(Os_info->fp);
+  Os_info->pScript->close();
+  Os_info->pBinScript = NULL;
   ALOGE("%s exit;End of Load Applet; status=0x%x", fn, status);
   return status;
 exit:
-  wResult = fclose(Os_info->fp);
-  if (Os_info->bytes_wrote == 0xAA) {
-    fclose(Os_info->fResp);
-  }
+  Os_info->pScript->close();
+  Os_info->pBinScript = NULL;
+  Os_info->pOut->close();
   /*Script ends with SW 6320 and reached END OF FILE*/
   if (reachEOFCheck == true) {
     status = STATUS_OK;
     LSC_UpdateExeStatus(LS_SUCCESS_STATUS);
   }
-  ALOGE("%s close fp and exit; status= 0x%X", fn, status);
+  ALOGE("%s close script and exit; status= 0x%X", fn, status);
   return status;
 }
 /*******************************************************************************
@@ -639,36 +760,37 @@ exit:
 ** Returns:         Success if ok.
 **
 *******************************************************************************/
-tLSC_STATUS LSC_Check_KeyIdentifier(Lsc_ImageInfo_t* Os_info,
-                                    tLSC_STATUS status,
-                                    Lsc_TranscieveInfo_t* pTranscv_Info,
-                                    uint8_t* temp_buf, tLSC_STATUS flag,
-                                    int32_t wNewLen) {
+tLSC_STATUS LsSession::LSC_Check_KeyIdentifier(
+    Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
+    Lsc_TranscieveInfo_t* pTranscv_Info, uint8_t* temp_buf, tLSC_STATUS flag,
+    int32_t wNewLen) {
   static const char fn[] = "LSC_Check_KeyIdentifier";
   uint16_t offset = 0x00, len_byte = 0;
   status = STATUS_FAILED;
   uint8_t read_buf[1024];
+  uint8_t* pRec = read_buf;
   int32_t wLen;
   uint8_t certf_found = STATUS_FAILED;
   uint8_t sign_found = STATUS_FAILED;
   ALOGD("%s: enter", fn);
 
-  while (!feof(Os_info->fp) && (Os_info->bytes_read < Os_info->fls_size)) {
+  while (LSC_IsScriptPending(Os_info)) {
     offset = 0x00;
     wLen = 0;
     if (flag == STATUS_OK) {
       /*If the 7F21 TAG is already read: After TAG 40*/
       memcpy(read_buf, temp_buf, wNewLen);
+      pRec = read_buf;
       status = STATUS_OK;
       flag = STATUS_FAILED;
     } else {
       /*If the 7F21 TAG is not read: Before TAG 40*/
       memset(read_buf, 0, sizeof(read_buf));
-      status = LSC_ReadScript(Os_info, read_buf);
+      status = LSC_ReadScript(Os_info, read_buf, &pRec);
     }
     if (status != STATUS_OK) return status;
     if (STATUS_OK ==
-        Check_Complete_7F21_Tag(Os_info, pTranscv_Info, read_buf, &offset)) {
+        Check_Complete_7F21_Tag(Os_info, pTranscv_Info, pRec, &offset)) {
       ALOGD("%s: Certificate is verified", fn);
       certf_found = STATUS_OK;
       break;
@@ -676,7 +798,7 @@ tLSC_STATUS LSC_Check_KeyIdentifier(Lsc_ImageInfo_t* Os_info,
     /*The Loader Service Client ignores all subsequent commands starting by tag
      * �7F21� or tag �60� until the first command starting by tag �40� is
      * found*/
-    else if (((read_buf[offset] == TAG_LSC_CMD_ID) &&
+    else if (((pRec[offset] == TAG_LSC_CMD_ID) &&
               (certf_found != STATUS_OK))) {
       ALOGE("%s: NOT FOUND Root entity identifier's certificate", fn);
       status = STATUS_FAILED;
@@ -687,24 +809,24 @@ tLSC_STATUS LSC_Check_KeyIdentifier(Lsc_ImageInfo_t* Os_info,
   if (certf_found == STATUS_OK) {
     offset = 0x00;
     wLen = 0;
-    status = LSC_ReadScript(Os_info, read_buf);
+    status = LSC_ReadScript(Os_info, read_buf, &pRec);
     if (status != STATUS_OK)
       return status;
     else
       status = STATUS_FAILED;
 
-    if ((read_buf[offset] == TAG_JSBL_HDR_ID) &&
+    if ((pRec[offset] == TAG_JSBL_HDR_ID) &&
         (certf_found != STATUS_FAILED) && (sign_found != STATUS_OK))
 
     {
       // TODO check the SElect cmd response and return status accordingly
       ALOGD("TAGID: TAG_JSBL_HDR_ID");
       offset = offset + 1;
-      len_byte = Numof_lengthbytes(&read_buf[offset], &wLen);
+      len_byte = Numof_lengthbytes(&pRec[offset], &wLen);
       offset = offset + len_byte;
-      if (read_buf[offset] == TAG_SIGNATURE_ID) {
+      if (pRec[offset] == TAG_SIGNATURE_ID) {
         offset = offset + 1;
-        len_byte = Numof_lengthbytes(&read_buf[offset], &wLen);
+        len_byte = Numof_lengthbytes(&pRec[offset], &wLen);
         offset = offset + len_byte;
         ALOGE("TAGID: TAG_SIGNATURE_ID");
 
@@ -716,7 +838,7 @@ tLSC_STATUS LSC_Check_KeyIdentifier(Lsc_ImageInfo_t* Os_info,
         pTranscv_Info->sSendData[3] = 0x00;
         pTranscv_Info->sSendData[4] = wLen;
 
-        memcpy(&(pTranscv_Info->sSendData[5]), &read_buf[offset], wLen);
+        memcpy(&(pTranscv_Info->sSendData[5]), &pRec[offset], wLen);
         ALOGE("%s: start transceive for length %ld", fn,
               (long)pTranscv_Info->sSendlength);
         status = LSC_SendtoLsc(Os_info, status, pTranscv_Info, LS_Sign);
@@ -726,7 +848,7 @@ tLSC_STATUS LSC_Check_KeyIdentifier(Lsc_ImageInfo_t* Os_info,
           sign_found = STATUS_OK;
         }
       }
-    } else if (read_buf[offset] != TAG_JSBL_HDR_ID) {
+    } else if (pRec[offset] != TAG_JSBL_HDR_ID) {
       status = STATUS_FAILED;
     }
   } else {
@@ -745,24 +867,32 @@ tLSC_STATUS LSC_Check_KeyIdentifier(Lsc_ImageInfo_t* Os_info,
 ** Returns:         Success if ok.
 **
 *******************************************************************************/
-tLSC_STATUS LSC_ReadScript(Lsc_ImageInfo_t* Os_info, uint8_t* read_buf) {
+tLSC_STATUS LsSession::LSC_ReadScript(Lsc_ImageInfo_t* Os_info,
+                                      uint8_t* read_buf, uint8_t** ppRecord) {
   static const char fn[] = "LSC_ReadScript";
+  ScriptSource* pScript = Os_info->pScript;
   int32_t wCount, wLen, wIndex = 0;
   uint8_t len_byte = 0;
   int wResult = 0;
-  tLSC_STATUS status = STATUS_FAILED;
   int32_t lenOff = 1;
   bool isMetaDatapresent = false;
 
   ALOGD("%s: enter", fn);
 
-  for (wCount = 0; (wCount < 2 && !feof(Os_info->fp)); wCount++, wIndex++) {
-    wResult = FSCANF_BYTE(Os_info->fp, "%2X", (unsigned int*)&read_buf[wIndex]);
+  if (Os_info->isBinScript) {
+    return LSC_ReadBinScript(Os_info, ppRecord);
+  }
+  *ppRecord = read_buf;
+
+  for (wCount = 0; (wCount < 2 && !pScript->atEnd()); wCount++, wIndex++) {
+    wResult = pScript->readHex(&read_buf[wIndex], 1);
 
     if(wResult == 0)
     {
       char metaString[MAX_META_STRING_SIZE];
-      char *ptr = fgets(metaString, sizeof(metaString), Os_info->fp);
+      char *ptr = pScript->readLine(metaString, sizeof(metaString))
+                      ? metaString
+                      : NULL;
       if(ptr != NULL)
       {
         isMetaDatapresent = true;
@@ -787,21 +917,13 @@ tLSC_STATUS LSC_ReadScript(Lsc_ImageInfo_t* Os_info, uint8_t* read_buf) {
       }
     }
   }
-  if (wResult == 0) return STATUS_FAILED;
-
-  Os_info->bytes_read = Os_info->bytes_read + (wCount * 2);
+  if ((wResult == 0) || (wCount < 2)) return STATUS_FAILED;
 
   if ((read_buf[0] == 0x7f) && (read_buf[1] == 0x21)) {
-    for (wCount = 0; (wCount < 1 && !feof(Os_info->fp)); wCount++, wIndex++) {
-      wResult =
-          FSCANF_BYTE(Os_info->fp, "%2X", (unsigned int*)&read_buf[wIndex]);
-    }
-    if (wResult == 0) {
+    if (pScript->readHex(&read_buf[wIndex++], 1) != 1) {
       ALOGE("%s: Exit Read Script failed in 7F21 ", fn);
       return STATUS_FAILED;
     }
-    /*Read_Script from wCount*2 to wCount*1 */
-    Os_info->bytes_read = Os_info->bytes_read + (wCount * 2);
     lenOff = 2;
   } else if ((read_buf[0] == 0x40) || (read_buf[0] == 0x60)) {
     lenOff = 1;
@@ -823,29 +945,20 @@ tLSC_STATUS LSC_ReadScript(Lsc_ImageInfo_t* Os_info, uint8_t* read_buf) {
     ALOGD("%s: Length byte Read from 0x80 is 0x%x ", fn, len_byte);
 
     if (len_byte == 0x02) {
-      for (wCount = 0; (wCount < 1 && !feof(Os_info->fp)); wCount++, wIndex++) {
-        wResult =
-            FSCANF_BYTE(Os_info->fp, "%2X", (unsigned int*)&read_buf[wIndex]);
-      }
-      if (wResult == 0) {
+      if (pScript->readHex(&read_buf[wIndex++], 1) != 1) {
         ALOGE("%s: Exit Read Script failed in length 0x02 ", fn);
         return STATUS_FAILED;
       }
 
       wLen = read_buf[lenOff + 1];
-      Os_info->bytes_read = Os_info->bytes_read + (wCount * 2);
       ALOGD("%s: Length of Read Script in len_byte= 0x02 is 0x%x ", fn, wLen);
     } else if (len_byte == 0x03) {
-      for (wCount = 0; (wCount < 2 && !feof(Os_info->fp)); wCount++, wIndex++) {
-        wResult =
-            FSCANF_BYTE(Os_info->fp, "%2X", (unsigned int*)&read_buf[wIndex]);
-      }
-      if (wResult == 0) {
+      if (pScript->readHex(&read_buf[wIndex], 2) != 2) {
         ALOGE("%s: Exit Read Script failed in length 0x03 ", fn);
         return STATUS_FAILED;
       }
+      wIndex += 2;
 
-      Os_info->bytes_read = Os_info->bytes_read + (wCount * 2);
       wLen = read_buf[lenOff + 1];  // Length of the packet send to LSC
       wLen = ((wLen << 8) | (read_buf[lenOff + 2]));
       ALOGD("%s: Length of Read Script in len_byte= 0x03 is 0x%x ", fn, wLen);
@@ -860,23 +973,202 @@ tLSC_STATUS LSC_ReadScript(Lsc_ImageInfo_t* Os_info, uint8_t* read_buf) {
     ALOGE("%s: Length of Read Script in len_byte= 0x01 is 0x%x ", fn, wLen);
   }
 
-  for (wCount = 0; (wCount < wLen && !feof(Os_info->fp)); wCount++, wIndex++) {
-    wResult = FSCANF_BYTE(Os_info->fp, "%2X", (unsigned int*)&read_buf[wIndex]);
+  if ((wIndex + wLen) > LS_SCRIPT_MAX_REC_LEN) {
+    ALOGE("%s: Record of length %d exceeds buffer", fn, wLen);
+    return STATUS_FAILED;
+  }
+  if (pScript->readHex(&read_buf[wIndex], wLen) != wLen) {
+    ALOGE("%s: Exit Read Script failed at offset %d, invalid character at %d",
+          fn, pScript->offset(), pScript->errorOffset());
+    return STATUS_FAILED;
   }
+  wIndex += wLen;
+  Os_info->bytes_read = pScript->offset();
 
-  if (wResult == 0) {
-    ALOGE("%s: Exit Read Script failed in fscanf function ", fn);
-    return status;
+  ALOGD("%s: exit: status=0x%x; Num of bytes read=%d and index=%d", fn,
+        STATUS_OK, Os_info->bytes_read, wIndex);
+
+  return STATUS_OK;
+}
+
+/*******************************************************************************
+**
+** Function:        LSC_GetLe32
+**
+** Description:     Reads a little endian 32 bit value of the binary script
+**
+** Returns:         Value read
+**
+*******************************************************************************/
+static inline uint32_t LSC_GetLe32(const uint8_t* p) {
+  return ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+          ((uint32_t)p[3] << 24));
+}
+
+/*******************************************************************************
+**
+** Function:        LSC_BinRecOffset
+**
+** Description:     Returns the offset of record idx of the binary script
+**
+** Returns:         Record offset from start of file
+**
+*******************************************************************************/
+static inline uint32_t LSC_BinRecOffset(Lsc_ImageInfo_t* Os_info,
+                                        uint32_t idx) {
+  return LSC_GetLe32(&Os_info->pBinScript[LS_BIN_SCRIPT_HDR_LEN + (idx * 4)]);
+}
+
+/*******************************************************************************
+**
+** Function:        LSC_IsValidBinRecord
+**
+** Description:     Checks that a binary script record holds exactly one
+**                  TLV with tag 7F21, 60 or 40 and that it fits in the
+**                  buffers used to process it.
+**
+** Returns:         true if valid
+**
+*******************************************************************************/
+static bool LSC_IsValidBinRecord(const uint8_t* pRec, uint32_t recLen) {
+  uint32_t lenOff = 0, len_byte = 0, wLen = 0;
+
+  if ((recLen < 3) || (recLen > LS_SCRIPT_MAX_REC_LEN)) return false;
+  if ((pRec[0] == 0x7F) && (pRec[1] == 0x21)) {
+    lenOff = 2;
+  } else if ((pRec[0] == TAG_LSC_CMD_ID) || (pRec[0] == TAG_JSBL_HDR_ID)) {
+    lenOff = 1;
   } else {
-    Os_info->bytes_read =
-        Os_info->bytes_read + (wCount * 2) + 1;  // not sure why 2 added
-    status = STATUS_OK;
+    return false;
+  }
+  if (pRec[lenOff] == 0x81) {
+    len_byte = 2;
+  } else if (pRec[lenOff] == 0x82) {
+    len_byte = 3;
+  } else if ((pRec[lenOff] == 0x00) || ((pRec[lenOff] & 0x80) == 0x80)) {
+    return false;
+  } else {
+    len_byte = 1;
   }
+  if ((lenOff + len_byte) > recLen) return false;
+  if (len_byte == 1) {
+    wLen = pRec[lenOff];
+  } else if (len_byte == 2) {
+    wLen = pRec[lenOff + 1];
+  } else {
+    wLen = ((uint32_t)pRec[lenOff + 1] << 8) | pRec[lenOff + 2];
+  }
+  return ((lenOff + len_byte + wLen) == recLen);
+}
 
-  ALOGD("%s: exit: status=0x%x; Num of bytes read=%d and index=%d", fn, status,
-        Os_info->bytes_read, wIndex);
+/*******************************************************************************
+**
+** Function:        LSC_LoadBinScript
+**
+** Description:     Checks if the opened script is a binary pre-compiled
+**                  script. If so its record offset table is validated.
+**
+** Returns:         Success if ok or script is in hex text format.
+**
+*******************************************************************************/
+tLSC_STATUS LsSession::LSC_LoadBinScript(Lsc_ImageInfo_t* Os_info) {
+  static const char fn[] = "LSC_LoadBinScript";
+  const uint8_t* pScript = Os_info->pScript->data();
+  uint32_t size = (uint32_t)Os_info->fls_size;
+  uint32_t cnt = 0, idx = 0, start = 0, end = 0;
+
+  Os_info->isBinScript = false;
+  Os_info->pBinScript = NULL;
+  Os_info->bin_rec_cnt = 0;
+  Os_info->bin_rec_idx = 0;
+  if ((size < LS_BIN_SCRIPT_HDR_LEN) ||
+      (memcmp(pScript, LS_BIN_SCRIPT_MAGIC, LS_BIN_SCRIPT_MAGIC_LEN) != 0)) {
+    /*Hex text script, parsed line by line*/
+    return STATUS_OK;
+  }
+  ALOGD("%s: binary script found; size=%u", fn, size);
+  if ((pScript[4] | (pScript[5] << 8)) != LS_BIN_SCRIPT_VERSION) {
+    ALOGE("%s: Unsupported version 0x%02X%02X", fn, pScript[5], pScript[4]);
+    return STATUS_FAILED;
+  }
+  cnt = LSC_GetLe32(&pScript[8]);
+  if ((cnt == 0) || (cnt > ((size - LS_BIN_SCRIPT_HDR_LEN) / 4))) {
+    ALOGE("%s: Invalid number of records %u", fn, cnt);
+    return STATUS_FAILED;
+  }
+  Os_info->pBinScript = pScript;
+  Os_info->bin_rec_cnt = cnt;
+  /*Records have to be in order, after the offset table and within the file*/
+  end = LS_BIN_SCRIPT_HDR_LEN + (cnt * 4);
+  start = LSC_BinRecOffset(Os_info, 0);
+  if (start < end) {
+    ALOGE("%s: Record 0 overlaps offset table", fn);
+    goto fail;
+  }
+  for (idx = 0; idx < cnt; idx++) {
+    start = LSC_BinRecOffset(Os_info, idx);
+    end = ((idx + 1) < cnt) ? LSC_BinRecOffset(Os_info, idx + 1) : size;
+    if ((start >= end) || (end > size) ||
+        !LSC_IsValidBinRecord(&pScript[start], end - start)) {
+      ALOGE("%s: Invalid record %u at offset %u", fn, idx, start);
+      goto fail;
+    }
+  }
+  Os_info->isBinScript = true;
+  Os_info->bytes_read = LSC_BinRecOffset(Os_info, 0);
+  ALOGD("%s: exit; records=%u", fn, cnt);
+  return STATUS_OK;
+fail:
+  Os_info->pBinScript = NULL;
+  Os_info->bin_rec_cnt = 0;
+  return STATUS_FAILED;
+}
 
-  return status;
+/*******************************************************************************
+**
+** Function:        LSC_ReadBinScript
+**
+** Description:     Returns the next record of a binary pre-compiled script
+**                  without copying it.
+**
+** Returns:         Success if ok.
+**
+*******************************************************************************/
+tLSC_STATUS LsSession::LSC_ReadBinScript(Lsc_ImageInfo_t* Os_info,
+                                         uint8_t** ppRecord) {
+  static const char fn[] = "LSC_ReadBinScript";
+  uint32_t idx = Os_info->bin_rec_idx;
+
+  if ((Os_info->pBinScript == NULL) || (idx >= Os_info->bin_rec_cnt)) {
+    ALOGE("%s: No record left in script", fn);
+    return STATUS_FAILED;
+  }
+  /*Records are only read, mapping stays read only*/
+  *ppRecord =
+      const_cast<uint8_t*>(&Os_info->pBinScript[LSC_BinRecOffset(Os_info, idx)]);
+  Os_info->bin_rec_idx++;
+  Os_info->bytes_read = (Os_info->bin_rec_idx < Os_info->bin_rec_cnt)
+                            ? LSC_BinRecOffset(Os_info, Os_info->bin_rec_idx)
+                            : Os_info->fls_size;
+  ALOGD("%s: record %u read; bytes read=%d", fn, idx, Os_info->bytes_read);
+  return STATUS_OK;
+}
+
+/*******************************************************************************
+**
+** Function:        LSC_IsScriptPending
+**
+** Description:     Checks if there are records left to read in the script
+**
+** Returns:         true if records are left
+**
+*******************************************************************************/
+bool LsSession::LSC_IsScriptPending(Lsc_ImageInfo_t* Os_info) {
+  if (Os_info->isBinScript) {
+    return (Os_info->bin_rec_idx < Os_info->bin_rec_cnt);
+  }
+  return (!Os_info->pScript->atEnd() &&
+          (Os_info->bytes_read < Os_info->fls_size));
 }
 
 /*******************************************************************************
@@ -888,8 +1180,9 @@ tLSC_STATUS LSC_ReadScript(Lsc_ImageInfo_t* Os_info, uint8_t* read_buf) {
 ** Returns:         Success if ok.
 **
 *******************************************************************************/
-tLSC_STATUS LSC_SendtoEse(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
-                          Lsc_TranscieveInfo_t* pTranscv_Info) {
+tLSC_STATUS LsSession::LSC_SendtoEse(Lsc_ImageInfo_t* Os_info,
+                                     tLSC_STATUS status,
+                                     Lsc_TranscieveInfo_t* pTranscv_Info) {
   static const char fn[] = "LSC_SendtoEse";
   bool chanl_open_cmd = false;
   tLSC_STATUS transStat = STATUS_FAILED;
@@ -925,11 +1218,10 @@ tLSC_STATUS LSC_SendtoEse(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
     phLS_memset(&rspApdu, 0x00, sizeof(phNxpLs_data));
 
     cmdApdu.len = (int32_t)(pTranscv_Info->sSendlength);
-    cmdApdu.p_data = (uint8_t*)phLS_memalloc(cmdApdu.len * sizeof(uint8_t));
-    memcpy(cmdApdu.p_data, pTranscv_Info->sSendData, cmdApdu.len);
+    cmdApdu.p_data = pTranscv_Info->sSendData;
 
+    IChannelStats_SetPhase(ICHANNEL_PHASE_LS_CMD);
     transStat = LSC_Transceive(&cmdApdu, &rspApdu);
-    phLS_free(cmdApdu.p_data);
     if (transStat != STATUS_SUCCESS) {
       ALOGE("%s: Transceive failed; status=0x%X", fn, transStat);
     } else {
@@ -966,7 +1258,7 @@ tLSC_STATUS LSC_SendtoEse(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
       status = Send_Backall_Loadcmds(Os_info, status, pTranscv_Info);
       SendBack_cmds = false;
     } else {
-      memset(Cmd_Buffer, 0, sizeof(Cmd_Buffer));
+      LSC_ResetCmdBuffer();
       SendBack_cmds = false;
       status = STATUS_FAILED;
     }
@@ -985,36 +1277,49 @@ tLSC_STATUS LSC_SendtoEse(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
 ** Returns:         Success if ok.
 **
 *******************************************************************************/
-tLSC_STATUS LSC_SendtoLsc(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
-                          Lsc_TranscieveInfo_t* pTranscv_Info,
-                          Ls_TagType tType) {
+tLSC_STATUS LsSession::LSC_SendtoLsc(Lsc_ImageInfo_t* Os_info,
+                                     tLSC_STATUS status,
+                                     Lsc_TranscieveInfo_t* pTranscv_Info,
+                                     Ls_TagType tType) {
   static const char fn[] = "LSC_SendtoLsc";
   tLSC_STATUS transStat = STATUS_FAILED;
   status = STATUS_FAILED;
+  bool isExtended;
 
   phNxpLs_data cmdApdu;
   phNxpLs_data rspApdu;
   ALOGD("%s: enter", fn);
   pTranscv_Info->sSendData[0] = (0x80 | Os_info->Channel_Info[0].channel_id);
   pTranscv_Info->timeout = gTransceiveTimeout;
-  pTranscv_Info->sRecvlength = 1024;
+  pTranscv_Info->sRecvlength = sizeof(pTranscv_Info->sRecvData);
+  isExtended = (pTranscv_Info->sSendlength > (5 + MAX_SIZE)) &&
+               (pTranscv_Info->sSendData[4] == 0x00);
 
   phLS_memset(&cmdApdu, 0x00, sizeof(phNxpLs_data));
   phLS_memset(&rspApdu, 0x00, sizeof(phNxpLs_data));
   cmdApdu.len = pTranscv_Info->sSendlength;
-  cmdApdu.p_data = (uint8_t*)phLS_memalloc(cmdApdu.len * sizeof(uint8_t));
-  memcpy(cmdApdu.p_data, pTranscv_Info->sSendData, cmdApdu.len);
+  cmdApdu.p_data = pTranscv_Info->sSendData;
 
+  /*Nested exchanges set their own phase, see LSC_ProcessResp*/
+  IChannelStats_SetPhase(((tType == LS_Cert) || (tType == LS_Sign))
+                             ? ICHANNEL_PHASE_LS_CERT
+                             : ICHANNEL_PHASE_LS_CMD);
   transStat = LSC_Transceive(&cmdApdu, &rspApdu);
 
   if (transStat != STATUS_SUCCESS) {
     ALOGE("%s: Transceive failed; status=0x%X", fn, transStat);
+  } else if (isExtended &&
+             LSC_IsExtLenRejected(rspApdu.p_data, rspApdu.len)) {
+    /*sRecvData now holds this reply, Process_EseResponse forwards its
+      own copy of the eSE response in short blocks*/
+    ALOGE("%s: Extended length not supported by Lsc", fn);
+    mExtLenState = LS_EXT_LEN_REJECTED;
   } else {
+    if (isExtended) mExtLenState = LS_EXT_LEN_SUPPORTED;
     memcpy(pTranscv_Info->sRecvData, rspApdu.p_data, rspApdu.len);
 
     status = LSC_ProcessResp(Os_info, rspApdu.len, pTranscv_Info, tType);
   }
-  phLS_free(cmdApdu.p_data);
   ALOGD("%s: exit: status=0x%x", fn, status);
   return status;
 }
@@ -1027,8 +1332,9 @@ tLSC_STATUS LSC_SendtoLsc(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
 ** Returns:         Success if ok.
 **
 *******************************************************************************/
-tLSC_STATUS LSC_CloseChannel(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
-                             Lsc_TranscieveInfo_t* pTranscv_Info) {
+tLSC_STATUS LsSession::LSC_CloseChannel(Lsc_ImageInfo_t* Os_info,
+                                        tLSC_STATUS status,
+                                        Lsc_TranscieveInfo_t* pTranscv_Info) {
   static const char fn[] = "LSC_CloseChannel";
   status = STATUS_FAILED;
   tLSC_STATUS transStat = STATUS_FAILED;
@@ -1045,10 +1351,9 @@ tLSC_STATUS LSC_CloseChannel(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
       phLS_memset(&cmdApdu, 0x00, sizeof(phNxpLs_data));
       phLS_memset(&rspApdu, 0x00, sizeof(phNxpLs_data));
 
-      cmdApdu.len = 5;
-      cmdApdu.p_data =
-          (uint8_t*)phLS_memalloc(cmdApdu.len * sizeof(uint8_t));
       if (Os_info->Channel_Info[cnt].isOpend == false) continue;
+      cmdApdu.len = 5;
+      cmdApdu.p_data = pTranscv_Info->sSendData;
       xx = 0;
       cmdApdu.p_data[xx++] = Os_info->Channel_Info[cnt].channel_id;
       cmdApdu.p_data[xx++] = 0x70;
@@ -1057,7 +1362,6 @@ tLSC_STATUS LSC_CloseChannel(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
       cmdApdu.p_data[xx++] = 0x00;
 
       transStat = LSC_Transceive(&cmdApdu, &rspApdu);
-      phLS_free(cmdApdu.p_data);
       if (transStat != STATUS_SUCCESS && rspApdu.len < 2) {
         ALOGE("%s: Transceive failed; status=0x%X", fn, transStat);
       } else if ((rspApdu.p_data[rspApdu.len - 2] == 0x90) &&
@@ -1083,14 +1387,14 @@ tLSC_STATUS LSC_CloseChannel(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
 ** Returns:         Success if ok.
 **
 *******************************************************************************/
-tLSC_STATUS LSC_ProcessResp(Lsc_ImageInfo_t* image_info, int32_t recvlen,
-                            Lsc_TranscieveInfo_t* trans_info,
-                            Ls_TagType tType) {
+tLSC_STATUS LsSession::LSC_ProcessResp(Lsc_ImageInfo_t* image_info,
+                                       int32_t recvlen,
+                                       Lsc_TranscieveInfo_t* trans_info,
+                                       Ls_TagType tType) {
   static const char fn[] = "LSC_ProcessResp";
   tLSC_STATUS status = STATUS_FAILED;
-  static int32_t temp_len = 0;
   uint8_t* RecvData = trans_info->sRecvData;
-  char sw[2];
+  uint8_t sw[2];
 
   ALOGD("%s: enter", fn);
 
@@ -1140,6 +1444,14 @@ tLSC_STATUS LSC_ProcessResp(Lsc_ImageInfo_t* image_info, int32_t recvlen,
     uint8_t respLen = 0;
     int32_t wStatus = 0;
 
+    if (mIsShared) {
+      /*The other sessions still select the current LS AID*/
+      ALOGE("%s: LS self update needs a session of its own", fn);
+      lsExecuteResp[2] = sw[0];
+      lsExecuteResp[3] = sw[1];
+      return STATUS_FAILED;
+    }
+
     AID_ARRAY[0] = recvlen + 3;
     AID_ARRAY[1] = 00;
     AID_ARRAY[2] = 0xA4;
@@ -1150,7 +1462,16 @@ tLSC_STATUS LSC_ProcessResp(Lsc_ImageInfo_t* image_info, int32_t recvlen,
     //memcpy(&ArrayOfAIDs[2][0], &AID_ARRAY[0], recvlen + 4);
     memcpy(&ArrayOfAIDs[LS_SELF_UPDATE_AID_IDX][0], &AID_ARRAY[0], recvlen + 4);
     image_info->isUpdaterMode = true;
-    fAID_MEM = fopen(AID_MEM_PATH[gpLsc_Dwnld_Context->
+    EseState_t state;
+    state.lsAidLen = ((recvlen + 5) > (int32_t)sizeof(AID_ARRAY))
+                         ? sizeof(AID_ARRAY)
+                         : (recvlen + 5);
+    memcpy(state.lsAid, AID_ARRAY, state.lsAidLen);
+    if (EseState_Write(mpLsc_Dwnld_Context->mchannel->getInterfaceInfo(),
+                       ESE_STATE_LS_AID, &state)) {
+      return STATUS_FILE_NOT_FOUND;
+    }
+    FILE* fAID_MEM = fopen(AID_MEM_PATH[mpLsc_Dwnld_Context->
       mchannel->getInterfaceInfo()], "w");
 
     if (fAID_MEM == NULL) {
@@ -1168,6 +1489,7 @@ tLSC_STATUS LSC_ProcessResp(Lsc_ImageInfo_t* image_info, int32_t recvlen,
       }
     }
     if (wStatus == 2) {
+      fclose(fAID_MEM);
       status = STATUS_FILE_NOT_FOUND;
     } else {
       status = STATUS_FAILED;
@@ -1189,8 +1511,9 @@ tLSC_STATUS LSC_ProcessResp(Lsc_ImageInfo_t* image_info, int32_t recvlen,
 ** Returns:         Success if ok.
 **
 *******************************************************************************/
-tLSC_STATUS Process_EseResponse(Lsc_TranscieveInfo_t* pTranscv_Info,
-                                int32_t recv_len, Lsc_ImageInfo_t* Os_info) {
+tLSC_STATUS LsSession::Process_EseResponse(Lsc_TranscieveInfo_t* pTranscv_Info,
+                                           int32_t recv_len,
+                                           Lsc_ImageInfo_t* Os_info) {
   static const char fn[] = "Process_EseResponse";
   tLSC_STATUS status = STATUS_OK;
   uint8_t xx = 0;
@@ -1200,7 +1523,7 @@ tLSC_STATUS Process_EseResponse(Lsc_TranscieveInfo_t* pTranscv_Info,
       (CLA_BYTE | Os_info->Channel_Info[0].channel_id);
   pTranscv_Info->sSendData[xx++] = 0xA2;
 
-  if (recv_len <= 0xFF) {
+  if (recv_len <= MAX_SIZE) {
     pTranscv_Info->sSendData[xx++] = 0x80;
     pTranscv_Info->sSendData[xx++] = 0x00;
     pTranscv_Info->sSendData[xx++] = (uint8_t)recv_len;
@@ -1208,29 +1531,77 @@ tLSC_STATUS Process_EseResponse(Lsc_TranscieveInfo_t* pTranscv_Info,
     pTranscv_Info->sSendlength = xx + recv_len;
     status = LSC_SendtoLsc(Os_info, status, pTranscv_Info, LS_Comm);
   } else {
-    while (recv_len > MAX_SIZE) {
+    uint8_t* pEseRsp;
+    int32_t offset = 0;
+    uint32_t mark = mpLsc_Dwnld_Context->arena.used;
+    bool isHeap = false;
+
+    /*The eSE response is kept aside as sRecvData receives the Lsc response
+      of each command, the refused extended one included*/
+    pEseRsp = LSC_ArenaAlloc(recv_len);
+    if (pEseRsp == NULL) {
+      /*Deeply nested exchanges*/
+      pEseRsp = (uint8_t*)phLS_memalloc(recv_len);
+      isHeap = true;
+    }
+    if (pEseRsp == NULL) {
+      ALOGE("%s: Memory allocation failed", fn);
+      return STATUS_FAILED;
+    }
+    memcpy(pEseRsp, pTranscv_Info->sRecvData, recv_len);
+    if ((mExtLenState != LS_EXT_LEN_REJECTED) &&
+        (recv_len <= LS_MAX_EXT_DATA)) {
+      /*Whole response in one extended length command*/
+      pTranscv_Info->sSendData[xx++] = 0x80;
+      pTranscv_Info->sSendData[xx++] = 0x00;
+      pTranscv_Info->sSendData[xx++] = 0x00;
+      pTranscv_Info->sSendData[xx++] = (uint8_t)(recv_len >> 8);
+      pTranscv_Info->sSendData[xx++] = (uint8_t)recv_len;
+      memcpy(&(pTranscv_Info->sSendData[xx]), pEseRsp, recv_len);
+      pTranscv_Info->sSendlength = xx + recv_len;
+      status = LSC_SendtoLsc(Os_info, status, pTranscv_Info, LS_Comm);
+      if (mExtLenState != LS_EXT_LEN_REJECTED) {
+        if (isHeap) phLS_free(pEseRsp);
+        LSC_ArenaRelease(mark);
+        ALOGD("%s: exit: status=0x%x", fn, status);
+        return status;
+      }
+      /*The blocks must carry what the refused command did*/
+      if (memcmp(pEseRsp, &(pTranscv_Info->sSendData[xx]), recv_len) != 0) {
+        ALOGE("%s: eSE response changed before the fallback", fn);
+        if (isHeap) phLS_free(pEseRsp);
+        LSC_ArenaRelease(mark);
+        return STATUS_FAILED;
+      }
+      status = STATUS_OK;
+    }
+    while ((recv_len - offset) > MAX_SIZE) {
       xx = PARAM_P1_OFFSET;
       pTranscv_Info->sSendData[xx++] = 0x00;
       pTranscv_Info->sSendData[xx++] = 0x00;
       pTranscv_Info->sSendData[xx++] = MAX_SIZE;
-      recv_len = recv_len - MAX_SIZE;
-      memcpy(&(pTranscv_Info->sSendData[xx]), pTranscv_Info->sRecvData,
-             MAX_SIZE);
+      memcpy(&(pTranscv_Info->sSendData[xx]), &pEseRsp[offset], MAX_SIZE);
+      offset += MAX_SIZE;
       pTranscv_Info->sSendlength = xx + MAX_SIZE;
       /*Need not store Process eSE response's response in the out file so
        * LS_Comm = 0*/
       status = LSC_SendtoLsc(Os_info, status, pTranscv_Info, LS_Comm);
       if (status != STATUS_OK) {
         ALOGE("Sending packet to Lsc failed: status=0x%x", status);
+        if (isHeap) phLS_free(pEseRsp);
+        LSC_ArenaRelease(mark);
         return status;
       }
     }
     xx = PARAM_P1_OFFSET;
     pTranscv_Info->sSendData[xx++] = LAST_BLOCK;
     pTranscv_Info->sSendData[xx++] = 0x01;
-    pTranscv_Info->sSendData[xx++] = recv_len;
-    memcpy(&(pTranscv_Info->sSendData[xx]), pTranscv_Info->sRecvData, recv_len);
-    pTranscv_Info->sSendlength = xx + recv_len;
+    pTranscv_Info->sSendData[xx++] = (uint8_t)(recv_len - offset);
+    memcpy(&(pTranscv_Info->sSendData[xx]), &pEseRsp[offset],
+           recv_len - offset);
+    pTranscv_Info->sSendlength = xx + (recv_len - offset);
+    if (isHeap) phLS_free(pEseRsp);
+    LSC_ArenaRelease(mark);
     status = LSC_SendtoLsc(Os_info, status, pTranscv_Info, LS_Comm);
   }
   ALOGD("%s: exit: status=0x%x", fn, status);
@@ -1238,6 +1609,58 @@ tLSC_STATUS Process_EseResponse(Lsc_TranscieveInfo_t* pTranscv_Info,
 }
 /*******************************************************************************
 **
+** Function:        LSC_IsExtLenRejected
+**
+** Description:     Checks whether the Lsc refused an extended length command:
+**                  wrong length, or INS/CLA not supported by the Lsc.
+**
+** Returns:         True if rejected.
+**
+*******************************************************************************/
+static bool LSC_IsExtLenRejected(const uint8_t* pRsp, int32_t len) {
+  if (pRsp == NULL || len != 2 || pRsp[1] != 0x00) return false;
+  return (pRsp[0] == 0x67) || (pRsp[0] == 0x6D) || (pRsp[0] == 0x6E);
+}
+/*******************************************************************************
+**
+** Function:        LSC_ArenaAlloc
+**
+** Description:     Allocates size bytes from the session arena. Memory is
+**                  given back by LSC_ArenaRelease with the value of
+**                  arena.used read before the allocation, so that nested
+**                  exchanges release in reverse order.
+**
+** Returns:         Pointer to the memory, NULL if the arena is exhausted.
+**
+*******************************************************************************/
+uint8_t* LsSession::LSC_ArenaAlloc(uint32_t size) {
+  static const char fn[] = "LSC_ArenaAlloc";
+  Lsc_Arena_t* pArena = &mpLsc_Dwnld_Context->arena;
+  uint32_t start = (pArena->used + 7) & ~7u;
+
+  if (size > LS_ARENA_SIZE || start > LS_ARENA_SIZE - size) {
+    ALOGD("%s: %u bytes exceed the arena, used=%u", fn, size, pArena->used);
+    return NULL;
+  }
+  pArena->used = start + size;
+  if (pArena->used > pArena->peak) pArena->peak = pArena->used;
+  return &pArena->buf[start];
+}
+/*******************************************************************************
+**
+** Function:        LSC_ArenaRelease
+**
+** Description:     Releases all arena memory allocated after mark was read
+**                  from arena.used.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void LsSession::LSC_ArenaRelease(uint32_t mark) {
+  mpLsc_Dwnld_Context->arena.used = mark;
+}
+/*******************************************************************************
+**
 ** Function:        Process_SelectRsp
 **
 ** Description:     It is used to process the received response for SELECT LSC
@@ -1246,7 +1669,7 @@ tLSC_STATUS Process_EseResponse(Lsc_TranscieveInfo_t* pTranscv_Info,
 ** Returns:         Success if ok.
 **
 *******************************************************************************/
-tLSC_STATUS Process_SelectRsp(uint8_t* Recv_data, int32_t Recv_len) {
+tLSC_STATUS LsSession::Process_SelectRsp(uint8_t* Recv_data, int32_t Recv_len) {
   (void)Recv_len;
   static const char fn[] = "Process_SelectRsp";
   tLSC_STATUS status = STATUS_FAILED;
@@ -1331,11 +1754,13 @@ tLSC_STATUS Process_SelectRsp(uint8_t* Recv_data, int32_t Recv_len) {
 }
 
 #ifdef JCOP3_WR
-tLSC_STATUS Bufferize_load_cmds(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
-                                Lsc_TranscieveInfo_t* pTranscv_Info) {
+tLSC_STATUS LsSession::Bufferize_load_cmds(
+    Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
+    Lsc_TranscieveInfo_t* pTranscv_Info) {
   (void)Os_info;
   static const char fn[] = "Bufferize_load_cmds";
   uint8_t Param_P2;
+  bool isBuffered = true;
   status = STATUS_FAILED;
 
   if (cmd_count == 0x00) {
@@ -1343,11 +1768,7 @@ tLSC_STATUS Bufferize_load_cmds(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
         (pTranscv_Info->sSendData[2] == PARAM_P1_OFFSET) &&
         (pTranscv_Info->sSendData[3] == 0x00)) {
       ALOGE("BUffer: install for load");
-      pBuffer[0] = pTranscv_Info->sSendlength;
-      memcpy(&pBuffer[1], &(pTranscv_Info->sSendData[0]),
-             pTranscv_Info->sSendlength);
-      pBuffer = pBuffer + pTranscv_Info->sSendlength + 1;
-      cmd_count++;
+      isBuffered = LSC_BufferCmd(pTranscv_Info);
     } else {
       /*
        * Do not buffer this cmd
@@ -1362,113 +1783,121 @@ tLSC_STATUS Bufferize_load_cmds(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
         (pTranscv_Info->sSendData[2] == LOAD_MORE_BLOCKS) &&
         (pTranscv_Info->sSendData[3] == Param_P2)) {
       ALOGE("BUffer: load");
-      pBuffer[0] = pTranscv_Info->sSendlength;
-      memcpy(&pBuffer[1], &(pTranscv_Info->sSendData[0]),
-             pTranscv_Info->sSendlength);
-      pBuffer = pBuffer + pTranscv_Info->sSendlength + 1;
-      cmd_count++;
+      isBuffered = LSC_BufferCmd(pTranscv_Info);
     } else if ((pTranscv_Info->sSendData[1] == LOAD_CMD_ID) &&
                (pTranscv_Info->sSendData[2] == LOAD_LAST_BLOCK) &&
                (pTranscv_Info->sSendData[3] == Param_P2)) {
       ALOGE("BUffer: last load");
       SendBack_cmds = true;
-      pBuffer[0] = pTranscv_Info->sSendlength;
-      memcpy(&pBuffer[1], &(pTranscv_Info->sSendData[0]),
-             pTranscv_Info->sSendlength);
-      pBuffer = pBuffer + pTranscv_Info->sSendlength + 1;
-      cmd_count++;
+      isBuffered = LSC_BufferCmd(pTranscv_Info);
       islastcmdLoad = true;
     } else {
       ALOGE("BUffer: Not a load cmd");
       SendBack_cmds = true;
-      pBuffer[0] = pTranscv_Info->sSendlength;
-      memcpy(&pBuffer[1], &(pTranscv_Info->sSendData[0]),
-             pTranscv_Info->sSendlength);
-      pBuffer = pBuffer + pTranscv_Info->sSendlength + 1;
+      isBuffered = LSC_BufferCmd(pTranscv_Info);
       islastcmdLoad = false;
-      cmd_count++;
     }
   }
+  if (!isBuffered) {
+    /*Drop the sequence, LSC_SendtoLsc reports the failure*/
+    SendBack_cmds = true;
+    islastcmdLoad = false;
+  }
   ALOGE("%s: exit; status=0x%x", fn, status);
   return status;
 }
 
-tLSC_STATUS Send_Backall_Loadcmds(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
-                                  Lsc_TranscieveInfo_t* pTranscv_Info) {
+/*******************************************************************************
+**
+** Function:        LSC_BufferCmd
+**
+** Description:     Appends the command in pTranscv_Info to Cmd_Buffer
+**
+** Returns:         false if the buffer is full
+**
+*******************************************************************************/
+bool LsSession::LSC_BufferCmd(Lsc_TranscieveInfo_t* pTranscv_Info) {
+  uint32_t len = (uint32_t)pTranscv_Info->sSendlength;
+
+  if ((cmd_count >= LS_MAX_BUFFERED_CMDS) ||
+      (len > (sizeof(Cmd_Buffer) - cmd_buf_len))) {
+    ALOGE("BUffer: no space left for command %d", cmd_count);
+    return false;
+  }
+  memcpy(&Cmd_Buffer[cmd_buf_len], pTranscv_Info->sSendData, len);
+  Cmd_List[cmd_count].p_data = &Cmd_Buffer[cmd_buf_len];
+  Cmd_List[cmd_count].len = (int32_t)len;
+  cmd_buf_len += len;
+  cmd_count++;
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        LSC_ResetCmdBuffer
+**
+** Description:     Drops all buffered commands
+**
+** Returns:         None
+**
+*******************************************************************************/
+void LsSession::LSC_ResetCmdBuffer() {
+  memset(Cmd_Buffer, 0, cmd_buf_len);
+  cmd_buf_len = 0;
+  cmd_count = 0x00;
+}
+
+tLSC_STATUS LsSession::Send_Backall_Loadcmds(
+    Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
+    Lsc_TranscieveInfo_t* pTranscv_Info) {
   static const char fn[] = "Send_Backall_Loadcmds";
-  tLSC_STATUS transStat = STATUS_FAILED;
+  IChannel_t* mchannel = mpLsc_Dwnld_Context->mchannel;
+  IChannelCmd_t* pLastCmd;
+  int32_t sent = 0;
   status = STATUS_FAILED;
-  phNxpLs_data cmdApdu;
-  phNxpLs_data rspApdu;
   int32_t recvBufferActualSize = 0;
   ALOGD("%s: enter", fn);
-  pBuffer = Cmd_Buffer;  // Points to start of first cmd to send
   if (cmd_count == 0x00) {
     ALOGE("No cmds stored to send to eSE");
   } else {
-    while (cmd_count-- > 0) {
-      phLS_memset(&cmdApdu, 0x00, sizeof(phNxpLs_data));
-      phLS_memset(&rspApdu, 0x00, sizeof(phNxpLs_data));
-
-      cmdApdu.len = (int32_t)(pBuffer[0]);
-      cmdApdu.p_data =
-          (uint8_t*)phLS_memalloc(cmdApdu.len * sizeof(uint8_t));
-      pBuffer = pBuffer + 1 + cmdApdu.len;
-
-      memcpy(cmdApdu.p_data, &pBuffer[1], cmdApdu.len);
-
-      transStat = LSC_Transceive(&cmdApdu, &rspApdu);
-
-      memcpy(pTranscv_Info->sRecvData, rspApdu.p_data, rspApdu.len);
-      recvBufferActualSize = rspApdu.len;
-      phLS_free(cmdApdu.p_data);
-      if (transStat != STATUS_SUCCESS || (recvBufferActualSize < 2)) {
-        ALOGE("%s: Transceive failed; status=0x%X", fn, transStat);
-      } else if (cmd_count == 0x00)  // Last command in the buffer
-      {
-        if (islastcmdLoad == false) {
-          status =
-              Process_EseResponse(pTranscv_Info, recvBufferActualSize, Os_info);
-        } else if ((recvBufferActualSize == 0x02) &&
-                   (pTranscv_Info->sRecvData[recvBufferActualSize - 2] ==
-                    0x90) &&
-                   (pTranscv_Info->sRecvData[recvBufferActualSize - 1] ==
-                    0x00)) {
-          recvBufferActualSize = 0x03;
-          pTranscv_Info->sRecvData[0] = 0x00;
-          pTranscv_Info->sRecvData[1] = 0x90;
-          pTranscv_Info->sRecvData[2] = 0x00;
-          status =
-              Process_EseResponse(pTranscv_Info, recvBufferActualSize, Os_info);
-        } else {
-          status =
-              Process_EseResponse(pTranscv_Info, recvBufferActualSize, Os_info);
-        }
+    /*Buffered commands are sent straight from Cmd_Buffer, stopping at the
+      first failure*/
+    IChannelStats_SetPhase(ICHANNEL_PHASE_LS_CMD);
+    sent = IChannelBatch_Transceive(
+        mchannel, Cmd_List, cmd_count, ICHANNEL_BATCH_ABORT_ON_SW,
+        pTranscv_Info->sRecvData, sizeof(pTranscv_Info->sRecvData),
+        recvBufferActualSize, gTransceiveTimeout);
+    pLastCmd = (sent > 0) ? &Cmd_List[sent - 1] : NULL;
+    if ((pLastCmd == NULL) || !pLastCmd->status ||
+        (recvBufferActualSize < 2)) {
+      ALOGE("%s: Transceive failed; command %d of %d", fn, sent, cmd_count);
+    } else if (sent == cmd_count)  // Last command in the buffer
+    {
+      if (islastcmdLoad == false) {
+        status =
+            Process_EseResponse(pTranscv_Info, recvBufferActualSize, Os_info);
       } else if ((recvBufferActualSize == 0x02) &&
-                 (pTranscv_Info->sRecvData[0] == 0x90) &&
-                 (pTranscv_Info->sRecvData[1] == 0x00)) {
-        /*Do not do anything
-         * send next command in the buffer*/
-      } else if ((recvBufferActualSize == 0x03) &&
-                 (pTranscv_Info->sRecvData[0] == 0x00) &&
-                 (pTranscv_Info->sRecvData[1] == 0x90) &&
-                 (pTranscv_Info->sRecvData[2] == 0x00)) {
-        /*Do not do anything
-         * Send next cmd in the buffer*/
-      } else if ((pTranscv_Info->sRecvData[recvBufferActualSize - 2] != 0x90) &&
-                 (pTranscv_Info->sRecvData[recvBufferActualSize - 1] != 0x00)) {
-        /*Error condition hence exiting the loop*/
+                 (pTranscv_Info->sRecvData[recvBufferActualSize - 2] ==
+                  0x90) &&
+                 (pTranscv_Info->sRecvData[recvBufferActualSize - 1] ==
+                  0x00)) {
+        recvBufferActualSize = 0x03;
+        pTranscv_Info->sRecvData[0] = 0x00;
+        pTranscv_Info->sRecvData[1] = 0x90;
+        pTranscv_Info->sRecvData[2] = 0x00;
+        status =
+            Process_EseResponse(pTranscv_Info, recvBufferActualSize, Os_info);
+      } else {
         status =
             Process_EseResponse(pTranscv_Info, recvBufferActualSize, Os_info);
-        /*If the sending of Load fails reset the count*/
-        cmd_count = 0;
-        break;
       }
+    } else {
+      /*Error condition, the load sequence is aborted*/
+      status =
+          Process_EseResponse(pTranscv_Info, recvBufferActualSize, Os_info);
     }
   }
-  memset(Cmd_Buffer, 0, sizeof(Cmd_Buffer));
-  pBuffer = Cmd_Buffer;  // point back to start of line
-  cmd_count = 0x00;
+  LSC_ResetCmdBuffer();
   ALOGD("%s: exit: status=0x%x", fn, status);
   return status;
 }
@@ -1483,7 +1912,7 @@ tLSC_STATUS Send_Backall_Loadcmds(Lsc_ImageInfo_t* Os_info, tLSC_STATUS status,
 ** Returns:         Number of Length bytes
 **
 *******************************************************************************/
-uint8_t Numof_lengthbytes(uint8_t* read_buf, int32_t* pLen) {
+uint8_t LsSession::Numof_lengthbytes(uint8_t* read_buf, int32_t* pLen) {
   static const char fn[] = "Numof_lengthbytes";
   uint8_t len_byte = 0, i = 0;
   int32_t wLen = 0;
@@ -1543,13 +1972,12 @@ uint8_t Numof_lengthbytes(uint8_t* read_buf, int32_t* pLen) {
 ** Returns:         Success if OK
 **
 *******************************************************************************/
-tLSC_STATUS Write_Response_To_OutFile(Lsc_ImageInfo_t* image_info,
-                                      uint8_t* RecvData, int32_t recvlen,
-                                      Ls_TagType tType) {
-  int32_t respLen = 0;
+tLSC_STATUS LsSession::Write_Response_To_OutFile(Lsc_ImageInfo_t* image_info,
+                                                 uint8_t* RecvData,
+                                                 int32_t recvlen,
+                                                 Ls_TagType tType) {
   tLSC_STATUS wStatus = STATUS_FAILED;
   static const char fn[] = "Write_Response_to_OutFile";
-  int32_t status = 0;
   uint8_t tagBuffer[12] = {0x61, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
   int32_t tag44Len = 0;
   int32_t tag61Len = 0;
@@ -1558,7 +1986,6 @@ tLSC_STATUS Write_Response_To_OutFile(Lsc_ImageInfo_t* image_info,
   uint8_t tag44off = 0;
   uint8_t ucTag44[3] = {0x00, 0x00, 0x00};
   uint8_t tagLen = 0;
-  uint8_t tempLen = 0;
   /*If the Response out file is NULL or Other than LS commands*/
   if ((image_info->bytes_wrote == 0x55) || (tType == LS_Default)) {
     return STATUS_OK;
@@ -1644,30 +2071,16 @@ tLSC_STATUS Write_Response_To_OutFile(Lsc_ImageInfo_t* image_info,
   } else {
     /*Do nothing*/
   }
-  while (tempLen < tagLen) {
-    status = fprintf(image_info->fResp, "%02X", tagBuffer[tempLen++]);
-    if (status != 2) {
-      ALOGE("%s: Invalid Response during fprintf; status=0x%x", fn, (status));
-      wStatus = STATUS_FAILED;
-      break;
-    }
-  }
-  /*Updating the response data into out script*/
-  while (respLen < recvlen) {
-    status = fprintf(image_info->fResp, "%02X", RecvData[respLen++]);
-    if (status != 2) {
-      ALOGE("%s: Invalid Response during fprintf; status=0x%x", fn, (status));
-      wStatus = STATUS_FAILED;
-      break;
-    }
-  }
-  if (status == 2) {
-    fprintf(image_info->fResp, "%s\n", "");
-    ALOGE("%s: SUCCESS Response written to script out file; status=0x%x", fn,
-          (status));
+  /*Queued to the writer thread, the file is written off the APDU path*/
+  if (image_info->pOut->writeHex(tagBuffer, tagLen) &&
+      image_info->pOut->writeHex(RecvData, recvlen) &&
+      image_info->pOut->writeEol()) {
+    ALOGD("%s: Response queued to script out file", fn);
     wStatus = STATUS_OK;
+  } else {
+    ALOGE("%s: Response out file write failed", fn);
+    wStatus = STATUS_FAILED;
   }
-  fflush(image_info->fResp);
   return wStatus;
 }
 
@@ -1681,7 +2094,8 @@ tLSC_STATUS Write_Response_To_OutFile(Lsc_ImageInfo_t* image_info,
 ** Returns:         Success if Tag found
 **
 *******************************************************************************/
-tLSC_STATUS Check_Certificate_Tag(uint8_t* read_buf, uint16_t* offset1) {
+tLSC_STATUS LsSession::Check_Certificate_Tag(uint8_t* read_buf,
+                                             uint16_t* offset1) {
   tLSC_STATUS status = STATUS_FAILED;
   uint16_t len_byte = 0;
   int32_t wLen /*, recvBufferActualSize=0*/;
@@ -1708,7 +2122,8 @@ tLSC_STATUS Check_Certificate_Tag(uint8_t* read_buf, uint16_t* offset1) {
 ** Returns:         Success if Tag found
 **
 *******************************************************************************/
-tLSC_STATUS Check_SerialNo_Tag(uint8_t* read_buf, uint16_t* offset1) {
+tLSC_STATUS LsSession::Check_SerialNo_Tag(uint8_t* read_buf,
+                                          uint16_t* offset1) {
   tLSC_STATUS status = STATUS_FAILED;
   uint16_t offset = *offset1;
   static const char fn[] = "Check_SerialNo_Tag";
@@ -1734,7 +2149,8 @@ tLSC_STATUS Check_SerialNo_Tag(uint8_t* read_buf, uint16_t* offset1) {
 ** Returns:         Success if Tag found
 **
 *******************************************************************************/
-tLSC_STATUS Check_LSRootID_Tag(uint8_t* read_buf, uint16_t* offset1) {
+tLSC_STATUS LsSession::Check_LSRootID_Tag(uint8_t* read_buf,
+                                          uint16_t* offset1) {
   uint16_t offset = *offset1;
   if (read_buf[offset] == TAG_LSRE_ID) {
     ALOGD("TAGID: TAG_LSROOT_ENTITY");
@@ -1765,7 +2181,8 @@ tLSC_STATUS Check_LSRootID_Tag(uint8_t* read_buf, uint16_t* offset1) {
 ** Returns:         Success if Tag found
 **
 *******************************************************************************/
-tLSC_STATUS Check_CertHoldID_Tag(uint8_t* read_buf, uint16_t* offset1) {
+tLSC_STATUS LsSession::Check_CertHoldID_Tag(uint8_t* read_buf,
+                                            uint16_t* offset1) {
   tLSC_STATUS status = STATUS_FAILED;
   uint16_t offset = *offset1;
 
@@ -1795,7 +2212,7 @@ tLSC_STATUS Check_CertHoldID_Tag(uint8_t* read_buf, uint16_t* offset1) {
 ** Returns:         Success if Tag found
 **
 *******************************************************************************/
-tLSC_STATUS Check_Date_Tag(uint8_t* read_buf, uint16_t* offset1) {
+tLSC_STATUS LsSession::Check_Date_Tag(uint8_t* read_buf, uint16_t* offset1) {
   tLSC_STATUS status = STATUS_OK;
   uint16_t offset = *offset1;
 
@@ -1835,8 +2252,8 @@ tLSC_STATUS Check_Date_Tag(uint8_t* read_buf, uint16_t* offset1) {
 ** Returns:         Success if Tag found
 **
 *******************************************************************************/
-tLSC_STATUS Check_45_Tag(uint8_t* read_buf, uint16_t* offset1,
-                         uint8_t* tag45Len) {
+tLSC_STATUS LsSession::Check_45_Tag(uint8_t* read_buf, uint16_t* offset1,
+                                    uint8_t* tag45Len) {
   uint16_t offset = *offset1;
   if (read_buf[offset] == TAG_LSRE_SIGNID) {
     *tag45Len = read_buf[offset + 1];
@@ -1864,10 +2281,9 @@ tLSC_STATUS Check_45_Tag(uint8_t* read_buf, uint16_t* offset1,
 ** Returns:         Success if certificate is verified
 **
 *******************************************************************************/
-tLSC_STATUS Certificate_Verification(Lsc_ImageInfo_t* Os_info,
-                                     Lsc_TranscieveInfo_t* pTranscv_Info,
-                                     uint8_t* read_buf, uint16_t* offset1,
-                                     uint8_t* tag45Len) {
+tLSC_STATUS LsSession::Certificate_Verification(
+    Lsc_ImageInfo_t* Os_info, Lsc_TranscieveInfo_t* pTranscv_Info,
+    uint8_t* read_buf, uint16_t* offset1, uint8_t* tag45Len) {
   tLSC_STATUS status = STATUS_FAILED;
   uint16_t offset = *offset1;
   int32_t wCertfLen = (read_buf[2] << 8 | read_buf[3]);
@@ -2013,9 +2429,9 @@ tLSC_STATUS Certificate_Verification(Lsc_ImageInfo_t* Os_info,
 ** Returns:         Success if all tags are verified
 **
 *******************************************************************************/
-tLSC_STATUS Check_Complete_7F21_Tag(Lsc_ImageInfo_t* Os_info,
-                                    Lsc_TranscieveInfo_t* pTranscv_Info,
-                                    uint8_t* read_buf, uint16_t* offset) {
+tLSC_STATUS LsSession::Check_Complete_7F21_Tag(
+    Lsc_ImageInfo_t* Os_info, Lsc_TranscieveInfo_t* pTranscv_Info,
+    uint8_t* read_buf, uint16_t* offset) {
   static const char fn[] = "Check_Complete_7F21_Tag";
 
   if (STATUS_OK == Check_Certificate_Tag(read_buf, offset)) {
@@ -2055,15 +2471,36 @@ tLSC_STATUS Check_Complete_7F21_Tag(Lsc_ImageInfo_t* Os_info,
 **
 ** Function:        LSC_UpdateExeStatus
 **
-** Description:     Updates LSC status to a file
+** Description:     Updates LSC status, left to the caller by a shared session
 **
 ** Returns:         true if success else false
 **
 *******************************************************************************/
-bool LSC_UpdateExeStatus(uint16_t status) {
-  fLS_STATUS = fopen(LS_STATUS_PATH[gpLsc_Dwnld_Context->mchannel
-  ->getInterfaceInfo()], "w+");
+bool LsSession::LSC_UpdateExeStatus(uint16_t status) {
+  if (mIsShared) return true;
+  return LSC_WriteExeStatus(mpLsc_Dwnld_Context->mchannel->getInterfaceInfo(),
+                            status);
+}
+
+/*******************************************************************************
+**
+** Function:        LSC_WriteExeStatus
+**
+** Description:     Writes LSC status in the state journal, or in a file
+**                  if the journal is not available
+**
+** Returns:         true if success else false
+**
+*******************************************************************************/
+bool LsSession::LSC_WriteExeStatus(uint8_t intfInfo, uint16_t status) {
+  EseState_t state;
   ALOGD("enter: LSC_UpdateExeStatus");
+  state.lsStatus = status;
+  if (EseState_Write(intfInfo, ESE_STATE_LS_STATUS, &state)) {
+    ALOGD("exit: LSC_UpdateExeStatus");
+    return true;
+  }
+  FILE* fLS_STATUS = fopen(LS_STATUS_PATH[intfInfo], "w+");
   if (fLS_STATUS == NULL) {
     ALOGE("Error opening LS Status file for backup: %s", strerror(errno));
     return false;
@@ -2088,44 +2525,37 @@ bool LSC_UpdateExeStatus(uint16_t status) {
 ** Returns:         SUCCESS/FAILURE
 **
 *******************************************************************************/
-tLSC_STATUS Get_LsStatus(uint8_t* pStatus) {
+tLSC_STATUS LsSession::Get_LsStatus(uint8_t* pStatus) {
   tLSC_STATUS status = STATUS_FAILED;
   uint8_t lsStatus[2] = {0x63, 0x40};
-  uint8_t loopcnt = 0;
-  fLS_STATUS = fopen(LS_STATUS_PATH[gpLsc_Dwnld_Context
-    ->mchannel->getInterfaceInfo()], "r");
+  EseState_t state;
 
-  if (fLS_STATUS == NULL) {
-    ALOGE("Error opening LS Status file for backup: %s", strerror(errno));
+  EseState_Read(mpLsc_Dwnld_Context->mchannel->getInterfaceInfo(), &state);
+  if (!(state.valid & ESE_STATE_LS_STATUS)) {
+    ALOGE("Error reading LS Status");
     return status;
   }
-  for (loopcnt = 0; loopcnt < 2; loopcnt++) {
-    if ((FSCANF_BYTE(fLS_STATUS, "%2x", &lsStatus[loopcnt])) == 0) {
-      ALOGE("Error updating LS Status backup: %s", strerror(errno));
-      fclose(fLS_STATUS);
-      return status;
-    }
-  }
+  lsStatus[0] = (uint8_t)(state.lsStatus >> 8);
+  lsStatus[1] = (uint8_t)state.lsStatus;
   ALOGD("enter: LSC_getLsStatus 0x%X 0x%X", lsStatus[0], lsStatus[1]);
   memcpy(pStatus, lsStatus, 2);
-  fclose(fLS_STATUS);
   return STATUS_OK;
 }
 
-static tLSC_STATUS LSC_Transceive(phNxpLs_data* pCmd, phNxpLs_data* pRsp)
+tLSC_STATUS LsSession::LSC_Transceive(phNxpLs_data* pCmd, phNxpLs_data* pRsp)
 {
   bool stat = false;
   tLSC_STATUS status = STATUS_FAILED;
   int32_t recvBufferActualSize = 0;
-  IChannel_t *mchannel = gpLsc_Dwnld_Context->mchannel;
-  Lsc_TranscieveInfo_t* pTranscv_Info = &gpLsc_Dwnld_Context->Transcv_Info;
+  IChannel_t *mchannel = mpLsc_Dwnld_Context->mchannel;
+  Lsc_TranscieveInfo_t* pTranscv_Info = &mpLsc_Dwnld_Context->Transcv_Info;
 
   pTranscv_Info->timeout = gTransceiveTimeout;
   pTranscv_Info->sSendlength = pCmd->len;
-  pTranscv_Info->sRecvlength = 1024;//(int32_t)sizeof(int32_t);
-  
-  memcpy(pTranscv_Info->sSendData, pCmd->p_data, pTranscv_Info->sSendlength);
-  stat = mchannel->transceive (pTranscv_Info->sSendData,
+  pTranscv_Info->sRecvlength = sizeof(pTranscv_Info->sRecvData);
+
+  /*The command is sent from the caller's buffer, no copy*/
+  stat = mchannel->transceive (pCmd->p_data,
           pTranscv_Info->sSendlength,
           pTranscv_Info->sRecvData,
           pTranscv_Info->sRecvlength,
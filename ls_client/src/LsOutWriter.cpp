@@ -0,0 +1,262 @@
+/*******************************************************************************
+ *
+ *  Copyright 2019 NXP
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+#include <cutils/log.h>
+#include <LsOutWriter.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Hex text encoded per put into the ring */
+#define LS_OUT_CHUNK 256
+
+LsOutWriter::LsOutWriter()
+    : mHead(0),
+      mTail(0),
+      mSyncPos(0),
+      mSyncedPos(0),
+      mFd(-1),
+      mRunning(false),
+      mStop(false),
+      mError(false),
+      mStalls(0) {
+  pthread_mutex_init(&mLock, NULL);
+  pthread_cond_init(&mDataCond, NULL);
+  pthread_cond_init(&mRoomCond, NULL);
+}
+
+LsOutWriter::~LsOutWriter() {
+  close();
+  pthread_cond_destroy(&mRoomCond);
+  pthread_cond_destroy(&mDataCond);
+  pthread_mutex_destroy(&mLock);
+}
+
+/*******************************************************************************
+**
+** Function:        open
+**
+** Description:     Opens path for appending and starts the writer thread.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+bool LsOutWriter::open(const char* path) {
+  static const char fn[] = "LsOutWriter::open";
+
+  if (mRunning || path == NULL) return false;
+  /*Same creation mode as fopen "a+"*/
+  mFd = ::open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+  if (mFd < 0) {
+    ALOGE("%s: Error opening <%s>: %s", fn, path, strerror(errno));
+    return false;
+  }
+  mHead = mTail = mSyncPos = mSyncedPos = 0;
+  mStop = false;
+  mError = false;
+  mStalls = 0;
+  if (pthread_create(&mThread, NULL, writerThread, this) != 0) {
+    ALOGE("%s: Unable to create writer thread", fn);
+    ::close(mFd);
+    mFd = -1;
+    return false;
+  }
+  mRunning = true;
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        put
+**
+** Description:     Copies len bytes of text into the ring, waiting for the
+**                  writer thread while it is full.
+**
+** Returns:         False if the file could not be written.
+**
+*******************************************************************************/
+bool LsOutWriter::put(const char* pText, uint32_t len) {
+  pthread_mutex_lock(&mLock);
+  while (len > 0 && !mError) {
+    uint32_t room = LS_OUT_RING_SIZE - (uint32_t)(mHead - mTail);
+    if (room == 0) {
+      mStalls++;
+      pthread_cond_wait(&mRoomCond, &mLock);
+      continue;
+    }
+    uint32_t pos = (uint32_t)(mHead % LS_OUT_RING_SIZE);
+    uint32_t cnt = LS_OUT_RING_SIZE - pos;
+    if (cnt > room) cnt = room;
+    if (cnt > len) cnt = len;
+    memcpy(&mRing[pos], pText, cnt);
+    mHead += cnt;
+    pText += cnt;
+    len -= cnt;
+    pthread_cond_signal(&mDataCond);
+  }
+  bool isOk = !mError;
+  pthread_mutex_unlock(&mLock);
+  return isOk;
+}
+
+/*******************************************************************************
+**
+** Function:        writeHex
+**
+** Description:     Queues len bytes of pData as upper case hex text, waits
+**                  only while the ring is full.
+**
+** Returns:         False if the file could not be written.
+**
+*******************************************************************************/
+bool LsOutWriter::writeHex(const uint8_t* pData, uint32_t len) {
+  static const char hex[] = "0123456789ABCDEF";
+  char text[2 * LS_OUT_CHUNK];
+
+  if (!mRunning) return false;
+  while (len > 0) {
+    uint32_t cnt = (len > LS_OUT_CHUNK) ? LS_OUT_CHUNK : len;
+    for (uint32_t i = 0; i < cnt; i++) {
+      text[2 * i] = hex[pData[i] >> 4];
+      text[2 * i + 1] = hex[pData[i] & 0x0F];
+    }
+    if (!put(text, 2 * cnt)) return false;
+    pData += cnt;
+    len -= cnt;
+  }
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        writeEol
+**
+** Description:     Queues the end of a record.
+**
+** Returns:         False if the file could not be written.
+**
+*******************************************************************************/
+bool LsOutWriter::writeEol() {
+  if (!mRunning) return false;
+  return put("\n", 1);
+}
+
+/*******************************************************************************
+**
+** Function:        sync
+**
+** Description:     Requests the writer thread to sync the file once all
+**                  text queued so far is written. Does not wait.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void LsOutWriter::sync() {
+  if (!mRunning) return;
+  pthread_mutex_lock(&mLock);
+  mSyncPos = mHead;
+  pthread_cond_signal(&mDataCond);
+  pthread_mutex_unlock(&mLock);
+}
+
+/*******************************************************************************
+**
+** Function:        close
+**
+** Description:     Writes the queued text, syncs and closes the file and
+**                  stops the writer thread. Safe to call when not open.
+**
+** Returns:         False if the file could not be written.
+**
+*******************************************************************************/
+bool LsOutWriter::close() {
+  static const char fn[] = "LsOutWriter::close";
+
+  if (!mRunning) return true;
+  pthread_mutex_lock(&mLock);
+  mSyncPos = mHead;
+  mStop = true;
+  pthread_cond_signal(&mDataCond);
+  pthread_mutex_unlock(&mLock);
+  pthread_join(mThread, NULL);
+  mRunning = false;
+  if (::close(mFd) != 0) mError = true;
+  mFd = -1;
+  ALOGD("%s: %llu bytes, %u stalls, error=%d", fn, (unsigned long long)mTail,
+        mStalls, mError);
+  return !mError;
+}
+
+void* LsOutWriter::writerThread(void* arg) {
+  ((LsOutWriter*)arg)->drain();
+  return NULL;
+}
+
+/*******************************************************************************
+**
+** Function:        drain
+**
+** Description:     Writes the queued text to the file, syncing it when the
+**                  requested position is reached, until stopped with an
+**                  empty ring.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void LsOutWriter::drain() {
+  static const char fn[] = "LsOutWriter::drain";
+
+  pthread_mutex_lock(&mLock);
+  for (;;) {
+    while ((mHead == mTail) && (mSyncPos == mSyncedPos) && !mStop) {
+      pthread_cond_wait(&mDataCond, &mLock);
+    }
+    if (mHead != mTail) {
+      uint32_t pos = (uint32_t)(mTail % LS_OUT_RING_SIZE);
+      uint32_t cnt = (uint32_t)(mHead - mTail);
+      if (cnt > LS_OUT_RING_SIZE - pos) cnt = LS_OUT_RING_SIZE - pos;
+      /*The producer only writes outside [mTail, mHead)*/
+      pthread_mutex_unlock(&mLock);
+      ssize_t ret = mError ? (ssize_t)cnt : write(mFd, &mRing[pos], cnt);
+      pthread_mutex_lock(&mLock);
+      if (ret < 0) {
+        if (errno == EINTR) continue;
+        ALOGE("%s: write failed: %s", fn, strerror(errno));
+        /*Text is dropped from now on, reported by close*/
+        mError = true;
+        ret = cnt;
+      }
+      mTail += (uint64_t)ret;
+      pthread_cond_broadcast(&mRoomCond);
+      continue;
+    }
+    if (mSyncPos != mSyncedPos) {
+      uint64_t syncPos = mSyncPos;
+      pthread_mutex_unlock(&mLock);
+      if (!mError && fsync(mFd) != 0) {
+        ALOGE("%s: fsync failed: %s", fn, strerror(errno));
+      }
+      pthread_mutex_lock(&mLock);
+      mSyncedPos = syncPos;
+      continue;
+    }
+    if (mStop) break;
+  }
+  pthread_mutex_unlock(&mLock);
+}
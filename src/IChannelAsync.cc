@@ -0,0 +1,276 @@
+/******************************************************************************
+ *
+ *  Copyright 2019 NXP
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+#include <log/log.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <IChannelAsync.h>
+
+struct IChannelAsyncCtx {
+  IChannel_t channel;
+  IChannelAsync_t native;
+  bool isNative;
+  bool stop;
+  pthread_t worker;
+  IChannelRequest_t* pHead;
+  IChannelRequest_t* pTail;
+  uint32_t pendingCnt;
+  pthread_mutex_t lock;
+  pthread_cond_t queueCond; /* Request queued or stop requested */
+  pthread_cond_t doneCond;  /* Request completed */
+};
+
+/*******************************************************************************
+**
+** Function:        IChannelAsync_Worker
+**
+** Description:     Runs the queued requests on the blocking entry points of
+**                  the channel, in submit order.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void* IChannelAsync_Worker(void* arg) {
+  IChannelAsyncHandle_t pCtx = (IChannelAsyncHandle_t)arg;
+
+  pthread_mutex_lock(&pCtx->lock);
+  for (;;) {
+    while ((pCtx->pHead == NULL) && !pCtx->stop) {
+      pthread_cond_wait(&pCtx->queueCond, &pCtx->lock);
+    }
+    /*Pending requests are still served when stopping*/
+    IChannelRequest_t* pReq = pCtx->pHead;
+    if (pReq == NULL) break;
+    pCtx->pHead = pReq->pNext;
+    if (pCtx->pHead == NULL) pCtx->pTail = NULL;
+    pthread_mutex_unlock(&pCtx->lock);
+
+    int32_t recvLen = 0;
+    bool status;
+    if (pReq->isRaw) {
+      status = pCtx->channel.transceiveRaw(
+          pReq->xmitBuffer, pReq->xmitBufferSize, pReq->recvBuffer,
+          pReq->recvBufferMaxSize, recvLen, pReq->timeoutMillisec);
+    } else {
+      status = pCtx->channel.transceive(
+          pReq->xmitBuffer, pReq->xmitBufferSize, pReq->recvBuffer,
+          pReq->recvBufferMaxSize, recvLen, pReq->timeoutMillisec);
+    }
+    IChannelAsync_Complete(pReq, status, recvLen);
+
+    pthread_mutex_lock(&pCtx->lock);
+  }
+  pthread_mutex_unlock(&pCtx->lock);
+  return NULL;
+}
+
+/*******************************************************************************
+**
+** Function:        IChannelAsync_Init
+**
+** Description:     Creates an adapter for channel. pNative is optional,
+**                  without it requests are run on a worker thread using the
+**                  blocking entry points of channel.
+**
+** Returns:         Handle of the adapter, NULL on failure.
+**
+*******************************************************************************/
+IChannelAsyncHandle_t IChannelAsync_Init(IChannel_t* channel,
+                                         IChannelAsync_t* pNative) {
+  static const char fn[] = "IChannelAsync_Init";
+  bool isNative = (pNative != NULL) && (pNative->submit != NULL);
+  IChannelAsyncHandle_t pCtx;
+
+  if (channel == NULL ||
+      (!isNative &&
+       (channel->transceive == NULL || channel->transceiveRaw == NULL))) {
+    ALOGE("%s: Invalid channel", fn);
+    return NULL;
+  }
+  pCtx = (IChannelAsyncHandle_t)malloc(sizeof(struct IChannelAsyncCtx));
+  if (pCtx == NULL) {
+    ALOGE("%s: Memory allocation failed", fn);
+    return NULL;
+  }
+  memset(pCtx, 0, sizeof(struct IChannelAsyncCtx));
+  memcpy(&pCtx->channel, channel, sizeof(IChannel_t));
+  if (isNative) memcpy(&pCtx->native, pNative, sizeof(IChannelAsync_t));
+  pCtx->isNative = isNative;
+  pthread_mutex_init(&pCtx->lock, NULL);
+  pthread_cond_init(&pCtx->queueCond, NULL);
+  pthread_cond_init(&pCtx->doneCond, NULL);
+  if (!isNative &&
+      pthread_create(&pCtx->worker, NULL, IChannelAsync_Worker, pCtx) != 0) {
+    ALOGE("%s: Unable to create worker thread", fn);
+    pthread_cond_destroy(&pCtx->doneCond);
+    pthread_cond_destroy(&pCtx->queueCond);
+    pthread_mutex_destroy(&pCtx->lock);
+    free(pCtx);
+    return NULL;
+  }
+  ALOGD("%s: %s transceive", fn, isNative ? "native" : "adapted");
+  return pCtx;
+}
+
+/*******************************************************************************
+**
+** Function:        IChannelAsync_DeInit
+**
+** Description:     Completes all pending requests of hAsync, stops its worker
+**                  and releases it.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void IChannelAsync_DeInit(IChannelAsyncHandle_t hAsync) {
+  if (hAsync == NULL) return;
+  pthread_mutex_lock(&hAsync->lock);
+  hAsync->stop = true;
+  pthread_cond_signal(&hAsync->queueCond);
+  while (hAsync->pendingCnt != 0) {
+    pthread_cond_wait(&hAsync->doneCond, &hAsync->lock);
+  }
+  pthread_mutex_unlock(&hAsync->lock);
+  if (!hAsync->isNative) pthread_join(hAsync->worker, NULL);
+  pthread_cond_destroy(&hAsync->doneCond);
+  pthread_cond_destroy(&hAsync->queueCond);
+  pthread_mutex_destroy(&hAsync->lock);
+  free(hAsync);
+}
+
+/*******************************************************************************
+**
+** Function:        IChannelAsync_Submit
+**
+** Description:     Queues pReq for transmission on the channel of hAsync.
+**                  Requests are sent in submit order.
+**
+** Returns:         True if the request was queued.
+**
+*******************************************************************************/
+bool IChannelAsync_Submit(IChannelAsyncHandle_t hAsync,
+                          IChannelRequest_t* pReq) {
+  static const char fn[] = "IChannelAsync_Submit";
+
+  if (hAsync == NULL || pReq == NULL) return false;
+  pthread_mutex_lock(&hAsync->lock);
+  if (hAsync->stop || pReq->state == ICHANNEL_REQ_PENDING) {
+    pthread_mutex_unlock(&hAsync->lock);
+    ALOGE("%s: Stopping or request already pending", fn);
+    return false;
+  }
+  pReq->status = false;
+  pReq->recvBufferActualSize = 0;
+  pReq->state = ICHANNEL_REQ_PENDING;
+  pReq->hAsync = hAsync;
+  pReq->pNext = NULL;
+  hAsync->pendingCnt++;
+  if (hAsync->isNative) {
+    pthread_mutex_unlock(&hAsync->lock);
+    if (!hAsync->native.submit(pReq)) {
+      pthread_mutex_lock(&hAsync->lock);
+      pReq->state = ICHANNEL_REQ_IDLE;
+      hAsync->pendingCnt--;
+      pthread_cond_broadcast(&hAsync->doneCond);
+      pthread_mutex_unlock(&hAsync->lock);
+      return false;
+    }
+    return true;
+  }
+  if (hAsync->pTail != NULL) {
+    hAsync->pTail->pNext = pReq;
+  } else {
+    hAsync->pHead = pReq;
+  }
+  hAsync->pTail = pReq;
+  pthread_cond_signal(&hAsync->queueCond);
+  pthread_mutex_unlock(&hAsync->lock);
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        IChannelAsync_Poll
+**
+** Description:     Checks for completion of pReq without blocking.
+**
+** Returns:         True if pReq is completed.
+**
+*******************************************************************************/
+bool IChannelAsync_Poll(IChannelRequest_t* pReq) {
+  IChannelAsyncHandle_t hAsync = pReq->hAsync;
+  bool isDone;
+
+  if (hAsync == NULL) return false;
+  pthread_mutex_lock(&hAsync->lock);
+  isDone = (pReq->state == ICHANNEL_REQ_DONE);
+  pthread_mutex_unlock(&hAsync->lock);
+  return isDone;
+}
+
+/*******************************************************************************
+**
+** Function:        IChannelAsync_Wait
+**
+** Description:     Blocks until pReq is completed.
+**
+** Returns:         Transceive status of pReq.
+**
+*******************************************************************************/
+bool IChannelAsync_Wait(IChannelRequest_t* pReq) {
+  IChannelAsyncHandle_t hAsync = pReq->hAsync;
+  bool status;
+
+  if (hAsync == NULL) return false;
+  pthread_mutex_lock(&hAsync->lock);
+  while (pReq->state == ICHANNEL_REQ_PENDING) {
+    pthread_cond_wait(&hAsync->doneCond, &hAsync->lock);
+  }
+  status = (pReq->state == ICHANNEL_REQ_DONE) && pReq->status;
+  pthread_mutex_unlock(&hAsync->lock);
+  return status;
+}
+
+/*******************************************************************************
+**
+** Function:        IChannelAsync_Complete
+**
+** Description:     Reports the result of a request, used by native
+**                  implementations of IChannelAsync_t::submit.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void IChannelAsync_Complete(IChannelRequest_t* pReq, bool status,
+                            int32_t recvBufferActualSize) {
+  IChannelAsyncHandle_t hAsync = pReq->hAsync;
+
+  pReq->status = status;
+  pReq->recvBufferActualSize = recvBufferActualSize;
+  /*The request is handed back only after the callback returned, so that the
+    owner may release it as soon as Poll/Wait report completion*/
+  if (pReq->callback != NULL) pReq->callback(pReq);
+
+  pthread_mutex_lock(&hAsync->lock);
+  pReq->state = ICHANNEL_REQ_DONE;
+  hAsync->pendingCnt--;
+  pthread_cond_broadcast(&hAsync->doneCond);
+  pthread_mutex_unlock(&hAsync->lock);
+}
@@ -0,0 +1,138 @@
+/******************************************************************************
+ *
+ *  Copyright 2019 NXP
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+#include <log/log.h>
+#include <pthread.h>
+#include <string.h>
+
+#include <IChannelBatch.h>
+
+/* Native batch of the channel with the transceive entry point */
+typedef struct IChannelBatchReg {
+  bool (*transceive)(uint8_t*, int32_t, uint8_t*, int32_t, int32_t&, int32_t);
+  IChannelBatch_t batch;
+} IChannelBatchReg_t;
+
+static IChannelBatchReg_t sBatch[ICHANNEL_BATCH_MAX_REG];
+static pthread_mutex_t sBatchLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*******************************************************************************
+**
+** Function:        IChannelBatch_Register
+**
+** Description:     Registers the native batch implementation of channel,
+**                  NULL restores the one by one fallback for it.
+**
+** Returns:         True if ok, false if all registrations are in use.
+**
+*******************************************************************************/
+bool IChannelBatch_Register(IChannel_t* channel, IChannelBatch_t* pBatch) {
+  static const char fn[] = "IChannelBatch_Register";
+  bool isNative = (pBatch != NULL) && (pBatch->transceiveBatch != NULL);
+  IChannelBatchReg_t* pFree = NULL;
+  bool stat = true;
+
+  if (channel == NULL || channel->transceive == NULL) {
+    ALOGE("%s: Invalid channel", fn);
+    return false;
+  }
+  pthread_mutex_lock(&sBatchLock);
+  for (int i = 0; i < ICHANNEL_BATCH_MAX_REG; i++) {
+    if (sBatch[i].transceive == channel->transceive) {
+      memset(&sBatch[i], 0, sizeof(IChannelBatchReg_t));
+    }
+    if (pFree == NULL && sBatch[i].transceive == NULL) pFree = &sBatch[i];
+  }
+  if (isNative) {
+    if (pFree != NULL) {
+      pFree->transceive = channel->transceive;
+      memcpy(&pFree->batch, pBatch, sizeof(IChannelBatch_t));
+    } else {
+      ALOGE("%s: No registration left", fn);
+      stat = false;
+    }
+  }
+  pthread_mutex_unlock(&sBatchLock);
+  return stat;
+}
+
+/*******************************************************************************
+**
+** Function:        IChannelBatch_Transceive
+**
+** Description:     Sends pCmds[0..count-1] using the registered batch
+**                  implementation or one transceive per command on channel.
+**                  See IChannelBatch_t::transceiveBatch.
+**
+** Returns:         Number of commands sent.
+**
+*******************************************************************************/
+int32_t IChannelBatch_Transceive(IChannel_t* channel, IChannelCmd_t* pCmds,
+                                 int32_t count, IChannelBatchPolicy_t policy,
+                                 uint8_t* recvBuffer, int32_t recvBufferMaxSize,
+                                 int32_t& recvBufferActualSize,
+                                 int32_t timeoutMillisec) {
+  static const char fn[] = "IChannelBatch_Transceive";
+  IChannelBatch_t batch;
+  bool isNative = false;
+  int32_t sent = 0;
+
+  recvBufferActualSize = 0;
+  if (pCmds == NULL || count <= 0) return 0;
+  if (channel == NULL || channel->transceive == NULL) {
+    ALOGE("%s: Invalid channel", fn);
+    return 0;
+  }
+
+  pthread_mutex_lock(&sBatchLock);
+  for (int i = 0; i < ICHANNEL_BATCH_MAX_REG && !isNative; i++) {
+    if (sBatch[i].transceive == channel->transceive) {
+      isNative = true;
+      batch = sBatch[i].batch;
+    }
+  }
+  pthread_mutex_unlock(&sBatchLock);
+  if (isNative) {
+    return batch.transceiveBatch(pCmds, count, policy, recvBuffer,
+                                 recvBufferMaxSize, recvBufferActualSize,
+                                 timeoutMillisec);
+  }
+
+  while (sent < count) {
+    IChannelCmd_t* pCmd = &pCmds[sent++];
+    recvBufferActualSize = 0;
+    pCmd->status =
+        channel->transceive(pCmd->p_data, pCmd->len, recvBuffer,
+                            recvBufferMaxSize, recvBufferActualSize,
+                            timeoutMillisec);
+    pCmd->sw = 0;
+    if (pCmd->status && (recvBufferActualSize >= 2)) {
+      pCmd->sw = (uint16_t)((recvBuffer[recvBufferActualSize - 2] << 8) |
+                            recvBuffer[recvBufferActualSize - 1]);
+    }
+    if (!pCmd->status) {
+      ALOGE("%s: Transceive of command %d failed", fn, sent - 1);
+      if (policy != ICHANNEL_BATCH_ABORT_NEVER) break;
+    } else if ((policy == ICHANNEL_BATCH_ABORT_ON_SW) &&
+               (pCmd->sw != 0x9000)) {
+      ALOGE("%s: Command %d failed with SW 0x%04X", fn, sent - 1, pCmd->sw);
+      break;
+    }
+  }
+  return sent;
+}
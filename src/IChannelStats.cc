@@ -0,0 +1,509 @@
+/******************************************************************************
+ *
+ *  Copyright 2019 NXP
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+#include <atomic>
+#include <log/log.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <IChannelStats.h>
+
+/* Log-linear buckets: values below 2^SUB_BITS microseconds are exact, above
+ * each power of two is split in 2^SUB_BITS buckets (12.5% resolution).
+ * The last bucket collects everything from 2^MAX_EXP us (about 67 s) on. */
+#define STATS_SUB_BITS 3
+#define STATS_SUB_CNT (1 << STATS_SUB_BITS)
+#define STATS_MAX_EXP 26
+#define STATS_BUCKETS ((STATS_MAX_EXP - STATS_SUB_BITS + 2) * STATS_SUB_CNT)
+#define STATS_NUM_INS 256
+
+typedef struct IChannelHist {
+  std::atomic<uint32_t> bucket[STATS_BUCKETS];
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> sumUs;
+  std::atomic<uint32_t> maxUs;
+} IChannelHist_t;
+
+typedef struct IChannelPhaseStats {
+  IChannelHist_t hist;
+  std::atomic<uint64_t> bytesIn;  /* C-APDU bytes */
+  std::atomic<uint64_t> bytesOut; /* R-APDU bytes */
+  std::atomic<uint64_t> firstUs;  /* Start of the first transceive */
+  std::atomic<uint64_t> lastUs;   /* End of the last transceive */
+  std::atomic<uint32_t> errSw;    /* Status words other than 9000 */
+  std::atomic<uint32_t> errTrans; /* Failed transceive calls */
+} IChannelPhaseStats_t;
+
+static IChannelPhaseStats_t sPhase[ICHANNEL_PHASE_MAX];
+/* Allocated on first use, most INS values are never seen */
+static std::atomic<IChannelHist_t*> sIns[STATS_NUM_INS];
+static std::atomic<uint32_t> sSw1[256];
+static thread_local IChannelPhase_t tPhase = ICHANNEL_PHASE_OTHER;
+
+static IChannel_t sWrapped[ICHANNEL_STATS_MAX_WRAP];
+static bool sWrapUsed[ICHANNEL_STATS_MAX_WRAP];
+static pthread_mutex_t sWrapLock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char* const sPhaseName[ICHANNEL_PHASE_MAX] = {
+    "OTHER", "LS_CERT", "LS_CMD", "JCOP_STEP1", "JCOP_STEP2", "JCOP_STEP3",
+    "UAI"};
+
+/*******************************************************************************
+**
+** Function:        IChannelStats_NowUs
+**
+** Description:     Monotonic clock.
+**
+** Returns:         Time in microseconds
+**
+*******************************************************************************/
+static uint64_t IChannelStats_NowUs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*******************************************************************************
+**
+** Function:        IChannelStats_Bucket
+**
+** Description:     Histogram bucket of a latency.
+**
+** Returns:         Bucket index
+**
+*******************************************************************************/
+static uint32_t IChannelStats_Bucket(uint64_t us) {
+  uint32_t exp;
+
+  if (us < STATS_SUB_CNT) return (uint32_t)us;
+  exp = 63 - __builtin_clzll(us);
+  if (exp > STATS_MAX_EXP) return STATS_BUCKETS - 1;
+  return (exp - STATS_SUB_BITS + 1) * STATS_SUB_CNT +
+         (uint32_t)((us >> (exp - STATS_SUB_BITS)) & (STATS_SUB_CNT - 1));
+}
+
+/*******************************************************************************
+**
+** Function:        IChannelStats_BucketValue
+**
+** Description:     Lowest latency accounted in a bucket.
+**
+** Returns:         Time in microseconds
+**
+*******************************************************************************/
+static uint64_t IChannelStats_BucketValue(uint32_t idx) {
+  uint32_t exp;
+
+  if (idx < STATS_SUB_CNT) return idx;
+  exp = idx / STATS_SUB_CNT + STATS_SUB_BITS - 1;
+  return (uint64_t)(STATS_SUB_CNT + idx % STATS_SUB_CNT)
+         << (exp - STATS_SUB_BITS);
+}
+
+/*******************************************************************************
+**
+** Function:        IChannelStats_Record
+**
+** Description:     Adds one sample to a histogram.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void IChannelStats_Record(IChannelHist_t* pHist, uint64_t us) {
+  uint32_t max = pHist->maxUs.load(std::memory_order_relaxed);
+  uint32_t val = (us > UINT32_MAX) ? UINT32_MAX : (uint32_t)us;
+
+  pHist->bucket[IChannelStats_Bucket(us)].fetch_add(
+      1, std::memory_order_relaxed);
+  pHist->count.fetch_add(1, std::memory_order_relaxed);
+  pHist->sumUs.fetch_add(us, std::memory_order_relaxed);
+  while (val > max && !pHist->maxUs.compare_exchange_weak(
+                          max, val, std::memory_order_relaxed)) {
+  }
+}
+
+/*******************************************************************************
+**
+** Function:        IChannelStats_InsHist
+**
+** Description:     Histogram of an INS byte, allocated on first use.
+**
+** Returns:         Histogram or NULL if out of memory.
+**
+*******************************************************************************/
+static IChannelHist_t* IChannelStats_InsHist(uint8_t ins) {
+  IChannelHist_t* pHist = sIns[ins].load(std::memory_order_acquire);
+  IChannelHist_t* pExpected = NULL;
+
+  if (pHist != NULL) return pHist;
+  /*Zeroed memory is a valid initial state for the atomic counters*/
+  pHist = (IChannelHist_t*)calloc(1, sizeof(IChannelHist_t));
+  if (pHist == NULL) return NULL;
+  if (!sIns[ins].compare_exchange_strong(pExpected, pHist,
+                                         std::memory_order_acq_rel)) {
+    free(pHist);
+    pHist = pExpected;
+  }
+  return pHist;
+}
+
+/*******************************************************************************
+**
+** Function:        IChannelStats_Account
+**
+** Description:     Accounts one transceive to the phase of the calling
+**                  thread and to the INS of the command.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void IChannelStats_Account(const uint8_t* xmitBuffer,
+                                  int32_t xmitBufferSize,
+                                  const uint8_t* recvBuffer,
+                                  int32_t recvBufferActualSize, bool status,
+                                  uint64_t startUs, uint64_t endUs) {
+  IChannelPhaseStats_t* pPhase = &sPhase[tPhase];
+  IChannelHist_t* pIns;
+  uint64_t first = 0;
+  uint64_t us = endUs - startUs;
+
+  IChannelStats_Record(&pPhase->hist, us);
+  if (xmitBufferSize >= 2 && (pIns = IChannelStats_InsHist(xmitBuffer[1]))) {
+    IChannelStats_Record(pIns, us);
+  }
+  pPhase->bytesIn.fetch_add(xmitBufferSize, std::memory_order_relaxed);
+  pPhase->firstUs.compare_exchange_strong(first, startUs,
+                                          std::memory_order_relaxed);
+  pPhase->lastUs.store(endUs, std::memory_order_relaxed);
+  if (!status) {
+    pPhase->errTrans.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  pPhase->bytesOut.fetch_add(recvBufferActualSize, std::memory_order_relaxed);
+  if (recvBufferActualSize >= 2) {
+    uint8_t sw1 = recvBuffer[recvBufferActualSize - 2];
+    uint8_t sw2 = recvBuffer[recvBufferActualSize - 1];
+    if (sw1 != 0x90 || sw2 != 0x00) {
+      pPhase->errSw.fetch_add(1, std::memory_order_relaxed);
+      sSw1[sw1].fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+}
+
+/* Entry points of wrapper slot N, IChannel_t carries no context */
+template <int N>
+struct IChannelStatsSlot {
+  static int16_t open() { return sWrapped[N].open(); }
+
+  static bool close(int16_t mHandle) { return sWrapped[N].close(mHandle); }
+
+  static bool transceive(uint8_t* xmitBuffer, int32_t xmitBufferSize,
+                         uint8_t* recvBuffer, int32_t recvBufferMaxSize,
+                         int32_t& recvBufferActualSize,
+                         int32_t timeoutMillisec) {
+    uint64_t startUs = IChannelStats_NowUs();
+    bool status = sWrapped[N].transceive(xmitBuffer, xmitBufferSize,
+                                         recvBuffer, recvBufferMaxSize,
+                                         recvBufferActualSize, timeoutMillisec);
+    IChannelStats_Account(xmitBuffer, xmitBufferSize, recvBuffer,
+                          recvBufferActualSize, status, startUs,
+                          IChannelStats_NowUs());
+    return status;
+  }
+
+  static bool transceiveRaw(uint8_t* xmitBuffer, int32_t xmitBufferSize,
+                            uint8_t* recvBuffer, int32_t recvBufferMaxSize,
+                            int32_t& recvBufferActualSize,
+                            int32_t timeoutMillisec) {
+    uint64_t startUs = IChannelStats_NowUs();
+    bool status = sWrapped[N].transceiveRaw(
+        xmitBuffer, xmitBufferSize, recvBuffer, recvBufferMaxSize,
+        recvBufferActualSize, timeoutMillisec);
+    IChannelStats_Account(xmitBuffer, xmitBufferSize, recvBuffer,
+                          recvBufferActualSize, status, startUs,
+                          IChannelStats_NowUs());
+    return status;
+  }
+
+  static void reset() { sWrapped[N].doeSE_Reset(); }
+
+  static void jcopDownLoadReset() { sWrapped[N].doeSE_JcopDownLoadReset(); }
+
+  static uint8_t getInterfaceInfo() { return sWrapped[N].getInterfaceInfo(); }
+
+  static void fill(const IChannel_t* channel, IChannel_t* pWrapped) {
+    memset(pWrapped, 0, sizeof(IChannel_t));
+    if (channel->open) pWrapped->open = open;
+    if (channel->close) pWrapped->close = close;
+    if (channel->transceive) pWrapped->transceive = transceive;
+    if (channel->transceiveRaw) pWrapped->transceiveRaw = transceiveRaw;
+    if (channel->doeSE_Reset) pWrapped->doeSE_Reset = reset;
+    if (channel->doeSE_JcopDownLoadReset) {
+      pWrapped->doeSE_JcopDownLoadReset = jcopDownLoadReset;
+    }
+    if (channel->getInterfaceInfo) {
+      pWrapped->getInterfaceInfo = getInterfaceInfo;
+    }
+  }
+};
+
+static void (*const sSlotFill[ICHANNEL_STATS_MAX_WRAP])(const IChannel_t*,
+                                                        IChannel_t*) = {
+    IChannelStatsSlot<0>::fill, IChannelStatsSlot<1>::fill};
+
+/*******************************************************************************
+**
+** Function:        IChannelStats_Wrap
+**
+** Description:     Fills pWrapped with a channel forwarding to channel and
+**                  accounting each transceive. channel is copied, pWrapped
+**                  may point to it.
+**
+** Returns:         True if ok, false if all wrapper slots are in use.
+**
+*******************************************************************************/
+bool IChannelStats_Wrap(IChannel_t* channel, IChannel_t* pWrapped) {
+  static const char fn[] = "IChannelStats_Wrap";
+
+  if (channel == NULL || pWrapped == NULL) return false;
+  pthread_mutex_lock(&sWrapLock);
+  for (int i = 0; i < ICHANNEL_STATS_MAX_WRAP; i++) {
+    if (sWrapUsed[i]) continue;
+    sWrapUsed[i] = true;
+    memcpy(&sWrapped[i], channel, sizeof(IChannel_t));
+    sSlotFill[i](&sWrapped[i], pWrapped);
+    pthread_mutex_unlock(&sWrapLock);
+    ALOGD("%s: channel accounted in slot %d", fn, i);
+    return true;
+  }
+  pthread_mutex_unlock(&sWrapLock);
+  ALOGE("%s: No free slot", fn);
+  return false;
+}
+
+/*******************************************************************************
+**
+** Function:        IChannelStats_Unwrap
+**
+** Description:     Releases the slot of a channel filled by
+**                  IChannelStats_Wrap. No call may be made through it
+**                  afterwards.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void IChannelStats_Unwrap(IChannel_t* pWrapped) {
+  IChannel_t slot;
+
+  if (pWrapped == NULL) return;
+  pthread_mutex_lock(&sWrapLock);
+  for (int i = 0; i < ICHANNEL_STATS_MAX_WRAP; i++) {
+    if (!sWrapUsed[i]) continue;
+    sSlotFill[i](&sWrapped[i], &slot);
+    if (slot.transceive == pWrapped->transceive &&
+        slot.transceiveRaw == pWrapped->transceiveRaw) {
+      sWrapUsed[i] = false;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&sWrapLock);
+}
+
+/*******************************************************************************
+**
+** Function:        IChannelStats_SetPhase
+**
+** Description:     Sets the phase the transceive calls of the calling thread
+**                  are accounted to.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void IChannelStats_SetPhase(IChannelPhase_t phase) {
+  if (phase >= ICHANNEL_PHASE_MAX) phase = ICHANNEL_PHASE_OTHER;
+  tPhase = phase;
+}
+
+/*******************************************************************************
+**
+** Function:        IChannelStats_Percentile
+**
+** Description:     Latency below which pct percent of the samples fall.
+**
+** Returns:         Time in microseconds
+**
+*******************************************************************************/
+static uint64_t IChannelStats_Percentile(const IChannelHist_t* pHist,
+                                         uint64_t count, uint32_t pct) {
+  uint64_t rank = (count * pct + 99) / 100;
+  uint64_t seen = 0;
+
+  for (uint32_t i = 0; i < STATS_BUCKETS; i++) {
+    seen += pHist->bucket[i].load(std::memory_order_relaxed);
+    if (seen >= rank) return IChannelStats_BucketValue(i);
+  }
+  return pHist->maxUs.load(std::memory_order_relaxed);
+}
+
+/*******************************************************************************
+**
+** Function:        IChannelStats_Print
+**
+** Description:     Writes one line of the dump.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void IChannelStats_Print(int fd, const char* pLine) {
+  if (fd < 0) {
+    ALOGD("%s", pLine);
+  } else {
+    dprintf(fd, "%s\n", pLine);
+  }
+}
+
+/*******************************************************************************
+**
+** Function:        IChannelStats_PrintHist
+**
+** Description:     Writes the summary of a histogram.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void IChannelStats_PrintHist(int fd, const char* pName,
+                                    const IChannelHist_t* pHist) {
+  char line[256];
+  uint64_t count = pHist->count.load(std::memory_order_relaxed);
+
+  if (count == 0) return;
+  snprintf(line, sizeof(line),
+           "%-10s n=%llu avg=%llu p50=%llu p90=%llu p99=%llu max=%u us",
+           pName, (unsigned long long)count,
+           (unsigned long long)(pHist->sumUs.load(std::memory_order_relaxed) /
+                                count),
+           (unsigned long long)IChannelStats_Percentile(pHist, count, 50),
+           (unsigned long long)IChannelStats_Percentile(pHist, count, 90),
+           (unsigned long long)IChannelStats_Percentile(pHist, count, 99),
+           pHist->maxUs.load(std::memory_order_relaxed));
+  IChannelStats_Print(fd, line);
+}
+
+/*******************************************************************************
+**
+** Function:        IChannelStats_Dump
+**
+** Description:     Writes percentiles, throughput and status word counts to
+**                  fd, or to the log if fd is negative.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void IChannelStats_Dump(int fd) {
+  char line[256];
+
+  IChannelStats_Print(fd, "APDU latency per phase:");
+  for (int i = 0; i < ICHANNEL_PHASE_MAX; i++) {
+    IChannelPhaseStats_t* pPhase = &sPhase[i];
+    uint64_t busyUs = pPhase->hist.sumUs.load(std::memory_order_relaxed);
+    uint64_t first = pPhase->firstUs.load(std::memory_order_relaxed);
+    uint64_t last = pPhase->lastUs.load(std::memory_order_relaxed);
+    uint64_t bytes = pPhase->bytesIn.load(std::memory_order_relaxed) +
+                     pPhase->bytesOut.load(std::memory_order_relaxed);
+    uint64_t wallUs = (last > first) ? last - first : 0;
+
+    if (pPhase->hist.count.load(std::memory_order_relaxed) == 0) continue;
+    IChannelStats_PrintHist(fd, sPhaseName[i], &pPhase->hist);
+    /*Channel time close to wall time means eSE or link bound, a low share
+      means the host is the bottleneck*/
+    snprintf(line, sizeof(line),
+             "%-10s in=%llu out=%llu B channel=%llu B/s wall=%llu B/s "
+             "busy=%llu%% errSw=%u errTrans=%u",
+             "", (unsigned long long)pPhase->bytesIn.load(),
+             (unsigned long long)pPhase->bytesOut.load(),
+             (unsigned long long)(busyUs ? bytes * 1000000 / busyUs : 0),
+             (unsigned long long)(wallUs ? bytes * 1000000 / wallUs : 0),
+             (unsigned long long)(wallUs ? busyUs * 100 / wallUs : 0),
+             pPhase->errSw.load(), pPhase->errTrans.load());
+    IChannelStats_Print(fd, line);
+  }
+
+  IChannelStats_Print(fd, "APDU latency per INS:");
+  for (int i = 0; i < STATS_NUM_INS; i++) {
+    IChannelHist_t* pHist = sIns[i].load(std::memory_order_acquire);
+    char name[16];
+
+    if (pHist == NULL) continue;
+    snprintf(name, sizeof(name), "INS 0x%02X", i);
+    IChannelStats_PrintHist(fd, name, pHist);
+  }
+
+  IChannelStats_Print(fd, "Status words other than 9000 per SW1:");
+  for (int i = 0; i < 256; i++) {
+    uint32_t cnt = sSw1[i].load(std::memory_order_relaxed);
+    if (cnt == 0) continue;
+    snprintf(line, sizeof(line), "SW1 0x%02X: %u", i, cnt);
+    IChannelStats_Print(fd, line);
+  }
+}
+
+/*******************************************************************************
+**
+** Function:        IChannelStats_ClearHist
+**
+** Description:     Clears a histogram.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void IChannelStats_ClearHist(IChannelHist_t* pHist) {
+  for (uint32_t i = 0; i < STATS_BUCKETS; i++) pHist->bucket[i].store(0);
+  pHist->count.store(0);
+  pHist->sumUs.store(0);
+  pHist->maxUs.store(0);
+}
+
+/*******************************************************************************
+**
+** Function:        IChannelStats_Reset
+**
+** Description:     Clears all counters.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void IChannelStats_Reset() {
+  for (int i = 0; i < ICHANNEL_PHASE_MAX; i++) {
+    IChannelStats_ClearHist(&sPhase[i].hist);
+    sPhase[i].bytesIn.store(0);
+    sPhase[i].bytesOut.store(0);
+    sPhase[i].firstUs.store(0);
+    sPhase[i].lastUs.store(0);
+    sPhase[i].errSw.store(0);
+    sPhase[i].errTrans.store(0);
+  }
+  /*INS histograms stay allocated, a concurrent transceive may use them*/
+  for (int i = 0; i < STATS_NUM_INS; i++) {
+    IChannelHist_t* pHist = sIns[i].load(std::memory_order_acquire);
+    if (pHist != NULL) IChannelStats_ClearHist(pHist);
+  }
+  for (int i = 0; i < 256; i++) sSw1[i].store(0);
+}
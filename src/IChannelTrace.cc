@@ -0,0 +1,504 @@
+/******************************************************************************
+ *
+ *  Copyright 2019 NXP
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+#include <log/log.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include <IChannelTrace.h>
+
+typedef struct IChannelTraceRecorder {
+  IChannel_t channel; /* Recorded channel */
+  FILE* fp;
+  uint64_t originUs;
+  IChannelTraceStats_t stats;
+} IChannelTraceRecorder_t;
+
+typedef struct IChannelTracePlayer {
+  std::vector<uint8_t> trace; /* Whole trace file */
+  size_t pos;                 /* Offset of the next record */
+  uint32_t latencyPct;
+  uint8_t intf;
+  IChannelTraceStats_t stats;
+} IChannelTracePlayer_t;
+
+static IChannelTraceRecorder_t sRecorder;
+static pthread_mutex_t sRecordLock = PTHREAD_MUTEX_INITIALIZER;
+static IChannelTracePlayer_t sPlayer;
+static pthread_mutex_t sReplayLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*******************************************************************************
+**
+** Function:        IChannelTrace_NowUs
+**
+** Description:     Monotonic clock.
+**
+** Returns:         Time in microseconds
+**
+*******************************************************************************/
+static uint64_t IChannelTrace_NowUs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*******************************************************************************
+**
+** Function:        IChannelTrace_Write
+**
+** Description:     Appends one exchange to the trace.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void IChannelTrace_Write(IChannelTraceType_t type, bool status,
+                                const uint8_t* pCmd, int32_t cmdLen,
+                                const uint8_t* pRsp, int32_t rspLen,
+                                uint64_t startUs, uint64_t endUs) {
+  IChannelTraceRec_t rec;
+
+  memset(&rec, 0, sizeof(rec));
+  rec.type = (uint8_t)type;
+  rec.status = status ? 1 : 0;
+  rec.cmdLen = (pCmd != NULL && cmdLen > 0) ? (uint32_t)cmdLen : 0;
+  rec.rspLen = (pRsp != NULL && rspLen > 0) ? (uint32_t)rspLen : 0;
+  rec.durationUs = (uint32_t)(endUs - startUs);
+
+  pthread_mutex_lock(&sRecordLock);
+  if (sRecorder.fp != NULL) {
+    rec.startUs = startUs - sRecorder.originUs;
+    fwrite(&rec, sizeof(rec), 1, sRecorder.fp);
+    if (rec.cmdLen != 0) fwrite(pCmd, 1, rec.cmdLen, sRecorder.fp);
+    if (rec.rspLen != 0) fwrite(pRsp, 1, rec.rspLen, sRecorder.fp);
+    sRecorder.stats.records++;
+    sRecorder.stats.bytes += rec.cmdLen + rec.rspLen;
+    sRecorder.stats.channelUs += rec.durationUs;
+  }
+  pthread_mutex_unlock(&sRecordLock);
+}
+
+static int16_t IChannelTrace_RecOpen() { return sRecorder.channel.open(); }
+
+static bool IChannelTrace_RecClose(int16_t mHandle) {
+  return sRecorder.channel.close(mHandle);
+}
+
+static bool IChannelTrace_RecTransceive(uint8_t* xmitBuffer,
+                                        int32_t xmitBufferSize,
+                                        uint8_t* recvBuffer,
+                                        int32_t recvBufferMaxSize,
+                                        int32_t& recvBufferActualSize,
+                                        int32_t timeoutMillisec) {
+  uint64_t startUs = IChannelTrace_NowUs();
+  bool status = sRecorder.channel.transceive(
+      xmitBuffer, xmitBufferSize, recvBuffer, recvBufferMaxSize,
+      recvBufferActualSize, timeoutMillisec);
+  IChannelTrace_Write(ICHANNEL_TRACE_TRANSCEIVE, status, xmitBuffer,
+                      xmitBufferSize, recvBuffer, recvBufferActualSize,
+                      startUs, IChannelTrace_NowUs());
+  return status;
+}
+
+static bool IChannelTrace_RecTransceiveRaw(uint8_t* xmitBuffer,
+                                           int32_t xmitBufferSize,
+                                           uint8_t* recvBuffer,
+                                           int32_t recvBufferMaxSize,
+                                           int32_t& recvBufferActualSize,
+                                           int32_t timeoutMillisec) {
+  uint64_t startUs = IChannelTrace_NowUs();
+  bool status = sRecorder.channel.transceiveRaw(
+      xmitBuffer, xmitBufferSize, recvBuffer, recvBufferMaxSize,
+      recvBufferActualSize, timeoutMillisec);
+  IChannelTrace_Write(ICHANNEL_TRACE_TRANSCEIVE_RAW, status, xmitBuffer,
+                      xmitBufferSize, recvBuffer, recvBufferActualSize,
+                      startUs, IChannelTrace_NowUs());
+  return status;
+}
+
+static void IChannelTrace_RecReset() {
+  uint64_t startUs = IChannelTrace_NowUs();
+  sRecorder.channel.doeSE_Reset();
+  IChannelTrace_Write(ICHANNEL_TRACE_RESET, true, NULL, 0, NULL, 0, startUs,
+                      IChannelTrace_NowUs());
+}
+
+static void IChannelTrace_RecJcopDownLoadReset() {
+  uint64_t startUs = IChannelTrace_NowUs();
+  sRecorder.channel.doeSE_JcopDownLoadReset();
+  IChannelTrace_Write(ICHANNEL_TRACE_JCOP_DL_RESET, true, NULL, 0, NULL, 0,
+                      startUs, IChannelTrace_NowUs());
+}
+
+static uint8_t IChannelTrace_RecGetInterfaceInfo() {
+  return sRecorder.channel.getInterfaceInfo();
+}
+
+/*******************************************************************************
+**
+** Function:        IChannelTrace_StartRecord
+**
+** Description:     Creates the trace file path and fills pTraced with a
+**                  channel recording each call before forwarding it to
+**                  channel.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+bool IChannelTrace_StartRecord(IChannel_t* channel, const char* path,
+                               IChannel_t* pTraced) {
+  static const char fn[] = "IChannelTrace_StartRecord";
+  IChannelTraceHdr_t hdr;
+  FILE* fp;
+
+  if (channel == NULL || path == NULL || pTraced == NULL) {
+    ALOGE("%s: Invalid parameter", fn);
+    return false;
+  }
+  pthread_mutex_lock(&sRecordLock);
+  if (sRecorder.fp != NULL) {
+    pthread_mutex_unlock(&sRecordLock);
+    ALOGE("%s: Recording already in progress", fn);
+    return false;
+  }
+  if ((fp = fopen(path, "wb")) == NULL) {
+    pthread_mutex_unlock(&sRecordLock);
+    ALOGE("%s: Unable to create <%s>", fn, path);
+    return false;
+  }
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = ICHANNEL_TRACE_MAGIC;
+  hdr.version = ICHANNEL_TRACE_VERSION;
+  hdr.intf =
+      (channel->getInterfaceInfo != NULL) ? channel->getInterfaceInfo() : 0;
+  fwrite(&hdr, sizeof(hdr), 1, fp);
+
+  memcpy(&sRecorder.channel, channel, sizeof(IChannel_t));
+  memset(&sRecorder.stats, 0, sizeof(IChannelTraceStats_t));
+  sRecorder.originUs = IChannelTrace_NowUs();
+  sRecorder.fp = fp;
+  pthread_mutex_unlock(&sRecordLock);
+
+  /*Entry points the recorded channel does not have stay NULL*/
+  memset(pTraced, 0, sizeof(IChannel_t));
+  if (channel->open) pTraced->open = IChannelTrace_RecOpen;
+  if (channel->close) pTraced->close = IChannelTrace_RecClose;
+  if (channel->transceive) pTraced->transceive = IChannelTrace_RecTransceive;
+  if (channel->transceiveRaw) {
+    pTraced->transceiveRaw = IChannelTrace_RecTransceiveRaw;
+  }
+  if (channel->doeSE_Reset) pTraced->doeSE_Reset = IChannelTrace_RecReset;
+  if (channel->doeSE_JcopDownLoadReset) {
+    pTraced->doeSE_JcopDownLoadReset = IChannelTrace_RecJcopDownLoadReset;
+  }
+  if (channel->getInterfaceInfo) {
+    pTraced->getInterfaceInfo = IChannelTrace_RecGetInterfaceInfo;
+  }
+  ALOGD("%s: recording to <%s>", fn, path);
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        IChannelTrace_StopRecord
+**
+** Description:     Flushes and closes the trace file.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void IChannelTrace_StopRecord(IChannelTraceStats_t* pStats) {
+  static const char fn[] = "IChannelTrace_StopRecord";
+
+  pthread_mutex_lock(&sRecordLock);
+  if (sRecorder.fp != NULL) {
+    fclose(sRecorder.fp);
+    sRecorder.fp = NULL;
+    ALOGD("%s: %u records, %llu bytes", fn, sRecorder.stats.records,
+          (unsigned long long)sRecorder.stats.bytes);
+  }
+  if (pStats != NULL) memcpy(pStats, &sRecorder.stats, sizeof(*pStats));
+  pthread_mutex_unlock(&sRecordLock);
+}
+
+/*******************************************************************************
+**
+** Function:        IChannelTrace_Next
+**
+** Description:     Copies the header of the next record of the trace without
+**                  consuming it. Records are packed back to back, so the
+**                  header is not aligned in the trace. Called with
+**                  sReplayLock held.
+**
+** Returns:         false at the end of the trace.
+**
+*******************************************************************************/
+static bool IChannelTrace_Next(IChannelTraceRec_t& rec) {
+  if (sPlayer.pos + sizeof(IChannelTraceRec_t) > sPlayer.trace.size()) {
+    return false;
+  }
+  memcpy(&rec, &sPlayer.trace[sPlayer.pos], sizeof(IChannelTraceRec_t));
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        IChannelTrace_Wait
+**
+** Description:     Spends the scaled recorded latency of a record.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void IChannelTrace_Wait(uint32_t durationUs, uint32_t latencyPct) {
+  uint64_t us = ((uint64_t)durationUs * latencyPct) / 100;
+  if (us != 0) usleep((useconds_t)us);
+}
+
+/*******************************************************************************
+**
+** Function:        IChannelTrace_Replay
+**
+** Description:     Serves the next exchange of the trace. Resets recorded
+**                  before it are skipped and counted as mismatches, as is a
+**                  command differing from the recorded one.
+**
+** Returns:         Recorded transceive status, false at the end of the trace.
+**
+*******************************************************************************/
+static bool IChannelTrace_Replay(IChannelTraceType_t type, uint8_t* xmitBuffer,
+                                 int32_t xmitBufferSize, uint8_t* recvBuffer,
+                                 int32_t recvBufferMaxSize,
+                                 int32_t& recvBufferActualSize) {
+  static const char fn[] = "IChannelTrace_Replay";
+  IChannelTraceRec_t rec;
+  const uint8_t *pCmd, *pRsp;
+  uint32_t durationUs, latencyPct;
+  bool status, found;
+
+  recvBufferActualSize = 0;
+  pthread_mutex_lock(&sReplayLock);
+  while ((found = IChannelTrace_Next(rec)) &&
+         rec.type != ICHANNEL_TRACE_TRANSCEIVE &&
+         rec.type != ICHANNEL_TRACE_TRANSCEIVE_RAW) {
+    ALOGE("%s: Skipping recorded reset", fn);
+    sPlayer.stats.mismatches++;
+    sPlayer.pos += sizeof(IChannelTraceRec_t);
+  }
+  if (!found) {
+    pthread_mutex_unlock(&sReplayLock);
+    ALOGE("%s: End of trace", fn);
+    return false;
+  }
+  pCmd = &sPlayer.trace[sPlayer.pos + sizeof(IChannelTraceRec_t)];
+  pRsp = pCmd + rec.cmdLen;
+  if (rec.type != type || rec.cmdLen != (uint32_t)xmitBufferSize ||
+      memcmp(pCmd, xmitBuffer, rec.cmdLen)) {
+    ALOGE("%s: Command %u differs from the trace", fn,
+          sPlayer.stats.records);
+    sPlayer.stats.mismatches++;
+  }
+  status = (rec.status != 0);
+  if ((int32_t)rec.rspLen > recvBufferMaxSize) {
+    ALOGE("%s: Recorded response exceeds buffer", fn);
+    status = false;
+  } else {
+    memcpy(recvBuffer, pRsp, rec.rspLen);
+    recvBufferActualSize = (int32_t)rec.rspLen;
+  }
+  sPlayer.stats.records++;
+  sPlayer.stats.bytes += rec.cmdLen + rec.rspLen;
+  sPlayer.stats.channelUs += rec.durationUs;
+  durationUs = rec.durationUs;
+  latencyPct = sPlayer.latencyPct;
+  sPlayer.pos += sizeof(IChannelTraceRec_t) + rec.cmdLen + rec.rspLen;
+  pthread_mutex_unlock(&sReplayLock);
+
+  IChannelTrace_Wait(durationUs, latencyPct);
+  return status;
+}
+
+/*******************************************************************************
+**
+** Function:        IChannelTrace_ReplayReset
+**
+** Description:     Consumes a recorded reset of the given type.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void IChannelTrace_ReplayReset(IChannelTraceType_t type) {
+  static const char fn[] = "IChannelTrace_ReplayReset";
+  IChannelTraceRec_t rec;
+  uint32_t durationUs = 0, latencyPct;
+
+  pthread_mutex_lock(&sReplayLock);
+  if (IChannelTrace_Next(rec) && rec.type == type) {
+    sPlayer.stats.records++;
+    sPlayer.stats.channelUs += rec.durationUs;
+    durationUs = rec.durationUs;
+    sPlayer.pos += sizeof(IChannelTraceRec_t) + rec.cmdLen + rec.rspLen;
+  } else {
+    ALOGE("%s: Reset not in the trace", fn);
+    sPlayer.stats.mismatches++;
+  }
+  latencyPct = sPlayer.latencyPct;
+  pthread_mutex_unlock(&sReplayLock);
+
+  IChannelTrace_Wait(durationUs, latencyPct);
+}
+
+static int16_t IChannelTrace_PlayOpen() { return 1; }
+
+static bool IChannelTrace_PlayClose(int16_t mHandle) {
+  (void)mHandle;
+  return true;
+}
+
+static bool IChannelTrace_PlayTransceive(uint8_t* xmitBuffer,
+                                         int32_t xmitBufferSize,
+                                         uint8_t* recvBuffer,
+                                         int32_t recvBufferMaxSize,
+                                         int32_t& recvBufferActualSize,
+                                         int32_t timeoutMillisec) {
+  (void)timeoutMillisec;
+  return IChannelTrace_Replay(ICHANNEL_TRACE_TRANSCEIVE, xmitBuffer,
+                              xmitBufferSize, recvBuffer, recvBufferMaxSize,
+                              recvBufferActualSize);
+}
+
+static bool IChannelTrace_PlayTransceiveRaw(uint8_t* xmitBuffer,
+                                            int32_t xmitBufferSize,
+                                            uint8_t* recvBuffer,
+                                            int32_t recvBufferMaxSize,
+                                            int32_t& recvBufferActualSize,
+                                            int32_t timeoutMillisec) {
+  (void)timeoutMillisec;
+  return IChannelTrace_Replay(ICHANNEL_TRACE_TRANSCEIVE_RAW, xmitBuffer,
+                              xmitBufferSize, recvBuffer, recvBufferMaxSize,
+                              recvBufferActualSize);
+}
+
+static void IChannelTrace_PlayReset() {
+  IChannelTrace_ReplayReset(ICHANNEL_TRACE_RESET);
+}
+
+static void IChannelTrace_PlayJcopDownLoadReset() {
+  IChannelTrace_ReplayReset(ICHANNEL_TRACE_JCOP_DL_RESET);
+}
+
+static uint8_t IChannelTrace_PlayGetInterfaceInfo() { return sPlayer.intf; }
+
+/*******************************************************************************
+**
+** Function:        IChannelTrace_StartReplay
+**
+** Description:     Loads the trace file path and fills pReplay with a channel
+**                  answering from it. latencyPct scales the recorded
+**                  latency, 100 for the original timing, 0 for none.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+bool IChannelTrace_StartReplay(const char* path, uint32_t latencyPct,
+                               IChannel_t* pReplay) {
+  static const char fn[] = "IChannelTrace_StartReplay";
+  std::vector<uint8_t> trace;
+  IChannelTraceHdr_t hdr;
+  uint8_t buf[4096];
+  size_t len, pos;
+  FILE* fp;
+
+  if (path == NULL || pReplay == NULL) {
+    ALOGE("%s: Invalid parameter", fn);
+    return false;
+  }
+  if ((fp = fopen(path, "rb")) == NULL) {
+    ALOGE("%s: Unable to open <%s>", fn, path);
+    return false;
+  }
+  if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+      hdr.magic != ICHANNEL_TRACE_MAGIC ||
+      hdr.version != ICHANNEL_TRACE_VERSION) {
+    fclose(fp);
+    ALOGE("%s: <%s> is not a trace", fn, path);
+    return false;
+  }
+  while ((len = fread(buf, 1, sizeof(buf), fp)) != 0) {
+    trace.insert(trace.end(), buf, buf + len);
+  }
+  fclose(fp);
+
+  /*Validate the record chain once so that replay can trust the lengths*/
+  for (pos = 0; pos + sizeof(IChannelTraceRec_t) <= trace.size();) {
+    IChannelTraceRec_t rec;
+    memcpy(&rec, &trace[pos], sizeof(IChannelTraceRec_t));
+    uint64_t next = (uint64_t)pos + sizeof(IChannelTraceRec_t) + rec.cmdLen +
+                    rec.rspLen;
+    if (next > trace.size()) break;
+    pos = (size_t)next;
+  }
+  if (pos != trace.size()) {
+    ALOGE("%s: Trace truncated at offset %zu", fn, pos);
+    trace.resize(pos);
+  }
+
+  pthread_mutex_lock(&sReplayLock);
+  sPlayer.trace.swap(trace);
+  sPlayer.pos = 0;
+  sPlayer.latencyPct = latencyPct;
+  sPlayer.intf = hdr.intf;
+  memset(&sPlayer.stats, 0, sizeof(IChannelTraceStats_t));
+  pthread_mutex_unlock(&sReplayLock);
+
+  memset(pReplay, 0, sizeof(IChannel_t));
+  pReplay->open = IChannelTrace_PlayOpen;
+  pReplay->close = IChannelTrace_PlayClose;
+  pReplay->transceive = IChannelTrace_PlayTransceive;
+  pReplay->transceiveRaw = IChannelTrace_PlayTransceiveRaw;
+  pReplay->doeSE_Reset = IChannelTrace_PlayReset;
+  pReplay->doeSE_JcopDownLoadReset = IChannelTrace_PlayJcopDownLoadReset;
+  pReplay->getInterfaceInfo = IChannelTrace_PlayGetInterfaceInfo;
+  ALOGD("%s: replaying <%s> at %u%% latency", fn, path, latencyPct);
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        IChannelTrace_StopReplay
+**
+** Description:     Releases the trace.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void IChannelTrace_StopReplay(IChannelTraceStats_t* pStats) {
+  static const char fn[] = "IChannelTrace_StopReplay";
+  std::vector<uint8_t> trace;
+
+  pthread_mutex_lock(&sReplayLock);
+  sPlayer.trace.swap(trace);
+  sPlayer.pos = 0;
+  if (pStats != NULL) memcpy(pStats, &sPlayer.stats, sizeof(*pStats));
+  ALOGD("%s: %u records replayed, %u mismatches", fn, sPlayer.stats.records,
+        sPlayer.stats.mismatches);
+  pthread_mutex_unlock(&sReplayLock);
+}
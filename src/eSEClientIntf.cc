@@ -27,30 +27,47 @@
 #include <sys/stat.h>
 #include <phNxpConfig.h>
 #include "phNxpConfig.h"
+#include <EseStateJournal.h>
+#include "sparse_crc32.h"
+#include <string.h>
+#include <time.h>
 #include <android-base/logging.h>
 #include <android-base/stringprintf.h>
 
+using android::base::StringPrintf;
+
 #define TERMINAL_LEN  5
 bool nfc_debug_enabled;
 void* performJCOS_Download_thread(void* data);
 IChannel_t Ch;
-static const char *path[3] = {"/vendor/etc/JcopOs_Update1.apdu",
-                             "/vendor/etc/JcopOs_Update2.apdu",
-                             "/vendor/etc/JcopOs_Update3.apdu"};
+static const char *path[3] = {ESE_FS_ROOT "/vendor/etc/JcopOs_Update1.apdu",
+                             ESE_FS_ROOT "/vendor/etc/JcopOs_Update2.apdu",
+                             ESE_FS_ROOT "/vendor/etc/JcopOs_Update3.apdu"};
 
-static const char *uai_path[2] = {"/vendor/etc/cci.apdu",
-                                  "/vendor/etc/jci.apdu"};
-static const char *isSystemImgInfo[2] = {"/data/vendor/nfc/jcop_info.txt",
-                                         "/data/vendor/secure_element/jcop_info.txt"};
+static const char *uai_path[2] = {ESE_FS_ROOT "/vendor/etc/cci.apdu",
+                                  ESE_FS_ROOT "/vendor/etc/jci.apdu"};
 static const char *lsUpdateBackupPath =
-"/vendor/etc/loaderservice_updater.txt";
-static const char *isFirstTimeLsUpdate[2] =
-{"/data/vendor/nfc/LS_Status.txt",
- "/data/vendor/secure_element/LS_Status.txt"};
+ESE_FS_ROOT "/vendor/etc/loaderservice_updater.txt";
 se_extns_entry seExtn;
 
-static bool scriptUpdateRequired(ESE_CLIENT_INTF intf);
-static bool jcopOsUpdateRequired(ESE_CLIENT_INTF intf);
+/* Vendor files the boot decision depends on */
+#define BOOT_INPUT_UAI_CCI 0
+#define BOOT_INPUT_UAI_JCI 1
+#define BOOT_INPUT_JCOP_IMG 2
+#define BOOT_INPUT_LS_SCRIPT 3
+#define BOOT_INPUT_CNT 4
+
+typedef struct BootInput {
+  uint64_t ino;
+  uint64_t size;
+  uint64_t mtimeSec;
+  uint64_t mtimeNsec;
+} BootInput_t;
+
+static bool scriptUpdateRequired(const EseState_t* pState);
+static bool jcopOsUpdateRequired(const EseState_t* pState);
+static uint32_t bootDecisionKey(ESE_CLIENT_INTF intf, const BootInput_t* pInput,
+                                const EseState_t* pState);
 /*******************************************************************************
 **
 ** Function:        checkeSEClientUpdateRequired
@@ -69,49 +86,81 @@ uint8_t checkeSEClientRequired(ESE_CLIENT_INTF intf ) {
   bool isSystemImgUpdated = false;
   bool isLsScriptPresent = true;
   bool isFirstLsUpdate = false;
+  const char *inputPath[BOOT_INPUT_CNT] = {uai_path[0], uai_path[1], path[0],
+                                           lsUpdateBackupPath};
+  BootInput_t input[BOOT_INPUT_CNT];
+  bool isPresent[BOOT_INPUT_CNT];
+  EseState_t state;
+  struct timespec start, end;
   struct stat st;
 
   LOG(ERROR) <<"Check_HalStart_Entry: enter:  ";
-  /*Check APDU files are present*/
-  for (int num = 0; num < 2; num++)
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  memset(input, 0, sizeof(input));
+  for (int i = 0; i < BOOT_INPUT_CNT; i++)
   {
-    if (stat(uai_path[num], &st))
+    isPresent[i] = (stat(inputPath[i], &st) == 0);
+    if (isPresent[i])
     {
-      isApduPresent = false;
+      input[i].ino = st.st_ino;
+      input[i].size = st.st_size;
+      input[i].mtimeSec = st.st_mtim.tv_sec;
+      input[i].mtimeNsec = st.st_mtim.tv_nsec;
     }
   }
+  EseState_Read(intf - 1, &state);
+  uint32_t key = bootDecisionKey(intf, input, &state);
+  /*Nothing changed since the last boot, reuse its decision*/
+  if ((state.valid & ESE_STATE_BOOT) && (state.bootKey == key))
+  {
+    seExtn.sJcopUpdateIntferface = state.bootJcopIntf;
+    seExtn.sLsUpdateIntferface = state.bootLsIntf;
+    seExtn.isJcopUpdateRequired =
+        (state.bootFlags & ESE_BOOT_JCOP_UPDATE) ? true : false;
+    seExtn.isLSUpdateRequired =
+        (state.bootFlags & ESE_BOOT_LS_UPDATE) ? true : false;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    LOG(ERROR) << StringPrintf(
+        "Check_HalStart_Entry: cached decision Jcop %d LS %d in %ld us",
+        seExtn.isJcopUpdateRequired, seExtn.isLSUpdateRequired,
+        (long)((end.tv_sec - start.tv_sec) * 1000000 +
+               (end.tv_nsec - start.tv_nsec) / 1000));
+    return status;
+  }
+  /*Check APDU files are present*/
+  if (!isPresent[BOOT_INPUT_UAI_CCI] || !isPresent[BOOT_INPUT_UAI_JCI])
+  {
+    isApduPresent = false;
+  }
   /*If UAI specific files are present*/
   if(isApduPresent == true)
   {
-    for (int num = 0; num < 1; num++)
+    if (!isPresent[BOOT_INPUT_JCOP_IMG])
     {
-      if (stat(path[num], &st))
-      {
-        isApduPresent = false;
-      }
+      isApduPresent = false;
     }
   }
   /*Check if OS udpate required*/
-  isSystemImgUpdated = jcopOsUpdateRequired(intf);
+  isSystemImgUpdated = jcopOsUpdateRequired(&state);
 
   /*Check if LS script present*/
-  if(stat(lsUpdateBackupPath, &st))
+  if(!isPresent[BOOT_INPUT_LS_SCRIPT])
   {
     isLsScriptPresent = false;
   }
   /*Check if LS update required*/
-  isFirstLsUpdate = scriptUpdateRequired(intf);
+  isFirstLsUpdate = scriptUpdateRequired(&state);
 
-  if(GetNxpNumValue(NAME_NXP_P61_JCOP_DEFAULT_INTERFACE, &num, sizeof(num))) {
+  if(GetNxpNum(CFG_NXP_P61_JCOP_DEFAULT_INTERFACE, &num, sizeof(num))) {
     seExtn.sJcopUpdateIntferface = num;
   }
-  if(GetNxpNumValue(NAME_NXP_P61_LS_DEFAULT_INTERFACE, &num, sizeof(num))) {
+  if(GetNxpNum(CFG_NXP_P61_LS_DEFAULT_INTERFACE, &num, sizeof(num))) {
     seExtn.sLsUpdateIntferface = num;
   }
-  if(GetNxpNumValue(NAME_NXP_LS_FORCE_UPDATE_REQUIRED, &num, sizeof(num))) {
+  if(GetNxpNum(CFG_NXP_LS_FORCE_UPDATE_REQUIRED, &num, sizeof(num))) {
     seExtn.isLSUpdateRequired = num;
   }
-  if(GetNxpNumValue(NAME_NXP_JCOP_FORCE_UPDATE_REQUIRED, &num, sizeof(num))) {
+  if(GetNxpNum(CFG_NXP_JCOP_FORCE_UPDATE_REQUIRED, &num, sizeof(num))) {
     seExtn.isJcopUpdateRequired = num;
   }
   if(isApduPresent && seExtn.sJcopUpdateIntferface &&
@@ -139,9 +188,47 @@ uint8_t checkeSEClientRequired(ESE_CLIENT_INTF intf ) {
     LOG(ERROR) <<" LS update not required  ";
     seExtn.isLSUpdateRequired = false;
   }
+  state.bootKey = key;
+  state.bootJcopIntf = seExtn.sJcopUpdateIntferface;
+  state.bootLsIntf = seExtn.sLsUpdateIntferface;
+  state.bootFlags = (seExtn.isJcopUpdateRequired ? ESE_BOOT_JCOP_UPDATE : 0) |
+                    (seExtn.isLSUpdateRequired ? ESE_BOOT_LS_UPDATE : 0);
+  EseState_Write(intf - 1, ESE_STATE_BOOT, &state);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  LOG(ERROR) << StringPrintf(
+      "Check_HalStart_Entry: decision made in %ld us",
+      (long)((end.tv_sec - start.tv_sec) * 1000000 +
+             (end.tv_nsec - start.tv_nsec) / 1000));
   return status;
 }
 
+/*******************************************************************************
+**
+** Function:        bootDecisionKey
+**
+** Description:     Computes the key of the boot decision from the metadata
+**                  of the vendor and config files and the recorded update
+**                  state
+**
+** Returns:         CRC32 of the inputs
+**
+*******************************************************************************/
+static uint32_t bootDecisionKey(ESE_CLIENT_INTF intf, const BootInput_t* pInput,
+                                const EseState_t* pState)
+{
+  uint32_t stateKey[4];
+  uint32_t crc = 0;
+
+  stateKey[0] = intf;
+  stateKey[1] = pState->valid & (ESE_STATE_JCOP | ESE_STATE_LS_STATUS);
+  stateKey[2] = (pState->jcopState << 16) | pState->lsStatus;
+  /*Metadata only, a cached boot does not load the config*/
+  stateKey[3] = getNxpConfigFilesKey();
+  crc = sparse_crc32(crc, stateKey, sizeof(stateKey));
+  crc = sparse_crc32(crc, pInput, BOOT_INPUT_CNT * sizeof(BootInput_t));
+  return crc;
+}
+
 /*******************************************************************************
 **
 ** Function:        scriptUpdateRequired
@@ -151,24 +238,17 @@ uint8_t checkeSEClientRequired(ESE_CLIENT_INTF intf ) {
 ** Returns:         TRUE/FALSE
 **
 *******************************************************************************/
-bool scriptUpdateRequired(ESE_CLIENT_INTF intf)
+bool scriptUpdateRequired(const EseState_t* pState)
 {
   bool mScriptUpdateRequired = false;
-  uint32_t status[2] = {SEMS_STATUS_FAILED_SW1, SEMS_STATUS_FAILED_SW2};
-  FILE* fLS_STATUS = fopen(isFirstTimeLsUpdate[intf-1], "r");
 
-  if (fLS_STATUS == NULL) {
-    LOG(ERROR) <<"Error opening status file";
+  if (!(pState->valid & ESE_STATE_LS_STATUS)) {
+    LOG(ERROR) <<"Error reading LS status";
     mScriptUpdateRequired = true;
   }
   else {
-    if ((fscanf(fLS_STATUS, "%2x %2x", &status[0], &status[1])) == 0) {
-      LOG(ERROR) <<"Error reading status file:";
-      status[0] = SEMS_STATUS_FAILED_SW1;
-      status[1] = SEMS_STATUS_FAILED_SW2;
-    }
-    if(status[0] == SEMS_STATUS_SUCCESS_SW1 &&
-                  status[1] == SEMS_STATUS_SUCCESS_SW2) {
+    if(pState->lsStatus == ((SEMS_STATUS_SUCCESS_SW1 << 8) |
+                          SEMS_STATUS_SUCCESS_SW2)) {
       mScriptUpdateRequired = false;
       LOG(ERROR) <<"Last script execution success";
     }
@@ -176,7 +256,6 @@ bool scriptUpdateRequired(ESE_CLIENT_INTF intf)
       mScriptUpdateRequired = true;
       LOG(ERROR) <<"Last script execution failed ";
     }
-    fclose(fLS_STATUS);
   }
   return mScriptUpdateRequired;
 }
@@ -189,33 +268,24 @@ bool scriptUpdateRequired(ESE_CLIENT_INTF intf)
 ** Returns:         TRUE/FALSE
 **
 *******************************************************************************/
-bool jcopOsUpdateRequired(ESE_CLIENT_INTF intf)
+bool jcopOsUpdateRequired(const EseState_t* pState)
 {
   bool isUpdateRequired = false;
-  uint32_t status = 0;
-  FILE* fp = fopen(isSystemImgInfo[intf-1], "r");
 
-  if (fp == NULL) {
-    LOG(ERROR) <<"jcopOsUpdateRequired : file not exits for reading";
+  if (!(pState->valid & ESE_STATE_JCOP)) {
+    LOG(ERROR) <<"jcopOsUpdateRequired : no JCOP state recorded";
     isUpdateRequired = true;
   }
   else {
-    if (fscanf(fp, "%u", &status) == 0) {
-      LOG(ERROR) <<"jcop status read fail";
-      isUpdateRequired = true;
+    LOG(ERROR) << "JcopOsState: "<< (uint32_t)pState->jcopState;
+    if (pState->jcopState == JCOP_UPDATE_3STEP_DONE) {
+      isUpdateRequired = false;
+      LOG(ERROR) <<"jcopOsUpdateRequired : Jcop update completed";
     }
     else {
-      LOG(ERROR) << "JcopOsState: "<< status;
-      if (status == JCOP_UPDATE_3STEP_DONE) {
-        isUpdateRequired = false;
-        LOG(ERROR) <<"jcopOsUpdateRequired : Jcop update completed";
-      }
-      else {
-        LOG(ERROR) << "jcopOsUpdateRequired : Jcop update required";
-        isUpdateRequired = true;
-      }
+      LOG(ERROR) << "jcopOsUpdateRequired : Jcop update required";
+      isUpdateRequired = true;
     }
-    fclose(fp);
   }
   return isUpdateRequired;
 }
@@ -251,7 +321,7 @@ bool geteSETerminalId(char* val)
 {
   bool ret = false;
 
-  if(GetNxpStrValue(NAME_NXP_SPI_SE_TERMINAL_NUM, val, TERMINAL_LEN))
+  if(GetNxpStr(CFG_NXP_SPI_SE_TERMINAL_NUM, val, TERMINAL_LEN))
   {
     LOG(ERROR) <<"eSETerminalId found";
     ALOGE("eSETerminalId found val = %s ", val);
@@ -265,7 +335,7 @@ bool getTruestedSETerminalId(char* val)
 {
   bool ret = false;
 
-  if(GetNxpStrValue(NAME_NXP_TRUSTED_SE_TERMINAL_NUM, val, TERMINAL_LEN))
+  if(GetNxpStr(CFG_NXP_TRUSTED_SE_TERMINAL_NUM, val, TERMINAL_LEN))
   {
     LOG(INFO) <<"TrustedSE TerminalId found";
     ALOGD("TrustedSE TerminalId found val = %s ", val);
@@ -279,7 +349,7 @@ bool geteUICCTerminalId(char* val)
 {
   bool ret = false;
 
-  if(GetNxpStrValue(NAME_NXP_VISO_SE_TERMINAL_NUM, val, TERMINAL_LEN))
+  if(GetNxpStr(CFG_NXP_VISO_SE_TERMINAL_NUM, val, TERMINAL_LEN))
   {
     ALOGE("eUICCTerminalId found val = %s ", val);
     ret = true;
@@ -291,7 +361,7 @@ bool getNfcSeTerminalId(char* val)
 {
   bool ret = false;
 
-  if(GetNxpStrValue(NAME_NXP_NFC_SE_TERMINAL_NUM, val, TERMINAL_LEN))
+  if(GetNxpStr(CFG_NXP_NFC_SE_TERMINAL_NUM, val, TERMINAL_LEN))
   {
     ALOGE("NfcSeTerminalId found val = %s ", val);
     ret = true;
@@ -81,7 +81,7 @@ static void phNxpLog_SetHALLogLevel(uint8_t level) {
   int len;
   char valueStr[PROPERTY_VALUE_MAX] = {0};
 
-  if (GetNxpNumValue(NAME_NXPLOG_HAL_LOGLEVEL, &num, sizeof(num))) {
+  if (GetNxpNum(CFG_NXPLOG_NCIHAL_LOGLEVEL, &num, sizeof(num))) {
     gLog_level.hal_log_level =
         (level > (unsigned char)num) ? level : (unsigned char)num;
     ;
@@ -108,7 +108,7 @@ static void phNxpLog_SetExtnsLogLevel(uint8_t level) {
   unsigned long num = 0;
   int len;
   char valueStr[PROPERTY_VALUE_MAX] = {0};
-  if (GetNxpNumValue(NAME_NXPLOG_EXTNS_LOGLEVEL, &num, sizeof(num))) {
+  if (GetNxpNum(CFG_NXPLOG_EXTNS_LOGLEVEL, &num, sizeof(num))) {
     gLog_level.extns_log_level =
         (level > (unsigned char)num) ? level : (unsigned char)num;
     ;
@@ -135,7 +135,7 @@ static void phNxpLog_SetTmlLogLevel(uint8_t level) {
   unsigned long num = 0;
   int len;
   char valueStr[PROPERTY_VALUE_MAX] = {0};
-  if (GetNxpNumValue(NAME_NXPLOG_TML_LOGLEVEL, &num, sizeof(num))) {
+  if (GetNxpNum(CFG_NXPLOG_TML_LOGLEVEL, &num, sizeof(num))) {
     gLog_level.tml_log_level =
         (level > (unsigned char)num) ? level : (unsigned char)num;
     ;
@@ -162,7 +162,7 @@ static void phNxpLog_SetDnldLogLevel(uint8_t level) {
   unsigned long num = 0;
   int len;
   char valueStr[PROPERTY_VALUE_MAX] = {0};
-  if (GetNxpNumValue(NAME_NXPLOG_FWDNLD_LOGLEVEL, &num, sizeof(num))) {
+  if (GetNxpNum(CFG_NXPLOG_FWDNLD_LOGLEVEL, &num, sizeof(num))) {
     gLog_level.dnld_log_level =
         (level > (unsigned char)num) ? level : (unsigned char)num;
     ;
@@ -189,11 +189,11 @@ static void phNxpLog_SetNciTxLogLevel(uint8_t level) {
   unsigned long num = 0;
   int len;
   char valueStr[PROPERTY_VALUE_MAX] = {0};
-  if (GetNxpNumValue(NAME_NXPLOG_NCIX_LOGLEVEL, &num, sizeof(num))) {
+  if (GetNxpNum(CFG_NXPLOG_NCIX_LOGLEVEL, &num, sizeof(num))) {
     gLog_level.ncix_log_level =
         (level > (unsigned char)num) ? level : (unsigned char)num;
   }
-  if (GetNxpNumValue(NAME_NXPLOG_NCIR_LOGLEVEL, &num, sizeof(num))) {
+  if (GetNxpNum(CFG_NXPLOG_NCIR_LOGLEVEL, &num, sizeof(num))) {
     gLog_level.ncir_log_level =
         (level > (unsigned char)num) ? level : (unsigned char)num;
     ;
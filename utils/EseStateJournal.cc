@@ -0,0 +1,312 @@
+/******************************************************************************
+ *
+ *  Copyright 2019 NXP
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <log/log.h>
+
+#include <EseStateJournal.h>
+#include <phNxpConfig.h>
+#include "sparse_crc32.h"
+
+namespace {
+
+const char* const kJournalPath[ESE_STATE_MAX_INTF] = {
+    ESE_FS_ROOT "/data/vendor/nfc/ese_state.bin",
+    ESE_FS_ROOT "/data/vendor/secure_element/ese_state.bin"};
+const char* const kJcopInfoPath[ESE_STATE_MAX_INTF] = {
+    ESE_FS_ROOT "/data/vendor/nfc/jcop_info.txt",
+    ESE_FS_ROOT "/data/vendor/secure_element/jcop_info.txt"};
+const char* const kLsStatusPath[ESE_STATE_MAX_INTF] = {
+    ESE_FS_ROOT "/data/vendor/nfc/LS_Status.txt",
+    ESE_FS_ROOT "/data/vendor/secure_element/LS_Status.txt"};
+const char* const kAidMemPath[ESE_STATE_MAX_INTF] = {
+    ESE_FS_ROOT "/data/vendor/nfc/AID_MEM.txt",
+    ESE_FS_ROOT "/data/vendor/secure_element/AID_MEM.txt"};
+
+#define ESE_STATE_MAGIC 0x4A455345 /* "ESEJ" */
+#define ESE_STATE_VERSION 1
+/* A slot fits in one sector, so a torn write damages at most that slot */
+#define ESE_STATE_SLOT_SIZE 512
+#define ESE_STATE_FILE_SIZE (2 * ESE_STATE_SLOT_SIZE)
+/* Fields that had a file before the journal */
+#define ESE_STATE_LEGACY \
+  (ESE_STATE_JCOP | ESE_STATE_LS_STATUS | ESE_STATE_LS_AID)
+
+typedef struct JournalSlot {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t len; /* sizeof(EseState_t) */
+  uint32_t seq; /* The valid slot with the higher seq is current */
+  EseState_t state;
+  uint32_t crc; /* Over all of the above */
+} JournalSlot_t;
+
+static_assert(sizeof(JournalSlot_t) <= ESE_STATE_SLOT_SIZE,
+              "journal slot exceeds a sector");
+
+typedef struct Journal {
+  int fd;
+  uint8_t* pBase;
+  bool isBroken; /* Not retried until the process restarts */
+} Journal_t;
+
+Journal_t sJournal[ESE_STATE_MAX_INTF] = {{-1, NULL, false},
+                                          {-1, NULL, false}};
+pthread_mutex_t sJournalLock = PTHREAD_MUTEX_INITIALIZER;
+
+uint32_t slotCrc(const JournalSlot_t* pSlot) {
+  return sparse_crc32(0, pSlot, offsetof(JournalSlot_t, crc));
+}
+
+const JournalSlot_t* getSlot(const Journal_t* pJournal, int idx) {
+  return (const JournalSlot_t*)(pJournal->pBase + idx * ESE_STATE_SLOT_SIZE);
+}
+
+/* Index of the current slot, -1 if none is valid */
+int currentSlot(const Journal_t* pJournal) {
+  int current = -1;
+  uint32_t seq = 0;
+
+  for (int i = 0; i < 2; i++) {
+    const JournalSlot_t* pSlot = getSlot(pJournal, i);
+    if ((pSlot->magic != ESE_STATE_MAGIC) ||
+        (pSlot->version != ESE_STATE_VERSION) ||
+        (pSlot->len != sizeof(EseState_t)) || (pSlot->crc != slotCrc(pSlot))) {
+      continue;
+    }
+    /*Sequence numbers are compared modulo 2^32*/
+    if ((current < 0) || ((int32_t)(pSlot->seq - seq) > 0)) {
+      current = i;
+      seq = pSlot->seq;
+    }
+  }
+  return current;
+}
+
+bool mapJournal(uint8_t intf) {
+  static const char fn[] = "EseState::mapJournal";
+  Journal_t* pJournal = &sJournal[intf];
+  struct stat st;
+  void* pBase;
+  int fd;
+
+  if (pJournal->pBase != NULL) return true;
+  if (pJournal->isBroken) return false;
+  pJournal->isBroken = true;
+  fd = open(kJournalPath[intf], O_RDWR | O_CREAT | O_CLOEXEC, 0660);
+  if (fd < 0) {
+    ALOGE("%s: Error opening <%s>: %s", fn, kJournalPath[intf],
+          strerror(errno));
+    return false;
+  }
+  if ((fstat(fd, &st) != 0) ||
+      ((st.st_size < ESE_STATE_FILE_SIZE) &&
+       (ftruncate(fd, ESE_STATE_FILE_SIZE) != 0))) {
+    ALOGE("%s: Error sizing <%s>: %s", fn, kJournalPath[intf],
+          strerror(errno));
+    close(fd);
+    return false;
+  }
+  pBase = mmap(NULL, ESE_STATE_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+               fd, 0);
+  if (pBase == MAP_FAILED) {
+    ALOGE("%s: Error mapping <%s>: %s", fn, kJournalPath[intf],
+          strerror(errno));
+    close(fd);
+    return false;
+  }
+  pJournal->fd = fd;
+  pJournal->pBase = (uint8_t*)pBase;
+  pJournal->isBroken = false;
+  return true;
+}
+
+/*Merges the given fields of pSrc into pDst*/
+void mergeState(EseState_t* pDst, uint32_t fields, const EseState_t* pSrc) {
+  if (fields & ESE_STATE_JCOP) {
+    pDst->jcopState = pSrc->jcopState;
+    pDst->ckptStep = pSrc->ckptStep;
+    pDst->ckptApduIndex = pSrc->ckptApduIndex;
+    pDst->ckptOffset = pSrc->ckptOffset;
+    pDst->ckptImgSize = pSrc->ckptImgSize;
+  }
+  if (fields & ESE_STATE_LS_STATUS) {
+    pDst->lsStatus = pSrc->lsStatus;
+  }
+  if (fields & ESE_STATE_LS_AID) {
+    pDst->lsAidLen = (pSrc->lsAidLen > ESE_STATE_AID_SIZE) ? ESE_STATE_AID_SIZE
+                                                           : pSrc->lsAidLen;
+    memset(pDst->lsAid, 0, sizeof(pDst->lsAid));
+    memcpy(pDst->lsAid, pSrc->lsAid, pDst->lsAidLen);
+  }
+  if (fields & ESE_STATE_BOOT) {
+    pDst->bootKey = pSrc->bootKey;
+    pDst->bootFlags = pSrc->bootFlags;
+    pDst->bootJcopIntf = pSrc->bootJcopIntf;
+    pDst->bootLsIntf = pSrc->bootLsIntf;
+  }
+  pDst->valid |= fields;
+}
+
+/*Writes the next record into the older slot, called with the lock held*/
+bool commitState(uint8_t intf, uint32_t fields, const EseState_t* pState) {
+  static const char fn[] = "EseState::commitState";
+  Journal_t* pJournal = &sJournal[intf];
+  JournalSlot_t slot;
+  bool isOk = true;
+
+  flock(pJournal->fd, LOCK_EX);
+  int current = currentSlot(pJournal);
+  memset(&slot, 0, sizeof(slot));
+  if (current >= 0) {
+    memcpy(&slot, getSlot(pJournal, current), sizeof(slot));
+  }
+  slot.magic = ESE_STATE_MAGIC;
+  slot.version = ESE_STATE_VERSION;
+  slot.len = sizeof(EseState_t);
+  slot.seq++;
+  mergeState(&slot.state, fields, pState);
+  slot.crc = slotCrc(&slot);
+  /*The current slot stays intact until the new one is on disk*/
+  memcpy(pJournal->pBase + ((current == 0) ? 1 : 0) * ESE_STATE_SLOT_SIZE,
+         &slot, sizeof(slot));
+  if (msync(pJournal->pBase, ESE_STATE_FILE_SIZE, MS_SYNC) != 0) {
+    ALOGE("%s: Error syncing <%s>: %s", fn, kJournalPath[intf],
+          strerror(errno));
+    isOk = false;
+  }
+  flock(pJournal->fd, LOCK_UN);
+  return isOk;
+}
+
+/*Reads the given fields from the files used before the journal*/
+void readLegacy(uint8_t intf, uint32_t fields, EseState_t* pState) {
+  unsigned int val[4];
+  FILE* fp;
+
+  if ((fields & ESE_STATE_JCOP) &&
+      ((fp = fopen(kJcopInfoPath[intf], "r")) != NULL)) {
+    if (fscanf(fp, "%u", &val[0]) == 1) {
+      pState->jcopState = (uint8_t)val[0];
+      /*Checkpoint of an interrupted image load follows the state*/
+      if (fscanf(fp, "%u %u %u %u", &val[0], &val[1], &val[2], &val[3]) ==
+          4) {
+        pState->ckptStep = val[0];
+        pState->ckptApduIndex = val[1];
+        pState->ckptOffset = val[2];
+        pState->ckptImgSize = val[3];
+      }
+      pState->valid |= ESE_STATE_JCOP;
+    }
+    fclose(fp);
+  }
+  if ((fields & ESE_STATE_LS_STATUS) &&
+      ((fp = fopen(kLsStatusPath[intf], "r")) != NULL)) {
+    if (fscanf(fp, "%2x %2x", &val[0], &val[1]) == 2) {
+      pState->lsStatus = (uint16_t)(((val[0] & 0xFF) << 8) | (val[1] & 0xFF));
+      pState->valid |= ESE_STATE_LS_STATUS;
+    }
+    fclose(fp);
+  }
+  if ((fields & ESE_STATE_LS_AID) &&
+      ((fp = fopen(kAidMemPath[intf], "r")) != NULL)) {
+    uint8_t len = 0;
+    while ((len < ESE_STATE_AID_SIZE) && (fscanf(fp, "%2x", &val[0]) == 1)) {
+      pState->lsAid[len++] = (uint8_t)val[0];
+    }
+    if (len > 0) {
+      pState->lsAidLen = len;
+      pState->valid |= ESE_STATE_LS_AID;
+    }
+    fclose(fp);
+  }
+}
+
+}  // namespace
+
+/*******************************************************************************
+**
+** Function:        EseState_Read
+**
+** Description:     Reads the state of interface intf. Fields missing from
+**                  the journal are taken from the legacy files, if present.
+**
+** Returns:         True if the journal is usable for intf.
+**
+*******************************************************************************/
+bool EseState_Read(uint8_t intf, EseState_t* pState) {
+  static const char fn[] = "EseState_Read";
+  bool isMapped;
+
+  memset(pState, 0, sizeof(EseState_t));
+  if (intf >= ESE_STATE_MAX_INTF) return false;
+  pthread_mutex_lock(&sJournalLock);
+  isMapped = mapJournal(intf);
+  if (isMapped) {
+    Journal_t* pJournal = &sJournal[intf];
+    flock(pJournal->fd, LOCK_SH);
+    int current = currentSlot(pJournal);
+    if (current >= 0) {
+      memcpy(pState, &getSlot(pJournal, current)->state, sizeof(EseState_t));
+    }
+    flock(pJournal->fd, LOCK_UN);
+  }
+  uint32_t missing = ESE_STATE_LEGACY & ~pState->valid;
+  if (missing != 0) {
+    readLegacy(intf, missing, pState);
+    uint32_t imported = missing & pState->valid;
+    if (isMapped && (imported != 0)) {
+      ALOGD("%s: importing legacy fields 0x%X", fn, imported);
+      commitState(intf, imported, pState);
+    }
+  }
+  pthread_mutex_unlock(&sJournalLock);
+  return isMapped;
+}
+
+/*******************************************************************************
+**
+** Function:        EseState_Write
+**
+** Description:     Replaces the given fields of the state of interface intf
+**                  with those of pState and commits the record durably.
+**
+** Returns:         False if the journal is not usable, the caller falls back
+**                  to the legacy file.
+**
+*******************************************************************************/
+bool EseState_Write(uint8_t intf, uint32_t fields, const EseState_t* pState) {
+  bool isOk = false;
+
+  if (intf >= ESE_STATE_MAX_INTF) return false;
+  pthread_mutex_lock(&sJournalLock);
+  if (mapJournal(intf)) {
+    isOk = commitState(intf, fields, pState);
+  }
+  pthread_mutex_unlock(&sJournalLock);
+  return isOk;
+}
@@ -0,0 +1,90 @@
+/******************************************************************************
+ *
+ *  Copyright 2019 NXP
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+#ifndef ESE_STATE_JOURNAL_H_
+#define ESE_STATE_JOURNAL_H_
+
+#include <stdint.h>
+
+/*
+ * Update state of the eSE clients, one record per interface.
+ * The record is kept in two checksummed slots of a small mapped file and
+ * each update goes to the older slot with the next sequence number, so a
+ * crash in the middle of an update leaves the previous record readable.
+ * Reading the state at boot is a single page access.
+ *
+ * Fields not found in the journal are read once from the text files used
+ * before (jcop_info.txt, LS_Status.txt, AID_MEM.txt) and imported.
+ * If the journal cannot be used the callers keep writing those files.
+ */
+
+#define ESE_STATE_MAX_INTF 2  /* Index as used by getInterfaceInfo() */
+#define ESE_STATE_AID_SIZE 32
+
+/* Fields of EseState_t */
+#define ESE_STATE_JCOP 0x01      /* jcopState and the checkpoint */
+#define ESE_STATE_LS_STATUS 0x02 /* lsStatus */
+#define ESE_STATE_LS_AID 0x04    /* lsAidLen and lsAid */
+#define ESE_STATE_BOOT 0x08      /* Cached boot decision */
+
+/* bootFlags */
+#define ESE_BOOT_JCOP_UPDATE 0x01
+#define ESE_BOOT_LS_UPDATE 0x02
+
+typedef struct EseState {
+  uint32_t valid; /* ESE_STATE_* fields holding a value */
+  uint8_t jcopState;
+  uint8_t lsAidLen;
+  uint16_t lsStatus; /* SW of the last LS script */
+  uint32_t ckptStep;
+  uint32_t ckptApduIndex;
+  uint32_t ckptOffset;
+  uint32_t ckptImgSize;
+  uint8_t lsAid[ESE_STATE_AID_SIZE]; /* Select command of the LS AID */
+  uint32_t bootKey; /* CRC of the inputs the boot decision was made from */
+  uint8_t bootFlags;
+  uint8_t bootJcopIntf;
+  uint8_t bootLsIntf;
+} EseState_t;
+
+/*******************************************************************************
+**
+** Function:        EseState_Read
+**
+** Description:     Reads the state of interface intf. Fields missing from
+**                  the journal are taken from the legacy files, if present.
+**
+** Returns:         True if the journal is usable for intf.
+**
+*******************************************************************************/
+bool EseState_Read(uint8_t intf, EseState_t* pState);
+
+/*******************************************************************************
+**
+** Function:        EseState_Write
+**
+** Description:     Replaces the given fields of the state of interface intf
+**                  with those of pState and commits the record durably.
+**
+** Returns:         False if the journal is not usable, the caller falls back
+**                  to the legacy file.
+**
+*******************************************************************************/
+bool EseState_Write(uint8_t intf, uint32_t fields, const EseState_t* pState);
+
+#endif /* ESE_STATE_JOURNAL_H_ */
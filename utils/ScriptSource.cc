@@ -0,0 +1,185 @@
+/******************************************************************************
+ *
+ *  Copyright 2019 NXP
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <log/log.h>
+
+#include <ScriptSource.h>
+#include "hex_decode.h"
+
+namespace {
+
+inline bool isSpace(uint8_t c) {
+  return (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r') ||
+         (c == '\v') || (c == '\f');
+}
+
+}  // namespace
+
+ScriptSource::ScriptSource()
+    : mData(NULL), mSize(0), mOffset(0), mErrorOffset(-1), mIsOpen(false) {}
+
+ScriptSource::~ScriptSource() { close(); }
+
+bool ScriptSource::open(const char* path) {
+  static const char fn[] = "ScriptSource::open";
+  struct stat st;
+  int fd;
+
+  close();
+  fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    ALOGE("%s: Error opening <%s>: %s", fn, path, strerror(errno));
+    return false;
+  }
+  if (fstat(fd, &st) != 0) {
+    ALOGE("%s: Error sizing <%s>: %s", fn, path, strerror(errno));
+    ::close(fd);
+    return false;
+  }
+  if ((st.st_size < 0) || (st.st_size > INT32_MAX)) {
+    ALOGE("%s: Invalid size of <%s>", fn, path);
+    ::close(fd);
+    return false;
+  }
+  if (st.st_size > 0) {
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      ALOGE("%s: Error mapping <%s>: %s", fn, path, strerror(errno));
+      ::close(fd);
+      return false;
+    }
+    /*Images are read once from start to end*/
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+    mData = (const uint8_t*)p;
+  }
+  ::close(fd);
+  mSize = (int32_t)st.st_size;
+  mOffset = 0;
+  mErrorOffset = -1;
+  mIsOpen = true;
+  return true;
+}
+
+void ScriptSource::close() {
+  if (mData != NULL) {
+    munmap((void*)mData, mSize);
+  }
+  mData = NULL;
+  mSize = 0;
+  mOffset = 0;
+  mErrorOffset = -1;
+  mIsOpen = false;
+}
+
+bool ScriptSource::seek(int32_t offset) {
+  if ((offset < 0) || (offset > mSize)) return false;
+  mOffset = offset;
+  return true;
+}
+
+void ScriptSource::skipSpace() {
+  while ((mOffset < mSize) && isSpace(mData[mOffset])) mOffset++;
+}
+
+bool ScriptSource::atEnd() {
+  skipSpace();
+  return (mOffset >= mSize);
+}
+
+bool ScriptSource::readRaw(int32_t len, ScriptSpan_t* pSpan) {
+  if ((len < 0) || (len > (mSize - mOffset))) return false;
+  pSpan->p_data = &mData[mOffset];
+  pSpan->len = len;
+  mOffset += len;
+  return true;
+}
+
+int32_t ScriptSource::readHex(uint8_t* pDst, int32_t count) {
+  int32_t consumed = 0;
+  int32_t wCount;
+
+  if (count <= 0) return 0;
+  wCount = hex_decode(&mData[mOffset], mSize - mOffset, pDst, count,
+                      &consumed);
+  mOffset += consumed;
+  if ((wCount < count) && (mOffset < mSize)) {
+    /*Stopped in front of a character which is not hex*/
+    mErrorOffset = mOffset;
+  }
+  return wCount;
+}
+
+bool ScriptSource::readLine(char* pLine, size_t maxLen) {
+  size_t len = 0;
+
+  if ((mOffset >= mSize) || (maxLen == 0)) return false;
+  while ((mOffset < mSize) && (len + 1 < maxLen)) {
+    char c = (char)mData[mOffset++];
+    pLine[len++] = c;
+    if (c == '\n') break;
+  }
+  pLine[len] = '\0';
+  return true;
+}
+
+bool ScriptSource::nextApdu(uint8_t* pDst, int32_t maxLen, int32_t* pLen) {
+  static const char fn[] = "ScriptSource::nextApdu";
+  int32_t wIndex = 0, wLen = 0;
+
+  *pLen = 0;
+  if (maxLen < 7) return false;
+  wIndex = readHex(pDst, 5);
+  if (wIndex != 5) {
+    ALOGE("%s: APDU header incomplete at offset %d, invalid character at %d",
+          fn, mOffset, mErrorOffset);
+    *pLen = wIndex;
+    return false;
+  }
+  wLen = pDst[4];
+  if (wLen == 0x00) {
+    /*Extended APDU*/
+    wIndex += readHex(&pDst[wIndex], 2);
+    if (wIndex != 7) {
+      ALOGE("%s: Extended length incomplete at offset %d, invalid character "
+            "at %d", fn, mOffset, mErrorOffset);
+      *pLen = wIndex;
+      return false;
+    }
+    wLen = (pDst[5] << 8) | pDst[6];
+  }
+  if (wLen > (maxLen - wIndex)) {
+    ALOGE("%s: APDU of length %d exceeds buffer", fn, wLen);
+    *pLen = wIndex;
+    return false;
+  }
+  wIndex += readHex(&pDst[wIndex], wLen);
+  *pLen = wIndex;
+  if (wIndex != (wLen + ((pDst[4] == 0x00) ? 7 : 5))) {
+    ALOGE("%s: APDU data incomplete at offset %d, invalid character at %d",
+          fn, mOffset, mErrorOffset);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,156 @@
+/******************************************************************************
+ *
+ *  Copyright 2019 NXP
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+#ifndef SCRIPT_SOURCE_H_
+#define SCRIPT_SOURCE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Raw byte range of a mapped script */
+typedef struct ScriptSpan {
+  const uint8_t* p_data;
+  int32_t len;
+} ScriptSpan_t;
+
+/*
+ * Read only view of an LS script or JCOP image file.
+ * The file is mapped once on open() and is walked with a read offset;
+ * hex text content is decoded straight from the mapping and binary content
+ * is handed out as spans pointing into the mapping.
+ */
+class ScriptSource {
+ public:
+  ScriptSource();
+  ~ScriptSource();
+
+  /*****************************************************************************
+  **
+  ** Function:        open
+  **
+  ** Description:     Maps the file and resets the read offset.
+  **
+  ** Returns:         true if ok.
+  **
+  *****************************************************************************/
+  bool open(const char* path);
+
+  /*****************************************************************************
+  **
+  ** Function:        close
+  **
+  ** Description:     Unmaps the file, safe to call when not open.
+  **
+  ** Returns:         None
+  **
+  *****************************************************************************/
+  void close();
+
+  bool isOpen() const { return mIsOpen; }
+  int32_t size() const { return mSize; }
+  int32_t offset() const { return mOffset; }
+  /* Offset of the last character readHex() stopped at, -1 if none */
+  int32_t errorOffset() const { return mErrorOffset; }
+  const uint8_t* data() const { return mData; }
+
+  /*****************************************************************************
+  **
+  ** Function:        seek
+  **
+  ** Description:     Moves the read offset to an absolute position.
+  **
+  ** Returns:         true if the position is within the file.
+  **
+  *****************************************************************************/
+  bool seek(int32_t offset);
+
+  /*****************************************************************************
+  **
+  ** Function:        atEnd
+  **
+  ** Description:     Skips white space at the read offset.
+  **
+  ** Returns:         true if nothing but white space is left.
+  **
+  *****************************************************************************/
+  bool atEnd();
+
+  /*****************************************************************************
+  **
+  ** Function:        readRaw
+  **
+  ** Description:     Hands out len bytes at the read offset without copying.
+  **
+  ** Returns:         true if len bytes are available.
+  **
+  *****************************************************************************/
+  bool readRaw(int32_t len, ScriptSpan_t* pSpan);
+
+  /*****************************************************************************
+  **
+  ** Function:        readHex
+  **
+  ** Description:     Decodes up to count hex encoded bytes into pDst. White
+  **                  space between bytes is skipped, decoding stops at the
+  **                  end of file or at the first character which is not hex,
+  **                  whose offset is then kept as errorOffset().
+  **
+  ** Returns:         Number of bytes decoded.
+  **
+  *****************************************************************************/
+  int32_t readHex(uint8_t* pDst, int32_t count);
+
+  /*****************************************************************************
+  **
+  ** Function:        readLine
+  **
+  ** Description:     Copies the rest of the current line, including the new
+  **                  line character, like fgets.
+  **
+  ** Returns:         true if anything was left to read.
+  **
+  *****************************************************************************/
+  bool readLine(char* pLine, size_t maxLen);
+
+  /*****************************************************************************
+  **
+  ** Function:        nextApdu
+  **
+  ** Description:     Decodes the next hex encoded C-APDU into pDst. Header is
+  **                  always 5 bytes, Lc 00 means 2 more bytes of extended
+  **                  length follow.
+  **
+  ** Returns:         true if a complete APDU was decoded, *pLen is its size.
+  **
+  *****************************************************************************/
+  bool nextApdu(uint8_t* pDst, int32_t maxLen, int32_t* pLen);
+
+ private:
+  ScriptSource(const ScriptSource&);
+  ScriptSource& operator=(const ScriptSource&);
+
+  void skipSpace();
+
+  const uint8_t* mData;
+  int32_t mSize;
+  int32_t mOffset;
+  int32_t mErrorOffset;
+  bool mIsOpen;
+};
+
+#endif /* SCRIPT_SOURCE_H_ */
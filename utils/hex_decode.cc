@@ -0,0 +1,211 @@
+/******************************************************************************
+ *
+ *  Copyright 2019 NXP
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HEX_DECODE_X86
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define HEX_DECODE_NEON
+#endif
+
+#include "hex_decode.h"
+
+namespace {
+
+/* Value of each character, 0xFF if not a hex digit */
+struct HexTable {
+  uint8_t val[256];
+  HexTable() {
+    for (int i = 0; i < 256; i++) val[i] = 0xFF;
+    for (int i = 0; i < 10; i++) val['0' + i] = i;
+    for (int i = 0; i < 6; i++) {
+      val['a' + i] = 10 + i;
+      val['A' + i] = 10 + i;
+    }
+  }
+};
+const HexTable kHex;
+
+inline bool isSpace(uint8_t c) {
+  return (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r') ||
+         (c == '\v') || (c == '\f');
+}
+
+/* Decodes 2 * blockBytes hex digits into blockBytes bytes.
+ * Returns false without a defined output if any character is not hex. */
+typedef bool (*DecodeBlockFn)(const uint8_t* src, uint8_t* dst);
+
+#if defined(HEX_DECODE_X86)
+/* 16 characters to 16 nibble values, sets *pValid to all ones if valid */
+inline __m128i nibbles_sse2(__m128i c, __m128i* pValid) {
+  const __m128i nine = _mm_set1_epi8(9);
+  const __m128i five = _mm_set1_epi8(5);
+  __m128i digit = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+  __m128i alpha =
+      _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+  __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(digit, nine), digit);
+  __m128i isAlpha = _mm_cmpeq_epi8(_mm_min_epu8(alpha, five), alpha);
+  *pValid = _mm_or_si128(isDigit, isAlpha);
+  return _mm_or_si128(
+      _mm_and_si128(isDigit, digit),
+      _mm_andnot_si128(isDigit, _mm_add_epi8(alpha, _mm_set1_epi8(10))));
+}
+
+/* Pairs of nibbles (high nibble first) to bytes in the low half of 16 bits */
+inline __m128i pairs_sse2(__m128i v) {
+  __m128i hi = _mm_slli_epi16(_mm_and_si128(v, _mm_set1_epi16(0x00FF)), 4);
+  return _mm_or_si128(hi, _mm_srli_epi16(v, 8));
+}
+
+bool decode16_sse2(const uint8_t* src, uint8_t* dst) {
+  __m128i valid0, valid1;
+  __m128i v0 =
+      nibbles_sse2(_mm_loadu_si128((const __m128i*)src), &valid0);
+  __m128i v1 =
+      nibbles_sse2(_mm_loadu_si128((const __m128i*)(src + 16)), &valid1);
+  if (_mm_movemask_epi8(_mm_and_si128(valid0, valid1)) != 0xFFFF) {
+    return false;
+  }
+  _mm_storeu_si128((__m128i*)dst,
+                   _mm_packus_epi16(pairs_sse2(v0), pairs_sse2(v1)));
+  return true;
+}
+
+__attribute__((target("avx2"))) bool decode32_avx2(const uint8_t* src,
+                                                   uint8_t* dst) {
+  const __m256i nine = _mm256_set1_epi8(9);
+  const __m256i five = _mm256_set1_epi8(5);
+  __m256i out[2];
+  __m256i valid = _mm256_set1_epi8(-1);
+
+  for (int i = 0; i < 2; i++) {
+    __m256i c = _mm256_loadu_si256((const __m256i*)(src + (i * 32)));
+    __m256i digit = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+    __m256i alpha = _mm256_sub_epi8(
+        _mm256_or_si256(c, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+    __m256i isDigit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, nine), digit);
+    __m256i isAlpha = _mm256_cmpeq_epi8(_mm256_min_epu8(alpha, five), alpha);
+    __m256i v = _mm256_blendv_epi8(
+        _mm256_add_epi8(alpha, _mm256_set1_epi8(10)), digit, isDigit);
+    valid = _mm256_and_si256(valid, _mm256_or_si256(isDigit, isAlpha));
+    __m256i hi =
+        _mm256_slli_epi16(_mm256_and_si256(v, _mm256_set1_epi16(0x00FF)), 4);
+    out[i] = _mm256_or_si256(hi, _mm256_srli_epi16(v, 8));
+  }
+  if (_mm256_movemask_epi8(valid) != -1) {
+    return false;
+  }
+  /*packus works per 128 bit lane, restore the order of the quad words*/
+  _mm256_storeu_si256(
+      (__m256i*)dst,
+      _mm256_permute4x64_epi64(_mm256_packus_epi16(out[0], out[1]), 0xD8));
+  return true;
+}
+#elif defined(HEX_DECODE_NEON)
+bool decode16_neon(const uint8_t* src, uint8_t* dst) {
+  /*De-interleave: val[0] has the high nibble digits, val[1] the low ones*/
+  uint8x16x2_t c = vld2q_u8(src);
+  uint8x16_t nib[2];
+  uint8x16_t valid = vdupq_n_u8(0xFF);
+
+  for (int i = 0; i < 2; i++) {
+    uint8x16_t digit = vsubq_u8(c.val[i], vdupq_n_u8('0'));
+    uint8x16_t alpha =
+        vsubq_u8(vorrq_u8(c.val[i], vdupq_n_u8(0x20)), vdupq_n_u8('a'));
+    uint8x16_t isDigit = vcleq_u8(digit, vdupq_n_u8(9));
+    uint8x16_t isAlpha = vcleq_u8(alpha, vdupq_n_u8(5));
+    valid = vandq_u8(valid, vorrq_u8(isDigit, isAlpha));
+    nib[i] = vbslq_u8(isDigit, digit, vaddq_u8(alpha, vdupq_n_u8(10)));
+  }
+#if defined(__aarch64__)
+  if (vminvq_u8(valid) != 0xFF) return false;
+#else
+  uint8x8_t m = vand_u8(vget_low_u8(valid), vget_high_u8(valid));
+  if (vget_lane_u64(vreinterpret_u64_u8(m), 0) != ~0ULL) return false;
+#endif
+  vst1q_u8(dst, vorrq_u8(vshlq_n_u8(nib[0], 4), nib[1]));
+  return true;
+}
+#endif
+
+struct BlockDecoder {
+  DecodeBlockFn fn;
+  int32_t bytes;
+};
+
+BlockDecoder selectDecoder() {
+  BlockDecoder d = {NULL, 0};
+#if defined(HEX_DECODE_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    d.fn = decode32_avx2;
+    d.bytes = 32;
+  } else if (__builtin_cpu_supports("sse2")) {
+    d.fn = decode16_sse2;
+    d.bytes = 16;
+  }
+#elif defined(HEX_DECODE_NEON)
+  d.fn = decode16_neon;
+  d.bytes = 16;
+#endif
+  return d;
+}
+
+}  // namespace
+
+int32_t hex_decode(const uint8_t* src, int32_t srcLen, uint8_t* dst,
+                   int32_t count, int32_t* pConsumed) {
+  static const BlockDecoder decoder = selectDecoder();
+  const int32_t blockBytes = decoder.bytes;
+  int32_t pos = 0, n = 0;
+  /*Scalar decoding is used up to here after a block with a separator*/
+  int32_t scalarUntil = 0;
+
+  while (n < count) {
+    if ((decoder.fn != NULL) && (pos >= scalarUntil)) {
+      while (((count - n) >= blockBytes) &&
+             ((srcLen - pos) >= (2 * blockBytes))) {
+        if (!decoder.fn(&src[pos], &dst[n])) {
+          scalarUntil = pos + (2 * blockBytes);
+          break;
+        }
+        pos += 2 * blockBytes;
+        n += blockBytes;
+      }
+      if (n >= count) break;
+    }
+
+    while ((pos < srcLen) && isSpace(src[pos])) pos++;
+    if (pos >= srcLen) break;
+    uint8_t hi = kHex.val[src[pos]];
+    if (hi == 0xFF) break;
+    pos++;
+    uint8_t lo = (pos < srcLen) ? kHex.val[src[pos]] : 0xFF;
+    if (lo == 0xFF) {
+      dst[n++] = hi;
+      continue;
+    }
+    pos++;
+    dst[n++] = (uint8_t)((hi << 4) | lo);
+  }
+  if (pConsumed != NULL) *pConsumed = pos;
+  return n;
+}
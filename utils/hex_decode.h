@@ -0,0 +1,41 @@
+/******************************************************************************
+ *
+ *  Copyright 2019 NXP
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+#ifndef HEX_DECODE_H_
+#define HEX_DECODE_H_
+
+#include <stdint.h>
+
+/*
+ * Decodes up to count bytes of ASCII hex from src into dst.
+ * White space in front of each byte is skipped. A single digit followed by
+ * a character which is not hex is decoded as one byte, like "%2X" does.
+ * Decoding stops after count bytes, at the end of src or in front of the
+ * first character which is neither white space nor hex.
+ *
+ * *pConsumed is set to the number of characters of src consumed, so
+ * src[*pConsumed] is the character decoding stopped at (if any).
+ * Returns the number of bytes written to dst.
+ *
+ * Runs of hex digits are decoded 32 or 64 characters at a time using
+ * SSE2/AVX2 on x86 and NEON on ARM, other targets use the scalar path.
+ */
+int32_t hex_decode(const uint8_t* src, int32_t srcLen, uint8_t* dst,
+                   int32_t count, int32_t* pConsumed);
+
+#endif /* HEX_DECODE_H_ */
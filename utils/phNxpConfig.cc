@@ -36,9 +36,16 @@
  *
  ******************************************************************************/
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
-#include <list>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
 #include <string>
 #include <vector>
 #include <log/log.h>
@@ -47,13 +54,15 @@
 #include <phNxpLog.h>
 #include "sparse_crc32.h"
 #if GENERIC_TARGET
-const char alternative_config_path[] = "/data/vendor/nfc/";
+const char alternative_config_path[] = ESE_FS_ROOT "/data/vendor/nfc/";
 #else
 const char alternative_config_path[] = "";
 #endif
 
 #if 1
-const char* transport_config_paths[] = {"/odm/etc/", "/vendor/etc/", "/etc/"};
+const char* transport_config_paths[] = {ESE_FS_ROOT "/odm/etc/",
+                                        ESE_FS_ROOT "/vendor/etc/",
+                                        ESE_FS_ROOT "/etc/"};
 #else
 const char* transport_config_paths[] = {"res/"};
 #endif
@@ -66,46 +75,104 @@ const int transport_config_path_size =
 #define IsStringValue 0x80000000
 
 const char rf_config_timestamp_path[] =
-        "/data/vendor/nfc/libnfc-nxpRFConfigState.bin";
+        ESE_FS_ROOT "/data/vendor/nfc/libnfc-nxpRFConfigState.bin";
 const char tr_config_timestamp_path[] =
-    "/data/vendor/nfc/libnfc-nxpTransitConfigState.bin";
+    ESE_FS_ROOT "/data/vendor/nfc/libnfc-nxpTransitConfigState.bin";
 const char config_timestamp_path[] =
-        "/data/vendor/nfc/libnfc-nxpConfigState.bin";
+        ESE_FS_ROOT "/data/vendor/nfc/libnfc-nxpConfigState.bin";
 /*const char default_nxp_config_path[] =
         "/vendor/etc/libnfc-nxp.conf";*/
 const char nxp_rf_config_path[] =
-        "/system/vendor/libnfc-nxp_RF.conf";
-const char transit_config_path[] = "/data/vendor/nfc/libnfc-nxpTransit.conf";
-void readOptionalConfig(const char* optional);
+        ESE_FS_ROOT "/system/vendor/libnfc-nxp_RF.conf";
+const char transit_config_path[] =
+    ESE_FS_ROOT "/data/vendor/nfc/libnfc-nxpTransit.conf";
+const char config_cache_path[] =
+    ESE_FS_ROOT "/data/vendor/nfc/libnfc-nxpConfigCache.bin";
 
 namespace {
 
-size_t readConfigFile(const char* fileName, uint8_t** p_data) {
-  FILE* fd = fopen(fileName, "rb");
-  if (fd == nullptr) return 0;
+/* Bytes checksummed ahead of the parser, small enough to stay in cache */
+#define CONFIG_CRC_BLOCK 4096
+
+#define CONFIG_CACHE_MAGIC 0x4346434E /* "NCFC" */
+#define CONFIG_CACHE_VERSION 1
+#define CONFIG_CACHE_CRC_START offsetof(ConfigCacheHeader_t, configCrc)
+
+/*
+ * Parsed settings of all config files, written after a full load and used
+ * instead of parsing as long as every file still has the recorded CRC.
+ * Layout: header, file table, param table sorted by name, then the names,
+ * paths and values referenced by offset from the start of the cache.
+ */
+typedef struct ConfigCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t length;    /* Of the whole cache */
+  uint32_t crc;       /* Of the bytes following it */
+  uint32_t configCrc; /* config_crc32_ after the load */
+  uint32_t numFiles;
+  uint32_t numParams;
+  uint32_t reserved;
+} ConfigCacheHeader_t;
+
+typedef struct ConfigCacheFile {
+  uint32_t pathOffset;
+  uint32_t pathLen;
+  uint32_t size; /* 0 if the file could not be read */
+  uint32_t crc;
+} ConfigCacheFile_t;
+
+typedef struct ConfigCacheParam {
+  uint32_t nameOffset;
+  uint32_t nameLen;
+  uint32_t valueOffset;
+  uint32_t valueLen; /* 0 for a numerical value */
+  uint64_t numValue;
+} ConfigCacheParam_t;
+
+/* A config file as read by the last load */
+typedef struct ConfigFile {
+  std::string path;
+  uint32_t size; /* 0 if the file could not be read */
+  uint32_t crc;
+} ConfigFile_t;
+
+/* Names of the settings by ConfigKey */
+const char* const kConfigKeyNames[CFG_KEY_COUNT] = {
+#define CONFIG_KEY_NAME(x) NAME_##x,
+    NXP_CONFIG_KEYS(CONFIG_KEY_NAME)
+#undef CONFIG_KEY_NAME
+};
 
-  fseek(fd, 0L, SEEK_END);
-  const size_t file_size = ftell(fd);
-  rewind(fd);
-  if ((long)file_size < 0) {
-    ALOGE("%s Invalid file size file_size = %zu\n", __func__, file_size);
-    fclose(fd);
-    return 0;
-  }
+/*******************************************************************************
+**
+** Function:    mapConfigFile()
+**
+** Description: map the config file read only
+**
+** Returns:     start of the mapping and its size in p_size, nullptr if the
+**              file cannot be opened or is empty
+**
+*******************************************************************************/
+const uint8_t* mapConfigFile(const char* fileName, size_t* p_size) {
+  int fd = open(fileName, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return nullptr;
 
-  uint8_t* buffer = new uint8_t[file_size];
-  if (!buffer) {
-    fclose(fd);
-    return 0;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    return nullptr;
   }
-  size_t read = fread(buffer, file_size, 1, fd);
-  fclose(fd);
-  if (read == 1) {
-    *p_data = buffer;
-    return file_size;
+  const size_t file_size = (size_t)st.st_size;
+  void* p_data = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p_data == MAP_FAILED) {
+    ALOGE("%s mmap failed for %s\n", __func__, fileName);
+    return nullptr;
   }
-  delete[] buffer;
-  return 0;
+  madvise(p_data, file_size, MADV_SEQUENTIAL);
+  *p_size = file_size;
+  return (const uint8_t*)p_data;
 }
 
 }  // namespace
@@ -127,40 +194,59 @@ class CNfcParam : public string {
   unsigned long m_numValue;
 };
 
+/*
+ * Settings read from the config files. An instance is never changed once
+ * published; a reload publishes a new one and the old one is deleted when
+ * no reader can still use it.
+ */
 class CNfcConfig : public vector<const CNfcParam*> {
  public:
   virtual ~CNfcConfig();
-  static CNfcConfig& GetInstance();
-  friend void readOptionalConfig(const char* optional);
-  bool isModified();
-  void resetModified();
+  static CNfcConfig* load();
+  static const CNfcConfig* readLock(uint32_t* pEpoch);
+  static void readUnlock(uint32_t epoch);
+  static void publish(CNfcConfig* pConfig);
+  bool isModified() const;
+  void resetModified() const;
+  uint32_t getCrc() const { return config_crc32_; }
+  bool isSameFiles(const CNfcConfig& config) const;
   int updateTimestamp();
-  int checkTimestamp(const char* fileName, const char* fileTimeStamp);
+  int checkTimestamp(const char* fileName, const char* fileTimeStamp) const;
 
   bool getValue(const char* name, char* pValue, size_t len) const;
   bool getValue(const char* name, unsigned long& rValue) const;
   bool getValue(const char* name, unsigned short& rValue) const;
   bool getValue(const char* name, char* pValue, long len, long* readlen) const;
+  bool getValue(const CNfcParam* pParam, char* pValue, size_t len) const;
+  bool getValue(const CNfcParam* pParam, char* pValue, long len,
+                long* readlen) const;
   const CNfcParam* find(const char* p_name) const;
-  void readNxpTransitConfig(const char* fileName) const;
-  void readNxpRFConfig(const char* fileName) const;
+  const CNfcParam* find(ConfigKey key) const {
+    return (key < CFG_KEY_COUNT) ? mKeyParams[key] : NULL;
+  }
+  void readNxpTransitConfig(const char* fileName);
+  void readNxpRFConfig(const char* fileName);
+  void readOptionalConfig(const char* extra);
   void clean();
 
  private:
   CNfcConfig();
   bool readConfig(const char* name, bool bResetContent);
-  void moveFromList();
-  void moveToList();
+  bool loadCache();
+  void storeCache() const;
+  void sortParams(size_t first);
+  void indexKeys();
   void add(const CNfcParam* pParam);
   void dump();
   bool isAllowed(const char* name);
-  list<const CNfcParam*> m_list;
   bool mValidFile;
   uint32_t config_crc32_;
   unsigned long m_timeStamp;
   unsigned long m_timeStampRF;
   unsigned long m_timeStampTransit;
   string mCurrentFile;
+  vector<ConfigFile_t> mFiles; /* Read since the last clean(), in order */
+  const CNfcParam* mKeyParams[CFG_KEY_COUNT]; /* Setting of each ConfigKey */
 
   unsigned long state;
 
@@ -169,6 +255,29 @@ class CNfcConfig : public vector<const CNfcParam*> {
   inline void Reset(unsigned long f) { state &= ~f; }
 };
 
+/* Published settings, nullptr until loaded */
+static std::atomic<CNfcConfig*> sConfig(nullptr);
+/* Read sections open, by parity of the epoch they were entered in */
+static std::atomic<uint32_t> sEpoch(0);
+static std::atomic<uint32_t> sReaders[2];
+/* Serializes loading and publishing of the settings */
+static pthread_mutex_t sConfigLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Read section on the published settings for the lifetime of the object */
+class CNfcConfigReader {
+ public:
+  CNfcConfigReader() : mpConfig(CNfcConfig::readLock(&mEpoch)) {}
+  ~CNfcConfigReader() { CNfcConfig::readUnlock(mEpoch); }
+  const CNfcConfig* operator->() const { return mpConfig; }
+
+ private:
+  CNfcConfigReader(const CNfcConfigReader&);
+  CNfcConfigReader& operator=(const CNfcConfigReader&);
+
+  uint32_t mEpoch;
+  const CNfcConfig* mpConfig;
+};
+
 /*******************************************************************************
 **
 ** Function:    isPrintable()
@@ -244,6 +353,57 @@ void findConfigFilePathFromTransportConfigPaths(const string& configName,
   filePath += configName;
 }
 
+/*******************************************************************************
+**
+** Function:    findOptionalConfigFilePath()
+**
+** Description: find the path of the optional config file libnfc-<extra>.conf
+**
+** Returns:     none
+**
+*******************************************************************************/
+void findOptionalConfigFilePath(const char* extra, string& filePath) {
+  string configName(extra_config_base);
+  configName += extra;
+  configName += extra_config_ext;
+
+  if (alternative_config_path[0] != '\0') {
+    filePath.assign(alternative_config_path);
+    filePath += configName;
+  } else {
+    findConfigFilePathFromTransportConfigPaths(configName, filePath);
+  }
+}
+
+/*******************************************************************************
+**
+** Function:    getConfigFilePaths()
+**
+** Description: list the config files CNfcConfig::load() reads, in
+**              order. The files after the alternative config are only read
+**              if it has no settings.
+**
+** Returns:     none
+**
+*******************************************************************************/
+void getConfigFilePaths(vector<string>& paths) {
+  string strPath;
+
+  if (alternative_config_path[0] != '\0') {
+    strPath.assign(alternative_config_path);
+    strPath += config_name;
+    paths.push_back(strPath);
+  }
+  findConfigFilePathFromTransportConfigPaths(config_name, strPath);
+  paths.push_back(strPath);
+#if (NXP_EXTNS == TRUE)
+  findOptionalConfigFilePath("brcm", strPath);
+  paths.push_back(strPath);
+  paths.push_back(transit_config_path);
+  paths.push_back(nxp_rf_config_path);
+#endif
+}
+
 /*******************************************************************************
 **
 ** Function:    CNfcConfig::readConfig()
@@ -265,9 +425,10 @@ bool CNfcConfig::readConfig(const char* name, bool bResetContent) {
     END_LINE
   };
 
-  uint8_t* p_config = nullptr;
-  size_t config_size = readConfigFile(name, &p_config);
+  size_t config_size = 0;
+  const uint8_t* p_config = mapConfigFile(name, &config_size);
   if (p_config == nullptr) {
+    mFiles.push_back({name, 0, 0});
     ALOGE("%s Cannot open config file %s\n", __func__, name);
     if (bResetContent) {
       ALOGE("%s Using default value for all settings\n", __func__);
@@ -286,16 +447,21 @@ bool CNfcConfig::readConfig(const char* name, bool bResetContent) {
   int bflag = 0;
   state = BEGIN_LINE;
 
-  config_crc32_ = sparse_crc32(0, (const void*)p_config, (int)config_size);
+  /*The CRC is computed a block ahead of the parser in the same pass*/
+  uint32_t crc32 = 0;
+  size_t crcEnd = 0;
   mValidFile = true;
-  if (size() > 0) {
-    if (bResetContent)
-      clean();
-    else
-      moveToList();
-  }
+  if ((size() > 0) && bResetContent) clean();
+  /*Settings of this file are appended, then sorted in once*/
+  size_t first = size();
 
   for (size_t offset = 0; offset != config_size; ++offset) {
+    if (offset == crcEnd) {
+      size_t len = config_size - offset;
+      if (len > CONFIG_CRC_BLOCK) len = CONFIG_CRC_BLOCK;
+      crc32 = sparse_crc32(crc32, (const void*)&p_config[offset], (int)len);
+      crcEnd += len;
+    }
     c = p_config[offset];
     switch (state & 0xff) {
       case BEGIN_LINE:
@@ -421,9 +587,12 @@ bool CNfcConfig::readConfig(const char* name, bool bResetContent) {
     }
   }
 
-  delete[] p_config;
+  munmap((void*)p_config, config_size);
+  config_crc32_ = crc32;
+  mFiles.push_back({name, (uint32_t)config_size, crc32});
 
-  moveFromList();
+  sortParams(first);
+  indexKeys();
   return size() > 0;
 }
 
@@ -442,6 +611,7 @@ CNfcConfig::CNfcConfig()
       m_timeStamp(0),
       m_timeStampRF(0),
       m_timeStampTransit(0),
+      mKeyParams(),
       state(0) {}
 
 /*******************************************************************************
@@ -453,40 +623,113 @@ CNfcConfig::CNfcConfig()
 ** Returns:     none
 **
 *******************************************************************************/
-CNfcConfig::~CNfcConfig() {}
+CNfcConfig::~CNfcConfig() { clean(); }
 
 /*******************************************************************************
 **
-** Function:    CNfcConfig::GetInstance()
+** Function:    CNfcConfig::load()
 **
-** Description: get class singleton object
+** Description: read the settings of all config files, from the config cache
+**              if they are unchanged
 **
-** Returns:     none
+** Returns:     new settings object, not published
 **
 *******************************************************************************/
-CNfcConfig& CNfcConfig::GetInstance() {
-  static CNfcConfig theInstance;
-
-  if (theInstance.size() == 0 && theInstance.mValidFile) {
-    string strPath;
-    if (alternative_config_path[0] != '\0') {
-      strPath.assign(alternative_config_path);
-      strPath += config_name;
-      theInstance.readConfig(strPath.c_str(), true);
-      if (!theInstance.empty()) {
-        return theInstance;
-      }
+CNfcConfig* CNfcConfig::load() {
+  CNfcConfig* pConfig = new CNfcConfig();
+  CNfcConfig& rConfig = *pConfig;
+
+  if (rConfig.loadCache()) return pConfig;
+  string strPath;
+  if (alternative_config_path[0] != '\0') {
+    strPath.assign(alternative_config_path);
+    strPath += config_name;
+    rConfig.readConfig(strPath.c_str(), true);
+    if (!rConfig.empty()) {
+      rConfig.storeCache();
+      return pConfig;
     }
-    findConfigFilePathFromTransportConfigPaths(config_name, strPath);
-    theInstance.readConfig(strPath.c_str(), true);
+  }
+  findConfigFilePathFromTransportConfigPaths(config_name, strPath);
+  rConfig.readConfig(strPath.c_str(), true);
 #if (NXP_EXTNS == TRUE)
-    readOptionalConfig("brcm");
-    theInstance.readNxpTransitConfig(transit_config_path);
-    theInstance.readNxpRFConfig(nxp_rf_config_path);
+  rConfig.readOptionalConfig("brcm");
+  rConfig.readNxpTransitConfig(transit_config_path);
+  rConfig.readNxpRFConfig(nxp_rf_config_path);
 #endif
+  rConfig.storeCache();
+  return pConfig;
+}
+
+/*******************************************************************************
+**
+** Function:    CNfcConfig::readLock()
+**
+** Description: enter a read section on the published settings, loading
+**              them first if none are. Does not wait for other threads once
+**              the settings are loaded.
+**
+** Returns:     settings, valid until readUnlock() with the epoch in pEpoch
+**
+*******************************************************************************/
+const CNfcConfig* CNfcConfig::readLock(uint32_t* pEpoch) {
+  for (;;) {
+    if (sConfig.load() == nullptr) {
+      pthread_mutex_lock(&sConfigLock);
+      if (sConfig.load() == nullptr) sConfig.store(load());
+      pthread_mutex_unlock(&sConfigLock);
+    }
+    uint32_t epoch = sEpoch.load();
+    sReaders[epoch & 1].fetch_add(1);
+    const CNfcConfig* pConfig = sConfig.load();
+    if (pConfig != nullptr) {
+      *pEpoch = epoch;
+      return pConfig;
+    }
+    /*Reset in between, load again*/
+    sReaders[epoch & 1].fetch_sub(1);
   }
+}
 
-  return theInstance;
+/*******************************************************************************
+**
+** Function:    CNfcConfig::readUnlock()
+**
+** Description: leave a read section entered in epoch
+**
+** Returns:     none
+**
+*******************************************************************************/
+void CNfcConfig::readUnlock(uint32_t epoch) {
+  sReaders[epoch & 1].fetch_sub(1);
+}
+
+/*******************************************************************************
+**
+** Function:    CNfcConfig::publish()
+**
+** Description: replace the published settings with pConfig (nullptr to have
+**              them loaded again on the next read) and delete the old ones
+**              once no read section can still use them. Called with
+**              sConfigLock held, never from a read section.
+**
+** Returns:     none
+**
+*******************************************************************************/
+void CNfcConfig::publish(CNfcConfig* pConfig) {
+  CNfcConfig* pOld = sConfig.exchange(pConfig);
+  if (pOld == nullptr) return;
+
+  /*
+   * A reader may have taken the epoch before the previous flip and only
+   * counted itself after it, so both parities are drained in turn. Readers
+   * entering meanwhile count in the other parity and cannot delay this.
+   */
+  for (int phase = 0; phase < 2; phase++) {
+    uint32_t epoch = sEpoch.fetch_add(1);
+    while (sReaders[epoch & 1].load() != 0) sched_yield();
+  }
+  delete pOld;
 }
 
 /*******************************************************************************
@@ -500,7 +743,11 @@ CNfcConfig& CNfcConfig::GetInstance() {
 **
 *******************************************************************************/
 bool CNfcConfig::getValue(const char* name, char* pValue, size_t len) const {
-  const CNfcParam* pParam = find(name);
+  return getValue(find(name), pValue, len);
+}
+
+bool CNfcConfig::getValue(const CNfcParam* pParam, char* pValue,
+                          size_t len) const {
   if (pParam == NULL) return false;
 
   if (pParam->str_len() > 0) {
@@ -513,7 +760,11 @@ bool CNfcConfig::getValue(const char* name, char* pValue, size_t len) const {
 
 bool CNfcConfig::getValue(const char* name, char* pValue, long len,
                           long* readlen) const {
-  const CNfcParam* pParam = find(name);
+  return getValue(find(name), pValue, len, readlen);
+}
+
+bool CNfcConfig::getValue(const CNfcParam* pParam, char* pValue, long len,
+                          long* readlen) const {
   if (pParam == NULL) return false;
 
   if (pParam->str_len() > 0) {
@@ -576,7 +827,8 @@ bool CNfcConfig::getValue(const char* name, unsigned short& rValue) const {
 **
 ** Function:    CNfcConfig::find()
 **
-** Description: search if a setting exist in the setting array
+** Description: search if a setting exist in the setting array, which add()
+**              keeps sorted by name without duplicates
 **
 ** Returns:     pointer to the setting object
 **
@@ -584,20 +836,18 @@ bool CNfcConfig::getValue(const char* name, unsigned short& rValue) const {
 const CNfcParam* CNfcConfig::find(const char* p_name) const {
   if (size() == 0) return NULL;
 
-  for (const_iterator it = begin(), itEnd = end(); it != itEnd; ++it) {
-    if (**it < p_name) {
-      continue;
-    } else if (**it == p_name) {
-      if ((*it)->str_len() > 0) {
-        NXPLOG_EXTNS_D("%s found %s=%s\n", __func__, p_name,
-                       (*it)->str_value());
-      } else {
-        NXPLOG_EXTNS_D("%s found %s=(0x%lx)\n", __func__, p_name,
-                       (*it)->numValue());
-      }
-      return *it;
-    } else
-      break;
+  const_iterator it = lower_bound(
+      begin(), end(), p_name,
+      [](const CNfcParam* pParam, const char* name) { return *pParam < name; });
+  if ((it != end()) && (**it == p_name)) {
+    if ((*it)->str_len() > 0) {
+      NXPLOG_EXTNS_D("%s found %s=%s\n", __func__, p_name,
+                     (*it)->str_value());
+    } else {
+      NXPLOG_EXTNS_D("%s found %s=(0x%lx)\n", __func__, p_name,
+                     (*it)->numValue());
+    }
+    return *it;
   }
   return NULL;
 }
@@ -611,9 +861,9 @@ const CNfcParam* CNfcConfig::find(const char* p_name) const {
 ** Returns:     none
 **
 *******************************************************************************/
-void CNfcConfig::readNxpTransitConfig(const char* fileName) const {
+void CNfcConfig::readNxpTransitConfig(const char* fileName) {
   ALOGD("readNxpTransitConfig-Enter..Reading %s", fileName);
-  CNfcConfig::GetInstance().readConfig(fileName, false);
+  readConfig(fileName, false);
 }
 
 /*******************************************************************************
@@ -625,9 +875,9 @@ void CNfcConfig::readNxpTransitConfig(const char* fileName) const {
 ** Returns:     none
 **
 *******************************************************************************/
-void CNfcConfig::readNxpRFConfig(const char* fileName) const {
+void CNfcConfig::readNxpRFConfig(const char* fileName) {
   ALOGD("readNxpRFConfig-Enter..Reading %s", fileName);
-  CNfcConfig::GetInstance().readConfig(fileName, false);
+  readConfig(fileName, false);
 }
 
 /*******************************************************************************
@@ -640,43 +890,32 @@ void CNfcConfig::readNxpRFConfig(const char* fileName) const {
 **
 *******************************************************************************/
 void CNfcConfig::clean() {
+  mFiles.clear();
   if (size() == 0) return;
 
   for (iterator it = begin(), itEnd = end(); it != itEnd; ++it) delete *it;
   clear();
+  indexKeys();
 }
 
 /*******************************************************************************
 **
 ** Function:    CNfcConfig::Add()
 **
-** Description: add a setting object to the list
+** Description: append a setting object to the array, sortParams() puts it
+**              in place once the file is read
 **
 ** Returns:     none
 **
 *******************************************************************************/
 void CNfcConfig::add(const CNfcParam* pParam) {
-  if (m_list.size() == 0) {
-    m_list.push_back(pParam);
-    return;
-  }
-  if ((mCurrentFile.find("nxpTransit") != std::string::npos) &&
+  if ((size() > 0) && (mCurrentFile.find("nxpTransit") != std::string::npos) &&
       !isAllowed(pParam->c_str())) {
     ALOGD("%s Token restricted. Returning", __func__);
+    delete pParam;
     return;
   }
-  for (list<const CNfcParam*>::iterator it = m_list.begin(),
-                                        itEnd = m_list.end();
-       it != itEnd; ++it) {
-    if (**it < pParam->c_str()) continue;
-    if (**it == pParam->c_str())
-      m_list.insert(m_list.erase(it), pParam);
-    else
-      m_list.insert(it, pParam);
-
-    return;
-  }
-  m_list.push_back(pParam);
+  push_back(pParam);
 }
 /*******************************************************************************
 **
@@ -690,9 +929,7 @@ void CNfcConfig::add(const CNfcParam* pParam) {
 void CNfcConfig::dump() {
   ALOGD("%s Enter", __func__);
 
-  for (list<const CNfcParam*>::iterator it = m_list.begin(),
-                                        itEnd = m_list.end();
-       it != itEnd; ++it) {
+  for (const_iterator it = begin(), itEnd = end(); it != itEnd; ++it) {
     if ((*it)->str_len() > 0)
       ALOGD("%s %s \t= %s", __func__, (*it)->c_str(), (*it)->str_value());
     else
@@ -729,39 +966,247 @@ bool CNfcConfig::isAllowed(const char* name) {
 }
 /*******************************************************************************
 **
-** Function:    CNfcConfig::moveFromList()
+** Function:    CNfcConfig::sortParams()
 **
-** Description: move the setting object from list to array
+** Description: sort the settings added from index first on by name and merge
+**              them into the sorted settings before it. Of settings with the
+**              same name the one added last is kept, so a later line or file
+**              overrides an earlier one.
 **
 ** Returns:     none
 **
 *******************************************************************************/
-void CNfcConfig::moveFromList() {
-  if (m_list.size() == 0) return;
-
-  for (list<const CNfcParam *>::iterator it = m_list.begin(),
-                                         itEnd = m_list.end();
-       it != itEnd; ++it)
-    push_back(*it);
-  m_list.clear();
+void CNfcConfig::sortParams(size_t first) {
+  auto byName = [](const CNfcParam* pA, const CNfcParam* pB) {
+    return *pA < *pB;
+  };
+
+  if (first == size()) return;
+  stable_sort(begin() + first, end(), byName);
+  inplace_merge(begin(), begin() + first, end(), byName);
+  iterator out = begin();
+  for (iterator it = begin(), itEnd = end(); it != itEnd; ++it) {
+    if (((it + 1) != itEnd) && (**it == **(it + 1))) {
+      delete *it;
+      continue;
+    }
+    *out++ = *it;
+  }
+  erase(out, end());
 }
 
 /*******************************************************************************
 **
-** Function:    CNfcConfig::moveToList()
+** Function:    CNfcConfig::indexKeys()
 **
-** Description: move the setting object from array to list
+** Description: point the ConfigKey slots to the settings, done whenever the
+**              setting array changes
 **
 ** Returns:     none
 **
 *******************************************************************************/
-void CNfcConfig::moveToList() {
-  if (m_list.size() != 0) m_list.clear();
+void CNfcConfig::indexKeys() {
+  auto byName = [](const CNfcParam* pParam, const char* name) {
+    return *pParam < name;
+  };
 
-  for (iterator it = begin(), itEnd = end(); it != itEnd; ++it)
-    m_list.push_back(*it);
-  clear();
+  for (int key = 0; key < CFG_KEY_COUNT; key++) {
+    const char* name = kConfigKeyNames[key];
+    const_iterator it = lower_bound(begin(), end(), name, byName);
+    mKeyParams[key] = ((it != end()) && (**it == name)) ? *it : NULL;
+  }
+}
+
+/*******************************************************************************
+**
+** Function:    isCacheUsable()
+**
+** Description: check the integrity of the config cache and that the config
+**              files are the ones it was made from
+**
+** Returns:     true if the settings of the cache can be used
+**
+*******************************************************************************/
+static bool isCacheUsable(const uint8_t* p_cache, size_t cache_size) {
+  const ConfigCacheHeader_t* pHdr = (const ConfigCacheHeader_t*)p_cache;
+
+  if (cache_size < sizeof(ConfigCacheHeader_t) ||
+      pHdr->magic != CONFIG_CACHE_MAGIC ||
+      pHdr->version != CONFIG_CACHE_VERSION || pHdr->length != cache_size) {
+    return false;
+  }
+  uint64_t tables_size = sizeof(ConfigCacheHeader_t) +
+                         (uint64_t)pHdr->numFiles * sizeof(ConfigCacheFile_t) +
+                         (uint64_t)pHdr->numParams * sizeof(ConfigCacheParam_t);
+  if (tables_size > cache_size) return false;
+  if (sparse_crc32(0, p_cache + CONFIG_CACHE_CRC_START,
+                   (int)(cache_size - CONFIG_CACHE_CRC_START)) != pHdr->crc) {
+    ALOGE("%s CRC mismatch", __func__);
+    return false;
+  }
+
+  const ConfigCacheParam_t* pParam =
+      (const ConfigCacheParam_t*)(p_cache + tables_size -
+                                  pHdr->numParams * sizeof(ConfigCacheParam_t));
+  for (uint32_t i = 0; i < pHdr->numParams; i++) {
+    if ((uint64_t)pParam[i].nameOffset + pParam[i].nameLen > cache_size ||
+        (uint64_t)pParam[i].valueOffset + pParam[i].valueLen > cache_size) {
+      return false;
+    }
+  }
+
+  /*Loading stops after the alternative config if it has settings*/
+  vector<string> paths;
+  getConfigFilePaths(paths);
+  if (pHdr->numFiles != paths.size() &&
+      !(alternative_config_path[0] != '\0' && pHdr->numFiles == 1)) {
+    return false;
+  }
+  const ConfigCacheFile_t* pFile =
+      (const ConfigCacheFile_t*)(p_cache + sizeof(ConfigCacheHeader_t));
+  for (uint32_t i = 0; i < pHdr->numFiles; i++) {
+    if ((uint64_t)pFile[i].pathOffset + pFile[i].pathLen > cache_size ||
+        paths[i].compare(0, string::npos,
+                         (const char*)p_cache + pFile[i].pathOffset,
+                         pFile[i].pathLen) != 0) {
+      return false;
+    }
+    size_t config_size = 0;
+    const uint8_t* p_config = mapConfigFile(paths[i].c_str(), &config_size);
+    if (p_config == nullptr) {
+      if (pFile[i].size != 0) return false;
+      continue;
+    }
+    uint32_t crc32 = sparse_crc32(0, (const void*)p_config, (int)config_size);
+    munmap((void*)p_config, config_size);
+    if (config_size != pFile[i].size || crc32 != pFile[i].crc) {
+      ALOGD("%s %s modified", __func__, paths[i].c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:    CNfcConfig::loadCache()
+**
+** Description: take the settings from the config cache if the config files
+**              are unchanged since it was written
+**
+** Returns:     true if the settings were loaded from the cache
+**
+*******************************************************************************/
+bool CNfcConfig::loadCache() {
+  size_t cache_size = 0;
+  const uint8_t* p_cache = mapConfigFile(config_cache_path, &cache_size);
+  if (p_cache == nullptr) return false;
+
+  if (!isCacheUsable(p_cache, cache_size)) {
+    munmap((void*)p_cache, cache_size);
+    return false;
+  }
+  const ConfigCacheHeader_t* pHdr = (const ConfigCacheHeader_t*)p_cache;
+  const ConfigCacheFile_t* pFile =
+      (const ConfigCacheFile_t*)(p_cache + sizeof(ConfigCacheHeader_t));
+  const ConfigCacheParam_t* pParam =
+      (const ConfigCacheParam_t*)(pFile + pHdr->numFiles);
+
+  clean();
+  for (uint32_t i = 0; i < pHdr->numFiles; i++) {
+    mFiles.push_back({string((const char*)p_cache + pFile[i].pathOffset,
+                             pFile[i].pathLen),
+                      pFile[i].size, pFile[i].crc});
+  }
+  /*Stored in the order sortParams() leaves them*/
+  reserve(pHdr->numParams);
+  for (uint32_t i = 0; i < pHdr->numParams; i++) {
+    string name((const char*)p_cache + pParam[i].nameOffset,
+                pParam[i].nameLen);
+    if (pParam[i].valueLen > 0) {
+      string value((const char*)p_cache + pParam[i].valueOffset,
+                   pParam[i].valueLen);
+      push_back(new CNfcParam(name.c_str(), value));
+    } else {
+      push_back(new CNfcParam(name.c_str(),
+                              (unsigned long)pParam[i].numValue));
+    }
+  }
+  indexKeys();
+  config_crc32_ = pHdr->configCrc;
+  mValidFile = true;
+  munmap((void*)p_cache, cache_size);
+  ALOGD("%s %zu settings from %s", __func__, size(), config_cache_path);
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:    CNfcConfig::storeCache()
+**
+** Description: write the settings read from the config files to the config
+**              cache. The cache is replaced atomically; a cache that is not
+**              written completely fails its CRC and is rebuilt.
+**
+** Returns:     none
+**
+*******************************************************************************/
+void CNfcConfig::storeCache() const {
+  if (!mValidFile || empty() || mFiles.empty()) return;
+
+  size_t tables_size = sizeof(ConfigCacheHeader_t) +
+                       mFiles.size() * sizeof(ConfigCacheFile_t) +
+                       size() * sizeof(ConfigCacheParam_t);
+  vector<uint8_t> cache(tables_size);
+  string blob;
+  ConfigCacheFile_t* pFile =
+      (ConfigCacheFile_t*)(cache.data() + sizeof(ConfigCacheHeader_t));
+  for (size_t i = 0; i < mFiles.size(); i++) {
+    pFile[i].pathOffset = (uint32_t)(tables_size + blob.size());
+    pFile[i].pathLen = (uint32_t)mFiles[i].path.size();
+    pFile[i].size = mFiles[i].size;
+    pFile[i].crc = mFiles[i].crc;
+    blob += mFiles[i].path;
+  }
+  ConfigCacheParam_t* pParam = (ConfigCacheParam_t*)(pFile + mFiles.size());
+  for (size_t i = 0; i < size(); i++) {
+    const CNfcParam* pNfcParam = at(i);
+    pParam[i].nameOffset = (uint32_t)(tables_size + blob.size());
+    pParam[i].nameLen = (uint32_t)pNfcParam->size();
+    blob += *pNfcParam;
+    pParam[i].valueOffset = (uint32_t)(tables_size + blob.size());
+    pParam[i].valueLen = (uint32_t)pNfcParam->str_len();
+    blob.append(pNfcParam->str_value(), pNfcParam->str_len());
+    pParam[i].numValue = pNfcParam->numValue();
+  }
+  cache.insert(cache.end(), blob.begin(), blob.end());
+
+  ConfigCacheHeader_t* pHdr = (ConfigCacheHeader_t*)cache.data();
+  pHdr->magic = CONFIG_CACHE_MAGIC;
+  pHdr->version = CONFIG_CACHE_VERSION;
+  pHdr->length = (uint32_t)cache.size();
+  pHdr->configCrc = config_crc32_;
+  pHdr->numFiles = (uint32_t)mFiles.size();
+  pHdr->numParams = (uint32_t)size();
+  pHdr->crc = sparse_crc32(0, cache.data() + CONFIG_CACHE_CRC_START,
+                           (int)(cache.size() - CONFIG_CACHE_CRC_START));
+
+  string tmpPath(config_cache_path);
+  tmpPath += "." + to_string(getpid());
+  int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                0644);
+  if (fd < 0) {
+    ALOGD("%s Cannot create %s", __func__, tmpPath.c_str());
+    return;
+  }
+  bool isOk = (write(fd, cache.data(), cache.size()) == (ssize_t)cache.size());
+  close(fd);
+  if (!isOk || rename(tmpPath.c_str(), config_cache_path) != 0) {
+    ALOGE("%s Unable to write %s", __func__, config_cache_path);
+    unlink(tmpPath.c_str());
+  }
 }
+
 /*******************************************************************************
 **
 ** Function:    CNfcConfig::checkTimestamp(const char* fileName,const char*
@@ -772,7 +1217,8 @@ void CNfcConfig::moveToList() {
 ** Returns:     0 if not modified, 1 otherwise.
 **
 *******************************************************************************/
-int CNfcConfig::checkTimestamp(const char* fileName, const char* fileNameTime) {
+int CNfcConfig::checkTimestamp(const char* fileName,
+                               const char* fileNameTime) const {
   FILE* fd;
   struct stat st;
   unsigned long value = 0, timeStamp = 0;
@@ -855,7 +1301,7 @@ int CNfcConfig::updateTimestamp() {
   return ret;
 }
 
-bool CNfcConfig::isModified() {
+bool CNfcConfig::isModified() const {
   FILE* fd = fopen(config_timestamp_path, "r+");
   if (fd == nullptr) {
     ALOGE("%s Unable to open file '%s' - assuming modified", __func__,
@@ -872,7 +1318,7 @@ bool CNfcConfig::isModified() {
   return stored_crc32 != config_crc32_;
 }
 
-void CNfcConfig::resetModified() {
+void CNfcConfig::resetModified() const {
   FILE* fd = fopen(config_timestamp_path, "w+");
   if (fd == nullptr) {
     ALOGE("%s Unable to open file '%s' for writing", __func__,
@@ -884,6 +1330,29 @@ void CNfcConfig::resetModified() {
   fclose(fd);
 }
 
+/*******************************************************************************
+**
+** Function:    CNfcConfig::isSameFiles()
+**
+** Description: check if config was read from the same files with the same
+**              content
+**
+** Returns:     true if the same
+**
+*******************************************************************************/
+bool CNfcConfig::isSameFiles(const CNfcConfig& config) const {
+  if (mFiles.size() != config.mFiles.size()) return false;
+
+  for (size_t i = 0; i < mFiles.size(); i++) {
+    if (mFiles[i].path != config.mFiles[i].path ||
+        mFiles[i].size != config.mFiles[i].size ||
+        mFiles[i].crc != config.mFiles[i].crc) {
+      return false;
+    }
+  }
+  return true;
+}
+
 /*******************************************************************************
 **
 ** Function:    CNfcParam::CNfcParam()
@@ -932,27 +1401,54 @@ CNfcParam::CNfcParam(const char* name, unsigned long value)
 
 /*******************************************************************************
 **
-** Function:    readOptionalConfig()
+** Function:    CNfcConfig::readOptionalConfig()
 **
 ** Description: read Config settings from an optional conf file
 **
 ** Returns:     none
 **
 *******************************************************************************/
-void readOptionalConfig(const char* extra) {
+void CNfcConfig::readOptionalConfig(const char* extra) {
   string strPath;
-  string configName(extra_config_base);
-  configName += extra;
-  configName += extra_config_ext;
+  findOptionalConfigFilePath(extra, strPath);
 
-  if (alternative_config_path[0] != '\0') {
-    strPath.assign(alternative_config_path);
-    strPath += configName;
-  } else {
-    findConfigFilePathFromTransportConfigPaths(configName, strPath);
-  }
+  readConfig(strPath.c_str(), false);
+}
 
-  CNfcConfig::GetInstance().readConfig(strPath.c_str(), false);
+/*******************************************************************************
+**
+** Function:    getNumValue
+**
+** Description: copy the numerical value of a setting to pValue of len bytes
+**
+** Returns:     true, if successful
+**
+*******************************************************************************/
+static int getNumValue(const CNfcParam* pParam, void* pValue,
+                       unsigned long len) {
+  if (pParam == NULL) return false;
+  unsigned long v = pParam->numValue();
+  if (v == 0 && pParam->str_len() > 0 && pParam->str_len() < 4) {
+    const unsigned char* p = (const unsigned char*)pParam->str_value();
+    for (unsigned int i = 0; i < pParam->str_len(); ++i) {
+      v *= 256;
+      v += *p++;
+    }
+  }
+  switch (len) {
+    case sizeof(unsigned long):
+      *(static_cast<unsigned long*>(pValue)) = (unsigned long)v;
+      break;
+    case sizeof(unsigned short):
+      *(static_cast<unsigned short*>(pValue)) = (unsigned short)v;
+      break;
+    case sizeof(unsigned char):
+      *(static_cast<unsigned char*>(pValue)) = (unsigned char)v;
+      break;
+    default:
+      return false;
+  }
+  return true;
 }
 
 /*******************************************************************************
@@ -966,9 +1462,9 @@ void readOptionalConfig(const char* extra) {
 *******************************************************************************/
 extern "C" int GetNxpStrValue(const char* name, char* pValue,
                               unsigned long len) {
-  CNfcConfig& rConfig = CNfcConfig::GetInstance();
+  CNfcConfigReader rConfig;
 
-  return rConfig.getValue(name, pValue, len);
+  return rConfig->getValue(name, pValue, len);
 }
 
 /*******************************************************************************
@@ -990,9 +1486,9 @@ extern "C" int GetNxpStrValue(const char* name, char* pValue,
 *******************************************************************************/
 extern "C" int GetNxpByteArrayValue(const char* name, char* pValue,
                                     long bufflen, long* len) {
-  CNfcConfig& rConfig = CNfcConfig::GetInstance();
+  CNfcConfigReader rConfig;
 
-  return rConfig.getValue(name, pValue, bufflen, len);
+  return rConfig->getValue(name, pValue, bufflen, len);
 }
 
 /*******************************************************************************
@@ -1008,32 +1504,55 @@ extern "C" int GetNxpNumValue(const char* name, void* pValue,
                               unsigned long len) {
   if (!pValue) return false;
 
-  CNfcConfig& rConfig = CNfcConfig::GetInstance();
-  const CNfcParam* pParam = rConfig.find(name);
+  CNfcConfigReader rConfig;
+  return getNumValue(rConfig->find(name), pValue, len);
+}
 
-  if (pParam == NULL) return false;
-  unsigned long v = pParam->numValue();
-  if (v == 0 && pParam->str_len() > 0 && pParam->str_len() < 4) {
-    const unsigned char* p = (const unsigned char*)pParam->str_value();
-    for (unsigned int i = 0; i < pParam->str_len(); ++i) {
-      v *= 256;
-      v += *p++;
-    }
-  }
-  switch (len) {
-    case sizeof(unsigned long):
-      *(static_cast<unsigned long*>(pValue)) = (unsigned long)v;
-      break;
-    case sizeof(unsigned short):
-      *(static_cast<unsigned short*>(pValue)) = (unsigned short)v;
-      break;
-    case sizeof(unsigned char):
-      *(static_cast<unsigned char*>(pValue)) = (unsigned char)v;
-      break;
-    default:
-      return false;
-  }
-  return true;
+/*******************************************************************************
+**
+** Function:    GetNxpStr
+**
+** Description: API function for getting a string value of a known setting
+**
+** Returns:     True if found, otherwise False.
+**
+*******************************************************************************/
+int GetNxpStr(ConfigKey key, char* pValue, unsigned long len) {
+  CNfcConfigReader rConfig;
+
+  return rConfig->getValue(rConfig->find(key), pValue, (size_t)len);
+}
+
+/*******************************************************************************
+**
+** Function:    GetNxpByteArray
+**
+** Description: Read byte array value of a known setting, see
+**              GetNxpByteArrayValue()
+**
+** Returns:     True if found, otherwise False.
+**
+*******************************************************************************/
+int GetNxpByteArray(ConfigKey key, char* pValue, long bufflen, long* len) {
+  CNfcConfigReader rConfig;
+
+  return rConfig->getValue(rConfig->find(key), pValue, bufflen, len);
+}
+
+/*******************************************************************************
+**
+** Function:    GetNxpNum
+**
+** Description: API function for getting a numerical value of a known setting
+**
+** Returns:     true, if successful
+**
+*******************************************************************************/
+int GetNxpNum(ConfigKey key, void* pValue, unsigned long len) {
+  if (!pValue) return false;
+
+  CNfcConfigReader rConfig;
+  return getNumValue(rConfig->find(key), pValue, len);
 }
 
 /*******************************************************************************
@@ -1048,23 +1567,84 @@ extern "C" int GetNxpNumValue(const char* name, void* pValue,
 extern "C" void resetNxpConfig()
 
 {
-  CNfcConfig& rConfig = CNfcConfig::GetInstance();
+  pthread_mutex_lock(&sConfigLock);
+  CNfcConfig::publish(nullptr);
+  pthread_mutex_unlock(&sConfigLock);
+}
 
-  rConfig.clean();
+/*******************************************************************************
+**
+** Function:    reloadNxpConfig
+**
+** Description: read the config files again and publish their settings if
+**              any file changed. Readers keep the settings they started
+**              with until done.
+**
+** Returns:     1 if the settings were replaced, 0 otherwise.
+**
+*******************************************************************************/
+extern "C" int reloadNxpConfig() {
+  pthread_mutex_lock(&sConfigLock);
+  CNfcConfig* pConfig = CNfcConfig::load();
+  const CNfcConfig* pCurrent = sConfig.load();
+  int isChanged = (pCurrent == nullptr) || !pCurrent->isSameFiles(*pConfig);
+  if (isChanged) {
+    CNfcConfig::publish(pConfig);
+  } else {
+    delete pConfig;
+  }
+  pthread_mutex_unlock(&sConfigLock);
+  ALOGD("%s changed=%d", __func__, isChanged);
+  return isChanged;
 }
 
 /*******************************************************************************
 **
 ** Function:    isNxpConfigModified()
 **
-** Description: check if config file has modified
+** Description: check if config file has modified, reloading the settings
+**              first so that the check and later reads see the files as
+**              they are now
 **
 ** Returns:     0 if not modified, 1 otherwise.
 **
 *******************************************************************************/
 extern "C" int isNxpConfigModified() {
-  CNfcConfig& rConfig = CNfcConfig::GetInstance();
-  return rConfig.isModified();
+  reloadNxpConfig();
+  CNfcConfigReader rConfig;
+  return rConfig->isModified();
+}
+
+/*******************************************************************************
+**
+** Function:    getNxpConfigFilesKey()
+**
+** Description: combine path, inode, size and modification time of every
+**              config file the settings are loaded from. Only stat() is
+**              used, the files are neither read nor parsed, so a change
+**              of the value means a config file may have changed.
+**
+** Returns:     CRC32 of the list
+**
+*******************************************************************************/
+extern "C" uint32_t getNxpConfigFilesKey() {
+  vector<string> paths;
+  uint32_t crc32 = 0;
+
+  getConfigFilePaths(paths);
+  for (size_t i = 0; i < paths.size(); i++) {
+    uint64_t fileKey[4] = {0, 0, 0, 0};
+    struct stat st;
+    if (stat(paths[i].c_str(), &st) == 0) {
+      fileKey[0] = st.st_ino;
+      fileKey[1] = st.st_size;
+      fileKey[2] = st.st_mtim.tv_sec;
+      fileKey[3] = st.st_mtim.tv_nsec;
+    }
+    crc32 = sparse_crc32(crc32, paths[i].c_str(), (int)paths[i].size() + 1);
+    crc32 = sparse_crc32(crc32, fileKey, sizeof(fileKey));
+  }
+  return crc32;
 }
 
 /*******************************************************************************
@@ -1078,10 +1658,10 @@ extern "C" int isNxpConfigModified() {
 *******************************************************************************/
 extern "C" int isNxpRFConfigModified() {
   int retRF = 0, rettransit = 0, ret = 0;
-  CNfcConfig& rConfig = CNfcConfig::GetInstance();
-  retRF = rConfig.checkTimestamp(nxp_rf_config_path, rf_config_timestamp_path);
+  CNfcConfigReader rConfig;
+  retRF = rConfig->checkTimestamp(nxp_rf_config_path, rf_config_timestamp_path);
   rettransit =
-      rConfig.checkTimestamp(transit_config_path, tr_config_timestamp_path);
+      rConfig->checkTimestamp(transit_config_path, tr_config_timestamp_path);
   ret = retRF | rettransit;
   ALOGD("ret RF or Transit value %d", ret);
   return ret;
@@ -1097,7 +1677,7 @@ extern "C" int isNxpRFConfigModified() {
 **
 *******************************************************************************/
 extern "C" int updateNxpConfigTimestamp() {
-  CNfcConfig& rConfig = CNfcConfig::GetInstance();
-  rConfig.resetModified();
+  CNfcConfigReader rConfig;
+  rConfig->resetModified();
   return 0;
 }
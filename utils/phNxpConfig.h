@@ -39,6 +39,8 @@
 #ifndef __CONFIG_H
 #define __CONFIG_H
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -51,6 +53,8 @@ void resetNxpConfig(void);
 int isNxpRFConfigModified();
 int isNxpConfigModified();
 int updateNxpConfigTimestamp();
+uint32_t getNxpConfigFilesKey();
+int reloadNxpConfig();
 
 #ifdef __cplusplus
 };
@@ -131,12 +135,125 @@ int updateNxpConfigTimestamp();
 #define NAME_NXP_P61_LS_DEFAULT_INTERFACE "NXP_P61_LS_DEFAULT_INTERFACE"
 #define NAME_NXP_LS_FORCE_UPDATE_REQUIRED "NXP_LS_FORCE_UPDATE_REQUIRED"
 #define NAME_NXP_JCOP_FORCE_UPDATE_REQUIRED "NXP_JCOP_FORCE_UPDATE_REQUIRED"
+#define NAME_NXP_JCOP_APDU_RING_DEPTH "NXP_JCOP_APDU_RING_DEPTH"
+#define NAME_NXP_JCOP_CHECKPOINT_INTERVAL "NXP_JCOP_CHECKPOINT_INTERVAL"
+#define NAME_NXP_APDU_STATS "NXP_APDU_STATS"
+#define NAME_NXP_LS_MAX_CHANNELS "NXP_LS_MAX_CHANNELS"
 #define NAME_NXP_SEMS_SUPPORTED "NXP_GP_AMD_I_SEMS_SUPPORTED"
 #define NAME_NXP_SPI_SE_TERMINAL_NUM "NXP_SPI_SE_TERMINAL_NUM"
 #define NAME_NXP_VISO_SE_TERMINAL_NUM "NXP_VISO_SE_TERMINAL_NUM"
 #define NAME_NXP_NFC_SE_TERMINAL_NUM "NXP_NFC_SE_TERMINAL_NUM"
 #define NAME_NXP_TRUSTED_SE_TERMINAL_NUM "NXP_TRUSTED_SE_TERMINAL_NUM"
+/*
+ * Root the vendor and data partition paths hang off, empty on the device.
+ * Host builds point it at a scratch tree so the clients run against ese_sim.
+ */
+#ifndef ESE_FS_ROOT
+#define ESE_FS_ROOT ""
+#endif
 /* default configuration */
-#define default_storage_location "/data/vendor/nfc"
+#define default_storage_location ESE_FS_ROOT "/data/vendor/nfc"
+
+#ifdef __cplusplus
+/*
+ * Settings with typed accessors, CFG_<x> stands for NAME_<x>.
+ * A setting added above should be listed here as well.
+ */
+#define NXP_CONFIG_KEYS(X) \
+  X(NXPLOG_EXTNS_LOGLEVEL) \
+  X(NXPLOG_NCIHAL_LOGLEVEL) \
+  X(NXPLOG_NCIX_LOGLEVEL) \
+  X(NXPLOG_NCIR_LOGLEVEL) \
+  X(NXPLOG_FWDNLD_LOGLEVEL) \
+  X(NXPLOG_TML_LOGLEVEL) \
+  X(MIFARE_READER_ENABLE) \
+  X(FW_STORAGE) \
+  X(NXP_NFC_DEV_NODE) \
+  X(NXP_NFC_CHIP) \
+  X(NXP_FW_NAME) \
+  X(NXP_FW_TYPE) \
+  X(NXP_FW_PROTECION_OVERRIDE) \
+  X(NXP_SYS_CLK_SRC_SEL) \
+  X(NXP_SYS_CLK_FREQ_SEL) \
+  X(NXP_SYS_CLOCK_TO_CFG) \
+  X(NXP_CLOCK_REQ_DELAY) \
+  X(NXP_ACT_PROP_EXTN) \
+  X(NXP_EXT_TVDD_CFG) \
+  X(NXP_EXT_TVDD_CFG_1) \
+  X(NXP_EXT_TVDD_CFG_2) \
+  X(NXP_EXT_TVDD_CFG_3) \
+  X(NXP_RF_CONF_BLK_MAX) \
+  X(NXP_CORE_CONF_EXTN) \
+  X(NXP_CORE_CONF) \
+  X(NXP_NFC_PROFILE_EXTN) \
+  X(NXP_CHINA_TIANJIN_RF_ENABLED) \
+  X(NXP_CHINA_BLK_NUM_CHK_ENABLE) \
+  X(NXP_CN_TRANSIT_CMA_BYPASSMODE_ENABLE) \
+  X(NXP_ESE_POWER_DH_CONTROL) \
+  X(NXP_ESE_POWER_EXT_PMU) \
+  X(NXP_ESE_POWER_DH_CONTROL_CFG_1) \
+  X(NXP_SWP_SWITCH_TIMEOUT) \
+  X(NXP_SWP_FULL_PWR_ON) \
+  X(NXP_CORE_RF_FIELD) \
+  X(NXP_NFC_MERGE_RF_PARAMS) \
+  X(NXP_I2C_FRAGMENTATION_ENABLED) \
+  X(NFC_DEBUG_ENABLED) \
+  X(AID_MATCHING_PLATFORM) \
+  X(NXP_TYPEA_UICC_BAUD_RATE) \
+  X(NXP_TYPEB_UICC_BAUD_RATE) \
+  X(NXP_SET_CONFIG_ALWAYS) \
+  X(NXP_PROP_BLACKLIST_ROUTING) \
+  X(NXP_WIREDMODE_RESUME_TIMEOUT) \
+  X(NXP_UICC_LISTEN_TECH_MASK) \
+  X(NXP_ESE_LISTEN_TECH_MASK) \
+  X(NXP_SVDD_SYNC_OFF_DELAY) \
+  X(NXP_CORE_PROP_SYSTEM_DEBUG) \
+  X(NXP_NCI_PARSER_LIBRARY) \
+  X(NXP_DEFAULT_UICC2_SELECT) \
+  X(NXP_ALWAYS_FW_UPDATE) \
+  X(NXP_P61_JCOP_DEFAULT_INTERFACE) \
+  X(RF_STATUS_UPDATE_ENABLE) \
+  X(DEFAULT_ROUTE) \
+  X(DEFAULT_SYS_CODE_ROUTE) \
+  X(DEFAULT_SYS_CODE_PWR_STATE) \
+  X(OFF_HOST_ESE_PIPE_ID) \
+  X(OFF_HOST_SIM_PIPE_ID) \
+  X(DEFAULT_OFFHOST_ROUTE) \
+  X(DEFAULT_NFCF_ROUTE) \
+  X(ISO_DEP_MAX_TRANSCEIVE) \
+  X(NFA_POLL_BAIL_OUT_MODE) \
+  X(ACTIVE_SE) \
+  X(ACTIVE_SE_NFCF) \
+  X(DEFAULT_FELICA_SYS_CODE_ROUTE) \
+  X(DEFAULT_ISODEP_ROUTE) \
+  X(DEVICE_HOST_WHITE_LIST) \
+  X(NFA_PROPRIETARY_CFG) \
+  X(PRESENCE_CHECK_ALGORITHM) \
+  X(NXP_CORE_SCRN_OFF_AUTONOMOUS_ENABLE) \
+  X(NXP_P61_LS_DEFAULT_INTERFACE) \
+  X(NXP_LS_FORCE_UPDATE_REQUIRED) \
+  X(NXP_JCOP_FORCE_UPDATE_REQUIRED) \
+  X(NXP_JCOP_APDU_RING_DEPTH) \
+  X(NXP_JCOP_CHECKPOINT_INTERVAL) \
+  X(NXP_APDU_STATS) \
+  X(NXP_LS_MAX_CHANNELS) \
+  X(NXP_SEMS_SUPPORTED) \
+  X(NXP_SPI_SE_TERMINAL_NUM) \
+  X(NXP_VISO_SE_TERMINAL_NUM) \
+  X(NXP_NFC_SE_TERMINAL_NUM) \
+  X(NXP_TRUSTED_SE_TERMINAL_NUM)
+
+enum ConfigKey {
+#define CONFIG_KEY_ENUM(x) CFG_##x,
+  NXP_CONFIG_KEYS(CONFIG_KEY_ENUM)
+#undef CONFIG_KEY_ENUM
+  CFG_KEY_COUNT
+};
+
+/* Same as the string based functions, without looking up the name */
+int GetNxpNum(ConfigKey key, void* p_value, unsigned long len);
+int GetNxpStr(ConfigKey key, char* p_value, unsigned long len);
+int GetNxpByteArray(ConfigKey key, char* pValue, long bufflen, long* len);
+#endif /* __cplusplus */
 
 #endif
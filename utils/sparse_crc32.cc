@@ -43,9 +43,24 @@
  */
 
 /* Code taken from FreeBSD 8 */
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
-static uint32_t crc32_tab[] = {
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRC32_X86
+#elif defined(__aarch64__)
+#include <sys/auxv.h>
+#define CRC32_ARMV8
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+
+#include "sparse_crc32.h"
+
+static const uint32_t crc32_tab[] = {
     0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
     0xe963a535, 0x9e6495a3, 0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
     0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91, 0x1db71064, 0x6ab020f2,
@@ -91,17 +106,208 @@ static uint32_t crc32_tab[] = {
     0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d};
 
 /*
- * A function that calculates the CRC-32 based on the table above is
- * given below for documentation purposes. An equivalent implementation
- * of this function that's actually used in the kernel can be found
- * in sys/libkern.h, where it can be inlined.
+ * The table above advances the CRC by one byte. The tables below, derived
+ * from it, advance it by eight bytes at a time (slice-by-8). Where the CPU
+ * has CRC32 instructions (ARMv8) or carry-less multiplication (x86
+ * PCLMULQDQ) those are used instead, selected at run time.
+ * All variants work on the CRC register, without the pre/post inversion.
  */
+namespace {
+
+#define CRC32_POLY 0xedb88320
+
+struct Crc32Tables {
+  uint32_t t[8][256];
+  Crc32Tables() {
+    for (int i = 0; i < 256; i++) t[0][i] = crc32_tab[i];
+    for (int k = 1; k < 8; k++) {
+      for (int i = 0; i < 256; i++) {
+        t[k][i] = (t[k - 1][i] >> 8) ^ crc32_tab[t[k - 1][i] & 0xFF];
+      }
+    }
+  }
+};
+const Crc32Tables kTables;
+
+typedef uint32_t (*Crc32Fn)(uint32_t crc, const uint8_t* p, size_t len);
+
+uint32_t crc32_bytes(uint32_t crc, const uint8_t* p, size_t len) {
+  while (len--) crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+  return crc;
+}
+
+uint32_t crc32_slice8(uint32_t crc, const uint8_t* p, size_t len) {
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+  const uint32_t(*t)[256] = kTables.t;
+
+  while (len >= 8) {
+    uint32_t lo, hi;
+    memcpy(&lo, p, 4);
+    memcpy(&hi, p + 4, 4);
+    lo ^= crc;
+    crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^
+          t[4][lo >> 24] ^ t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^
+          t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+    p += 8;
+    len -= 8;
+  }
+#endif
+  return crc32_bytes(crc, p, len);
+}
+
+#if defined(CRC32_X86)
+/* Fold constants of the bit reflected polynomial, x^n mod P(x) */
+#define CRC32_K1 0x154442bd4ULL /* x^(4*128+32) */
+#define CRC32_K2 0x1c6e41596ULL /* x^(4*128-32) */
+#define CRC32_K3 0x1751997d0ULL /* x^(128+32) */
+#define CRC32_K4 0x0ccaa009eULL /* x^(128-32) */
+#define CRC32_K5 0x163cd6124ULL /* x^64 */
+#define CRC32_P 0x1db710641ULL  /* P(x) */
+#define CRC32_U 0x1f7011641ULL  /* x^64 / P(x) */
+
+__attribute__((target("pclmul,sse4.1"))) inline __m128i fold_pclmul(
+    __m128i x, __m128i k, __m128i data) {
+  return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00),
+                                     _mm_clmulepi64_si128(x, k, 0x11)),
+                       data);
+}
+
+/* Folds 64 bytes per iteration into four 128 bit lanes, then into one and
+ * reduces it to 32 bits with a Barrett reduction. */
+__attribute__((target("pclmul,sse4.1"))) uint32_t crc32_pclmul(
+    uint32_t crc, const uint8_t* p, size_t len) {
+  if (len < 64) return crc32_slice8(crc, p, len);
+
+  const __m128i k1k2 = _mm_set_epi64x(CRC32_K2, CRC32_K1);
+  const __m128i k3k4 = _mm_set_epi64x(CRC32_K4, CRC32_K3);
+  const __m128i k5 = _mm_set_epi64x(0, CRC32_K5);
+  const __m128i pu = _mm_set_epi64x(CRC32_U, CRC32_P);
+  const __m128i mask32 = _mm_set_epi32(0, 0, 0, -1);
+  __m128i x1 = _mm_loadu_si128((const __m128i*)p);
+  __m128i x2 = _mm_loadu_si128((const __m128i*)(p + 16));
+  __m128i x3 = _mm_loadu_si128((const __m128i*)(p + 32));
+  __m128i x4 = _mm_loadu_si128((const __m128i*)(p + 48));
+  __m128i t;
+
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+  p += 64;
+  len -= 64;
+  while (len >= 64) {
+    x1 = fold_pclmul(x1, k1k2, _mm_loadu_si128((const __m128i*)p));
+    x2 = fold_pclmul(x2, k1k2, _mm_loadu_si128((const __m128i*)(p + 16)));
+    x3 = fold_pclmul(x3, k1k2, _mm_loadu_si128((const __m128i*)(p + 32)));
+    x4 = fold_pclmul(x4, k1k2, _mm_loadu_si128((const __m128i*)(p + 48)));
+    p += 64;
+    len -= 64;
+  }
+  x1 = fold_pclmul(x1, k3k4, x2);
+  x1 = fold_pclmul(x1, k3k4, x3);
+  x1 = fold_pclmul(x1, k3k4, x4);
+  while (len >= 16) {
+    x1 = fold_pclmul(x1, k3k4, _mm_loadu_si128((const __m128i*)p));
+    p += 16;
+    len -= 16;
+  }
+  /*128 to 64 bits, appending 32 zero bits*/
+  t = _mm_clmulepi64_si128(k3k4, x1, 0x01);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), t);
+  /*64 to 32 bits*/
+  t = _mm_srli_si128(x1, 4);
+  x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k5, 0x00);
+  x1 = _mm_xor_si128(x1, t);
+  /*Barrett reduction*/
+  t = x1;
+  x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), pu, 0x10);
+  x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), pu, 0x00);
+  x1 = _mm_xor_si128(x1, t);
+  crc = (uint32_t)_mm_extract_epi32(x1, 1);
+  return crc32_slice8(crc, p, len);
+}
+#elif defined(CRC32_ARMV8)
+#if defined(__clang__)
+#define CRC32_TARGET_ARMV8 __attribute__((target("crc")))
+#define CRC32_ARMV8_B(crc, v) __builtin_arm_crc32b((crc), (v))
+#define CRC32_ARMV8_D(crc, v) __builtin_arm_crc32d((crc), (v))
+#else
+#define CRC32_TARGET_ARMV8 __attribute__((target("+crc")))
+#define CRC32_ARMV8_B(crc, v) __builtin_aarch64_crc32b((crc), (v))
+#define CRC32_ARMV8_D(crc, v) __builtin_aarch64_crc32x((crc), (v))
+#endif
+
+CRC32_TARGET_ARMV8 uint32_t crc32_armv8(uint32_t crc, const uint8_t* p,
+                                        size_t len) {
+  while ((len > 0) && (((uintptr_t)p & 7) != 0)) {
+    crc = CRC32_ARMV8_B(crc, *p++);
+    len--;
+  }
+  while (len >= 8) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    crc = CRC32_ARMV8_D(crc, v);
+    p += 8;
+    len -= 8;
+  }
+  while (len--) crc = CRC32_ARMV8_B(crc, *p++);
+  return crc;
+}
+#endif
+
+Crc32Fn selectCrc32() {
+#if defined(CRC32_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+    return crc32_pclmul;
+  }
+#elif defined(CRC32_ARMV8)
+  if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+    return crc32_armv8;
+  }
+#endif
+  return crc32_slice8;
+}
+
+/* Product of a and b modulo the polynomial, both bit reflected */
+uint32_t multmodp(uint32_t a, uint32_t b) {
+  uint32_t m = 1U << 31;
+  uint32_t p = 0;
+
+  for (;;) {
+    if (a & m) {
+      p ^= b;
+      if ((a & (m - 1)) == 0) break;
+    }
+    m >>= 1;
+    b = (b & 1) ? ((b >> 1) ^ CRC32_POLY) : (b >> 1);
+  }
+  return p;
+}
+
+/* x^(2^n) modulo the polynomial for n = 0..31 */
+struct Crc32Powers {
+  uint32_t x2n[32];
+  Crc32Powers() {
+    uint32_t p = 1U << 30; /* x^1 */
+    x2n[0] = p;
+    for (int n = 1; n < 32; n++) x2n[n] = p = multmodp(p, p);
+  }
+};
+const Crc32Powers kPowers;
+
+}  // namespace
 
 uint32_t sparse_crc32(uint32_t crc_in, const void* buf, int size) {
-  const uint8_t* p = (const uint8_t*)buf;
-  uint32_t crc;
+  static const Crc32Fn crc32_fn = selectCrc32();
+
+  if (size <= 0) return crc_in;
+  return crc32_fn(crc_in ^ ~0U, (const uint8_t*)buf, (size_t)size) ^ ~0U;
+}
+
+uint32_t sparse_crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2) {
+  uint32_t xn = 1U << 31; /* x^0 */
 
-  crc = crc_in ^ ~0U;
-  while (size--) crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
-  return crc ^ ~0U;
+  /*crc1 is advanced by 8 * len2 zero bits*/
+  for (unsigned k = 3; len2 != 0; len2 >>= 1, k++) {
+    if (len2 & 1) xn = multmodp(kPowers.x2n[k & 31], xn);
+  }
+  return multmodp(xn, crc1) ^ crc2;
 }
@@ -19,6 +19,18 @@
 
 #include <stdint.h>
 
+/*
+ * CRC-32 (IEEE 802.3) of size bytes at buf, continuing from crc (0 to
+ * start). Uses the ARMv8 CRC32 instructions or x86 PCLMULQDQ when the CPU
+ * has them, slice-by-8 tables otherwise.
+ */
 uint32_t sparse_crc32(uint32_t crc, const void* buf, int size);
 
+/*
+ * CRC-32 of the concatenation of two buffers, given the CRC crc1 of the
+ * first, the CRC crc2 of the second and its length len2. Lets a large
+ * input be checked in parts, in any order or in parallel.
+ */
+uint32_t sparse_crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+
 #endif